@@ -43,9 +43,21 @@
 
 static unsigned long long int asynch_next_uid = 0;
 
+/* called by the wheel when the response did not arrive in time */
+static void asynch_timeout(struct slave_asynch_command *cmd) {
+	
+	ASYNCH_DBG("" LLU ": Asynch timeout reached! (%u ms) packet type: %u", cmd->uid, cmd->timeout, cmd->command);
+	
+	asynch_destroy(cmd, NULL);
+	
+	return;
+}
+
 static void asynch_obj_destroy(struct slave_asynch_command *cmd) {
 	
 	collectible_destroy(cmd);
+	
+	wheel_cancel(&cmd->timer);
 
 	if(collection_find(cmd->cnx->asynch_queries, cmd)) {
 		collection_delete(cmd->cnx->asynch_queries, cmd);
@@ -89,6 +101,7 @@ struct slave_asynch_command *asynch_new(
 	cmd->send_time = 0;
 	cmd->uid = asynch_next_uid++;
 	cmd->timeout = timeout;
+	wheel_timer_init(&cmd->timer, (wheel_f)asynch_timeout, cmd);
 
 	cmd->reply_callback = reply_callback;
 	cmd->param = param;
@@ -110,6 +123,17 @@ struct slave_asynch_command *asynch_new(
 	return cmd;
 }
 
+void asynch_sent(struct slave_asynch_command *cmd) {
+	
+	cmd->send_time = time_now();
+	
+	if(cmd->timeout != -1) {
+		wheel_schedule(&cmd->timer, cmd->send_time + cmd->timeout + 1);
+	}
+	
+	return;
+}
+
 /*
 	The destroy function calls the callback and destroy the asynch command,
 	removing it from the slave's asynch queries.
@@ -126,6 +150,7 @@ unsigned int asynch_destroy(struct slave_asynch_command *cmd, struct packet *p)
 
 	obj_ref(&cmd->o);
 	obj_destroy(&cmd->o);
+	wheel_cancel(&cmd->timer);
 
 	/* pass the data to the callback */
 	success = (*cmd->reply_callback)(cmd->cnx, cmd, p);
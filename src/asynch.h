@@ -46,6 +46,7 @@
 #endif
 
 #include "packet.h"
+#include "wheel.h"
 
 /* holds command data and response */
 struct slave_asynch_command {
@@ -59,6 +60,7 @@ struct slave_asynch_command {
 	/* tracking */
 	unsigned int timeout; /* desired timeout for the response to arrive, in milliseconds */
 	unsigned long long int send_time; /* time at wich the data has been sent */
+	struct wheel_timer timer; /* armed once sent, unless the timeout is -1 */
 
 	/* called when the response arrives, on timeout or on error */
 	/* if the callback return zero the slave will get disconnected. */
@@ -76,6 +78,9 @@ unsigned int asynch_match(struct slave_connection *cnx, struct packet *p);
 
 unsigned int asynch_destroy(struct slave_asynch_command *cmd, struct packet *p);
 
+/* Mark the command as sent, and start waiting for the response */
+void asynch_sent(struct slave_asynch_command *cmd);
+
 struct slave_asynch_command *asynch_new(
 	struct slave_connection *cnx,
 	unsigned char command,
@@ -49,6 +49,45 @@
 
 //collection_static_list(all_iterators);
 
+/*
+	Membership instances are created and destroyed for every
+	collection_add/collection_delete, so they are carved out of
+	slabs of COLLECTION_SLAB_SIZE and recycled through a free
+	list instead of going through malloc/free every time. Free
+	instances are chained by their 'collectibles' member.
+*/
+collection_static_list(instance_pool);
+
+static struct collectible_instance *instance_alloc() {
+	struct collectible_instance *slab;
+	struct collection_list *current;
+	unsigned int i;
+	
+	if(instance_pool.next == &instance_pool) {
+		slab = malloc(sizeof(struct collectible_instance) * COLLECTION_SLAB_SIZE);
+		if(!slab) {
+			COLLECTION_DBG("instance_alloc: malloc failed");
+			exit(1);
+		}
+		
+		for(i=0;i<COLLECTION_SLAB_SIZE;i++) {
+			collection_list_addlast(&instance_pool, &slab[i].collectibles);
+		}
+	}
+	
+	current = instance_pool.next;
+	collection_list_remove(current);
+	
+	return CONTAINING_RECORD(current, struct collectible_instance, collectibles);
+}
+
+static void instance_free(struct collectible_instance *instance) {
+	
+	collection_list_addfirst(&instance_pool, &instance->collectibles);
+	
+	return;
+}
+
 static void instance_destroy(struct collectible_instance *instance) {
 	
 	if(obj_isvalid(&instance->o)) {
@@ -66,14 +105,79 @@ static void instance_destroy(struct collectible_instance *instance) {
 	return;
 }
 
-void collection_iterator_destroy(struct collection_iterator *iter) {
+/*
+	Return the first live instance starting at 'iter->next' and
+	move the iterator past it. Deletions made while the caller
+	holds the iterator are fixed up by instance_obj_destroy, so
+	stepping is only a few pointer reads: a collection that is
+	not mutated during the iteration never pays for the safety.
+*/
+static FUNC_INLINE struct collectible_instance *collection_step(struct collection *c, struct collection_iterator *iter) {
+	struct collection_list *current;
+	struct collectible_instance *instance;
+	
+	if(!iter->next) {
+		return NULL;
+	}
+	
+	current = &iter->next->collectibles;
+	while(current != &c->collectibles.list) {
+		instance = CONTAINING_RECORD(current, struct collectible_instance, collectibles);
+		current = current->next;
+		
+		if(obj_isvalid(&instance->o) && obj_isvalid(&instance->self->o) && obj_isvalid(instance->self->self)) {
+			
+			/* switch to the next instance */
+			if(current == &c->collectibles.list) {
+				iter->next = NULL;
+			} else {
+				iter->next = CONTAINING_RECORD(current, struct collectible_instance, collectibles);
+			}
+			
+			return instance;
+		}
+	}
 	
 	iter->next = NULL;
 	
-	collection_list_remove(&iter->iterators);
-	//collection_list_remove(&iter->all_iterators);
+	return NULL;
+}
+
+/*
+	Lock/unlock an instance we already hold, without looking
+	it up again. See collection_t_lock for the reasoning.
+*/
+static void instance_lock(struct collectible_instance *instance) {
+	struct collectible *cb = instance->self;
 	
-	free(iter);
+	obj_ref(&instance->c->o);
+	obj_ref(&cb->o);
+	obj_ref(cb->self);
+	cb->self_locked++;
+	obj_ref(&instance->o);
+	
+	return;
+}
+
+static void instance_unlock(struct collectible_instance *instance) {
+	struct collection *c = instance->c;
+	struct collectible *cb = instance->self;
+	
+	/* The unreferencing must be in this exact order */
+	obj_unref(&instance->o); /* associative instance NEED 'c' and 'cb' */
+	cb->self_locked--;
+	obj_unref(&cb->o); /* 'cb' NEED 'cb->self' AND 'c' */
+	if(cb->self) obj_unref(cb->self); /* the collectible's parent must be destroyed *after* its collectible. */
+	obj_unref(&c->o); /* needs nothing, when this is destroyed everything else should be GONE. */
+	
+	return;
+}
+
+void collection_iterator_release(struct collection_iterator *iter) {
+	
+	iter->next = NULL;
+	
+	collection_list_remove(&iter->iterators);
 	
 	return;
 }
@@ -81,7 +185,8 @@ void collection_iterator_destroy(struct collection_iterator *iter) {
 /* Empty the collection, call the destructors if needed */
 int collection_t_empty(struct collection *c, char *file, int line) {
 //	struct collection_list *current, *next;
-	struct collection_iterator *iter;
+	struct collection_iterator iter;
+	struct collectible_instance *instance;
 	struct collectible *cb;
 	
 	COLLECTION_ASSERT(c, "collection_empty: c == NULL");
@@ -90,11 +195,12 @@ int collection_t_empty(struct collection *c, char *file, int line) {
 	obj_ref(&c->o);
 	
 	/* Unlink all collectibles */
-	iter=collection_new_iterator(c);
-	for(cb=collection_c_next(c, iter);cb;cb=collection_c_next(c, iter)) {
+	collection_iterator_init(c, &iter);
+	while((instance = collection_step(c, &iter))) {
+		cb = instance->self;
 		
 		/* remove the collectible from the collection. */
-		collection_c_delete(c, cb);
+		instance_destroy(instance);
 		
 		/* Cascade delete he collectible if needed. */
 		if(c->destroy_type == C_CASCADE) {
@@ -102,7 +208,7 @@ int collection_t_empty(struct collection *c, char *file, int line) {
 			obj_destroy(&cb->o);
 		}
 	}
-	collection_iterator_destroy(iter);
+	collection_iterator_release(&iter);
 	
 	obj_unref(&c->o);
 	
@@ -125,18 +231,20 @@ int collection_cleanup_iterators() {
 */
 static void collection_obj_destroy(struct collection *c) {
 	struct collection_list *current, *next;
-	struct collection_iterator *iter;
+	struct collection_iterator iter;
+	struct collectible_instance *instance;
 	struct collectible *cb;
 	
 	/* 1. Make sure the collection is void during this process */
 	c->is_void = 1;
 	
 	/* 3. Unlink all collectibles */
-	iter = collection_new_iterator(c);
-	for(cb=collection_c_next(c, iter);cb;cb=collection_c_next(c, iter)) {
+	collection_iterator_init(c, &iter);
+	while((instance = collection_step(c, &iter))) {
+		cb = instance->self;
 		
 		/* remove the collectible from the collection. */
-		collection_c_delete(c, cb);
+		instance_destroy(instance);
 		
 		/* Cascade delete he collectible if needed. */
 		if(c->destroy_type == C_CASCADE) {
@@ -145,12 +253,15 @@ static void collection_obj_destroy(struct collection *c) {
 		}
 	}
 	
-	/* 2. Destroy all iterators */
+	/*
+		2. Detach all iterators, including ours. They live on
+		their owner's stack so they are only unlinked here.
+	*/
 	current = c->iterators.list.next;
 	while(current != &c->iterators.list) {
 		struct collection_iterator *iter = CONTAINING_RECORD(current, struct collection_iterator, iterators);
 		next = current->next;
-		collection_iterator_destroy(iter);
+		collection_iterator_release(iter);
 		current = next;
 	}
 	
@@ -299,8 +410,8 @@ static void instance_obj_destroy(struct collectible_instance *instance) {
 	instance->c = NULL;
 	instance->self = NULL;
 	
-	/* Free the memory */
-	free(instance);
+	/* Give the instance back to the slab */
+	instance_free(instance);
 	
 	return;
 }
@@ -321,12 +432,7 @@ int collection_t_add(struct collection *c, struct collectible *cb, char *file, i
 	COLLECTION_ASSERT(obj_isvalid(cb->self), "collection_add: collectible's 'self' is invalid");
 	COLLECTION_ASSERT(!c->is_void, "collection_add: collection is void");
 	
-	instance = malloc(sizeof(struct collectible_instance));
-	if(!instance) {
-		COLLECTION_DBG("collection_add: malloc failed");
-		COLLECTION_TRACEBACK();
-		exit(1);
-	}
+	instance = instance_alloc();
 	
 	obj_init(&instance->o, instance, (obj_f)instance_obj_destroy);
 	
@@ -489,11 +595,7 @@ int collection_t_lock(struct collection *c, struct collectible *cb, char *file,
 		of them will be deleted during the lock. Also, just to be sure,
 		lock the collectible's parent object.
 	*/
-	obj_ref(&c->o);
-	obj_ref(&cb->o);
-	obj_ref(cb->self);
-	cb->self_locked++;
-	obj_ref(&instance->o);
+	instance_lock(instance);
 
 	return 1;
 }
@@ -516,12 +618,7 @@ int collection_t_unlock(struct collection *c, struct collectible *cb, char *file
 	
 	ret = (!obj_isvalid(cb->self) || !obj_isvalid(&cb->o));
 
-	/* The unreferencing must be in this exact order */
-	obj_unref(&instance->o); /* associative instance NEED 'c' and 'cb' */
-	cb->self_locked--;
-	obj_unref(&cb->o); /* 'cb' NEED 'cb->self' AND 'c' */
-	if(cb->self) obj_unref(cb->self); /* the collectible's parent must be destroyed *after* its collectible. */
-	obj_unref(&c->o); /* needs nothing, when this is destroyed everything else should be GONE. */
+	instance_unlock(instance);
 	
 	return ret;
 }
@@ -529,8 +626,8 @@ int collection_t_unlock(struct collection *c, struct collectible *cb, char *file
 /* iterate the collection */
 /* return 1 if the iteration was completed */
 int collection_t_iterate(struct collection *c, int (*callback)(struct collection *c, void *item, void *param), void *param, char *file, int line) {
-	struct collection_iterator *iter;
-	struct collectible *cb;
+	struct collection_iterator iter;
+	struct collectible_instance *instance;
 	int ret;
 
 	COLLECTION_ASSERT(c, "collection_iterate: c == NULL");
@@ -538,10 +635,10 @@ int collection_t_iterate(struct collection *c, int (*callback)(struct collection
 
 	obj_ref(&c->o);
 	
-	iter = collection_new_iterator(c);
-	for(cb=collection_c_next(c, iter);cb;cb=collection_c_next(c, iter)) {
+	collection_iterator_init(c, &iter);
+	while((instance = collection_step(c, &iter))) {
 		
-		ret = (*callback)(c, obj_self(cb->self), param);
+		ret = (*callback)(c, obj_self(instance->self->self), param);
 		
 		if(!obj_isvalid(&c->o)) {
 			COLLECTION_DBG("collection_iterate: collection destroyed during iteration.");
@@ -549,12 +646,12 @@ int collection_t_iterate(struct collection *c, int (*callback)(struct collection
 		}
 		
 		if(!ret) {
+			collection_iterator_release(&iter);
 			obj_unref(&c->o);
-			collection_iterator_destroy(iter);
 			return 0;
 		}
 	}
-	collection_iterator_destroy(iter);
+	collection_iterator_release(&iter);
 	
 	obj_unref(&c->o);
 
@@ -564,7 +661,8 @@ int collection_t_iterate(struct collection *c, int (*callback)(struct collection
 /* iterate the collection */
 /* return the element chosen by the matcher */
 void *collection_t_match(struct collection *c, int (*callback)(struct collection *c, void *item, void *param), void *param, char *file, int line) {
-	struct collection_iterator *iter;
+	struct collection_iterator iter;
+	struct collectible_instance *instance;
 	struct collectible *cb;
 	int ret;
 	
@@ -573,16 +671,19 @@ void *collection_t_match(struct collection *c, int (*callback)(struct collection
 	
 	obj_ref(&c->o);
 	
-	iter = collection_new_iterator(c);
-	for(cb=collection_c_next(c, iter);cb;cb=collection_c_next(c, iter)) {
+	collection_iterator_init(c, &iter);
+	while((instance = collection_step(c, &iter))) {
+		cb = instance->self;
 		
-		collection_c_lock(c, cb);
+		/* the instance is already at hand, no need to look it up for locking */
+		instance_lock(instance);
 		
 		ret = (*callback)(c, obj_self(cb->self), param);
 		
 		if(!obj_isvalid(&c->o)) {
 			COLLECTION_DBG("collection_iterate: collection destroyed during iteration.");
 			COLLECTION_TRACEBACK();
+			instance_unlock(instance);
 			break;
 		}
 		
@@ -590,24 +691,24 @@ void *collection_t_match(struct collection *c, int (*callback)(struct collection
 			/* deleted during unlock: bad, bad, bad */
 			COLLECTION_DBG("collection_match: deleting items while matching is bad behaviour.");
 			COLLECTION_TRACEBACK();
-			collection_c_unlock(c, cb);
+			instance_unlock(instance);
 			if(ret) {
+				collection_iterator_release(&iter);
 				obj_unref(&c->o);
-				collection_iterator_destroy(iter);
 				return NULL;
 			}
 			continue;
 		}
 		
-		collection_c_unlock(c, cb);
+		instance_unlock(instance);
 		
 		if(ret) {
+			collection_iterator_release(&iter);
 			obj_unref(&c->o);
-			collection_iterator_destroy(iter);
 			return obj_self(cb->self);
 		}
 	}
-	collection_iterator_destroy(iter);
+	collection_iterator_release(&iter);
 	
 	obj_unref(&c->o);
 	
@@ -635,63 +736,36 @@ void *collection_t_first(struct collection *c, char *file, int line) {
 	return NULL;
 }
 
-struct collection_iterator *collection_t_new_iterator(struct collection *c, char *file, int line) {
-	struct collection_iterator *iter;
+int collection_t_iterator_init(struct collection *c, struct collection_iterator *iter, char *file, int line) {
+	
+	collection_list_init(&iter->iterators);
+	iter->next = NULL;
 	
 	COLLECTION_ASSERT(c, "collection_iterator: c == NULL");
 	COLLECTION_ASSERT(obj_isvalid(&c->o), "collection_iterator: 'c->o' is not valid");
 	
-	iter = malloc(sizeof(struct collection_iterator));
-	if(!iter) {
-		COLLECTION_DBG("memory error");
-		COLLECTION_TRACEBACK();
-		exit(0);
-	}
-	
-	collection_list_init(&iter->iterators);
-	//collection_list_init(&iter->all_iterators);
-	
-	c->iterators.count++;
 	collection_list_addfirst(&c->iterators.list, &iter->iterators);
-	//collection_list_addfirst(&all_iterators, &iter->all_iterators);
 	
-	if(!collection_size(c)) {
-		iter->next = NULL;
-	} else {
+	if(c->collectibles.list.next != &c->collectibles.list) {
 		iter->next = CONTAINING_RECORD(c->collectibles.list.next, struct collectible_instance, collectibles);
 	}
 	
-	return iter;
+	return 1;
 }
 
 void *collection_t_next(struct collection *c, struct collection_iterator *iter, char *file, int line) {
-	struct collection_list *current;
+	struct collectible_instance *instance;
 	
 	COLLECTION_ASSERT(c, "collection_next: c == NULL");
 	COLLECTION_ASSERT(obj_isvalid(&c->o), "collection_next: isvalid(c)");
 	COLLECTION_ASSERT(iter, "collection_next: iter == NULL");
-	COLLECTION_ASSERT(iter->next, "");
 	
-	current = &iter->next->collectibles;
-	while(current != &c->collectibles.list) {
-		struct collectible_instance *instance = CONTAINING_RECORD(current, struct collectible_instance, collectibles);
-		struct collectible *cb = instance->self;
-		
-		if(obj_isvalid(&instance->o) && obj_isvalid(&cb->o) && obj_isvalid(cb->self)) {
-			
-			/* switch to the next instance */
-			if(&instance->c->collectibles.list == instance->collectibles.next) {
-				iter->next = NULL;
-			} else {
-				iter->next = CONTAINING_RECORD(instance->collectibles.next, struct collectible_instance, collectibles);
-			}
-			
-			return cb;
-		}
-		current = current->next;
+	instance = collection_step(c, iter);
+	if(!instance) {
+		return NULL;
 	}
 
-	return NULL;
+	return instance->self;
 }
 
 void *collection_next(struct collection *c, struct collection_iterator *iter) {
@@ -104,9 +104,11 @@ struct collection_counted_list {
 } __attribute__((packed));
 
 /*
-	Iterators are stored at collection level and always
-	reflect the changes made on the collection. The
-	iterators are garbage collected once every cycle.
+	Iterators are linked at collection level and always
+	reflect the changes made on the collection. They are
+	meant to live on the caller's stack: initialize them
+	with collection_iterator_init and release them with
+	collection_iterator_release before they go out of scope.
 */
 typedef struct collection_iterator collection_iterator;
 struct collection_iterator {
@@ -244,8 +246,9 @@ void *collection_t_match(struct collection *c, int (*callback)(struct collection
 
 /* non-callback iterators stuff */
 //int collection_cleanup_iterators();
-struct collection_iterator *collection_t_new_iterator(struct collection *c, char *file, int line);
-#define collection_new_iterator(_c) collection_t_new_iterator(_c, __FILE__, __LINE__)
+int collection_t_iterator_init(struct collection *c, struct collection_iterator *iter, char *file, int line);
+#define collection_iterator_init(_c, _i) collection_t_iterator_init(_c, _i, __FILE__, __LINE__)
+void collection_iterator_release(struct collection_iterator *iter);
 void *collection_t_next(struct collection *c, struct collection_iterator *iter, char *file, int line);
 #define collection_c_next(_c, _i) collection_t_next(_c, _i, __FILE__, __LINE__)
 void *collection_next(struct collection *c, struct collection_iterator *iter);
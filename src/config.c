@@ -32,7 +32,7 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-
+
 #ifdef WIN32
 #include <windows.h>
 #include <io.h>
@@ -42,18 +42,26 @@
 #endif
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "main.h"
 #include "logging.h"
 #include "collection.h"
 #include "time.h"
-#include "crc32.h"
 #include "asprintf.h"
 #include "adio.h"
 
 struct collection *open_configs = NULL;
 
+/* same files as open_configs, hashed by filename */
+static struct hash_table *open_index = NULL;
+
+static struct config_file *config_raw_get(const char *filename);
+static struct config_file *config_raw_take(const char *filename);
+static void config_raw_forget(const char *filename);
+
 /* TODO: use that and parse manualy instead of fgets() in functions below */
 char *config_load_file(const char *filename, unsigned int *length)
 {
@@ -76,7 +84,8 @@ char *config_load_file(const char *filename, unsigned int *length)
 		return NULL;
 	}
 
-	buffer = malloc(fsize);
+	/* keep room for a terminating zero, the parsers rely on it */
+	buffer = malloc(fsize + 1);
 	if(!buffer) {
 		CONFIG_DBG("Memory error: %u", fsize);
 		fclose(fd);
@@ -90,6 +99,7 @@ char *config_load_file(const char *filename, unsigned int *length)
 		fclose(fd);
 		return NULL;
 	}
+	buffer[fsize] = 0;
 
 	if(length)
 		*length = fsize;
@@ -99,11 +109,14 @@ char *config_load_file(const char *filename, unsigned int *length)
 	return buffer;
 }
 
-/* return the parameter's value from the ini, or the default value on error */
+/*
+	Return the parameter's value from the ini, or the default value on error.
+	The file is parsed once and kept in the raw cache, so reading several
+	parameters from the same file does not open it again.
+*/
 char *config_raw_read(const char *filename, const char *param, const char *default_value) {
-	char buffer[1024], *ptr;
-	unsigned int i;
-	FILE *f;
+	struct config_file *config;
+	const char *value;
 
 	if(!filename || !param) {
 		CONFIG_DBG("Params error");
@@ -114,52 +127,14 @@ char *config_raw_read(const char *filename, const char *param, const char *defau
 		return NULL;
 	}
 
-	/* open the file */
-	f = fopen(filename, "r");
-	if(!f) return default_value ? strdup(default_value) : NULL;
-
-	/* search the parameter */
-	while(!feof(f)) {
-
-		/* read a line */
-		if(!fgets(buffer, sizeof(buffer)-1, f)) break;
-
-		/* avoid comments */
-		if(buffer[0] == '#') continue;
-
-		for(i=0;i<strlen(buffer);i++) {
-			if(buffer[i] == '\r') buffer[i] = 0;
-			if(buffer[i] == '\n') buffer[i] = 0;
-		}
-
-		/* parse the line */
-		if(!strncasecmp(buffer, param, strlen(param))) {
-			ptr = &buffer[strlen(param)];
-
-			/* trim white spaces before the equal sign */
-			while(*ptr == ' ') ptr++;
-			if(*ptr != '=') {
-				/* invalid line */
-				continue;
-			}
-			else ptr++;
-
-			/* trim white spaces after the equal sign */
-			while(*ptr == ' ') ptr++;
-
-			/* no value? return the default one */
-			if(!strlen(ptr)) break;
-
-			/* there we are, now we return the value */
-			fclose(f);
-
-			return strdup(ptr);
-		}
-	}
+	config = config_raw_get(filename);
+	if(!config) return default_value ? strdup(default_value) : NULL;
 
-	fclose(f);
+	/* no value? return the default one */
+	value = config_pread(config, param, NULL);
+	if(!value || !strlen(value)) return default_value ? strdup(default_value) : NULL;
 
-	return default_value ? strdup(default_value) : NULL;
+	return strdup(value);
 }
 
 unsigned long long int config_raw_read_int(const char *filename, const char *param, unsigned long long int default_value) {
@@ -222,6 +197,7 @@ int config_raw_write(const char *filename, const char *param, const char *new_va
 	f = fopen(filename, "r");
 	if(!f) {
 		/* file does not exist ? */
+		config_raw_forget(filename);
 		if(new_value) {
 			logging_write(filename, "%s = %s\n", param, new_value);
 		}
@@ -275,6 +251,9 @@ int config_raw_write(const char *filename, const char *param, const char *new_va
 
 	free(filename_tmp);
 
+	/* don't answer the next reads from the old content */
+	config_raw_forget(filename);
+
 	return 1;
 }
 
@@ -305,6 +284,7 @@ int config_raw_write_int(const char *filename, const char *param, unsigned long
 	f = fopen(filename, "r");
 	if(!f) {
 		/* file does not exist ? */
+		config_raw_forget(filename);
 		logging_write(filename, "%s = %I64u\n", param, new_value);
 		free(filename_tmp);
 		return 0;
@@ -352,6 +332,9 @@ int config_raw_write_int(const char *filename, const char *param, unsigned long
 
 	free(filename_tmp);
 
+	/* don't answer the next reads from the old content */
+	config_raw_forget(filename);
+
 	return 1;
 }
 
@@ -360,10 +343,17 @@ static void config_obj_destroy(struct config_file *config) {
 	
 	collectible_destroy(config);
 
+	hash_remove(open_index, &config->node);
+
+	/* the fields unlink themselves from the index as they go */
 	collection_destroy(config->fields);
+	hash_destroy(config->index);
 	if(config->filename) {
 		free(config->filename);
 	}
+	if(config->comments) {
+		free(config->comments);
+	}
 	free(config);
 	
 	return;
@@ -392,30 +382,27 @@ void config_close(struct config_file *config) {
 	return;
 }
 
-static int config_get_field_matcher(struct collection *c, struct config_field *field, void *param) {
-	struct {
-		const char *name;
-		unsigned int namesum;
-	} *ctx = param;
+/*
+	Return the field with the given name. When a name is present
+	more than once in the file, the first one wins, like it always did.
+*/
+static struct config_field *config_get_field(struct config_file *config, const char *name) {
+	struct config_field *field = NULL;
+	struct hash_node *node;
 
-	if(field->namesum == ctx->namesum) {
-		return !strcasecmp(ctx->name, field->name);
+	/* the index keeps the most recent field first */
+	node = hash_find(config->index, name);
+	while(node) {
+		field = hash_entry(node, struct config_field, node);
+		node = hash_find_next(config->index, node);
 	}
 
-	return 0;
-}
-
-static struct config_field *config_get_field(struct config_file *config, const char *name, unsigned int namesum) {
-	struct {
-		const char *name;
-		unsigned int namesum;
-	} ctx = { name, namesum };
-
-	return collection_match(config->fields, (collection_f)config_get_field_matcher, &ctx);
+	return field;
 }
 
 static void config_field_destroy(struct config_field *field) {
 	
+	hash_remove(field->config->index, &field->node);
 	obj_destroy(&field->o);
 	
 	return;
@@ -425,16 +412,28 @@ static void config_field_obj_destroy(struct config_field *field) {
 	
 	collectible_destroy(field);
 	
+	/* if still linked, the config (and its index) is still around */
+	if(hash_node_linked(&field->node)) {
+		hash_remove(field->config->index, &field->node);
+	}
+	
 	free(field->name);
 	field->name = NULL;
 	
 	free(field->value);
 	field->value = NULL;
 	
+	if(field->comments) {
+		free(field->comments);
+		field->comments = NULL;
+	}
+	
+	free(field);
+	
 	return;
 }
 
-static struct config_field *config_new_field(struct config_file *config, const char *name, unsigned int namesum, const char *value) {
+static struct config_field *config_new_field(struct config_file *config, const char *name, const char *value) {
 	struct config_field *field;
 
 	field = malloc(sizeof(struct config_field));
@@ -448,7 +447,8 @@ static struct config_field *config_new_field(struct config_file *config, const c
 
 	field->comments = NULL;
 	
-	field->namesum = namesum;
+	field->config = config;
+	hash_node_init(&field->node);
 	
 	field->name = strdup(name);
 	if(!field->name) {
@@ -473,32 +473,13 @@ static struct config_field *config_new_field(struct config_file *config, const c
 		return NULL;
 	}
 
-	return field;
-}
-
-/*
-	The name sum is calculated without the ending zero for more
-	flexibility (less string movement)
-*/
-unsigned int config_namesum(const char *name, unsigned int length) {
-#define IS_MAJ(_c) (((_c) >= 'A') && ((_c) <= 'Z'))
-	unsigned int i;
-	unsigned int sum;
-	unsigned char m;
-
-	crc32_init(&sum);
-	for(i=0;i<length;i++) {
-		if(IS_MAJ(name[i])) {
-			m = (name[i] - 'A') + 'a';
-			crc32_add(&sum, (void *)&m, 1);
-		} else {
-			crc32_add(&sum, (void *)&name[i], 1);
-		}
+	if(!hash_add(config->index, &field->node, field->name)) {
+		CONFIG_DBG("Hash error");
+		config_field_destroy(field);
+		return NULL;
 	}
-	crc32_close(&sum);
 
-	return sum;
-#undef IS_MAJ
+	return field;
 }
 
 /* Load all fields of the specified config file. */
@@ -506,7 +487,6 @@ int config_load(struct config_file *config) {
 	struct config_field *field;
 	char *line, *value, *tmp;
 	unsigned int i;
-	unsigned int namesum;
 	char *buffer;
 	unsigned int length;
 	char *comment = NULL;
@@ -561,7 +541,7 @@ int config_load(struct config_file *config) {
 		}
 		
 		if(!line[0]) continue; // empty line, go on...
-		
+		
 		//CONFIG_DBG("Loading line: %s", line);
 		
 		value = strchr(line, '=');
@@ -578,8 +558,8 @@ int config_load(struct config_file *config) {
 		
 		//CONFIG_DBG("Loading field \"%s\" = \"%s\" at %u", line, value, (line-buffer));
 		
-		namesum = config_namesum(line, strlen(line));
-		field = config_new_field(config, line, namesum, value);
+		field = config_new_field(config, line, value);
+		if(!field) continue;
 		
 		if(comment) {
 			field->comments = strdup(comment);
@@ -592,19 +572,25 @@ int config_load(struct config_file *config) {
 		comment = NULL;
 	}
 	
+	free(buffer);
+	
 	return 1;
 }
 
-static int config_find_matcher(struct collection *c, struct config_file *config, const char *filename) {
-	if(!config->filename) return 0;
-	return !strcasecmp(config->filename, filename);
-}
-
 static struct config_file *config_find(const char *filename) {
-	if(!filename)
+	struct config_file *config;
+	struct hash_node *node;
+	
+	if(!filename || !open_index)
 		return NULL;
 	
-	return (struct config_file *)collection_match(open_configs, (collection_f)config_find_matcher, (void *)filename);
+	for(node = hash_find(open_index, filename); node; node = hash_find_next(open_index, node)) {
+		config = hash_entry(node, struct config_file, node);
+		if(obj_isvalid(&config->o))
+			return config;
+	}
+	
+	return NULL;
 }
 
 
@@ -613,22 +599,10 @@ struct config_file *config_volatile() {
 	return config_open(NULL);
 }
 
-/* Initialize the config structure without loading the file */
-struct config_file *config_open(const char *filename) {
+/* Allocate a config structure and load the file, if any */
+static struct config_file *config_new(const char *filename) {
 	struct config_file *config;
 	
-	if(!open_configs) {
-		open_configs = collection_new(C_CASCADE);
-	}
-
-	if(filename) {
-		config = config_find(filename);
-		if(config) {
-			config->refs++;
-			return config;
-		}
-	}
-	
 	config = malloc(sizeof(struct config_file));
 	if(!config) {
 		CONFIG_DBG("Memory error");
@@ -661,20 +635,170 @@ struct config_file *config_open(const char *filename) {
 
 	config->savetime = time_now();
 
+	hash_node_init(&config->node);
+
+	config->index = hash_new(0, 1);
+	if(!config->index) {
+		CONFIG_DBG("Memory error");
+		if(config->filename) free(config->filename);
+		free(config);
+		return NULL;
+	}
+
 	config->fields = collection_new(C_CASCADE);
 	
 	config_load(config);
 
+	return config;
+}
+
+/* Open the config structure, loading the file if it's not already open */
+struct config_file *config_open(const char *filename) {
+	struct config_file *config;
+	
+	if(!open_configs) {
+		open_configs = collection_new(C_CASCADE);
+	}
+	
+	if(!open_index) {
+		open_index = hash_new(0, 1);
+		if(!open_index) {
+			CONFIG_DBG("Memory error");
+			return NULL;
+		}
+	}
+
+	if(filename) {
+		config = config_find(filename);
+		if(config) {
+			config->refs++;
+			return config;
+		}
+		
+		/* if the file was just parsed by config_raw_read(), take it from there */
+		config = config_raw_take(filename);
+	} else {
+		config = NULL;
+	}
+	
+	if(!config) {
+		config = config_new(filename);
+		if(!config) return NULL;
+	}
+
 	if(!collection_add(open_configs, config)) {
-		if(config->filename) free(config->filename);
-		collection_destroy(config->fields);
-		free(config);
+		obj_destroy(&config->o);
+		return NULL;
+	}
+	
+	if(filename && !hash_add(open_index, &config->node, config->filename)) {
+		CONFIG_DBG("Hash error");
+		obj_destroy(&config->o);
 		return NULL;
 	}
 
 	return config;
 }
 
+/*
+	Raw cache: the files read with config_raw_read() are parsed once
+	into a config structure, and the following reads are answered from
+	memory as long as the file's size and modification time are the same
+	on disk. The cache is small, it only has to cover the burst of reads
+	that are done on the same file while loading a user, a slave, etc.
+*/
+struct config_raw_entry {
+	struct config_file *config;
+	unsigned long long int size;
+	unsigned long long int mtime;
+};
+
+static struct config_raw_entry raw_cache[CONFIG_RAW_CACHE_SIZE];
+static unsigned int raw_cache_next = 0;
+
+static struct config_raw_entry *config_raw_find(const char *filename) {
+	unsigned int i;
+	
+	for(i=0;i<CONFIG_RAW_CACHE_SIZE;i++) {
+		if(raw_cache[i].config && !strcasecmp(raw_cache[i].config->filename, filename))
+			return &raw_cache[i];
+	}
+	
+	return NULL;
+}
+
+static void config_raw_forget(const char *filename) {
+	struct config_raw_entry *entry;
+	
+	entry = config_raw_find(filename);
+	if(entry) {
+		obj_destroy(&entry->config->o);
+		entry->config = NULL;
+	}
+	
+	return;
+}
+
+/* return the parsed file, or NULL if it does not exist */
+static struct config_file *config_raw_get(const char *filename) {
+	struct config_raw_entry *entry;
+	struct stat st;
+	
+	if(stat(filename, &st) == -1) {
+		config_raw_forget(filename);
+		return NULL;
+	}
+	
+	entry = config_raw_find(filename);
+	if(entry) {
+		if((entry->size == st.st_size) && (entry->mtime == st.st_mtime))
+			return entry->config;
+		
+		/* modified since we parsed it */
+		obj_destroy(&entry->config->o);
+		entry->config = NULL;
+	} else {
+		entry = &raw_cache[raw_cache_next];
+		raw_cache_next = (raw_cache_next + 1) % CONFIG_RAW_CACHE_SIZE;
+		
+		if(entry->config) {
+			obj_destroy(&entry->config->o);
+			entry->config = NULL;
+		}
+	}
+	
+	entry->config = config_new(filename);
+	if(!entry->config) {
+		CONFIG_DBG("Memory error");
+		return NULL;
+	}
+	
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtime;
+	
+	return entry->config;
+}
+
+/* remove a fresh parsed file from the cache and return it, or NULL */
+static struct config_file *config_raw_take(const char *filename) {
+	struct config_raw_entry *entry;
+	struct config_file *config;
+	struct stat st;
+	
+	entry = config_raw_find(filename);
+	if(!entry) return NULL;
+	
+	if((stat(filename, &st) == -1) || (entry->size != st.st_size) || (entry->mtime != st.st_mtime)) {
+		config_raw_forget(filename);
+		return NULL;
+	}
+	
+	config = entry->config;
+	entry->config = NULL;
+	
+	return config;
+}
+
 static int config_dump_getlength(struct collection *c, struct config_field *field, unsigned int *length) {
 	
 	*length += (field->comments ? 2 + strlen(field->comments) + 2 : 0) + // crlf + field's comments
@@ -866,6 +990,9 @@ static int config_poll_process_adio(struct collection *c, struct config_file *co
 		
 		config->is_saving = 0;
 		
+		/* the content on disk just changed */
+		config_raw_forget(config->filename);
+		
 		if(config->shouldsave) {
 			/* shouldsave was set again while we were saving. */
 			//CONFIG_DBG("The shouldsave flag was set again while we were saving: %s", config->filename);
@@ -906,15 +1033,13 @@ char *config_read(struct config_file *config, const char *param, const char *def
 
 const char *config_pread(struct config_file *config, const char *param, const char *default_value) {
 	struct config_field *field;
-	unsigned int namesum;
 	
 	if(!config || !param) {
 		CONFIG_DBG("Params error");
 		return NULL;
 	}
 	
-	namesum = config_namesum(param, strlen(param));
-	field = config_get_field(config, param, namesum);
+	field = config_get_field(config, param);
 	if(!field) {
 		/* not found ... */
 		return default_value;
@@ -947,15 +1072,13 @@ unsigned long long int config_read_int(struct config_file *config, char *param,
 
 int config_write(struct config_file *config, const char *param, const char *new_value) {
 	struct config_field *field;
-	unsigned int namesum;
 	
 	if(!config || !param) {
 		CONFIG_DBG("Params error");
 		return 0;
 	}
 	
-	namesum = config_namesum(param, strlen(param));
-	field = config_get_field(config, param, namesum);
+	field = config_get_field(config, param);
 	if(field) {
 		/* The field is already present in the file */
 		
@@ -994,7 +1117,7 @@ int config_write(struct config_file *config, const char *param, const char *new_
 		return 1;
 	}
 	
-	field = config_new_field(config, param, namesum, new_value);
+	field = config_new_field(config, param, new_value);
 	if(!field) {
 		CONFIG_DBG("Memory error");
 		return 0;
@@ -1030,15 +1153,13 @@ int config_write_int(struct config_file *config, const char *param, unsigned lon
 
 int config_field_comment(struct config_file *config, const char *param, const char *new_comment) {
 	struct config_field *field;
-	unsigned int namesum;
 	
 	if(!config || !param) {
 		CONFIG_DBG("Params error");
 		return 0;
 	}
 	
-	namesum = config_namesum(param, strlen(param));
-	field = config_get_field(config, param, namesum);
+	field = config_get_field(config, param);
 	if(!field)
 		return 0;
 	
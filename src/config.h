@@ -39,6 +39,7 @@
 #include "constants.h"
 #include "obj.h"
 #include "collection.h"
+#include "hash.h"
 
 #include "debug.h"
 #if defined(DEBUG_CONFIG)
@@ -52,7 +53,10 @@ struct config_field {
 	struct obj o;
 	struct collectible c;
 	
-	unsigned int namesum;
+	/* linked to the file's field index, keyed by name */
+	struct hash_node node;
+	struct config_file *config;
+	
 	char *name;
 	char *value;
 	
@@ -68,6 +72,9 @@ struct config_file {
 	/* Fully qualified path to the file. */
 	char *filename;
 	
+	/* linked to the index of open files, keyed by filename */
+	struct hash_node node;
+	
 	/* The adio file and optionally the adio operation
 		if any is started. */
 	struct adio_file *adf;
@@ -87,6 +94,7 @@ struct config_file {
 	
 	/* All fields of the file */
 	struct collection *fields; /* struct config_field */
+	struct hash_table *index; /* same fields, hashed by name */
 } __attribute__((packed));
 
 
@@ -94,7 +102,8 @@ extern struct collection *open_configs;
 
 
 /*
-	Low level access to config files
+	Low level access to config files. Reads are answered from a small
+	cache of parsed files, which is refreshed when the file changes on disk.
 */
 char *config_load_file(const char *filename, unsigned int *length);
 
@@ -49,7 +49,7 @@
 	sanity checks.
 */
 //#define TOLUA_RELEASE
-
+
 #ifdef WIN32
 /* Uncomment these lines to compile each modules as services */
 //#define MASTER_WIN32_SERVICE
@@ -120,11 +120,33 @@
 
 #define CONFIG_SAVETIME		(20 * 1000) /* 20 seconds */
 
+/* number of parsed files kept around for config_raw_read() */
+#define CONFIG_RAW_CACHE_SIZE	8
+
+/* number of collection membership instances allocated at once */
+#define COLLECTION_SLAB_SIZE	256
+
 #define NUKELOG_FILE			"xftpd.nukelog"
 
+/* the nukelog is rewritten once it holds this many obsolete records */
+#define NUKE_JOURNAL_COMPACT		4096
+
+/* largest IO_DELETE_BATCH sent to a slave, in bytes of paths */
+#define SLAVE_DELETE_BATCH_SIZE		(64 * 1024)
+
+/* slave selection decisions, when xftpd.topology.log is set */
+#define TOPOLOGY_LOG_FILE		"xftpd.selectionlog"
+
 #define SLAVE_UP_BUFFER_SIZE		(1024 * 1024)
 #define SLAVE_DN_BUFFER_SIZE		(65535)
 
+/* memory for the blocks shared by the downloads of a same file,
+	0 gives each download its own buffer of SLAVE_DN_BUFFER_SIZE */
+#define SLAVE_CACHE_SIZE		(64 * 1024 * 1024) /* 64 mb */
+#define SLAVE_CACHE_BLOCK_SIZE		(256 * 1024) /* 256 kb */
+/* blocks read ahead of the leading download of a file */
+#define SLAVE_CACHE_READAHEAD		4
+
 #define SLAVE_DELETE_INCOMPLETE_UPLOADS		1
 
 /* timeout for master/slave data arrival */
@@ -134,18 +156,61 @@
 	it's also used as a keepalive for the master */
 #define FTPD_STATS_PROBE_TIME		(5 * 1000) /* 5 seconds (in milliseconds) */
 
+/* rate at wich the slave pushes the progress of its transfers */
+#define SLAVE_PROGRESS_INTERVAL		(1000) /* 1 second */
+
+/* rate at wich the slave reads back the files of unknown checksum */
+#define SLAVE_SCRUB_RATE		(4 * 1024 * 1024) /* 4 mb per second */
+#define SLAVE_SCRUB_INTERVAL		(250) /* 250 ms */
+#define SLAVE_SCRUB_CHUNK_SIZE		(64 * 1024) /* 64 kb */
+
+/* largest IO_CHECKSUMS sent to the master, in bytes of entries */
+#define SLAVE_SCRUB_BATCH_SIZE		(16 * 1024)
+
+/* data received for an upload and not yet sent to one of its replicas,
+	the upload stops reading from the client above this */
+#define SLAVE_TEE_BACKLOG		(4 * 1024 * 1024) /* 4 mb */
+
 /* size of the socket buffer between the master and slave */
 #define SLAVE_MASTER_SOCKET_SIZE	(256 * 1024) /* 256 kb */
 
 /* timeout for data connection */
 #define DATA_CONNECTION_TIMEOUT		(10 * 1000) /* 10 seconds */
 
+/* initial size of the host name cache */
+#define RESOLVER_CACHE_SIZE		16
+
+/* time for wich resolved (or unresolvable) host names are cached */
+#define RESOLVER_POSITIVE_TTL		(5 * 60 * 1000) /* 5 mins. */
+#define RESOLVER_NEGATIVE_TTL		(30 * 1000) /* 30 seconds */
+
+/* maximum number of idle tunnels the slave keeps to each data proxy */
+#define SLAVE_TUNNEL_POOL_SIZE		8
+
+/* time between each resize of the tunnel pools */
+#define SLAVE_TUNNEL_INTERVAL		(10 * 1000) /* 10 seconds */
+
+/* idle tunnels older than this are reopened */
+#define SLAVE_TUNNEL_MAX_IDLE		(5 * 60 * 1000) /* 5 mins. */
+
+/* time between each report of the tunnel pools' counters */
+#define SLAVE_TUNNEL_STATS_INTERVAL	(5 * 60 * 1000) /* 5 mins. */
+
 /* timeout for irc connection */
 #define IRC_DATA_TIMEOUT		(30 * 60 * 1000) /* 20 minutes */
 
 /* irc socket buffer size */
 #define IRC_SOCKET_SIZE			(16 * 1024) /* 16 kb */
 
+/* irc receive buffer, bounds the longest line the server may send */
+#define IRC_READ_BUFFER_SIZE		(4 * 1024) /* 4 kb */
+
+/* irc send buffer, queued lines are coalesced into it */
+#define IRC_SEND_BUFFER_SIZE		(4 * 1024) /* 4 kb */
+
+/* number of lines that may be sent back-to-back before the delay applies */
+#define IRC_FLOOD_BURST			5
+
 /* timeout for clients connection */
 #define FTPD_CLIENT_TIMEOUT		(5 * 60 * 1000) /* 5 minutes */
 
@@ -165,6 +230,16 @@
 /* maximum time the master will wait for an asynch response to be received */
 #define MASTER_ASYNCH_TIMEOUT		(60 * 1000) /* 1 minute */
 
+/*
+	Slave selection scores. Each term is scaled to 0-1000: the
+	link usage, the disk usage (uploads only), the lag and the
+	number of transfers.
+*/
+#define SLAVESELECTION_MIN_CAPACITY	(1024 * 1024) /* 1 mb/s, until more is seen */
+#define SLAVESELECTION_MAX_LAG		(5 * 1000) /* 5 seconds */
+#define SLAVESELECTION_QUEUE_COST	100 /* per transfer */
+#define SLAVESELECTION_UNREPORTED_COST	1000 /* until the first stats answer, as if the link was full */
+
 /* slave's speed correction */
 #define SPEEDCHECK_TIME				(10 * 1000) /* 5 seconds */
 #define SPEEDCHECK_THRESHOLD		(5) /* 5% change */
@@ -176,6 +251,15 @@
 */
 #define PROXY_LISTEN_TIMEOUT		(5 * 60 * 1000) /* 5 mins. */
 
+/*
+	Size of the ring buffer holding the proxy's own packets
+	when the traffic itself is relayed with splice().
+*/
+#define PROXY_CONTROL_BUFFER_SIZE	1024
+
+/* time between each report of the proxy workers' counters */
+#define PROXY_STATS_INTERVAL		(5 * 60 * 1000) /* 5 mins. */
+
 /* ftpd config */
 //#define IO_SOCKET_TIMEOUT		5000
 #define COMMUNICATION_KEY_LEN		1024
@@ -185,10 +269,69 @@
 #define SLAVES_USE_COMPRESSION		1
 #define SLAVES_COMPRESSION_THRESHOLD	500
 
+/*
+	The file list of a connecting slave is merged in slices of at
+	most this many ms per loop, so the clients are still served.
+	The clock is only read every SLAVES_FILE_LIST_CHECK entries.
+*/
+#define SLAVES_FILE_LIST_SLICE		20
+#define SLAVES_FILE_LIST_CHECK		64
+
+/*
+	Milliseconds spent in the background jobs on each loop
+	(see job.h), overridden by xftpd.jobs.budget.
+*/
+#define JOB_BUDGET			10
+
+/* folders with more elements than this are wiped by a background job */
+#define FTPD_WIPE_INLINE		1000
+/* elements deleted on each step of the wipe job */
+#define FTPD_WIPE_STEP			64
+
+/* number of nukes matched with the vfs on each step of their job */
+#define NUKE_CHECK_STEP			64
+
+/*
+	Mirrors started from the queued batches (see mirror.h) while
+	there are fewer than this many in total, and fewer than this
+	many on the source and target slaves. Overridden by
+	xftpd.mirror.max-running and xftpd.mirror.max-per-slave.
+*/
+#define MIRROR_MAX_RUNNING		16
+#define MIRROR_MAX_PER_SLAVE		2
+
+/* time between each pass over the queued batches */
+#define MIRROR_SCHEDULE_INTERVAL	(1000) /* 1 second */
+
+/* number of queued files looked at per batch on each pass */
+#define MIRROR_SCHEDULE_SCAN		64
+
+/* highest number of replicas an upload is streamed to, whatever
+	the section's "replicas" setting says */
+#define MIRROR_TEE_MAX			4
+
+/*
+	Files and folders downloaded by this many clients per slave
+	serving them are copied to more slaves for as long as the
+	demand lasts (see mirror.h). Overridden by
+	xftpd.mirror.hot-threshold, xftpd.mirror.hot-copies and
+	xftpd.mirror.hot-expire.
+*/
+#define MIRROR_HOT_THRESHOLD		8
+#define MIRROR_HOT_COPIES		2
+#define MIRROR_HOT_EXPIRE		(15 * 60 * 1000) /* 15 minutes */
+
+/* time between each pass over the download demand, each
+	pass forgets 1/MIRROR_HOT_DECAY of the recent downloads */
+#define MIRROR_HOT_INTERVAL		(5 * 1000) /* 5 seconds */
+#define MIRROR_HOT_DECAY		8
+
 
 #define SLAVES_PORT			20
 #define FTPD_PORT			21
 #define FTPD_BUFFER_SIZE		65535
+#define FTPD_REPLY_BUFFER_SIZE	(4 * 1024) /* initial size of the reply buffers */
+#define FTPD_READ_SIZE			(4 * 1024) /* size of each read on the control connection */
 
 #define FTPD_LOW_DATA_PORT		40000
 #define FTPD_HIGH_DATA_PORT		49000
@@ -206,6 +349,7 @@
 #define EVENTS_REFTABLE			"events_reftable"
 #define SLAVESELECTION_REFTABLE	"slaveselection_reftable"
 #define TIMER_REFTABLE			"timer_reftable"
+#define JOB_REFTABLE			"job_reftable"
 #define MIRRORS_REFTABLE		"mirrors_reftable"
 #define SITE_REFTABLE			"site_reftable"
 #define IRCCORE_REFTABLE		"irccore_reftable"
@@ -58,8 +58,10 @@
 #define DEBUG_SLAVE_DIALOG //*
 #define DEBUG_FTPD
 #define DEBUG_FTPD_DIALOG //*
+#define DEBUG_HASH
 #define DEBUG_IO
 #define DEBUG_IRCCORE
+#define DEBUG_JOB
 #define DEBUG_LUAINIT
 #define DEBUG_MAIN
 #define DEBUG_MIRROR
@@ -67,6 +69,7 @@
 #define DEBUG_OBJ
 #define DEBUG_PACKET //*
 #define DEBUG_PROXY
+#define DEBUG_RESOLVER
 #define DEBUG_SCRIPTS
 #define DEBUG_SECURE
 #define DEBUG_SFV
@@ -79,10 +82,12 @@
 #define DEBUG_SOCKET_SIGNALS
 #define DEBUG_STATS
 #define DEBUG_TIMER
+#define DEBUG_TOPOLOGY
 #define DEBUG_TREE
 #define DEBUG_UPDATE
 #define DEBUG_USERS
 #define DEBUG_VFS
+#define DEBUG_WHEEL
 #define DEBUG_SECTIONS
 #define DEBUG_SKINS
 
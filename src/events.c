@@ -418,6 +418,20 @@ unsigned int event_onSlaveIdentFail(struct slave_connection *cnx, struct slave_h
 	return ret;
 }
 
+/* called after each slice of the file list merged, see cnx.file_list */
+void event_onSlaveIdentProgress(struct slave_connection *cnx) {
+	struct event_parameter params[1];
+
+	params[0].ptr = cnx;
+	params[0].type = "slave_connection";
+	
+	EVENTS_CALLS_DBG("onSlaveIdentProgress");
+
+	event_raise("onSlaveIdentProgress", 1, &params[0]);
+
+	return;
+}
+
 void event_onSlaveDisconnect(struct slave_connection *cnx) {
 	struct event_parameter params[1];
 
@@ -122,6 +122,7 @@ void event_onClientDisconnect(struct ftpd_client_ctx *client);
 unsigned int event_onSlaveConnect(struct slave_connection *cnx);
 unsigned int event_onSlaveIdentSuccess(struct slave_connection *cnx);
 unsigned int event_onSlaveIdentFail(struct slave_connection *cnx, struct slave_hello_data *hello);
+void event_onSlaveIdentProgress(struct slave_connection *cnx);
 void event_onSlaveDisconnect(struct slave_connection *cnx);
 
 /* ftpd: transfer operations */
@@ -66,9 +66,11 @@
 #include "service.h"
 #include "slaves.h"
 #include "signal.h"
+#include "wheel.h"
 #include "proxy.h"
 #include "adio.h"
 #include "dir.h"
+#include "hash.h"
 
 #include "constants.h"
 
@@ -96,6 +98,7 @@ static unsigned int fsd_buffer_down =  1 * 1024 * 1024;
 //static char *working_buffer = NULL;
 
 static struct collection *xfers_collection = NULL;
+static struct collection *tees_collection = NULL; /* struct fsd_tee, owned here */
 
 static unsigned long long int current_proxy_uid = 0;
 
@@ -114,6 +117,36 @@ static unsigned int use_pasv_proxy = 0;
 static unsigned int pasv_proxy_ip = 0;
 static unsigned short pasv_proxy_port = 0;
 
+/* idle tunnels kept open to the data proxies */
+static unsigned int tunnel_pool_max = SLAVE_TUNNEL_POOL_SIZE;
+static struct fsd_tunnel_pool pasv_tunnels;
+static struct fsd_tunnel_pool data_tunnels;
+
+/* progress of the transfers is pushed to the master at this rate, 0 to disable */
+static unsigned int fsd_progress_interval = SLAVE_PROGRESS_INTERVAL;
+static struct wheel_timer fsd_progress_timer;
+
+/* files of unknown checksum are read back at this rate (bytes per second), 0 to disable */
+static unsigned int fsd_scrub_rate = SLAVE_SCRUB_RATE;
+
+/* blocks shared by the downloads, see struct fsd_block */
+static unsigned int fsd_cache_size = SLAVE_CACHE_SIZE; /* 0 to disable */
+static unsigned int fsd_cache_readahead = SLAVE_CACHE_READAHEAD;
+static unsigned int fsd_cache_used = 0; /* bytes of all the blocks */
+static struct collection *blocks_collection = NULL; /* struct fsd_block, least recently used first, owned here */
+static struct collection *blocks_reading = NULL; /* blocks with a read in progress */
+static struct wheel_timer fsd_scrub_timer;
+static struct collection *scrub_pending = NULL; /* file_map structs of unknown checksum */
+static struct collection *scrub_report = NULL; /* file_map structs with a checksum not yet sent */
+static char scrub_master_ready = 0; /* the master has our file list since we're connected */
+static struct {
+	struct file_map *file; /* file being read back */
+	FILE *stream;
+	unsigned long long int offset;
+	unsigned int checksum;
+	char *buffer;
+} scrub = { NULL, NULL, 0, 0, NULL };
+
 static unsigned int fsd_delete_incomplete_uploads = SLAVE_DELETE_INCOMPLETE_UPLOADS;
 
 static struct collection *xfer_monitored_adio = NULL;
@@ -156,12 +189,588 @@ static unsigned short get_next_local_port() {
 	return port;
 }
 
+static void tunnel_obj_destroy(struct fsd_tunnel *tunnel) {
+	
+	collectible_destroy(tunnel);
+	
+	if(tunnel->fd != -1) {
+		signal_clear_all_with_filter(tunnel->pool->group, (void *)tunnel->fd);
+		if(!tunnel->connected) {
+			socket_monitor_fd_closed(tunnel->fd);
+		}
+		close_socket(tunnel->fd);
+		tunnel->fd = -1;
+	}
+	
+	free(tunnel);
+	
+	return;
+}
+
+static void tunnel_destroy(struct fsd_tunnel *tunnel) {
+	
+	obj_destroy(&tunnel->o);
+	
+	return;
+}
+
+static int tunnel_connect(int fd, struct fsd_tunnel *tunnel) {
+	
+	/* the tunnel stays unmonitored until a transfer claims it */
+	signal_clear_all_with_filter(tunnel->pool->group, (void *)fd);
+	socket_monitor_fd_closed(fd);
+	
+	tunnel->connected = 1;
+	tunnel->timestamp = time_now();
+	
+	return 1;
+}
+
+static int tunnel_connect_timeout(struct fsd_tunnel *tunnel) {
+	
+	SLAVE_DBG("%s tunnel: connect timeout", tunnel->pool->name);
+	tunnel->pool->failures++;
+	tunnel_destroy(tunnel);
+	
+	return 1;
+}
+
+static int tunnel_error(int fd, struct fsd_tunnel *tunnel) {
+	
+	SLAVE_DBG("%s tunnel: could not connect to the proxy", tunnel->pool->name);
+	tunnel->pool->failures++;
+	tunnel_destroy(tunnel);
+	
+	return 1;
+}
+
+/*
+	Return 1 if a parked tunnel can still be used. The proxy
+	never talks first, so anything readable on the socket,
+	including its closure, means the tunnel is gone.
+*/
+static int tunnel_alive(struct fsd_tunnel *tunnel) {
+	char c;
+	int flags = MSG_PEEK;
+	
+#ifndef WIN32
+	/* make_socket_blocking() leaves the socket blocking here */
+	flags |= MSG_DONTWAIT;
+#endif
+	
+	if(recv(tunnel->fd, &c, sizeof(c), flags) != -1) {
+		return 0;
+	}
+	
+#ifdef WIN32
+	return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+	return (errno == EWOULDBLOCK);
+#endif
+}
+
+/* start connecting a new tunnel to the pool's proxy */
+static int tunnel_open(struct fsd_tunnel_pool *pool) {
+	struct fsd_tunnel *tunnel;
+	struct signal_callback *s;
+	
+	tunnel = malloc(sizeof(struct fsd_tunnel));
+	if(!tunnel) {
+		SLAVE_DBG("Memory error");
+		return 0;
+	}
+	
+	obj_init(&tunnel->o, tunnel, (obj_f)tunnel_obj_destroy);
+	collectible_init(tunnel);
+	
+	tunnel->pool = pool;
+	tunnel->connected = 0;
+	tunnel->timestamp = time_now();
+	
+	tunnel->fd = connect_to_ip_non_blocking(pool->ip, pool->port);
+	if(tunnel->fd == -1) {
+		SLAVE_DBG("%s tunnel: could not create socket", pool->name);
+		pool->failures++;
+		tunnel_destroy(tunnel);
+		return 0;
+	}
+	
+	if(!collection_add(pool->tunnels, tunnel)) {
+		SLAVE_DBG("Collection error");
+		tunnel_destroy(tunnel);
+		return 0;
+	}
+	
+	socket_monitor_new(tunnel->fd, 0, 0);
+	s = socket_monitor_signal_add(tunnel->fd, pool->group, "socket-connect", (signal_f)tunnel_connect, tunnel);
+	signal_timeout(s, DATA_CONNECTION_TIMEOUT, (timeout_f)tunnel_connect_timeout, tunnel);
+	socket_monitor_signal_add(tunnel->fd, pool->group, "socket-error", (signal_f)tunnel_error, tunnel);
+	socket_monitor_signal_add(tunnel->fd, pool->group, "socket-close", (signal_f)tunnel_error, tunnel);
+	
+	return 1;
+}
+
+/* bring the number of tunnels in the pool to its target */
+static void tunnel_pool_fill(struct fsd_tunnel_pool *pool) {
+	
+	while(collection_size(pool->tunnels) > pool->target) {
+		tunnel_destroy(collection_first(pool->tunnels));
+	}
+	
+	while(collection_size(pool->tunnels) < pool->target) {
+		if(!tunnel_open(pool)) break;
+	}
+	
+	return;
+}
+
+static int tunnel_ready_matcher(struct collection *c, struct fsd_tunnel *tunnel, void *param) {
+	
+	return tunnel->connected;
+}
+
+static int tunnel_expire_callback(struct collection *c, struct fsd_tunnel *tunnel, void *param) {
+	
+	if(tunnel->connected && ((timer(tunnel->timestamp) > SLAVE_TUNNEL_MAX_IDLE) || !tunnel_alive(tunnel))) {
+		tunnel_destroy(tunnel);
+	}
+	
+	return 1;
+}
+
+/*
+	Return a socket connected (or connecting) to the pool's
+	proxy for the specified xfer: a parked tunnel when one
+	is available, or a brand new connection otherwise.
+*/
+static int tunnel_pool_claim(struct fsd_tunnel_pool *pool, struct slave_xfer *xfer) {
+	struct fsd_tunnel *tunnel;
+	int fd = -1;
+	
+	xfer->tunnel_pool = pool;
+	xfer->tunnel_claimed = time_now();
+	xfer->tunneled = 0;
+	
+	pool->claims++;
+	
+	while((fd == -1) && (tunnel = collection_match(pool->tunnels, (collection_f)tunnel_ready_matcher, NULL))) {
+		if(tunnel_alive(tunnel)) {
+			/* the xfer now owns the socket */
+			fd = tunnel->fd;
+			tunnel->fd = -1;
+		}
+		tunnel_destroy(tunnel);
+	}
+	
+	if(fd != -1) {
+		xfer->tunneled = 1;
+	} else {
+		fd = connect_to_ip_non_blocking(pool->ip, pool->port);
+	}
+	
+	/* replace the claimed tunnel right away */
+	tunnel_pool_fill(pool);
+	
+	return fd;
+}
+
+/* the proxy answered the xfer's query: account for the setup latency */
+static void tunnel_pool_account(struct slave_xfer *xfer) {
+	struct fsd_tunnel_pool *pool = xfer->tunnel_pool;
+	
+	if(xfer->tunneled) {
+		pool->pooled++;
+		pool->pooled_latency += timer(xfer->tunnel_claimed);
+	} else {
+		pool->direct++;
+		pool->direct_latency += timer(xfer->tunnel_claimed);
+	}
+	
+	return;
+}
+
+static void tunnel_pool_report(struct fsd_tunnel_pool *pool) {
+	
+	SLAVE_DBG("%s tunnels: %u open, %u target; %u pooled (avg " LLU " ms), %u direct (avg " LLU " ms), %u failures",
+		pool->name, collection_size(pool->tunnels), pool->target,
+		pool->pooled, pool->pooled ? (pool->pooled_latency / pool->pooled) : 0,
+		pool->direct, pool->direct ? (pool->direct_latency / pool->direct) : 0,
+		pool->failures);
+	
+	pool->pooled = 0;
+	pool->pooled_latency = 0;
+	pool->direct = 0;
+	pool->direct_latency = 0;
+	pool->failures = 0;
+	pool->reported = time_now();
+	
+	return;
+}
+
+/*
+	Resize the pool to follow the recent transfer rate: keep
+	about one interval's worth of claims ready, plus one.
+*/
+static void tunnel_pool_tick(struct fsd_tunnel_pool *pool) {
+	
+	pool->rate = ((pool->rate * 3) + (pool->claims << 4)) / 4;
+	pool->claims = 0;
+	
+	pool->target = ((pool->rate + 15) >> 4) + 1;
+	if(pool->target > tunnel_pool_max) {
+		pool->target = tunnel_pool_max;
+	}
+	
+	collection_iterate(pool->tunnels, (collection_f)tunnel_expire_callback, NULL);
+	tunnel_pool_fill(pool);
+	
+	if(timer(pool->reported) >= SLAVE_TUNNEL_STATS_INTERVAL) {
+		tunnel_pool_report(pool);
+	}
+	
+	wheel_schedule(&pool->timer, time_now() + SLAVE_TUNNEL_INTERVAL);
+	
+	return;
+}
+
+static void tunnel_pool_init(struct fsd_tunnel_pool *pool, const char *name, unsigned int ip, unsigned short port) {
+	
+	pool->name = name;
+	pool->ip = ip;
+	pool->port = port;
+	
+	pool->tunnels = collection_new(C_CASCADE);
+	pool->group = collection_new(C_CASCADE);
+	
+	pool->target = tunnel_pool_max ? 1 : 0;
+	pool->rate = 0;
+	pool->claims = 0;
+	
+	pool->pooled = 0;
+	pool->pooled_latency = 0;
+	pool->direct = 0;
+	pool->direct_latency = 0;
+	pool->failures = 0;
+	pool->reported = time_now();
+	
+	tunnel_pool_fill(pool);
+	
+	wheel_timer_init(&pool->timer, (wheel_f)tunnel_pool_tick, pool);
+	wheel_schedule(&pool->timer, time_now() + SLAVE_TUNNEL_INTERVAL);
+	
+	return;
+}
+
 static void delete_xfer(struct slave_xfer *xfer, int error);
+
+/* stop reading back the current file */
+static void scrub_close() {
+
+	if(scrub.stream) {
+		fclose(scrub.stream);
+		scrub.stream = NULL;
+	}
+	scrub.file = NULL;
+
+	return;
+}
+
+/* the checksum of that file is known, no need to read it back */
+static void scrub_known(struct file_map *file, unsigned int checksum) {
+
+	if(scrub.file == file) {
+		scrub_close();
+	}
+
+	file->checksum = checksum;
+	if(collection_find(scrub_pending, file)) {
+		collection_delete(scrub_pending, file);
+	}
+
+	return;
+}
+
+/* one less user of the open file, close it when it was the last one */
+static void file_map_io_release(struct file_map *file) {
+	
+	if(!file->io.refcount) {
+		SLAVE_DBG("ERROR: file is referenced but refcount is null");
+		return;
+	}
+	
+	file->io.refcount--;
+	if(file->io.refcount) {
+		return;
+	}
+	
+	SLAVE_DBG("File %s is no longer in use", file->name);
+	
+	if(file->io.adio) {
+		adio_close(file->io.adio);
+		file->io.adio = NULL;
+	} else {
+		SLAVE_DBG("ERROR: no file's adio!");
+	}
+	
+	return;
+}
+
+static void block_obj_destroy(struct fsd_block *block) {
+	
+	collectible_destroy(block);
+	
+	if(block->op) {
+		adio_complete(block->op);
+		block->op = NULL;
+		file_map_io_release(block->file);
+	}
+	
+	fsd_cache_used -= block->length;
+	
+	free(block->data);
+	block->data = NULL;
+	block->file = NULL;
+	free(block);
+	
+	return;
+}
+
+/* check how much of the block is read, return 0 if the read failed */
+static int block_probe(struct fsd_block *block) {
+	unsigned int done = 0;
+	int success;
+	
+	if(!block->op) {
+		return !block->failed;
+	}
+	
+	/* the block is packed, the count is read on the stack */
+	success = adio_probe(block->op, &done);
+	if(success != -1) {
+		block->done = done;
+	}
+	if(!success) {
+		return 1;
+	}
+	
+	if((success == 1) && (block->done != block->length)) {
+		SLAVE_DBG("Short read on %s at " LLU ": %u bytes on %u", block->file->name, block->offset, block->done, block->length);
+		success = -1;
+	} else if(success == -1) {
+		SLAVE_DBG("Read error on %s at " LLU, block->file->name, block->offset);
+	}
+	
+	/* the read is over, it no longer needs the file */
+	adio_complete(block->op);
+	block->op = NULL;
+	collection_delete(blocks_reading, block);
+	file_map_io_release(block->file);
+	
+	if(success == -1) {
+		block->failed = 1;
+		return 0;
+	}
+	
+	return 1;
+}
+
+/* used by block_poll */
+static int block_poll_callback(struct collection *c, struct fsd_block *block, void *param) {
+	
+	if(!block_probe(block) && !block->users) {
+		obj_destroy(&block->o);
+	}
+	
+	return 1;
+}
+
+/* complete the reads nobody is waiting for, mostly the read ahead */
+static int block_poll() {
+	
+	collection_iterate(blocks_reading, (collection_f)block_poll_callback, NULL);
+	
+	return 1;
+}
+
+/* used by block_evict */
+static int block_evict_callback(struct collection *c, struct fsd_block *block, unsigned int *length) {
+	
+	if((fsd_cache_used + *length) <= fsd_cache_size) {
+		return 0;
+	}
+	
+	if(!block->users) {
+		obj_destroy(&block->o);
+	}
+	
+	return 1;
+}
+
+/* drop the least recently used blocks until 'length' more bytes
+	fit in the cache, return 0 if the blocks in use do not leave
+	enough room */
+static int block_evict(unsigned int length) {
+	
+	if((fsd_cache_used + length) <= fsd_cache_size) {
+		return 1;
+	}
+	
+	collection_iterate(blocks_collection, (collection_f)block_evict_callback, &length);
+	
+	return ((fsd_cache_used + length) <= fsd_cache_size);
+}
+
+/* used by block_lookup */
+static int block_lookup_callback(struct collection *c, struct fsd_block *block, unsigned long long int *offset) {
+	
+	return ((block->offset == *offset) && !block->failed);
+}
+
+/* return the cached block of the file at 'offset' */
+static struct fsd_block *block_lookup(struct file_map *file, unsigned long long int offset) {
+	
+	return collection_match(file->blocks, (collection_f)block_lookup_callback, &offset);
+}
+
+/* start reading the block of the file at 'offset'. the file must
+	be open for download. a read ahead is not done when the cache
+	is full, a block needed right now is read anyway. */
+static struct fsd_block *block_new(struct file_map *file, unsigned long long int offset, int readahead) {
+	struct fsd_block *block;
+	unsigned int length;
+	
+	if(offset >= file->size) {
+		return NULL;
+	}
+	
+	length = ((file->size - offset) > SLAVE_CACHE_BLOCK_SIZE) ? SLAVE_CACHE_BLOCK_SIZE : (file->size - offset);
+	
+	if(!block_evict(length) && readahead) {
+		return NULL;
+	}
+	
+	block = malloc(sizeof(struct fsd_block));
+	if(!block) {
+		SLAVE_DBG("Memory error");
+		return NULL;
+	}
+	
+	block->data = malloc(length);
+	if(!block->data) {
+		SLAVE_DBG("Memory error");
+		free(block);
+		return NULL;
+	}
+	
+	obj_init(&block->o, block, (obj_f)block_obj_destroy);
+	collectible_init(block);
+	
+	block->file = file;
+	block->offset = offset;
+	block->length = length;
+	block->done = 0;
+	block->failed = 0;
+	block->users = 0;
+	
+	block->op = adio_read(file->io.adio, block->data, offset, length, NULL);
+	if(!block->op) {
+		SLAVE_DBG("Could not create asynchronous operation!");
+		free(block->data);
+		free(block);
+		return NULL;
+	}
+	
+	/* the read keeps the file open */
+	file->io.refcount++;
+	fsd_cache_used += length;
+	
+	if(!collection_add(blocks_collection, block) ||
+		!collection_add(file->blocks, block) ||
+		!collection_add(blocks_reading, block)) {
+		SLAVE_DBG("Collection error");
+		obj_destroy(&block->o);
+		return NULL;
+	}
+	
+	return block;
+}
+
+/* used by file_map_drop_blocks */
+static int file_map_block_drop_callback(struct collection *c, struct fsd_block *block, void *param) {
+	
+	if(block->users) {
+		/* kept by the downloads sending from it, nobody else will find it */
+		collection_delete(c, block);
+	} else {
+		obj_destroy(&block->o);
+	}
+	
+	return 1;
+}
+
+/* forget the cached blocks of a file that changed on disk */
+static void file_map_drop_blocks(struct file_map *file) {
+	
+	if(!collection_size(file->blocks)) {
+		return;
+	}
+	
+	SLAVE_DBG("File %s changed on disk, dropping its cached blocks", file->name);
+	
+	collection_iterate(file->blocks, (collection_f)file_map_block_drop_callback, NULL);
+	
+	return;
+}
+
+/* read the blocks that follow 'offset' before they are needed. the
+	other downloads find the blocks of the leading one in the cache,
+	so the read ahead only ever happens in front of the leader. */
+static void block_readahead(struct file_map *file, unsigned long long int offset) {
+	unsigned int i;
+	
+	for(i=0;i<fsd_cache_readahead;i++) {
+		offset += SLAVE_CACHE_BLOCK_SIZE;
+		if(offset >= file->size) {
+			break;
+		}
+		
+		if(block_lookup(file, offset)) {
+			continue;
+		}
+		
+		if(!block_new(file, offset, 1)) {
+			break;
+		}
+	}
+	
+	return;
+}
+
+/* used by file_map_obj_destroy */
+static int file_map_block_detach_callback(struct collection *c, struct fsd_block *block, void *param) {
+	
+	if(block->op) {
+		adio_complete(block->op);
+		block->op = NULL;
+		collection_delete(blocks_reading, block);
+		file_map_io_release(block->file);
+	}
+	
+	/* in case a download still holds it */
+	block->failed = 1;
+	block->file = NULL;
+	
+	return 1;
+}
 	
 static void file_map_obj_destroy(struct file_map *file) {
 	
 	collectible_destroy(file);
 	
+	if(scrub.file == file) {
+		scrub_close();
+	}
+	
 	/* delete all xfers from that file */
 	if(file->xfers) {
 		while(collection_size(file->xfers)) {
@@ -172,6 +781,12 @@ static void file_map_obj_destroy(struct file_map *file) {
 		collection_destroy(file->xfers);
 		file->xfers = NULL;
 	}
+	
+	if(file->blocks) {
+		collection_iterate(file->blocks, (collection_f)file_map_block_detach_callback, NULL);
+		collection_destroy(file->blocks);
+		file->blocks = NULL;
+	}
 
 	if(file->sfv) {
 		file->sfv->file = NULL;
@@ -206,12 +821,14 @@ static struct file_map *file_map_add(struct disk_map *disk, const char *name) {
 	strcpy(file->name, name);
 
 	file->xfers = collection_new(C_CASCADE);
+	file->blocks = collection_new(C_CASCADE);
 
 	/* verify that we can access the file both way */
 	full_name = malloc(strlen(disk->path) + strlen(name) + 1);
 	if(!full_name) {
 		SLAVE_DBG("Memory error");
 		collection_destroy(file->xfers);
+		collection_destroy(file->blocks);
 		free(file);
 		return NULL;
 	}
@@ -220,6 +837,7 @@ static struct file_map *file_map_add(struct disk_map *disk, const char *name) {
 	if(stat(full_name, &stats) == -1) {
 		SLAVE_DBG("Error getting stats on %s", full_name);
 		collection_destroy(file->xfers);
+		collection_destroy(file->blocks);
 		free(file);
 		free(full_name);
 		return NULL;
@@ -235,6 +853,12 @@ static struct file_map *file_map_add(struct disk_map *disk, const char *name) {
 	file->io.upload = 0;
 	file->io.adio = NULL;
 
+	/* known once the upload completes or the file is read back */
+	file->checksum = 0;
+	if(!collection_add(scrub_pending, file)) {
+		SLAVE_DBG("Collection error");
+	}
+
 	return file;
 }
 
@@ -312,9 +936,9 @@ void _rmdir_recursive(char *path, char *toremove) {
 
 /* delete the file from disk,
 	close all data connections if some are open,
-	delete the parent folder if there's one & if
-	there's no more file & folder in it */
-static void file_unmap(struct file_map *file) {
+	if 'prune' is set, delete the parent folder if
+	there's one & if there's no more file & folder in it */
+static void file_unmap(struct file_map *file, int prune) {
 	char *fullname, *ptr;
 
 	if(!file) return;
@@ -331,7 +955,7 @@ static void file_unmap(struct file_map *file) {
 	}
 
 	fullname = &file->name[1];
-	ptr = strchr(fullname, '\\');
+	ptr = prune ? strchr(fullname, '\\') : NULL;
 	if(ptr) {
 		while(strchr(ptr+1, '\\')) ptr = strchr(ptr+1, '\\');
 		*ptr = 0;
@@ -651,7 +1275,7 @@ static char *build_sfv_info(struct file_map *file, unsigned int *size) {
 	unsigned int i;
 	FILE *s;
 	unsigned int crc;
-	struct sfv_entry *entry;
+	struct sfvlog_entry *entry;
 	unsigned long long int t;
 
 	t = time_now();
@@ -704,9 +1328,9 @@ static char *build_sfv_info(struct file_map *file, unsigned int *size) {
 
 		/* we've got the crc & the filename, happend it to the buffer */
 		if(!buffer) {
-			buffer = malloc(sizeof(struct sfv_entry) + strlen(line) + 1);
+			buffer = malloc(sizeof(struct sfvlog_entry) + strlen(line) + 1);
 		} else {
-			buffer = realloc(buffer, filled + (sizeof(struct sfv_entry) + strlen(line) + 1));
+			buffer = realloc(buffer, filled + (sizeof(struct sfvlog_entry) + strlen(line) + 1));
 		}
 
 		if(!buffer) {
@@ -714,13 +1338,13 @@ static char *build_sfv_info(struct file_map *file, unsigned int *size) {
 			break; /* memory error */
 		}
 
-		entry = (struct sfv_entry*)&buffer[filled];
+		entry = (struct sfvlog_entry*)&buffer[filled];
 
 		entry->crc = crc;
 		sprintf(entry->filename, line);
 
 		/* move to next entry */
-		filled += (sizeof(struct sfv_entry) + strlen(line) + 1);
+		filled += (sizeof(struct sfvlog_entry) + strlen(line) + 1);
 	}
 
 	fclose(s);
@@ -873,75 +1497,326 @@ static unsigned int process_slave_sfvlog(struct io_context *io, struct packet *p
 		
 		input_current += strlen(filename)+1;
 	}
-	
-	if(!enqueue_packet(p->uid, IO_SFVLOG, buffer, filled)) {
-		SLAVE_DBG("" LLU ": Enqueue packet failed.", p->uid);
-		free(buffer);
+	
+	if(!enqueue_packet(p->uid, IO_SFVLOG, buffer, filled)) {
+		SLAVE_DBG("" LLU ": Enqueue packet failed.", p->uid);
+		free(buffer);
+		return 0;
+	}
+	free(buffer);
+
+	SLAVE_DBG("" LLU ": SFVLOG response build (%u bytes, %u files, %u entries)", p->uid, filled, total_sfv, total_entries);
+
+	return 1;
+}
+
+/* used by process_hello */
+static unsigned int make_stats_diskspace(struct collection *c, struct disk_map *disk, struct stats_global *gstats) {
+#ifdef WIN32
+	struct _diskfree_t driveinfo;
+	unsigned int drive = 0;
+	
+	if((disk->path[0] >= 'a') && (disk->path[0] <= 'z')) drive = disk->path[0] - 'a'+1;
+	if((disk->path[0] >= 'A') && (disk->path[0] <= 'Z')) drive = disk->path[0] - 'A'+1;
+	if(!drive) return 1;
+
+	if(_getdiskfree(drive, &driveinfo)) {
+		SLAVE_DBG("Cannot get disk infos for drive: %c", disk->path[0]);
+		return 1;
+	}
+	
+	/* update the local diskfree and disktotal all along */
+	disk->diskfree = (unsigned long long int)(
+						(unsigned long long int)driveinfo.avail_clusters *
+						(unsigned long long int)driveinfo.sectors_per_cluster *
+						(unsigned long long int)driveinfo.bytes_per_sector);
+	disk->disktotal = (unsigned long long int)(
+						(unsigned long long int)driveinfo.total_clusters *
+						(unsigned long long int)driveinfo.sectors_per_cluster *
+						(unsigned long long int)driveinfo.bytes_per_sector);
+#else
+  struct statvfs driveinfo;
+  
+	if(statvfs(disk->path, &driveinfo)) {
+		SLAVE_DBG("Cannot get disk infos for drive: %s", disk->path);
+		return 1;
+	}
+	
+	disk->diskfree = (unsigned long long int)(
+	          (unsigned long long int)driveinfo.f_bfree *
+	          (unsigned long long int)driveinfo.f_bsize);
+	disk->disktotal = (unsigned long long int)(
+	          (unsigned long long int)driveinfo.f_blocks *
+	          (unsigned long long int)driveinfo.f_frsize);
+#endif
+  
+	gstats->diskfree += disk->diskfree;
+	gstats->disktotal += disk->disktotal;
+  
+	return 1;
+}
+
+static unsigned int make_stats_xfers(struct collection *c, struct slave_xfer *xfer, void *param) {
+	struct {
+		unsigned int i;
+		struct stats_xfer *xstats;
+	} *ctx = param;
+
+	ctx->xstats[ctx->i].uid = xfer->uid;
+	ctx->xstats[ctx->i].xfered = xfer->xfered;
+
+	ctx->i++;
+
+	return 1;
+}
+
+static unsigned int make_progress_xfers(struct collection *c, struct slave_xfer *xfer, void *param) {
+	struct {
+		unsigned int i;
+		struct stats_xfer *xstats;
+	} *ctx = param;
+
+	if(xfer->xfered == xfer->reported) {
+		return 1;
+	}
+
+	ctx->xstats[ctx->i].uid = xfer->uid;
+	ctx->xstats[ctx->i].xfered = xfer->xfered;
+	xfer->reported = xfer->xfered;
+
+	ctx->i++;
+
+	return 1;
+}
+
+/* push the progress of the transfers that moved since the last time */
+static void push_progress(void *param) {
+	struct {
+		unsigned int i;
+		struct stats_xfer *xstats;
+	} ctx = { 0, NULL };
+
+	wheel_schedule(&fsd_progress_timer, time_now() + fsd_progress_interval);
+
+	if(!main_ctx.connected || !collection_size(xfers_collection)) {
+		return;
+	}
+
+	ctx.xstats = malloc(collection_size(xfers_collection) * sizeof(struct stats_xfer));
+	if(!ctx.xstats) {
+		SLAVE_DBG("Memory error");
+		return;
+	}
+
+	collection_iterate(xfers_collection, (collection_f)make_progress_xfers, &ctx);
+
+	if(ctx.i) {
+		/* nothing to match on the master's side */
+		if(!enqueue_packet(0, IO_PROGRESS, ctx.xstats, ctx.i * sizeof(struct stats_xfer))) {
+			SLAVE_DBG("Could not enqueue the progress packet");
+		}
+	}
+	free(ctx.xstats);
+
+	return;
+}
+
+/* used by scrub_disk_busy */
+static unsigned int scrub_xfer_on_disk(struct collection *c, struct slave_xfer *xfer, struct disk_map *disk) {
+
+	return (xfer->file && (xfer->file->disk == disk));
+}
+
+/* nonzero if some transfer is using that disk */
+static int scrub_disk_busy(struct disk_map *disk) {
+
+	return (collection_match(xfers_collection, (collection_f)scrub_xfer_on_disk, disk) != NULL);
+}
+
+/* start reading back the next file of unknown checksum.
+	return 0 if there is none we can read right now */
+static int scrub_open() {
+	struct file_map *file;
+	char *fullname;
+
+	file = collection_first(scrub_pending);
+	if(!file) {
+		return 0;
+	}
+
+	if(file->io.refcount || scrub_disk_busy(file->disk)) {
+		/* give the next one a chance on the next tick */
+		collection_movelast(scrub_pending, file);
+		return 0;
+	}
+
+	fullname = malloc(strlen(file->disk->path) + strlen(file->name) + 1);
+	if(!fullname) {
+		SLAVE_DBG("Memory error");
 		return 0;
 	}
-	free(buffer);
+	sprintf(fullname, "%s%s", file->disk->path, &file->name[1]);
 
-	SLAVE_DBG("" LLU ": SFVLOG response build (%u bytes, %u files, %u entries)", p->uid, filled, total_sfv, total_entries);
+	scrub.stream = fopen(fullname, "rb");
+	if(!scrub.stream) {
+		SLAVE_DBG("Could not open %s to compute its checksum", fullname);
+		free(fullname);
+		collection_delete(scrub_pending, file);
+		return 0;
+	}
+	free(fullname);
+
+	/* we read in large chunks already */
+	setvbuf(scrub.stream, NULL, _IONBF, 0);
+
+#ifdef POSIX_FADV_NOREUSE
+	/* each block is read only once, keep the page cache for the transfers */
+	posix_fadvise(fileno(scrub.stream), 0, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fileno(scrub.stream), 0, 0, POSIX_FADV_NOREUSE);
+#endif
+
+	scrub.file = file;
+	scrub.offset = 0;
+	crc32_init(&scrub.checksum);
 
 	return 1;
 }
 
-/* used by process_hello */
-static unsigned int make_stats_diskspace(struct collection *c, struct disk_map *disk, struct stats_global *gstats) {
-#ifdef WIN32
-	struct _diskfree_t driveinfo;
-	unsigned int drive = 0;
-	
-	if((disk->path[0] >= 'a') && (disk->path[0] <= 'z')) drive = disk->path[0] - 'a'+1;
-	if((disk->path[0] >= 'A') && (disk->path[0] <= 'Z')) drive = disk->path[0] - 'A'+1;
-	if(!drive) return 1;
+/* used by scrub_report_push */
+static unsigned int scrub_report_entry(struct collection *c, struct file_map *file, void *param) {
+	struct {
+		char *buffer;
+		unsigned int offset;
+	} *ctx = param;
+	struct slave_checksum_entry *entry;
+	unsigned int entry_size = (sizeof(struct slave_checksum_entry) + strlen(file->name) + 1);
+	unsigned int i;
 
-	if(_getdiskfree(drive, &driveinfo)) {
-		SLAVE_DBG("Cannot get disk infos for drive: %c", disk->path[0]);
-		return 1;
+	if((ctx->offset + entry_size) > SLAVE_SCRUB_BATCH_SIZE) {
+		/* next time */
+		return 0;
 	}
-	
-	/* update the local diskfree and disktotal all along */
-	disk->diskfree = (unsigned long long int)(
-						(unsigned long long int)driveinfo.avail_clusters *
-						(unsigned long long int)driveinfo.sectors_per_cluster *
-						(unsigned long long int)driveinfo.bytes_per_sector);
-	disk->disktotal = (unsigned long long int)(
-						(unsigned long long int)driveinfo.total_clusters *
-						(unsigned long long int)driveinfo.sectors_per_cluster *
-						(unsigned long long int)driveinfo.bytes_per_sector);
-#else
-  struct statvfs driveinfo;
-  
-	if(statvfs(disk->path, &driveinfo)) {
-		SLAVE_DBG("Cannot get disk infos for drive: %s", disk->path);
-		return 1;
-	}
-	
-	disk->diskfree = (unsigned long long int)(
-	          (unsigned long long int)driveinfo.f_bfree *
-	          (unsigned long long int)driveinfo.f_bsize);
-	disk->disktotal = (unsigned long long int)(
-	          (unsigned long long int)driveinfo.f_blocks *
-	          (unsigned long long int)driveinfo.f_frsize);
-#endif
-  
-	gstats->diskfree += disk->diskfree;
-	gstats->disktotal += disk->disktotal;
-  
+
+	entry = (struct slave_checksum_entry *)&ctx->buffer[ctx->offset];
+	ctx->offset += entry_size;
+
+	entry->entry_size = entry_size;
+	entry->checksum = file->checksum;
+	strcpy(entry->name, file->name);
+	for(i=0;i<strlen(entry->name);i++) if(entry->name[i] == '\\') entry->name[i] = '/';
+
+	collection_delete(c, file);
+
 	return 1;
 }
 
-static unsigned int make_stats_xfers(struct collection *c, struct slave_xfer *xfer, void *param) {
+/* send a batch of the checksums found since the last time */
+static void scrub_report_push() {
 	struct {
-		unsigned int i;
-		struct stats_xfer *xstats;
-	} *ctx = param;
+		char *buffer;
+		unsigned int offset;
+	} ctx = { NULL, 0 };
 
-	ctx->xstats[ctx->i].uid = xfer->uid;
-	ctx->xstats[ctx->i].xfered = xfer->xfered;
+	if(!main_ctx.connected || !scrub_master_ready || !collection_size(scrub_report)) {
+		return;
+	}
 
-	ctx->i++;
+	ctx.buffer = malloc(SLAVE_SCRUB_BATCH_SIZE);
+	if(!ctx.buffer) {
+		SLAVE_DBG("Memory error");
+		return;
+	}
+
+	collection_iterate(scrub_report, (collection_f)scrub_report_entry, &ctx);
+
+	if(ctx.offset) {
+		/* nothing to match on the master's side */
+		if(!enqueue_packet(0, IO_CHECKSUMS, ctx.buffer, ctx.offset)) {
+			SLAVE_DBG("Could not enqueue the checksums packet");
+		}
+	}
+	free(ctx.buffer);
+
+	return;
+}
+
+/*
+	read back the files of unknown checksum, at most
+	fsd_scrub_rate bytes per second and only while
+	no transfer is using the file's disk.
+*/
+static void scrub_tick(void *param) {
+	struct file_map *file;
+	unsigned int quota, length;
+	size_t done;
+
+	wheel_schedule(&fsd_scrub_timer, time_now() + SLAVE_SCRUB_INTERVAL);
+
+	scrub_report_push();
+
+	quota = (unsigned int)(((unsigned long long int)fsd_scrub_rate * SLAVE_SCRUB_INTERVAL) / 1000);
+
+	while(quota) {
+		if(!scrub.file && !scrub_open()) {
+			break;
+		}
+		file = scrub.file;
+
+		if(file->io.refcount || scrub_disk_busy(file->disk)) {
+			/* resume when the disk is idle */
+			break;
+		}
+
+		length = ((quota > SLAVE_SCRUB_CHUNK_SIZE) ? SLAVE_SCRUB_CHUNK_SIZE : quota);
+		done = fread(scrub.buffer, 1, length, scrub.stream);
+		if(done) {
+			crc32_add(&scrub.checksum, scrub.buffer, done);
+#ifdef POSIX_FADV_DONTNEED
+			/* NOREUSE is a no-op on most kernels */
+			posix_fadvise(fileno(scrub.stream), scrub.offset, done, POSIX_FADV_DONTNEED);
+#endif
+			scrub.offset += done;
+			quota -= done;
+		}
+
+		if(done < length) {
+			if(ferror(scrub.stream)) {
+				SLAVE_DBG("Error reading %s after " LLU " bytes, checksum left unknown", file->name, scrub.offset);
+				scrub_close();
+				collection_delete(scrub_pending, file);
+				continue;
+			}
+
+			/* end of file */
+			crc32_close(&scrub.checksum);
+			scrub_known(file, scrub.checksum);
+
+			SLAVE_DBG("Checksum of %s is %08x (" LLU " bytes)", file->name, file->checksum, scrub.offset);
+
+			if(!collection_add(scrub_report, file)) {
+				SLAVE_DBG("Collection error");
+			}
+		}
+	}
+
+	return;
+}
+
+/* used by scrub_report_all */
+static unsigned int scrub_report_file(struct collection *c, struct file_map *file, void *param) {
+
+	if(file->checksum && !collection_add(scrub_report, file)) {
+		SLAVE_DBG("Collection error");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* used by process_slave_stats */
+static unsigned int scrub_report_all(struct collection *c, struct disk_map *disk, void *param) {
+
+	collection_iterate(disk->files_collection, (collection_f)scrub_report_file, param);
 
 	return 1;
 }
@@ -981,6 +1856,17 @@ static unsigned int process_slave_stats(struct io_context *io, struct packet *p)
 	}
 	free(buffer);
 
+	if(fsd_scrub_rate && !scrub_master_ready) {
+		/*
+			the master only polls the slaves that are done sending
+			their file list: from now on it can match our checksums
+			to its files. send all of them, it may not have them yet.
+		*/
+		scrub_master_ready = 1;
+		collection_empty(scrub_report);
+		collection_iterate(mapped_disks, (collection_f)scrub_report_all, NULL);
+	}
+
 	return 1;
 }
 
@@ -1135,21 +2021,278 @@ static unsigned int process_public_key(struct io_context *io, struct packet *p)
 		return 0;
 	}
 
-	if(!enqueue_packet(p->uid, IO_PUBLIC_KEY, data, length)) {
-		free(data);
-		return 0;
+	if(!enqueue_packet(p->uid, IO_PUBLIC_KEY, data, length)) {
+		free(data);
+		return 0;
+	}
+	free(data);
+
+	SLAVE_DIALOG_DBG("" LLU ": Public key repsponse sent", p->uid);
+
+	return 1;
+}
+
+static void tee_obj_destroy(struct fsd_tee *tee) {
+	
+	collectible_destroy(tee);
+	
+	if(tee->group) {
+		signal_clear(tee->group);
+		collection_destroy(tee->group);
+		tee->group = NULL;
+	}
+	
+	if(tee->fd != -1) {
+		socket_monitor_fd_closed(tee->fd);
+		close_socket(tee->fd);
+		tee->fd = -1;
+	}
+	
+	if(tee->backlog) {
+		free(tee->backlog);
+		tee->backlog = NULL;
+	}
+	
+	free(tee);
+	
+	return;
+}
+
+/*
+	Drop the connection with a reset so the peer fails its
+	upload instead of keeping a truncated copy. close_socket()
+	would shut the connection down gracefully first.
+*/
+static void tee_abort(struct fsd_tee *tee) {
+	struct linger l;
+	
+	if(tee->fd != -1) {
+		l.l_onoff = 1;
+		l.l_linger = 0;
+		setsockopt(tee->fd, SOL_SOCKET, SO_LINGER, (void *)&l, sizeof(l));
+		
+		signal_clear(tee->group);
+		socket_monitor_fd_closed(tee->fd);
+		closesocket(tee->fd);
+		tee->fd = -1;
+	}
+	
+	obj_destroy(&tee->o);
+	
+	return;
+}
+
+/* send as much of the backlog as the socket takes */
+static int tee_write(int fd, struct fsd_tee *tee) {
+	int flags = 0;
+	int size;
+	
+#ifndef WIN32
+	flags |= MSG_DONTWAIT;
+#endif
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	
+	if(tee->length) {
+		size = send(tee->fd, &tee->backlog[tee->head], tee->length, flags);
+		if(size == SOCKET_ERROR) {
+			if(WSAGetLastError() == EWOULDBLOCK) {
+				return 1;
+			}
+			SLAVE_DBG("" LLU ": Replica connection failed while sending.", tee->uid);
+			tee_abort(tee);
+			return 1;
+		}
+		
+		tee->head += size;
+		tee->length -= size;
+		
+		/* move the rest to the front only once it is smaller
+			than what was sent since the last move */
+		if(!tee->length) {
+			tee->head = 0;
+		} else if(tee->head > (tee->size / 2)) {
+			memmove(tee->backlog, &tee->backlog[tee->head], tee->length);
+			tee->head = 0;
+		}
+	}
+	
+	if(!tee->length && tee->closing) {
+		/* the peer completes its copy when it sees the closure */
+		SLAVE_DBG("" LLU ": Replica fully sent.", tee->uid);
+		obj_destroy(&tee->o);
+	}
+	
+	return 1;
+}
+
+static int tee_connect(int fd, struct fsd_tee *tee) {
+	
+	SLAVE_DBG("" LLU ": Replica connection established.", tee->uid);
+	
+	signal_clear_with_filter(tee->group, "socket-connect", (void *)fd);
+	socket_monitor_signal_add(tee->fd, tee->group, "socket-write", (signal_f)tee_write, tee);
+	
+	tee->connected = 1;
+	
+	return 1;
+}
+
+static int tee_error(int fd, struct fsd_tee *tee) {
+	
+	SLAVE_DBG("" LLU ": Replica connection failed.", tee->uid);
+	
+	/* the upload goes on without this replica */
+	tee_abort(tee);
+	
+	return 1;
+}
+
+static int tee_connect_timeout(struct fsd_tee *tee) {
+	
+	SLAVE_DBG("" LLU ": Replica connect timeout.", tee->uid);
+	tee_abort(tee);
+	
+	return 1;
+}
+
+/* queue a copy of the data received for the upload to each of its replicas */
+static int xfer_tee_data_callback(struct collection *c, struct fsd_tee *tee, void *param) {
+	struct {
+		char *buffer;
+		unsigned int size;
+	} *ctx = param;
+	unsigned int size;
+	char *ptr;
+	
+	if((tee->head + tee->length + ctx->size) > tee->size) {
+		/* double it so a lagging replica does not realloc on every read */
+		size = (tee->head + tee->length + ctx->size) * 2;
+		ptr = realloc(tee->backlog, size);
+		if(!ptr) {
+			SLAVE_DBG("" LLU ": Memory error, dropping the replica.", tee->uid);
+			tee_abort(tee);
+			return 1;
+		}
+		tee->backlog = ptr;
+		tee->size = size;
+	}
+	
+	memcpy(&tee->backlog[tee->head + tee->length], ctx->buffer, ctx->size);
+	tee->length += ctx->size;
+	
+	return 1;
+}
+
+static void xfer_tee_data(struct slave_xfer *xfer, char *buffer, unsigned int size) {
+	struct {
+		char *buffer;
+		unsigned int size;
+	} ctx = { buffer, size };
+	
+	collection_iterate(xfer->tees, (collection_f)xfer_tee_data_callback, &ctx);
+	
+	return;
+}
+
+static int xfer_tee_backlog_callback(struct collection *c, struct fsd_tee *tee, unsigned int *length) {
+	
+	if(tee->length > *length) {
+		*length = tee->length;
+	}
+	
+	return 1;
+}
+
+/* nonzero while the upload must not read from the client, so the replicas keep up */
+static int xfer_tee_wait(struct slave_xfer *xfer) {
+	unsigned int length = 0;
+	
+	if(xfer->tees_expected) {
+		if(time_now() < xfer->tees_deadline) {
+			return 1;
+		}
+		SLAVE_DBG("" LLU ": %u replica(s) never came, going on without them.", xfer->uid, xfer->tees_expected);
+		xfer->tees_expected = 0;
+	}
+	
+	collection_iterate(xfer->tees, (collection_f)xfer_tee_backlog_callback, &length);
+	
+	return (length > SLAVE_TEE_BACKLOG);
+}
+
+/* the upload is complete, the replicas are closed once they got everything */
+static int xfer_tee_release_callback(struct collection *c, struct fsd_tee *tee, void *param) {
+	
+	tee->closing = 1;
+	collection_delete(c, tee);
+	
+	if(tee->connected) {
+		tee_write(tee->fd, tee);
+	}
+	
+	return 1;
+}
+
+static int xfer_tee_abort_callback(struct collection *c, struct fsd_tee *tee, void *param) {
+	
+	tee_abort(tee);
+	
+	return 1;
+}
+
+/* hold the block the download is in, reading it if it is not cached */
+static int xfer_block_hold(struct slave_xfer *xfer) {
+	struct fsd_block *block;
+	unsigned long long int offset;
+	
+	offset = xfer->restart - (xfer->restart % SLAVE_CACHE_BLOCK_SIZE);
+	
+	block = block_lookup(xfer->file, offset);
+	if(!block) {
+		block = block_new(xfer->file, offset, 0);
+		if(!block) {
+			return 0;
+		}
+	}
+	
+	collection_movelast(blocks_collection, block);
+	obj_ref(&block->o);
+	block->users++;
+	xfer->block = block;
+	
+	block_readahead(xfer->file, offset);
+	
+	return 1;
+}
+
+/* the download is done with its block, it may be dropped from now on */
+static void xfer_block_release(struct slave_xfer *xfer) {
+	struct fsd_block *block = xfer->block;
+	
+	if(!block) {
+		return;
 	}
-	free(data);
-
-	SLAVE_DIALOG_DBG("" LLU ": Public key repsponse sent", p->uid);
-
-	return 1;
+	
+	xfer->block = NULL;
+	block->users--;
+	obj_unref(&block->o);
+	
+	return;
 }
 
 static void xfer_obj_destroy(struct slave_xfer *xfer) {
 	
 	collectible_destroy(xfer);
 	
+	if(xfer->tees) {
+		/* the upload did not complete, neither will the replicas */
+		collection_iterate(xfer->tees, (collection_f)xfer_tee_abort_callback, NULL);
+		collection_destroy(xfer->tees);
+		xfer->tees = NULL;
+	}
+	
 	secure_destroy(&xfer->secure);
 	
 	if(xfer->group) {
@@ -1183,31 +2326,11 @@ static void xfer_obj_destroy(struct slave_xfer *xfer) {
 		adio_complete(xfer->op);
 		xfer->op = NULL;
 	}
+	
+	xfer_block_release(xfer);
 
 	if(xfer->file) {
-		if(xfer->file->io.refcount) {
-			xfer->file->io.refcount--;
-			
-			if(!xfer->file->io.refcount) {
-				/* no more downloads on that file, close it */
-				
-				SLAVE_DBG("File %s is no longer in use", xfer->file->name);
-				
-				/*if(xfer->file->io.stream != -1) {
-					_close(xfer->file->io.stream);
-					xfer->file->io.stream = -1;
-				}*/
-				
-				if(xfer->file->io.adio) {
-					adio_close(xfer->file->io.adio);
-					xfer->file->io.adio = NULL;
-				} else {
-					SLAVE_DBG("ERROR: no file's adio!");
-				}
-			}
-		} else {
-			SLAVE_DBG("ERROR: file is referenced but refcount is null");
-		}
+		file_map_io_release(xfer->file);
 
 		//collection_delete(xfer->file->xfers, xfer);
 		xfer->file = NULL;
@@ -1245,7 +2368,7 @@ static void delete_xfer(struct slave_xfer *xfer, int error) {
 	if(upload && file && fsd_delete_incomplete_uploads) {
 		/* client was uploding, we shall remove the file */
 		SLAVE_DBG("Deleting file %s from disk because file was being uploaded.", file->name);
-		file_unmap(file);
+		file_unmap(file, 1);
 	}
 
 	/* send FAILURE to master */
@@ -1287,8 +2410,17 @@ static void complete_xfer(struct slave_xfer *xfer) {
 	crc32_close(&xfer->checksum);
 	data.checksum = xfer->checksum;
 
+	if(xfer->file && xfer->upload) {
+		/* uploads never resume, so the whole file went
+			through the checksum: the master gets it with the reply */
+		scrub_known(xfer->file, xfer->checksum);
+	}
+
 	SLAVE_DBG("" LLU ": Transfer complete: " LLU " bytes transfered, checksum is %08x (time: " LLU ")",
 			xfer->uid, xfer->xfered, xfer->checksum, time_now());
+	
+	/* the replicas complete when they got the rest of the data */
+	collection_iterate(xfer->tees, (collection_f)xfer_tee_release_callback, NULL);
 
 	if(xfer->asynch_uid != -1) {
 		/* send TRASNFERED to the master */
@@ -1361,6 +2493,7 @@ int xfer_resume_recv(int fd, struct slave_xfer *xfer) {
 	
 	/* Update the checksum */
 	crc32_add(&xfer->checksum, xfer->secure_resume_buf, size);
+	xfer_tee_data(xfer, xfer->secure_resume_buf, size);
 	
 	/* Update the operation pointer. */
 	xfer->op_pointer += size;
@@ -1448,6 +2581,10 @@ int xfer_read(int fd, struct slave_xfer *xfer) {
 		
 		xfer->proxy_connected = 1;
 		
+		if(xfer->tunnel_pool) {
+			tunnel_pool_account(xfer);
+		}
+		
 		return 1;
 	}
 	
@@ -1528,6 +2665,11 @@ int xfer_read(int fd, struct slave_xfer *xfer) {
 		}
 	}
 	
+	if(xfer_tee_wait(xfer)) {
+		/* the replicas are not connected yet, or they are behind */
+		return 1;
+	}
+	
 	/* Check if there's room for more data */
 	room = (xfer->buffersize - xfer->op_pointer);
 	if(!room && xfer->op_active) {
@@ -1587,6 +2729,7 @@ int xfer_read(int fd, struct slave_xfer *xfer) {
 		
 		/* Update the checksum */
 		crc32_add(&xfer->checksum, &xfer->buffer[xfer->op_pointer], size);
+		xfer_tee_data(xfer, &xfer->buffer[xfer->op_pointer], size);
 		
 		/* Update the operation pointer. */
 		xfer->op_pointer += size;
@@ -1626,6 +2769,89 @@ int xfer_read(int fd, struct slave_xfer *xfer) {
 	return 1;
 }
 
+/*
+	Send the download from the blocks it shares with the other
+	downloads of the file. xfer->restart is the position of the
+	next byte to send.
+*/
+static int xfer_write_cached(int fd, struct slave_xfer *xfer) {
+	struct fsd_block *block;
+	unsigned int pointer, rem_size, checksum;
+	int write_size;
+	int tryagain = 0;
+	
+	if(xfer->completed) {
+		return 1;
+	}
+	
+	if(xfer->restart == xfer->file->size) {
+		SLAVE_DBG("" LLU ": Transfer completed successfully. Sutting down socket. (time: " LLU ")", xfer->uid, time_now());
+		
+		make_socket_blocking(fd, 1);
+		shutdown(fd, SD_SEND);
+		
+		xfer->completed = 1;
+		
+		return 1;
+	}
+	
+	if(!xfer->block && !xfer_block_hold(xfer)) {
+		SLAVE_DBG("" LLU ": Could not read the file at " LLU, xfer->uid, xfer->restart);
+		delete_xfer(xfer, IO_ERROR_FILE_READWRITE);
+		return 0;
+	}
+	block = xfer->block;
+	
+	if(!block_probe(block)) {
+		delete_xfer(xfer, IO_ERROR_FILE_READWRITE);
+		return 1;
+	}
+	
+	pointer = (xfer->restart - block->offset);
+	if(pointer >= block->length) {
+		/* the block is shorter than the file now is */
+		SLAVE_DBG("" LLU ": Cached block at " LLU " does not hold " LLU, xfer->uid, block->offset, xfer->restart);
+		delete_xfer(xfer, IO_ERROR_FILE_READWRITE);
+		return 1;
+	}
+	if(block->done <= pointer) {
+		/* still reading */
+		return 1;
+	}
+	rem_size = (block->done - pointer);
+	
+	write_size = secure_send(&xfer->secure, &block->data[pointer], rem_size, &tryagain);
+	if(write_size == -1) {
+		if(tryagain) {
+			xfer->secure_resume_buf = &block->data[pointer];
+			xfer->secure_resume_len = rem_size;
+			return 1;
+		}
+		
+		return 0;
+	}
+	if(write_size <= 0) {
+		/* send error */
+		SLAVE_DBG("" LLU ": send() error: %u wanted, %d done (connection reset?).", xfer->uid, rem_size, write_size);
+		delete_xfer(xfer, IO_FAILURE);
+		return 1;
+	}
+	
+	checksum = xfer->checksum;
+	crc32_add(&checksum, &block->data[pointer], write_size);
+	xfer->checksum = checksum;
+	
+	xfer->restart += write_size;
+	xfer->xfered += write_size;
+	
+	if(xfer->restart == (block->offset + block->length)) {
+		/* the next block is most likely read already */
+		xfer_block_release(xfer);
+	}
+	
+	return 1;
+}
+
 int xfer_resume_send(int fd, struct slave_xfer *xfer) {
 	int write_size;
 	int tryagain = 0;
@@ -1650,7 +2876,15 @@ int xfer_resume_send(int fd, struct slave_xfer *xfer) {
 	
 	crc32_add(&xfer->checksum, xfer->secure_resume_buf, write_size);
 	
-	xfer->op_pointer += write_size;
+	if(xfer->block) {
+		/* sending from a shared block, see xfer_write_cached */
+		xfer->restart += write_size;
+		if(xfer->restart == (xfer->block->offset + xfer->block->length)) {
+			xfer_block_release(xfer);
+		}
+	} else {
+		xfer->op_pointer += write_size;
+	}
 	xfer->xfered += write_size;
 	
 	xfer->secure_resume_buf = NULL;
@@ -1710,6 +2944,10 @@ int xfer_write(int fd, struct slave_xfer *xfer) {
 		delete_xfer(xfer, IO_FAILURE);
 		return 0;
 	}
+	
+	if(!xfer->buffer) {
+		return xfer_write_cached(fd, xfer);
+	}
 
 	/*
 		The user is downloading, we need to send him stuff.
@@ -2113,6 +3351,8 @@ static unsigned int process_slave_listen(struct io_context *io, struct packet *p
 	collectible_init(xfer);
 
 	xfer->group = collection_new(C_CASCADE);
+	xfer->tees = collection_new(C_NONE);
+	xfer->tees_expected = 0;
 	xfer->fd = -1;
 	xfer->restart = 0;
 	xfer->asynch_uid = -1;
@@ -2122,6 +3362,7 @@ static unsigned int process_slave_listen(struct io_context *io, struct packet *p
 	xfer->buffer = NULL;
 	xfer->buffersize = 0;
 	xfer->buffer = NULL;
+	xfer->block = NULL;
 	xfer->op_length = 0;
 	xfer->op_done = 0;
 	xfer->op_pointer = 0;
@@ -2132,6 +3373,7 @@ static unsigned int process_slave_listen(struct io_context *io, struct packet *p
 	xfer->passive = 1;
 	xfer->timestamp = time_now();
 	xfer->xfered = 0;
+	xfer->reported = 0;
 	xfer->query = 0;
 	xfer->reply = 0;
 	xfer->upload = 0;
@@ -2147,8 +3389,10 @@ static unsigned int process_slave_listen(struct io_context *io, struct packet *p
 		return 0;
 	}
 
+	xfer->tunnel_pool = NULL;
+
 	if(use_pasv_proxy) {
-		xfer->fd = connect_to_ip_non_blocking(pasv_proxy_ip, pasv_proxy_port);
+		xfer->fd = tunnel_pool_claim(&pasv_tunnels, xfer);
 		xfer->proxy_connected = 0;
 		xfer->filledsize = 0;
 	} else {
@@ -2262,6 +3506,11 @@ static int setup_file_io(struct slave_xfer *xfer, int *error) {
 	if(stat(filename, &stats) == -1) {
 		SLAVE_DBG("" LLU ": Error getting stats on %s", xfer->uid, filename);
 	} else {
+		if((xfer->file->size != stats.st_size) ||
+			(xfer->file->timestamp != ((unsigned long long int)stats.st_mtime * 1000))) {
+			file_map_drop_blocks(xfer->file);
+		}
+		
 		xfer->file->size = stats.st_size;
 		xfer->file->timestamp = (stats.st_mtime * 1000); /* timestamp need milliseconds resolution */
 	}
@@ -2269,12 +3518,15 @@ static int setup_file_io(struct slave_xfer *xfer, int *error) {
 	if(xfer->upload) {
 		xfer->buffersize = fsd_buffer_up;
 		xfer->buffer = malloc(fsd_buffer_up);
-	} else {
+	} else if(!fsd_cache_size) {
 		xfer->buffersize = fsd_buffer_down;
 		xfer->buffer = malloc(fsd_buffer_down);
+	} else {
+		/* sent from the blocks shared with the other downloads */
+		xfer->buffersize = 0;
 	}
 	
-	if(!xfer->buffer) {
+	if(xfer->buffersize && !xfer->buffer) {
 		SLAVE_DBG("" LLU ": Memory error", xfer->uid);
 		free(filename);
 		return 0;
@@ -2310,22 +3562,24 @@ static int setup_file_io(struct slave_xfer *xfer, int *error) {
 	free(filename);
 	filename = NULL;
 	
+	if(scrub.file == xfer->file) {
+		/* the partial checksum may not match what is
+			on disk afterward, read it back from the start */
+		scrub_close();
+	}
+	
 	/* signal that we're one more */
 	xfer->file->io.refcount++;
 	
 	/* now create the asynchronous operation */
-	if(!xfer->file->io.upload) {
+	if(!xfer->file->io.upload && xfer->buffer) {
 		/* we can start reading from the file right now-- we beleive the whole file will be read. */
 		xfer->op_length = ((xfer->buffersize > xfer->file->size) ? xfer->file->size : xfer->buffersize);
 		xfer->op = adio_read(xfer->file->io.adio, xfer->buffer, xfer->restart, xfer->op_length, xfer->op);
 		
 		if(!xfer->op) {
 			SLAVE_DBG("" LLU ": Could not create asynchronous operation!", xfer->uid);
-			xfer->file->io.refcount--;
-			if(!xfer->file->io.refcount) {
-				adio_close(xfer->file->io.adio);
-				xfer->file->io.adio = NULL;
-			}
+			file_map_io_release(xfer->file);
 			
 			if(error) *error = IO_ERROR_FILE_READWRITE;
 			
@@ -2431,11 +3685,14 @@ static unsigned int process_slave_transfer(struct io_context *io, struct packet
 		xfer->ip = req->ip;
 		xfer->port = req->port;
 		xfer->group = collection_new(C_CASCADE);
+		xfer->tees = collection_new(C_NONE);
+		xfer->tees_expected = 0;
 		xfer->query = NULL;
 		xfer->reply = NULL;
+		xfer->tunnel_pool = NULL;
 		
 		if(use_data_proxy) {
-			xfer->fd = connect_to_ip_non_blocking(data_proxy_ip, data_proxy_port);
+			xfer->fd = tunnel_pool_claim(&data_tunnels, xfer);
 			xfer->proxy_connected = 0;
 			xfer->filledsize = 0;
 		}
@@ -2507,11 +3764,17 @@ static unsigned int process_slave_transfer(struct io_context *io, struct packet
 	xfer->asynch_uid = p->uid;
 	xfer->timestamp = time_now();
 	xfer->xfered = 0;
+	xfer->reported = 0;
 	xfer->file = NULL;
 	
+	/* the replicas are connected by the IO_SLAVE_TEE queries that follow */
+	xfer->tees_expected = req->upload ? req->tees : 0;
+	xfer->tees_deadline = time_now() + DATA_CONNECTION_TIMEOUT;
+	
 	xfer->op = NULL;
 	xfer->buffersize = 0;
 	xfer->buffer = NULL;
+	xfer->block = NULL;
 	xfer->op_length = 0;
 	xfer->op_done = 0;
 	xfer->op_pointer = 0;
@@ -2621,7 +3884,7 @@ static unsigned int process_slave_delete(struct io_context *io, struct packet *p
 		return 1;
 	}
 
-	file_unmap(file);
+	file_unmap(file, 1);
 
 	if(!enqueue_packet(p->uid, IO_DELETED, NULL, 0))
 		return 0;
@@ -2629,6 +3892,282 @@ static unsigned int process_slave_delete(struct io_context *io, struct packet *p
 	return 1;
 }
 
+/* one path of an IO_DELETE_BATCH */
+struct delete_batch_entry {
+	struct hash_node node;
+	unsigned int index; /* bit in the reply */
+} __attribute__((packed));
+
+/* a folder emptied by an IO_DELETE_BATCH, removed once at the end */
+struct delete_batch_folder {
+	struct hash_node node;
+	struct collection_list list;
+	struct disk_map *disk;
+	char name[1]; /* disk path followed by the folder */
+} __attribute__((packed));
+
+struct delete_batch_ctx {
+	struct hash_table *entries;
+	unsigned char *bitmap;
+	struct collection *matched;
+} __attribute__((packed));
+
+/* set the bits of all paths equal to 'name' */
+static int delete_batch_mark(struct delete_batch_ctx *ctx, char *name) {
+	struct hash_node *node;
+	struct delete_batch_entry *entry;
+	int found = 0;
+
+	for(node = hash_find(ctx->entries, name);node;node = hash_find_next(ctx->entries, node)) {
+		entry = hash_entry(node, struct delete_batch_entry, node);
+		ctx->bitmap[entry->index / 8] |= (1 << (entry->index % 8));
+		found = 1;
+	}
+
+	return found;
+}
+
+/* used by process_slave_delete_batch */
+static int delete_batch_match_file(struct collection *c, struct file_map *file, struct delete_batch_ctx *ctx) {
+	unsigned int i;
+	char saved;
+	int found;
+
+	found = delete_batch_mark(ctx, file->name);
+
+	/* or one of its folders, with its trailing \ */
+	for(i=strlen(file->name);!found && (i > 1);i--) {
+		if(file->name[i-1] != '\\') continue;
+		saved = file->name[i];
+		file->name[i] = 0;
+		found = delete_batch_mark(ctx, file->name);
+		file->name[i] = saved;
+	}
+
+	if(found) {
+		collection_add(ctx->matched, file);
+	}
+
+	return 1;
+}
+
+/* used by process_slave_delete_batch */
+static int delete_batch_match_disk(struct collection *c, struct disk_map *disk, struct delete_batch_ctx *ctx) {
+
+	collection_iterate(disk->files_collection, (collection_f)delete_batch_match_file, ctx);
+
+	return 1;
+}
+
+/* remember the folder of a deleted file, once */
+static void delete_batch_add_folder(struct hash_table *folders, struct collection_list *list, struct file_map *file) {
+	struct delete_batch_folder *folder;
+	char *ptr;
+	unsigned int length;
+
+	ptr = strrchr(&file->name[1], '\\');
+	if(!ptr) return;
+
+	length = (ptr - &file->name[1]);
+	folder = malloc(sizeof(struct delete_batch_folder) + strlen(file->disk->path) + length);
+	if(!folder) {
+		SLAVE_DBG("Memory error");
+		return;
+	}
+	sprintf(folder->name, "%s%.*s", file->disk->path, length, &file->name[1]);
+
+	if(hash_find(folders, folder->name)) {
+		free(folder);
+		return;
+	}
+
+	folder->disk = file->disk;
+	hash_node_init(&folder->node);
+	hash_add(folders, &folder->node, folder->name);
+	collection_list_addlast(list, &folder->list);
+
+	return;
+}
+
+/*
+	delete many files at once. the paths are separated
+	by zeros, a path ending with a \ is a whole folder.
+	all mapped files are matched against the paths in a
+	single pass, and each emptied folder is removed once.
+	the master gets a bitmap with one bit per path, set
+	if something was deleted for it.
+*/
+static unsigned int process_slave_delete_batch(struct io_context *io, struct packet *p) {
+	char *buffer = (char*)&p->data;
+	struct delete_batch_entry *entries;
+	struct delete_batch_folder *folder;
+	struct delete_batch_ctx ctx;
+	struct hash_table *folders;
+	struct collection_list list, *l;
+	struct file_map *file;
+	unsigned int length, count, current, i;
+	unsigned int ret;
+
+	length = packet_data_length(p);
+
+	/* protocol error */
+	if(!length || buffer[length-1]) {
+		SLAVE_DBG("" LLU ": Protocol error", p->uid);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+
+	count = 0;
+	for(i=0;i<length;i++) {
+		if(buffer[i] == '/') buffer[i] = '\\';
+		if(!buffer[i]) count++;
+	}
+
+	SLAVE_DIALOG_DBG("" LLU ": Delete query received for %u path(s)", p->uid, count);
+
+	entries = malloc(sizeof(struct delete_batch_entry) * count);
+	ctx.bitmap = malloc((count + 7) / 8);
+	ctx.entries = hash_new(count, 1);
+	ctx.matched = collection_new(C_NONE);
+	folders = hash_new(16, 1);
+	if(!entries || !ctx.bitmap || !ctx.entries || !ctx.matched || !folders) {
+		SLAVE_DBG("Memory error");
+		if(entries) free(entries);
+		if(ctx.bitmap) free(ctx.bitmap);
+		if(ctx.entries) hash_destroy(ctx.entries);
+		if(ctx.matched) collection_destroy(ctx.matched);
+		if(folders) hash_destroy(folders);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+	memset(ctx.bitmap, 0, (count + 7) / 8);
+
+	current = 0;
+	for(i=0;i<count;i++) {
+		hash_node_init(&entries[i].node);
+		entries[i].index = i;
+		hash_add(ctx.entries, &entries[i].node, &buffer[current]);
+		current += strlen(&buffer[current]) + 1;
+	}
+
+	collection_iterate(mapped_disks, (collection_f)delete_batch_match_disk, &ctx);
+
+	/* delete the files, then their folders */
+	collection_list_init(&list);
+	while((file = collection_first(ctx.matched))) {
+		collection_delete(ctx.matched, file);
+		delete_batch_add_folder(folders, &list, file);
+		file_unmap(file, 0);
+	}
+
+	while(list.next != &list) {
+		l = list.next;
+		collection_list_remove(l);
+		folder = CONTAINING_RECORD(l, struct delete_batch_folder, list);
+		hash_remove(folders, &folder->node);
+		_rmdir_recursive(folder->disk->path, &folder->name[strlen(folder->disk->path)]);
+		free(folder);
+	}
+
+	ret = enqueue_packet(p->uid, IO_DELETED, ctx.bitmap, (count + 7) / 8);
+
+	hash_destroy(folders);
+	collection_destroy(ctx.matched);
+	hash_destroy(ctx.entries);
+	free(ctx.bitmap);
+	free(entries);
+
+	return ret ? 1 : 0;
+}
+
+/* called from the master: stream the upload to a peer slave */
+static unsigned int process_slave_tee(struct io_context *io, struct packet *p) {
+	struct slave_tee_request *req = (struct slave_tee_request *)&p->data;
+	unsigned int length = (p->size - sizeof(struct packet));
+	struct slave_xfer *xfer;
+	struct fsd_tee *tee;
+	struct signal_callback *s;
+	
+	SLAVE_DIALOG_DBG("" LLU ": Tee query received", p->uid);
+	
+	if(length < sizeof(struct slave_tee_request)) {
+		SLAVE_DBG("" LLU ": Protocol error", p->uid);
+		return 0; /* protocol error */
+	}
+	
+	xfer = get_xfer_from_uid(req->xfer_uid);
+	if(!xfer || !xfer->upload || xfer->completed) {
+		SLAVE_DBG("" LLU ": Could not match upload " LLU " locally", p->uid, req->xfer_uid);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+	
+	if(xfer->tees_expected) {
+		xfer->tees_expected--;
+	}
+	
+	if(!req->port) {
+		/* the replica could not be set up on the master's side */
+		if(!enqueue_packet(p->uid, IO_SLAVE_TEE, NULL, 0)) return 0;
+		return 1;
+	}
+	
+	if(xfer->xfered) {
+		/* too late, the copy would be missing the start of the file */
+		SLAVE_DBG("" LLU ": Upload " LLU " already started, no replica", p->uid, xfer->uid);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+	
+	tee = malloc(sizeof(struct fsd_tee));
+	if(!tee) {
+		SLAVE_DBG("" LLU ": Memory error", p->uid);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+	
+	obj_init(&tee->o, tee, (obj_f)tee_obj_destroy);
+	collectible_init(tee);
+	
+	tee->uid = xfer->uid;
+	tee->connected = 0;
+	tee->closing = 0;
+	tee->backlog = NULL;
+	tee->head = 0;
+	tee->length = 0;
+	tee->size = 0;
+	
+	tee->group = collection_new(C_CASCADE);
+	
+	/* the peer listens like it would for a client: connect directly */
+	tee->fd = connect_to_ip_non_blocking(req->ip, req->port);
+	if(tee->fd == -1) {
+		SLAVE_DBG("" LLU ": Could not create socket", p->uid);
+		obj_destroy(&tee->o);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+	
+	if(!collection_add(tees_collection, tee) || !collection_add(xfer->tees, tee)) {
+		SLAVE_DBG("" LLU ": Collection error", p->uid);
+		obj_destroy(&tee->o);
+		if(!enqueue_packet(p->uid, IO_FAILURE, NULL, 0)) return 0;
+		return 1;
+	}
+	
+	socket_monitor_new(tee->fd, 0, 0);
+	s = socket_monitor_signal_add(tee->fd, tee->group, "socket-connect", (signal_f)tee_connect, tee);
+	signal_timeout(s, DATA_CONNECTION_TIMEOUT, (timeout_f)tee_connect_timeout, tee);
+	socket_monitor_signal_add(tee->fd, tee->group, "socket-error", (signal_f)tee_error, tee);
+	socket_monitor_signal_add(tee->fd, tee->group, "socket-close", (signal_f)tee_error, tee);
+	
+	SLAVE_DBG("" LLU ": Streaming to a replica.", xfer->uid);
+	
+	if(!enqueue_packet(p->uid, IO_SLAVE_TEE, NULL, 0)) return 0;
+	
+	return 1;
+}
+
 static unsigned int process_slave_sslcert_pkey(struct io_context *io, struct packet *p) {
 	unsigned char *buffer, *tmp;
 	int len;
@@ -2723,7 +4262,7 @@ static unsigned int process_slave_deletelog(struct io_context *io, struct packet
 			SLAVE_DBG("" LLU ": Could not find file %s", p->uid, ptr);
 		}
 		else {
-			file_unmap(file);
+			file_unmap(file, 1);
 		}
 	}
 
@@ -2781,6 +4320,12 @@ static unsigned int handle_inputs(struct io_context *io) {
 	case IO_DELETELOG: /* reply with FAILURE or DELETED */
 		ret = process_slave_deletelog(io, p);
 		break;
+	case IO_DELETE_BATCH: /* reply with FAILURE or DELETED */
+		ret = process_slave_delete_batch(io, p);
+		break;
+	case IO_SLAVE_TEE: /* reply with FAILURE or the same type */
+		ret = process_slave_tee(io, p);
+		break;
 	case IO_SFV: /* reply with FAILURE or the same type */
 		ret = process_slave_sfv(io, p);
 		break;
@@ -2833,21 +4378,15 @@ static unsigned int handle_outputs(struct io_context *io) {
 	return success;
 }
 
-static unsigned int get_entry_matcher(struct collection *c, struct fsd_sfv_entry *entry, char *filename) {
-
-	return !strcasecmp(entry->filename, filename);
-}
-
-/* this function does not check for duplicates, it returns the
-	first entry matching the given filename */
+/* return the entry for the given filename, case insensitive */
 struct fsd_sfv_entry *fsd_sfv_get_entry(struct fsd_sfv_ctx *sfv, char *filename) {
-	struct fsd_sfv_entry *entry;
+	struct hash_node *node;
 
 	if(!sfv || !filename) return 0;
 
-	entry = collection_match(sfv->entries, (collection_f)get_entry_matcher, filename);
+	node = hash_find(sfv->index, filename);
 
-	return entry;
+	return node ? hash_entry(node, struct fsd_sfv_entry, node) : NULL;
 }
 
 static void sfv_entry_obj_destroy(struct fsd_sfv_entry *entry) {
@@ -2877,11 +4416,13 @@ struct fsd_sfv_entry *fsd_sfv_add_entry(struct fsd_sfv_ctx *sfv, char *filename,
 		
 		obj_init(&entry->o, entry, (obj_f)sfv_entry_obj_destroy);
 		collectible_init(entry);
+		hash_node_init(&entry->node);
 
 		entry->crc = crc;
 		sprintf(entry->filename, filename);
 
 		collection_add(sfv->entries, entry);
+		hash_add(sfv->index, &entry->node, entry->filename);
 	} else {
 		if(entry->crc != crc) return NULL;
 	}
@@ -2893,6 +4434,12 @@ static void sfv_obj_destroy(struct fsd_sfv_ctx *sfv) {
 	
 	collectible_destroy(sfv);
 	
+	/* the entries only go away with their sfv */
+	if(sfv->index) {
+		hash_destroy(sfv->index);
+		sfv->index = NULL;
+	}
+	
 	if(sfv->entries) {
 		collection_destroy(sfv->entries);
 		sfv->entries = NULL;
@@ -2938,6 +4485,15 @@ unsigned int sfv_parse(struct file_map *file) {
 		collectible_init(file->sfv);
 		
 		file->sfv->entries = collection_new(C_CASCADE);
+		file->sfv->index = hash_new(0, 1);
+		if(!file->sfv->entries || !file->sfv->index) {
+			SLAVE_DBG("Memory error");
+			if(file->sfv->entries) collection_destroy(file->sfv->entries);
+			if(file->sfv->index) hash_destroy(file->sfv->index);
+			free(file->sfv);
+			file->sfv = NULL;
+			return 1;
+		}
 		file->sfv->file = file;
 		
 	}
@@ -3234,6 +4790,11 @@ static unsigned int load_config() {
 		SLAVE_DBG("slave.buffer.download was invalid, defaulted to %u", SLAVE_DN_BUFFER_SIZE);
 		fsd_buffer_down = SLAVE_DN_BUFFER_SIZE;
 	}
+	fsd_cache_size = config_raw_read_int(SLAVE_CONFIG_FILE, "slave.cache.size", SLAVE_CACHE_SIZE);
+	fsd_cache_readahead = config_raw_read_int(SLAVE_CONFIG_FILE, "slave.cache.readahead", SLAVE_CACHE_READAHEAD);
+	if(fsd_cache_size) {
+		SLAVE_DBG("Downloads share a cache of %u bytes (%u blocks read ahead)", fsd_cache_size, fsd_cache_readahead);
+	}
 /*
 	working_buffer = malloc(fsd_buffer_up > fsd_buffer_down ? fsd_buffer_up : fsd_buffer_down);
 	if(!working_buffer) {
@@ -3321,6 +4882,15 @@ static unsigned int load_config() {
 		free(p);
 	}
 
+	/* rate at wich the transfers' progress is pushed to the master, 0 to disable */
+	fsd_progress_interval = config_raw_read_int(SLAVE_CONFIG_FILE, "slave.progress-interval", SLAVE_PROGRESS_INTERVAL);
+
+	/* rate at wich files of unknown checksum are read back, in bytes per second, 0 to disable */
+	fsd_scrub_rate = config_raw_read_int(SLAVE_CONFIG_FILE, "slave.scrub.rate", SLAVE_SCRUB_RATE);
+
+	/* maximum number of idle tunnels kept to each data proxy, 0 to disable */
+	tunnel_pool_max = config_raw_read_int(SLAVE_CONFIG_FILE, "slave.proxy.pool", SLAVE_TUNNEL_POOL_SIZE);
+
 	return 1;
 }
 
@@ -3605,10 +5175,16 @@ int main(int argc, char* argv[]) {
 
 	enqueued_packets = collection_new(C_CASCADE);
 	xfers_collection = collection_new(C_CASCADE);
+	tees_collection = collection_new(C_CASCADE);
+	blocks_collection = collection_new(C_CASCADE);
+	blocks_reading = collection_new(C_NONE);
 	main_ctx.group = collection_new(C_CASCADE);
 	
 	xfer_monitored_adio = collection_new(C_CASCADE);
 	
+	scrub_pending = collection_new(C_NONE);
+	scrub_report = collection_new(C_NONE);
+	
 	main_ctx.slave_is_dead = 0;
 
 	if(!load_config()) {
@@ -3620,6 +5196,29 @@ int main(int argc, char* argv[]) {
 		SLAVE_DBG("There appears to be no disk loaded!");
 		return 1;
 	}
+	
+	if(use_pasv_proxy) {
+		tunnel_pool_init(&pasv_tunnels, "PASV", pasv_proxy_ip, pasv_proxy_port);
+	}
+	if(use_data_proxy) {
+		tunnel_pool_init(&data_tunnels, "PORT", data_proxy_ip, data_proxy_port);
+	}
+	
+	if(fsd_progress_interval) {
+		wheel_timer_init(&fsd_progress_timer, (wheel_f)push_progress, NULL);
+		wheel_schedule(&fsd_progress_timer, time_now() + fsd_progress_interval);
+	}
+	
+	if(fsd_scrub_rate) {
+		scrub.buffer = malloc(SLAVE_SCRUB_CHUNK_SIZE);
+		if(scrub.buffer) {
+			SLAVE_DBG("Reading back %u files of unknown checksum at %u bytes/s", collection_size(scrub_pending), fsd_scrub_rate);
+			wheel_timer_init(&fsd_scrub_timer, (wheel_f)scrub_tick, NULL);
+			wheel_schedule(&fsd_scrub_timer, time_now() + SLAVE_SCRUB_INTERVAL);
+		} else {
+			SLAVE_DBG("Memory error");
+		}
+	}
 
 	while((!master_connections || (attempts < master_connections)) && !main_ctx.slave_is_dead) {
 		
@@ -3657,10 +5256,12 @@ int main(int argc, char* argv[]) {
 		
 		/* loop until we are disconnected from the master */
 		do {
+			wheel_poll();
 			socket_poll();
 			xfer_adio_poll();
+			block_poll();
 //			collection_cleanup_iterators();
-			sleep(SLAVE_SLEEP_TIME);
+			sleep(wheel_sleep_time(SLAVE_SLEEP_TIME));
 		} while(main_ctx.connected && !main_ctx.slave_is_dead);
 		
 		SLAVE_DBG("Connection lost from master !");
@@ -3692,6 +5293,9 @@ int main(int argc, char* argv[]) {
 		}
 		collection_empty(enqueued_packets);
 		
+		/* the checksums are sent again once the master has our file list */
+		scrub_master_ready = 0;
+		
 		sleep(10000);
 	}
 
@@ -3700,8 +5304,19 @@ int main(int argc, char* argv[]) {
 	collection_destroy(main_ctx.group);
 	collection_destroy(enqueued_packets);
 	collection_destroy(xfers_collection);
+	collection_destroy(tees_collection);
+	collection_destroy(blocks_reading);
+	collection_destroy(blocks_collection);
 	
 	collection_destroy(xfer_monitored_adio);
+	
+	scrub_close();
+	collection_destroy(scrub_report);
+	collection_destroy(scrub_pending);
+	if(scrub.buffer) {
+		free(scrub.buffer);
+		scrub.buffer = NULL;
+	}
 
 	secure_free();
 	socket_free();
@@ -53,6 +53,8 @@
 
 #include "collection.h"
 #include "secure.h"
+#include "wheel.h"
+#include "hash.h"
 
 struct slave_main_ctx {
 	char slave_is_dead; /* is the slave dead ? */
@@ -66,6 +68,69 @@ struct slave_main_ctx {
 	unsigned int filledsize;
 } __attribute__((packed));
 
+/*
+	A tcp connection to one of the data proxies, opened ahead
+	of time so a transfer can send its PROXY_CONNECT/PROXY_LISTEN
+	packet without waiting for the connection to be established.
+*/
+struct fsd_tunnel {
+	struct obj o;
+	struct collectible c;
+	
+	struct fsd_tunnel_pool *pool;
+	
+	int fd;
+	char connected; /* the connection is established and parked */
+	unsigned long long int timestamp; /* time at wich it was connected */
+} __attribute__((packed));
+
+struct fsd_tunnel_pool {
+	const char *name;
+	unsigned int ip;
+	unsigned short port;
+	
+	struct collection *tunnels; /* fsd_tunnel structs, oldest first */
+	struct collection *group; /* signals of the tunnels being connected */
+	
+	unsigned int target; /* number of tunnels we try to keep */
+	unsigned int rate; /* average claims per interval, in 1/16th */
+	unsigned int claims; /* claims since the last interval */
+	
+	/* setup latency of the transfers, up to the proxy's reply */
+	unsigned int pooled;
+	unsigned long long int pooled_latency;
+	unsigned int direct;
+	unsigned long long int direct_latency;
+	unsigned int failures;
+	unsigned long long int reported; /* time of the last report */
+	
+	struct wheel_timer timer;
+} __attribute__((packed));
+
+/*
+	A connection to a peer slave that receives a copy of an
+	upload while it is written here (see IO_SLAVE_TEE). The
+	peer sees a regular client upload: the copy is complete
+	when the connection is closed gracefully, and it fails
+	when the connection is reset.
+*/
+struct fsd_tee {
+	struct obj o;
+	struct collectible c;
+	
+	unsigned long long int uid; /* of the upload */
+	
+	int fd;
+	char connected;
+	char closing; /* the upload is complete, close once the backlog is sent */
+	struct collection *group;
+	
+	char *backlog; /* data not yet sent to the peer */
+	unsigned int head; /* start of that data in the buffer */
+	unsigned int length;
+	unsigned int size; /* allocated */
+} __attribute__((packed));
+
 struct slave_xfer {
 	struct obj o;
 	struct collectible c;
@@ -103,15 +168,26 @@ struct slave_xfer {
 	struct packet *query;
 	struct packet *reply;
 	unsigned int filledsize;
+	
+	struct fsd_tunnel_pool *tunnel_pool; /* pool the proxy connection came from */
+	char tunneled; /* 1 if a pooled tunnel was claimed */
+	unsigned long long int tunnel_claimed; /* time of the claim */
 
 	unsigned long long int xfered; /* xfered size */
+	unsigned long long int reported; /* xfered size last pushed to the master */
 	unsigned int checksum; /* checksum for the transfer */
+	
+	/* replicas of an upload, see struct fsd_tee */
+	struct collection *tees;
+	unsigned char tees_expected; /* IO_SLAVE_TEE queries not received yet */
+	unsigned long long int tees_deadline; /* stop waiting for them after this */
 
 	char ready; /* ready to transfer the file? */
 	struct file_map *file;
 	
 	char *buffer;
 	unsigned int buffersize;
+	struct fsd_block *block; /* block being sent, for the downloads without a buffer */
 	struct adio_operation *op; /* asyncrhonous disk i/o operation's reference */
 	unsigned int op_length; /* number of bytes that are implied in the current operation */
 	unsigned int op_done; /* number of bytes processed by the adio_operation */
@@ -162,6 +238,13 @@ struct file_list_entry {
 	char name[1];
 } __attribute__((packed));
 
+/* entries of the IO_CHECKSUMS packets pushed to the master */
+struct slave_checksum_entry {
+	unsigned int entry_size; /* size of this entry */
+	unsigned int checksum; /* crc32 of the file */
+	char name[1];
+} __attribute__((packed));
+
 typedef enum {
 	SLAVE_PLATFORM_WIN32,
 } slave_platform;
@@ -179,6 +262,8 @@ struct fsd_sfv_entry {
 	struct obj o;
 	struct collectible c;
 	
+	struct hash_node node; /* in the sfv's index */
+	
 	unsigned int crc;
 	char filename[];
 } __attribute__((packed));
@@ -189,6 +274,7 @@ struct fsd_sfv_ctx {
 	struct collectible c;
 	
 	struct collection *entries; /* collection of fsd_sfv_entry structures */
+	struct hash_table *index; /* fsd_sfv_entry by filename */
 	struct file_map *file;
 } __attribute__((packed));
 
@@ -215,15 +301,39 @@ struct file_map {
 
 	unsigned long long int size; /* file size in bytes */
 	unsigned long long int timestamp; /* modification date */
-	/* TODO: crc checksum, ... */
+	unsigned int checksum; /* crc32 of the whole file, 0 while unknown */
 
 	struct collection *xfers; /* current xfers for this file, collection of struct struct slave_xfer */
+	struct collection *blocks; /* cached blocks of the file, collection of struct fsd_block */
 	
 	struct fsd_sfv_ctx *sfv;
 
 	char name[1];	/* name relative to the disk's path like hum\abc\file.bin */
 } __attribute__((packed));
 
+/*
+	A block of a file read for its downloads. All the downloads
+	of the file send from the same blocks, so the file is read
+	once for all of them as long as they stay close to each
+	other. The blocks nobody is sending from are dropped, least
+	recently used first, when the cache is full.
+*/
+struct fsd_block {
+	struct obj o;
+	struct collectible c;
+	
+	struct file_map *file;
+	unsigned long long int offset; /* in the file, a multiple of SLAVE_CACHE_BLOCK_SIZE */
+	unsigned int length; /* size of the block, shorter at the end of the file */
+	
+	char *data;
+	struct adio_operation *op; /* NULL once the block is read */
+	unsigned int done; /* bytes of the block read so far */
+	char failed; /* the read failed, the block is not used anymore */
+	
+	unsigned int users; /* downloads sending from this block */
+} __attribute__((packed));
+
 struct disk_map {
 	struct obj o;
 	struct collectible c;
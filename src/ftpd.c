@@ -43,7 +43,7 @@
     rfc-2389 compliant (in progress)
 		English: http://www.wu-ftpd.org/rfc/rfc2389.html
 */
-
+
 #ifdef WIN32
 #include <windows.h>
 #endif
@@ -74,6 +74,8 @@
 #include "nuke.h"
 #include "asynch.h"
 #include "luainit.h"
+#include "job.h"
+#include "mirror.h"
 
 
 /* Config stuff */
@@ -111,61 +113,142 @@ static int ftpd_secure_control_type = FTPD_SECURE_BOTH;
 static int ftpd_secure_data_type = FTPD_SECURE_BOTH;
 static int ftpd_secure_no_drop = 0; /* if 1, CCC cannot be used to drop a secure connection */
 
-static ftpd_command ftpd_client_text_to_command(char *buffer, unsigned int len) {
+/*
+	Commands are decoded with a perfect hash over their first
+	four characters (upper-cased and packed in an integer). The
+	multiplier below was chosen so that none of the commands in
+	ftpd_commands collide in a table of FTPD_COMMAND_HASH_SIZE
+	entries. Three letter commands are packed with a zero byte.
+*/
+#define FTPD_COMMAND_HASH_BITS		7
+#define FTPD_COMMAND_HASH_SIZE		(1 << FTPD_COMMAND_HASH_BITS)
+#define FTPD_COMMAND_HASH_MULT		0x5f10c13dU
+
+#define FTPD_UPPER(_c) ((((_c) >= 'a') && ((_c) <= 'z')) ? ((_c) - ('a' - 'A')) : (_c))
+#define FTPD_COMMAND_KEY(_a, _b, _c, _d) ( \
+	((unsigned int)(unsigned char)(_a)) | \
+	((unsigned int)(unsigned char)(_b) << 8) | \
+	((unsigned int)(unsigned char)(_c) << 16) | \
+	((unsigned int)(unsigned char)(_d) << 24))
+#define FTPD_COMMAND_HASH(_key) ((unsigned int)((_key) * FTPD_COMMAND_HASH_MULT) >> (32 - FTPD_COMMAND_HASH_BITS))
+
+struct ftpd_command_entry {
+	const char *name;
+	ftpd_command command;
+	char need_space; /* the command must be followed by a space */
+};
+
+static const struct ftpd_command_entry ftpd_commands[] = {
+	{ "PWD", CMD_PRINT_WORKING_DIRECTORY, 0 },
+	{ "CCC", CMD_CLEAR_COMMAND_CHANNEL, 0 },
+
+	{ "QUIT", CMD_QUIT, 0 },
+	{ "SYST", CMD_SYSTEM, 0 },
+	{ "FEAT", CMD_FEATURES, 0 },
+	{ "CWD ", CMD_CHANGE_WORKING_DIRECTORY, 0 },
+	{ "CDUP", CMD_CHANGE_TO_PARENT_DIRECTORY, 0 },
+	{ "REIN", CMD_REINITIALIZE, 0 },
+	{ "PASV", CMD_PASSIVE, 0 },
+	{ "ABOR", CMD_ABORT, 0 },
+	{ "RMD ", CMD_REMOVE_DIRECTORY, 0 },
+	{ "MKD ", CMD_MAKE_DIRECTORY, 0 },
+	{ "LIST", CMD_LIST, 0 },
+	{ "NLST", CMD_NAME_LIST, 0 },
+	{ "STAT", CMD_STATUS, 0 },
+	{ "HELP", CMD_HELP, 0 },
+	{ "NOOP", CMD_NO_OPERATION, 0 },
+	{ "STOU", CMD_STORE_UNIQUE, 0 },
+	{ "SSCN", CMD_SET_SECURE_CLIENT_NEGOTIATION, 0 },
+
+	{ "USER", CMD_USERNAME, 1 },
+	{ "PASS", CMD_PASSWORD, 1 },
+	{ "CLNT", CMD_CLIENT, 1 },
+	{ "ACCT", CMD_ACCOUNT, 1 },
+	{ "SMNT", CMD_STRUCTURE_MOUNT, 1 },
+	{ "ALLO", CMD_ALLOCATE, 1 },
+	{ "PORT", CMD_DATA_PORT, 1 },
+	{ "TYPE", CMD_REPRESENTATION_TYPE, 1 },
+	{ "STRU", CMD_FILE_STRUCTURE, 1 },
+	{ "MODE", CMD_TRANSFER_MODE, 1 },
+	{ "RETR", CMD_RETRIEVE, 1 },
+	{ "STOR", CMD_STORE, 1 },
+	{ "APPE", CMD_APPEND, 1 },
+	{ "REST", CMD_RESTART, 1 },
+	{ "RNFR", CMD_RENAME_FROM, 1 },
+	{ "RNTO", CMD_RENAME_TO, 1 },
+	{ "DELE", CMD_DELETE, 1 },
+	{ "SITE", CMD_SITE, 1 },
+	{ "SIZE", CMD_SIZE_OF_FILE, 1 },
+	{ "PRET", CMD_PRE_TRANSFER, 1 },
+	{ "PROT", CMD_PROTECTION, 1 },
+	{ "PBSZ", CMD_PROTECTION_BUFFER_SIZE, 1 },
+	{ "AUTH", CMD_AUTHENTICATE, 1 },
+
+	{ NULL, CMD_NONE, 0 }
+};
+
+static struct {
+	unsigned int key;
+	const struct ftpd_command_entry *entry;
+} ftpd_command_table[FTPD_COMMAND_HASH_SIZE];
+
+static int ftpd_build_command_table() {
+	const struct ftpd_command_entry *entry;
+	unsigned int key, slot;
+	const char *name;
+
+	memset(ftpd_command_table, 0, sizeof(ftpd_command_table));
+
+	for(entry=&ftpd_commands[0];entry->name;entry++) {
+		name = entry->name;
+		key = FTPD_COMMAND_KEY(name[0], name[1], name[2], name[3]);
+		slot = FTPD_COMMAND_HASH(key);
+
+		if(ftpd_command_table[slot].entry) {
+			FTPD_DBG("Command %s collides with %s in the command table", name, ftpd_command_table[slot].entry->name);
+			return 0;
+		}
+
+		ftpd_command_table[slot].key = key;
+		ftpd_command_table[slot].entry = entry;
+	}
+
+	return 1;
+}
 
+static FUNC_INLINE const struct ftpd_command_entry *ftpd_lookup_command(unsigned int key) {
+	unsigned int slot;
+
+	slot = FTPD_COMMAND_HASH(key);
+	if(ftpd_command_table[slot].entry && (ftpd_command_table[slot].key == key))
+		return ftpd_command_table[slot].entry;
+
+	return NULL;
+}
+
+static ftpd_command ftpd_client_text_to_command(char *buffer, unsigned int len) {
+	const struct ftpd_command_entry *entry;
+	
 	if(len < 3) return CMD_UNKNOWN;
-	if(!strncasecmp(buffer, "PWD", 3)) return CMD_PRINT_WORKING_DIRECTORY;
-	if(!strncasecmp(buffer, "CCC", 3)) return CMD_CLEAR_COMMAND_CHANNEL;
-
-	if(len < 4) return CMD_UNKNOWN;
-	if(!strncasecmp(buffer, "QUIT", 4)) return CMD_QUIT;
-	if(!strncasecmp(buffer, "SYST", 4)) return CMD_SYSTEM;
-	if(!strncasecmp(buffer, "FEAT", 4)) return CMD_FEATURES;
-	if(!strncasecmp(buffer, "CWD ", 4)) return CMD_CHANGE_WORKING_DIRECTORY;
-	if(!strncasecmp(buffer, "CDUP", 4)) return CMD_CHANGE_TO_PARENT_DIRECTORY;
-	if(!strncasecmp(buffer, "REIN", 4)) return CMD_REINITIALIZE;
-	if(!strncasecmp(buffer, "PASV", 4)) return CMD_PASSIVE;
-	if(!strncasecmp(buffer, "ABOR", 4)) return CMD_ABORT;
-	if(!strncasecmp(buffer, "RMD ", 4)) return CMD_REMOVE_DIRECTORY;
-	if(!strncasecmp(buffer, "MKD ", 4)) return CMD_MAKE_DIRECTORY;
-	if(!strncasecmp(buffer, "LIST", 4)) return CMD_LIST;
-	if(!strncasecmp(buffer, "NLST", 4)) return CMD_NAME_LIST;
-	if(!strncasecmp(buffer, "STAT", 4)) return CMD_STATUS;
-	if(!strncasecmp(buffer, "HELP", 4)) return CMD_HELP;
-	if(!strncasecmp(buffer, "NOOP", 4)) return CMD_NO_OPERATION;
-	if(!strncasecmp(buffer, "STOU", 4)) return CMD_STORE_UNIQUE;
-	if(!strncasecmp(buffer, "SSCN", 4)) return CMD_SET_SECURE_CLIENT_NEGOTIATION;
-
-	if(len < 5) return CMD_UNKNOWN;
-	if(!strncasecmp(buffer, "USER ", 5)) return CMD_USERNAME;
-	if(!strncasecmp(buffer, "PASS ", 5)) return CMD_PASSWORD;
-	if(!strncasecmp(buffer, "CLNT ", 5)) return CMD_CLIENT;
-	if(!strncasecmp(buffer, "ACCT ", 5)) return CMD_ACCOUNT;
-	if(!strncasecmp(buffer, "SMNT ", 5)) return CMD_STRUCTURE_MOUNT;
-	if(!strncasecmp(buffer, "ALLO ", 5)) return CMD_ALLOCATE;
-	if(!strncasecmp(buffer, "PORT ", 5)) return CMD_DATA_PORT;
-	if(!strncasecmp(buffer, "TYPE ", 5)) return CMD_REPRESENTATION_TYPE;
-	if(!strncasecmp(buffer, "STRU ", 5)) return CMD_FILE_STRUCTURE;
-	if(!strncasecmp(buffer, "MODE ", 5)) return CMD_TRANSFER_MODE;
-	if(!strncasecmp(buffer, "RETR ", 5)) return CMD_RETRIEVE;
-	if(!strncasecmp(buffer, "STOR ", 5)) return CMD_STORE;
-	if(!strncasecmp(buffer, "APPE ", 5)) return CMD_APPEND;
-	if(!strncasecmp(buffer, "REST ", 5)) return CMD_RESTART;
-	if(!strncasecmp(buffer, "RNFR ", 5)) return CMD_RENAME_FROM;
-	if(!strncasecmp(buffer, "RNTO ", 5)) return CMD_RENAME_TO;
-	if(!strncasecmp(buffer, "DELE ", 5)) return CMD_DELETE;
-	if(!strncasecmp(buffer, "SITE ", 5)) return CMD_SITE;
-	if(!strncasecmp(buffer, "SIZE ", 5)) return CMD_SIZE_OF_FILE;
-	if(!strncasecmp(buffer, "PRET ", 5)) return CMD_PRE_TRANSFER;
-	if(!strncasecmp(buffer, "PROT ", 5)) return CMD_PROTECTION;
-	if(!strncasecmp(buffer, "PBSZ ", 5)) return CMD_PROTECTION_BUFFER_SIZE;
-	if(!strncasecmp(buffer, "AUTH ", 5)) return CMD_AUTHENTICATE;
+
+	if(len >= 4) {
+		entry = ftpd_lookup_command(FTPD_COMMAND_KEY(FTPD_UPPER(buffer[0]), FTPD_UPPER(buffer[1]),
+			FTPD_UPPER(buffer[2]), FTPD_UPPER(buffer[3])));
+		if(entry) {
+			if(!entry->need_space) return entry->command;
+			if((len >= 5) && (buffer[4] == ' ')) return entry->command;
+		}
+	}
+
+	entry = ftpd_lookup_command(FTPD_COMMAND_KEY(FTPD_UPPER(buffer[0]), FTPD_UPPER(buffer[1]),
+		FTPD_UPPER(buffer[2]), 0));
+	if(entry) return entry->command;
 
 	/*
 		Special case of "ABOR" that FlashFXP send. Looks like: ABOR
 		What a broken client.
 	*/
-	if((strlen(buffer) > 4) && !strncasecmp(&buffer[strlen(buffer)-4], "ABOR", 4)) return CMD_BROKEN_ABORT;
+	if((len > 4) && !strncasecmp(&buffer[len-4], "ABOR", 4)) return CMD_BROKEN_ABORT;
 
 	return CMD_UNKNOWN;
 }
@@ -203,46 +286,219 @@ struct ftpd_collectible_line *ftpd_line_new(char *line) {
 	return l;
 }
 
-/* add a message for the client from lua */
-unsigned int ftpd_lua_message(struct ftpd_client_ctx *client, const char *msg) {
-	char *tmp, *line;
-	struct ftpd_collectible_line *l;
-	char *ptr;
+static void ftpd_reply_init(struct ftpd_reply_buffer *reply) {
+	
+	reply->data = NULL;
+	reply->size = 0;
+	reply->length = 0;
+	reply->offset = 0;
+	
+	reply->replycode = 0;
+	reply->pending = -1;
+	reply->last_line = -1;
+	reply->tail = -1;
+	
+	return;
+}
 
-	if(!client || !msg) return 0;
+/* forget the content of the buffer but keep its memory for the next reply */
+static void ftpd_reply_reset(struct ftpd_reply_buffer *reply) {
+	
+	reply->length = 0;
+	reply->offset = 0;
+	
+	reply->replycode = 0;
+	reply->pending = -1;
+	reply->last_line = -1;
+	reply->tail = -1;
+	
+	return;
+}
 
-	tmp = strdup(msg);
-	if(!tmp) {
+static void ftpd_reply_free(struct ftpd_reply_buffer *reply) {
+	
+	if(reply->data) {
+		free(reply->data);
+		reply->data = NULL;
+	}
+	reply->size = 0;
+	ftpd_reply_reset(reply);
+	
+	return;
+}
+
+/* make sure there's at least 'length' more bytes available in the buffer */
+static unsigned int ftpd_reply_reserve(struct ftpd_reply_buffer *reply, unsigned int length) {
+	unsigned int size;
+	char *data;
+	
+	if(reply->length + length <= reply->size)
+		return 1;
+	
+	size = reply->size ? reply->size : FTPD_REPLY_BUFFER_SIZE;
+	while(size < reply->length + length) {
+		size *= 2;
+	}
+	
+	data = realloc(reply->data, size);
+	if(!data) {
 		FTPD_DBG("Memory error");
 		return 0;
 	}
+	
+	reply->data = data;
+	reply->size = size;
+	
+	return 1;
+}
 
-	/* add line by line */
-	line = tmp;
-	do {
-		ptr = strchr(line, '\n');
-		if(ptr) {
-			*ptr = 0;
-			ptr++;
+/* write the reply code in the "NNN-" slot at the given offset */
+static void ftpd_reply_stamp(struct ftpd_reply_buffer *reply, int offset, unsigned int code) {
+	
+	reply->data[offset] = '0' + ((code / 100) % 10);
+	reply->data[offset+1] = '0' + ((code / 10) % 10);
+	reply->data[offset+2] = '0' + (code % 10);
+	
+	return;
+}
+
+/* stamp all the lines that were waiting for a reply code */
+static void ftpd_reply_stamp_pending(struct ftpd_reply_buffer *reply) {
+	char *ptr, *end;
+	
+	if(reply->pending == -1)
+		return;
+	
+	ptr = &reply->data[reply->pending];
+	end = &reply->data[reply->length];
+	while(ptr < end) {
+		/* unstamped slots are zero-filled, lines without slot never start with a zero */
+		if(!*ptr) {
+			ftpd_reply_stamp(reply, ptr - reply->data, reply->replycode);
 		}
+		
+		ptr = memchr(ptr, '\n', end - ptr);
+		if(!ptr) break;
+		ptr++;
+	}
+	
+	reply->pending = -1;
+	
+	return;
+}
 
-		l = ftpd_line_new(line);
-		if(l) {
-			if(!collection_add(client->messages, l)) {
-				FTPD_DBG("Collection error");
-			} else {
-				collection_movelast(client->messages, l);
+/*
+	Return the reply code at the beginning of the line, or zero if
+	there is none. A reply code is three digits followed by one of
+	'-', ' ' or '*'. The '*' separator is used internally to start
+	a new reply within the same buffer.
+*/
+static unsigned int ftpd_reply_code(const char *line, unsigned int length, char *separator) {
+	unsigned int i;
+	
+	if(length < 4) return 0;
+	
+	for(i=0;i<3;i++) {
+		if((line[i] < '0') || (line[i] > '9')) return 0;
+	}
+	
+	if((line[3] != '-') && (line[3] != ' ') && (line[3] != '*')) return 0;
+	if(line[0] == '0') return 0;
+	
+	*separator = line[3];
+	
+	return ((line[0] - '0') * 100) + ((line[1] - '0') * 10) + (line[2] - '0');
+}
+
+/*
+	Append one line to the reply buffer. The first line of a message
+	always gets a reply code slot, the following lines get one only
+	if they carry their own reply code.
+*/
+static unsigned int ftpd_reply_append_line(struct ftpd_reply_buffer *reply, const char *line, unsigned int length, int first) {
+	unsigned int code;
+	char separator = 0;
+	int offset;
+	
+	code = ftpd_reply_code(line, length, &separator);
+	if(code) {
+		line += 4;
+		length -= 4;
+		
+		if(separator == '*') {
+			/* terminate the current reply and start a new one */
+			if((reply->last_line != -1) && (reply->last_line == reply->tail)) {
+				reply->data[reply->last_line+3] = ' ';
 			}
+			reply->replycode = code;
+			ftpd_reply_stamp_pending(reply);
+		} else if(!reply->replycode) {
+			reply->replycode = code;
+			ftpd_reply_stamp_pending(reply);
+		}
+	}
+	
+	if(!ftpd_reply_reserve(reply, 4 + length + 2))
+		return 0;
+	
+	offset = reply->length;
+	
+	if(code || first) {
+		if(reply->replycode) {
+			ftpd_reply_stamp(reply, offset, reply->replycode);
+		} else {
+			memset(&reply->data[offset], 0, 3);
+			if(reply->pending == -1) reply->pending = offset;
 		}
+		reply->data[offset+3] = '-';
+		reply->length += 4;
 		
-		line = ptr;
-	} while(line && strlen(line));
-
-	free(tmp);
+		reply->last_line = offset;
+	}
+	
+	memcpy(&reply->data[reply->length], line, length);
+	reply->length += length;
+	reply->data[reply->length++] = '\r';
+	reply->data[reply->length++] = '\n';
+	
+	reply->tail = offset;
+	
+	return 1;
+}
 
+/*
+	Append a message to the reply buffer, line by line. When 'each_line'
+	is set, every line is handled as a message by itself.
+*/
+static unsigned int ftpd_reply_append(struct ftpd_reply_buffer *reply, const char *msg, int each_line) {
+	const char *line, *next;
+	unsigned int length;
+	int first = 1;
+	
+	line = msg;
+	do {
+		next = strchr(line, '\n');
+		length = next ? (next - line) : strlen(line);
+		if(length && (line[length-1] == '\r')) length--;
+		
+		if(!ftpd_reply_append_line(reply, line, length, first || each_line))
+			return 0;
+		first = 0;
+		
+		line = next ? (next + 1) : NULL;
+	} while(line && *line);
+	
 	return 1;
 }
 
+/* add a message for the client from lua */
+unsigned int ftpd_lua_message(struct ftpd_client_ctx *client, const char *msg) {
+
+	if(!client || !msg) return 0;
+
+	return ftpd_reply_append(&client->output, msg, 1);
+}
+
 /* add a formatted message for the client */
 unsigned int ftpd_message(struct ftpd_client_ctx *client, char *format, ...) {
 //	char *line;
@@ -297,6 +553,31 @@ static unsigned int ftpd_client_text_enqueue(struct collection *c, char *format,
 	return 1;
 }
 
+/* enqueue a reply to be sent on the control connection */
+static unsigned int ftpd_client_reply_enqueue(struct ftpd_client_ctx *client, char *format, ...) {
+	int result;
+	char *str = NULL;
+
+	va_list args;
+	va_start(args, format);
+	result = vasprintf(&str, format, args);
+	va_end(args);
+	if(result == -1) {
+		FTPD_DBG("Memory error");
+		return 0;
+	}
+	
+	if(!ftpd_reply_append(&client->output, str, 0)) {
+		FTPD_DBG("Memory error");
+		free(str);
+		return 0;
+	}
+	
+	free(str);
+
+	return 1;
+}
+
 /* parse any inputs from a new client that is not logged */
 static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *client, ftpd_command *command, char *ptr) {
 	char *Pointer;
@@ -306,14 +587,14 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 	
 	/* always use secure connection */
 	if((ftpd_secure_control_type == FTPD_SECURE_ALWAYS) && (client->auth == FTPD_AUTH_NONE) && (*command != CMD_AUTHENTICATE)) {
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"530 Please configure your client to use a secure connection and try again.\n"
 		);
 		return 1;
 	}
 	
 	if(client->ssl_waiting) {
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"530 Still waiting for SSL Negotiation ...\n"
 		);
 		return 1;
@@ -326,7 +607,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		/* do not accept AUTH ? */
 		if(ftpd_secure_control_type == FTPD_SECURE_NEVER) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"421-You should have logged in.\n"
 				"421 Service not available, closing control connection.\n"
 			);
@@ -334,7 +615,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		}
 		if(ftpd_secure_control_type == FTPD_SECURE_IMPLICIT) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You do not need to authenticate.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -344,7 +625,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		/* already sent AUTH ? */
 		if(client->auth != FTPD_AUTH_NONE) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You already sent AUTH.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -355,7 +636,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		client->auth = FTPD_AUTH_SSL_OR_TLS;
 		client->ssl_waiting = 1;
 		
-		ftpd_client_text_enqueue(client->messages, "234 Using secure connection.");
+		ftpd_client_reply_enqueue(client, "234 Using secure connection.");
 		
 		return 1;
 	case CMD_PROTECTION_BUFFER_SIZE:
@@ -363,7 +644,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		
 		/* client cannot use this command without AUTH */
 		if(client->auth != FTPD_AUTH_SSL_OR_TLS) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You cannot use PBSZ before AUTH.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -371,12 +652,12 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		}
 		
 		if(!strcasecmp(Pointer, "0")) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200 Protection Buffer Size set to 0\n"
 			);
 		}
 		else {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"501 This server only accept \"PBSZ 0\"\n"
 			);
 		}
@@ -388,7 +669,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		/*
 		PBSZ must be sent before PROT at any time, so it's wrong to check this here
 		if(client->last_command != CMD_PROTECTION_BUFFER_SIZE) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You must sent PBSZ before PROT.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -397,7 +678,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		
 		/* client cannot use this command without AUTH */
 		if(client->auth != FTPD_AUTH_SSL_OR_TLS) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You cannot use PROT before AUTH.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -406,7 +687,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		
 		/* set Private protection */
 		if(*Pointer == 'P') {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200 Protection set to Private.\n"
 			);
 			client->protection = FTPD_PROTECTION_PRIVATE;
@@ -414,14 +695,14 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		
 		/* set Clear protection */
 		else if(*Pointer == 'C') {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200 Protection set to Clear.\n"
 			);
 			client->protection = FTPD_PROTECTION_CLEAR;
 		}
 		
 		else {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"501 Unknown protection type.\n"
 			);
 		}
@@ -431,7 +712,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		FTPD_DIALOG_DBG("[%08x] CMD_CLEAR_COMMAND_CHANNEL", (int)client);
 		
 		if(client->auth != FTPD_AUTH_SSL_OR_TLS) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"533 Control connection is not protected.\n"
 			);
 			return 1;
@@ -439,14 +720,14 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		
 		/* auth-only connections cannot be unprotected */
 		if((ftpd_secure_control_type == FTPD_SECURE_ALWAYS) || (ftpd_secure_control_type == FTPD_SECURE_IMPLICIT) || ftpd_secure_no_drop) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"534 Control connection cannot be cleared.\n"
 			);
 			return 1;
 		}
 		
 		/*
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"200 Command Channel Cleared.\n"
 		);
 		
@@ -454,7 +735,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		client->ssl_waiting = 1;
 		*/
 		
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"534 Control connection cannot be cleared.\n"
 		);
 		
@@ -472,7 +753,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		FTPD_DIALOG_DBG("[%08x] CMD_USERNAME (%s)", (int)client, Pointer);
 
 		/*if(client->last_command != CMD_NONE) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"421-Invalid USER command at this point.\n"
 				"421 Service not available, closing control connection.\n"
 			);
@@ -482,7 +763,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		strncpy(client->username, Pointer, sizeof(client->username)-1);
 
 		/* check the client username and copy it */
-		ftpd_client_text_enqueue(client->messages, "331 User name okay, need password.");
+		ftpd_client_reply_enqueue(client, "331 User name okay, need password.");
 
 		break;
 	case CMD_PASSWORD:
@@ -499,7 +780,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		FTPD_DIALOG_DBG("[%08x] CMD_PASSWORD (%s)", (int)client, "hidden" /*Pointer*/);
 
 		if(client->last_command != CMD_USERNAME) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"421-Invalid PASS command at this point.\n"
 				"421 Service not available, closing control connection.\n"
 			);
@@ -513,7 +794,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 				client->user = user_new(client->username, "xFTPd", Pointer);
 				if(!client->user) {
 					/* couldn't create new user */
-					ftpd_client_text_enqueue(client->messages,
+					ftpd_client_reply_enqueue(client,
 						"530-There is no user account created, and\n"
 						"530-  xFTPd is unable to create one for %s\n"
 						"530 Not logged in\n",
@@ -522,7 +803,7 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 					return 0;
 				}
 
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"230-WELCOME TO xFTPd.\n"
 					"230-As there was no user in the database, xFTPd\n"
 					"230-  has created an admin account for %s\n",
@@ -534,14 +815,14 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 				if(!client->user) {
 					/* bad username */
 					event_onClientLoginFail(client);
-					ftpd_client_text_enqueue(client->messages, "530 Not logged in, %s.\n", client->username);
+					ftpd_client_reply_enqueue(client, "530 Not logged in, %s.\n", client->username);
 					return 0;
 				}
 
 				if(client->user->disabled || !user_auth(client->user, Pointer)) {
 					/* bad password */
 					event_onClientLoginFail(client);
-					ftpd_client_text_enqueue(client->messages, "530 Not logged in, %s.\n", client->username);
+					ftpd_client_reply_enqueue(client, "530 Not logged in, %s.\n", client->username);
 					return 0;
 				}
 
@@ -556,12 +837,12 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 
 			if(!event_onClientLoginSuccess(client)) {
 				//printf("[client:" LLU "] rejected by event_onClientLoginSuccess()");
-				ftpd_client_text_enqueue(client->messages, "530 Not logged in.");
+				ftpd_client_reply_enqueue(client, "530 Not logged in.");
 				return 0;
 			}
 
 			/* check if the client has the right password */
-			ftpd_client_text_enqueue(client->messages, "230 User logged in, %s.\n", client->user->username);
+			ftpd_client_reply_enqueue(client, "230 User logged in, %s.\n", client->user->username);
 
 			//obj_unref(&client->user->o);
 
@@ -576,14 +857,14 @@ static unsigned int ftpd_client_parse_unlogged_input(struct ftpd_client_ctx *cli
 		  500
 */
 		FTPD_DIALOG_DBG("[%08x] CMD_QUIT", (int)client);
-		ftpd_client_text_enqueue(client->messages, "221 Service closing control connection.");
+		ftpd_client_reply_enqueue(client, "221 Service closing control connection.");
 
 		return 0;
 	default:
 
 		FTPD_DBG("Unresolved: %s", ptr);
 
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"421-You should have logged in.\n"
 			"421 Service not available, closing control connection.\n"
 		);
@@ -661,7 +942,7 @@ static unsigned int ftpd_client_make_directory_listing(struct collection *c, str
 		sprintf(date, "%s %2u %04u", format_month(month), (int)day, (int)year);
 	}
 
-	user = user_get(element->owner);
+	user = vfs_get_owner(element);
 
 	if(element->type == VFS_LINK) {
 		targetpath = vfs_get_relative_path(vfs_root, element->link_to);
@@ -732,6 +1013,43 @@ unsigned int ftpd_inject_listing(struct ftpd_client_ctx *client, char type, cons
 	);
 }
 
+/*
+	Big folders are wiped by a background job, FTPD_WIPE_STEP
+	elements per step and each folder after its content, so
+	vfs_recursive_delete() only ever deletes one element. The
+	folder stays listed meanwhile but nothing can be created
+	under it, the job would delete it.
+*/
+struct ftpd_wipe_job {
+	struct obj o;
+	struct collectible c;
+
+	struct vfs_element *folder; /* the folder being wiped */
+	struct collection *elements; /* struct vfs_element, in the wipe order */
+	struct slave_ctx *slave; /* only for ftpd_wipe_from() */
+} __attribute__((packed));
+
+/* the wipes running in background, struct ftpd_wipe_job */
+static struct collection *ftpd_wipes = NULL;
+
+/* used by ftpd_wipe_pending */
+static int ftpd_wipe_pending_matcher(struct collection *c, struct ftpd_wipe_job *wipe, struct vfs_element *element) {
+
+	for(;element;element = element->parent) {
+		if(element == wipe->folder) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* nonzero if the element is in a folder that is being wiped */
+static int ftpd_wipe_pending(struct vfs_element *element) {
+
+	return (collection_match(ftpd_wipes, (collection_f)ftpd_wipe_pending_matcher, element) != NULL);
+}
+
 /* this is called on PASV when the connection is passive
 	and on STOR/RETR for active connections
 	it make sure the file exists and it setup everyting */
@@ -741,33 +1059,33 @@ static unsigned int setup_file_download(struct ftpd_client_ctx *client, struct v
 
 #ifdef FTPD_STOP_WORKING_TIMESTAMP
 	if((time_now() / 1000) > FTPD_STOP_WORKING_TIMESTAMP) {
-		ftpd_client_text_enqueue(client->messages, "Please visit www.xftpd.com and get a new version!");
+		ftpd_client_reply_enqueue(client, "Please visit www.xftpd.com and get a new version!");
 		return 0;
 	}
 #endif
 
 	element = vfs_find_element(container, file);
 	if(!element || (element->type != VFS_FILE)) {
-		ftpd_client_text_enqueue(client->messages, "File not found or target is not a file.");
+		ftpd_client_reply_enqueue(client, "File not found or target is not a file.");
 		return 0;
 	}
 
 	/* file must not have an uploader linked to it */
 	if(element->uploader) {
-		ftpd_client_text_enqueue(client->messages, "The file is being uploaded.");
+		ftpd_client_reply_enqueue(client, "The file is being uploaded.");
 		return 0;
 	}
 
-	cnx = slaveselection_download(element);
+	cnx = slaveselection_download(element, client);
 	if(!cnx) {
-		ftpd_client_text_enqueue(client->messages, "Slaveselection failed (no transfer slave).");
+		ftpd_client_reply_enqueue(client, "Slaveselection failed (no transfer slave).");
 		
 		FTPD_DBG("couldn't find suitable slave for download");
 		return 0;
 	}
 
 	if(!cnx->ready) {
-		ftpd_client_text_enqueue(client->messages, "Slaveselection failed (chosen slave is not ready).");
+		ftpd_client_reply_enqueue(client, "Slaveselection failed (chosen slave is not ready).");
 		
 		FTPD_DBG("WARNING: chosen slave is NOT ready.");
 		return 0;
@@ -806,7 +1124,7 @@ static unsigned int setup_file_download(struct ftpd_client_ctx *client, struct v
 	client->xfer.last_alive = time_now();
 
 	if(!event_onPreDownload(client, element)) {
-		ftpd_client_text_enqueue(client->messages, "Transfer rejected by external policy.");
+		ftpd_client_reply_enqueue(client, "Transfer rejected by external policy.");
 		
 		client->xfer.uid = -1;
 		collection_delete(element->leechers, client);
@@ -815,6 +1133,13 @@ static unsigned int setup_file_download(struct ftpd_client_ctx *client, struct v
 		client->xfer.element = NULL;
 		return 0;
 	}
+	
+	wheel_schedule(&client->xfer.timer, client->xfer.last_alive + FTPD_XFER_TIMEOUT + 1);
+	stats_link_add(&client->xfer.progress, cnx, client->xfer.uid);
+	slaveselection_update(cnx);
+	
+	/* busy files get copied to more slaves */
+	mirror_hot_hit(element, cnx);
 
 	return 1;
 }
@@ -828,29 +1153,34 @@ static unsigned int setup_file_upload(struct ftpd_client_ctx *client, struct vfs
 
 #ifdef FTPD_STOP_WORKING_TIMESTAMP
 	if((time_now() / 1000) > FTPD_STOP_WORKING_TIMESTAMP) {
-		ftpd_client_text_enqueue(client->messages, "Please visit www.xftpd.com and get a new version!");
+		ftpd_client_reply_enqueue(client, "Please visit www.xftpd.com and get a new version!");
 		return 0;
 	}
 #endif
 
 	element = vfs_find_element(container, file);
 	if(element) {
-		ftpd_client_text_enqueue(client->messages, "Target file already exist.");
+		ftpd_client_reply_enqueue(client, "Target file already exist.");
 
 		//FTPD_DBG("upload can't be set up: file already exists");
 		return 0;
 	}
 
+	if(ftpd_wipe_pending(container)) {
+		ftpd_client_reply_enqueue(client, "Target folder is being deleted.");
+		return 0;
+	}
+
 	cnx = slaveselection_upload(container);
 	if(!cnx) {
-		ftpd_client_text_enqueue(client->messages, "Slaveselection failed (no transfer slave).");
+		ftpd_client_reply_enqueue(client, "Slaveselection failed (no transfer slave).");
 
 		FTPD_DBG("no suitable slave for upload");
 		return 0;
 	}
 
 	if(!cnx->ready) {
-		ftpd_client_text_enqueue(client->messages, "Slaveselection failed (chosen slave is not ready).");
+		ftpd_client_reply_enqueue(client, "Slaveselection failed (chosen slave is not ready).");
 		
 		FTPD_DBG("WARNING: chosen slave is NOT ready.");
 		return 0;
@@ -859,19 +1189,17 @@ static unsigned int setup_file_upload(struct ftpd_client_ctx *client, struct vfs
 	/* create an empty 0-byte file */
 	element = vfs_create_file(container, file, client->username);
 	if(!element) {
-		ftpd_client_text_enqueue(client->messages, "Could not create target file.");
+		ftpd_client_reply_enqueue(client, "Could not create target file.");
 
 		FTPD_DBG("can't create the new file (%s)", file);
 		return 0;
 	}
 
-	nuke_check(element);
-
 	/* Check if the chosen slave's vroot is a parent of 'element' */
 	if(!vfs_is_child(cnx->slave->vroot, element)) {
 		FTPD_DBG("Trying to upload a file outside the scope %s's vroot", cnx->slave->name);
-		ftpd_client_text_enqueue(client->messages, "BUG YOUR SITEOP: CANNOT UPLOAD ON %s AT THIS LOCATION", cnx->slave->name);
-		ftpd_client_text_enqueue(client->messages, "   BECAUSE IT IS OUSIDE THE SCOPE OF ITS VROOT.");
+		ftpd_client_reply_enqueue(client, "BUG YOUR SITEOP: CANNOT UPLOAD ON %s AT THIS LOCATION", cnx->slave->name);
+		ftpd_client_reply_enqueue(client, "   BECAUSE IT IS OUSIDE THE SCOPE OF ITS VROOT.");
 
 		vfs_recursive_delete(element);
 		return 0;
@@ -903,7 +1231,7 @@ static unsigned int setup_file_upload(struct ftpd_client_ctx *client, struct vfs
 	client->xfer.last_alive = time_now();
 
 	if(!event_onPreUpload(client, element)) {
-		ftpd_client_text_enqueue(client->messages, "Transfer rejected by external policy.");
+		ftpd_client_reply_enqueue(client, "Transfer rejected by external policy.");
 		
 		client->xfer.uid = -1;
 		client->xfer.upload = 0;
@@ -914,6 +1242,10 @@ static unsigned int setup_file_upload(struct ftpd_client_ctx *client, struct vfs
 		vfs_recursive_delete(element);
 		return 0;
 	}
+	
+	wheel_schedule(&client->xfer.timer, client->xfer.last_alive + FTPD_XFER_TIMEOUT + 1);
+	stats_link_add(&client->xfer.progress, cnx, client->xfer.uid);
+	slaveselection_update(cnx);
 
 	return 1;
 }
@@ -930,10 +1262,14 @@ void ftpd_client_cleanup_data_connection(struct ftpd_client_ctx *client) {
 		client->xfer.cmd = NULL;
 	}
 
+	wheel_cancel(&client->xfer.timer);
+	stats_link_remove(&client->xfer.progress);
+
 	if(client->xfer.cnx) {
 		/* delete this client from the slave xfer list */
 		if(collection_find(client->xfer.cnx->xfers, client)) {
 			collection_delete(client->xfer.cnx->xfers, client);
+			slaveselection_update(client->xfer.cnx);
 		} else {
 			FTPD_DBG("Client not found in slave's xfers!");
 		}
@@ -944,6 +1280,7 @@ void ftpd_client_cleanup_data_connection(struct ftpd_client_ctx *client) {
 		if(client->xfer.upload) {
 			/* client was uploading: delete the file from vfs */
 			client->xfer.element->uploader = NULL;
+			mirror_tee_complete(client->xfer.element, 0, 0);
 			vfs_recursive_delete(client->xfer.element);
 		} else {
 			/* client was downloading: delete this client from the element xfer list */
@@ -981,6 +1318,7 @@ void ftpd_client_cleanup_data_connection(struct ftpd_client_ctx *client) {
 	client->xfer.restart = 0;
 	client->xfer.upload = 0;
 	client->xfer.xfered = 0;
+	client->xfer.speed = 0;
 	client->xfer.last_alive = 0;
 
 	FTPD_DIALOG_DBG("Dictonnected client at %08x", (int)client);
@@ -988,6 +1326,50 @@ void ftpd_client_cleanup_data_connection(struct ftpd_client_ctx *client) {
 	return;
 }
 
+/* called by the wheel when the slave may have stopped reporting the transfer */
+static void ftpd_client_xfer_timeout(struct ftpd_client_ctx *client) {
+	
+	if(!obj_isvalid(&client->o) || !client->xfer.cnx)
+		return;
+	
+	if(timer(client->xfer.last_alive) > FTPD_XFER_TIMEOUT) {
+		FTPD_DBG("" LLU ": Client xfer timeout reached!", client->xfer.uid);
+		
+		ftpd_client_cleanup_data_connection(client);
+		
+		return;
+	}
+	
+	wheel_schedule(&client->xfer.timer, client->xfer.last_alive + FTPD_XFER_TIMEOUT + 1);
+	
+	return;
+}
+
+/* called by stats.c when the slave reported the transfer's progress */
+static void ftpd_client_xfer_progress(struct stats_link *link) {
+	struct ftpd_client_ctx *client = CONTAINING_RECORD(link, struct ftpd_client_ctx, xfer.progress);
+	
+	/*
+		update the timestamp because the client is xfering
+		and we don't want him to get disconnected
+	*/
+	client->last_timestamp = time_now();
+	
+	/* update the xfered size */
+	client->xfer.xfered = link->xfered;
+	client->xfer.speed = link->speed;
+	client->xfer.last_alive = time_now();
+	
+#ifdef GROW_FILE_SIZES_ON_TRANSFER
+	if(client->xfer.upload && client->xfer.element) {
+		/* set the current file size if the user is uploading it */
+		vfs_set_size(client->xfer.element, client->xfer.xfered);
+	}
+#endif
+	
+	return;
+}
+
 /* p is NULL on timeout and on read error */
 static unsigned int slave_listen_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
 	struct slave_listen_reply *reply;
@@ -1000,7 +1382,7 @@ static unsigned int slave_listen_query_callback(struct slave_connection *cnx, st
 	if(!p) {
 
 		/* the slave couldn't answer/timeout occured */
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"425-Communication error occured.\n"
 			"425 Can't open data connection.\n"
 		);
@@ -1016,7 +1398,7 @@ static unsigned int slave_listen_query_callback(struct slave_connection *cnx, st
 		/* general failure status: slave couldn't listen */
 		
 		/* give its answer to the client */
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"425-The slave explicitly rejected your request\n"
 			"425 Can't open data connection.\n"
 		);
@@ -1032,7 +1414,7 @@ static unsigned int slave_listen_query_callback(struct slave_connection *cnx, st
 		if((p->size - sizeof(struct packet)) < sizeof(struct slave_listen_reply)) {
 			/* protocol error */
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"425-Unknown protocol error.\n"
 				"425 Can't open data connection.\n"
 			);
@@ -1046,7 +1428,7 @@ static unsigned int slave_listen_query_callback(struct slave_connection *cnx, st
 
 		reply = (struct slave_listen_reply *)&p->data;
 		/* listen succeed, tell the client */
-		ftpd_client_text_enqueue(client->messages, "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u).\n",
+		ftpd_client_reply_enqueue(client, "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u).\n",
 			(reply->ip) & 0xff,
 			(reply->ip >> 8) & 0xff,
 			(reply->ip >> 16) & 0xff,
@@ -1059,7 +1441,7 @@ static unsigned int slave_listen_query_callback(struct slave_connection *cnx, st
 	}
 
 	/* protocol error */
-	ftpd_client_text_enqueue(client->messages,
+	ftpd_client_reply_enqueue(client,
 		"425-Unknown protocol error\n"
 		"425 Can't open data connection.\n"
 	);
@@ -1124,7 +1506,7 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 
 	if(!p) {
 		/* the slave couldn't answer/timeout occured */
-		ftpd_client_text_enqueue(client->messages, "426 Requested action aborted.");
+		ftpd_client_reply_enqueue(client, "426 Requested action aborted.");
 
 		/* cleanup data connection */
 		ftpd_client_cleanup_data_connection(client);
@@ -1137,7 +1519,7 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 	for(i=0;i<sizeof(slave_transfer_errors) / sizeof(struct slave_transfer_error_ctx);i++) {
 		if(p->type == slave_transfer_errors[i].error) {
 			event_onTransferFail(client, &client->xfer);
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"425-%s\n"
 				"425 Requested action aborted.\n",
 				slave_transfer_errors[i].message
@@ -1161,7 +1543,7 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 		if((p->size - sizeof(struct packet)) < sizeof(struct slave_transfer_reply)) {
 			/* protocol error */
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"425 Requested action aborted. Unknown protocol error.\n"
 			);
 
@@ -1187,12 +1569,13 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 		client->xfer.xfered = reply->xfersize;
 		client->xfer.checksum = reply->checksum;
 
-		ftpd_client_text_enqueue(client->messages, "Transfer from %s is now complete\n",client->xfer.cnx->slave->name);
+		ftpd_client_reply_enqueue(client, "Transfer from %s is now complete\n",client->xfer.cnx->slave->name);
 
 		if(!event_onTransferSuccess(client, &client->xfer)) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"425-Transfer rejected by external policy (file will be deleted).\n"
 				"425 Requested action aborted.");
+			mirror_tee_complete(client->xfer.element, 0, 0);
 			ftpd_wipe(client->xfer.element);
 			client->xfer.element = NULL;
 			ftpd_client_cleanup_data_connection(client);
@@ -1202,7 +1585,7 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 		/* Transfer is Complete */
 
 		/* give 226 to the client */
-		ftpd_client_text_enqueue(client->messages, "226 Closing data connection.");
+		ftpd_client_reply_enqueue(client, "226 Closing data connection.");
 
 		/* unlink the file from the data context before
 			closing it because if we don't, the file will
@@ -1210,6 +1593,9 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 		if(client->xfer.upload) {
 			client->xfer.element->uploader = NULL;
 
+			/* the replicas that got the same data are now available too */
+			mirror_tee_complete(client->xfer.element, 1, reply->checksum);
+
 			/* if the file was .sfv then request its infos */
 			if((strlen(client->xfer.element->name) > 4) &&
 				!strcasecmp(&client->xfer.element->name[strlen(client->xfer.element->name)-4], ".sfv")) {
@@ -1220,6 +1606,7 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 		} else {
 			/* client was downloading: delete this client from the element xfer list */
 			collection_delete(client->xfer.element->leechers, client);
+			mirror_hot_served(client->xfer.element, cnx, client->xfer.xfered);
 		}
 		client->xfer.element = NULL;
 
@@ -1229,7 +1616,7 @@ static unsigned int slave_transfer_query_callback(struct slave_connection *cnx,
 	}
 
 	/* protocol error */
-	ftpd_client_text_enqueue(client->messages,
+	ftpd_client_reply_enqueue(client,
 		"425-Unknown protocol error.\n"
 		"425 Requested action aborted.\n"
 	);
@@ -1282,6 +1669,7 @@ struct slave_transfer_request *ftpd_transfer(
 	
 	data->use_secure = 0;
 	data->secure_server = 0;
+	data->tees = 0;
 
 	data->xfer_uid = uid;
 	data->ip = ip;
@@ -1312,6 +1700,11 @@ static unsigned int make_slave_transfer_query(struct ftpd_client_ctx *client) {
 	if(client->protection == FTPD_PROTECTION_PRIVATE) {
 		ftpd_secure_transfer(data, client->secure_server /* slave is the server-side for the ssl negotiation */);
 	}
+	
+	if(client->xfer.upload && !client->xfer.restart) {
+		/* the slave copies the upload to the section's replicas while it is received */
+		data->tees = mirror_tee_start(client->xfer.cnx, client->xfer.element, client->xfer.uid);
+	}
 
 	cmd = asynch_new(client->xfer.cnx, IO_SLAVE_TRANSFER, -1, (void*)data, length, slave_transfer_query_callback, client);
 	free(data);
@@ -1340,9 +1733,169 @@ static unsigned int ftpd_wipe_queue_delete_query(struct collection *c, struct sl
 	return 1;
 }
 
+static unsigned int ftpd_wipe_now(struct vfs_element *element);
+static unsigned int ftpd_wipe_from_now(struct vfs_element *element, struct slave_ctx *slave);
+
 static int ftpd_wipe_child(struct collection *c, struct vfs_element *child, void *param) {
 
-	ftpd_wipe(child);
+	ftpd_wipe_now(child);
+
+	return 1;
+}
+
+/* add the content of the folder first, then the folder itself */
+static void ftpd_wipe_collect(struct vfs_element *folder, struct collection *elements);
+
+static int ftpd_wipe_collect_child(struct collection *c, struct vfs_element *child, struct collection *elements) {
+
+	if(child->type == VFS_FOLDER) {
+		ftpd_wipe_collect(child, elements);
+	} else {
+		collection_add(elements, child);
+	}
+
+	return 1;
+}
+
+static void ftpd_wipe_collect(struct vfs_element *folder, struct collection *elements) {
+
+	collection_iterate(folder->childs, (collection_f)ftpd_wipe_collect_child, elements);
+	collection_add(elements, folder);
+
+	return;
+}
+
+static int ftpd_wipe_step(struct job_ctx *job) {
+	struct ftpd_wipe_job *wipe = job->param;
+	struct vfs_element *element;
+	unsigned int i;
+
+	if(wipe->slave && !obj_isvalid(&wipe->slave->o)) {
+		/* the slave was deleted meanwhile */
+		return 0;
+	}
+
+	slave_delete_begin();
+
+	for(i=0;i<FTPD_WIPE_STEP;i++) {
+		element = collection_first(wipe->elements);
+		if(!element) {
+			break;
+		}
+
+		obj_ref(&element->o);
+		collection_delete(wipe->elements, element);
+
+		if(element->type != VFS_FOLDER) {
+			if(!wipe->slave) {
+				ftpd_wipe_now(element);
+			} else {
+				ftpd_wipe_from_now(element, wipe->slave);
+			}
+		} else if(!wipe->slave) {
+			/* its content is already gone */
+			ftpd_wipe_now(element);
+		} else if(!collection_size(element->childs)) {
+			/* its content was done, some of it may remain */
+			vfs_recursive_delete(element);
+		}
+
+		obj_unref(&element->o);
+	}
+
+	slave_delete_end(NULL);
+
+	return collection_size(wipe->elements);
+}
+
+static void ftpd_wipe_cleanup(struct job_ctx *job) {
+	struct ftpd_wipe_job *wipe = job->param;
+
+	obj_destroy(&wipe->o);
+
+	return;
+}
+
+static void ftpd_wipe_job_obj_destroy(struct ftpd_wipe_job *wipe) {
+
+	collectible_destroy(wipe);
+
+	collection_destroy(wipe->elements);
+	wipe->elements = NULL;
+
+	if(wipe->slave) {
+		obj_unref(&wipe->slave->o);
+		wipe->slave = NULL;
+	}
+
+	obj_unref(&wipe->folder->o);
+	wipe->folder = NULL;
+
+	free(wipe);
+
+	return;
+}
+
+/* wipe the folder now if it is small, or start a job to do it */
+static unsigned int ftpd_wipe_folder(struct vfs_element *folder, struct slave_ctx *slave) {
+	struct collection *elements;
+	struct ftpd_wipe_job *wipe;
+	struct job_ctx *job;
+	char *name;
+
+	elements = collection_new(C_NONE);
+	if(!elements) {
+		FTPD_DBG("Memory error");
+		return 0;
+	}
+
+	ftpd_wipe_collect(folder, elements);
+
+	if(collection_size(elements) <= FTPD_WIPE_INLINE) {
+		collection_destroy(elements);
+		return slave ? ftpd_wipe_from_now(folder, slave) : ftpd_wipe_now(folder);
+	}
+
+	wipe = malloc(sizeof(struct ftpd_wipe_job));
+	if(!wipe) {
+		FTPD_DBG("Memory error");
+		collection_destroy(elements);
+		return 0;
+	}
+
+	obj_init(&wipe->o, wipe, (obj_f)ftpd_wipe_job_obj_destroy);
+	collectible_init(wipe);
+
+	wipe->folder = folder;
+	obj_ref(&folder->o);
+	wipe->elements = elements;
+	wipe->slave = slave;
+	if(slave) {
+		obj_ref(&slave->o);
+	}
+
+	if(!collection_add(ftpd_wipes, wipe)) {
+		FTPD_DBG("Collection error");
+		obj_destroy(&wipe->o);
+		return 0;
+	}
+
+	name = slave ? bprintf("wipe %s from %s", folder->name, slave->name) : bprintf("wipe %s", folder->name);
+	if(!name) {
+		FTPD_DBG("Memory error");
+		obj_destroy(&wipe->o);
+		return 0;
+	}
+
+	job = job_new(name, JOB_PRIORITY_NORMAL, ftpd_wipe_step, ftpd_wipe_cleanup, wipe);
+	free(name);
+	if(!job) {
+		FTPD_DBG("Could not start the wipe job");
+		obj_destroy(&wipe->o);
+		return 0;
+	}
+
+	FTPD_DBG("Wiping %u elements of %s in background", collection_size(elements), folder->name);
 
 	return 1;
 }
@@ -1350,7 +1903,9 @@ static int ftpd_wipe_child(struct collection *c, struct vfs_element *child, void
 /*
 	Wipe an element from the vfs and from all slaves it's available from.
 	the element may be a folder, in wich case all its childs
-	will get deleted.
+	will get deleted. Big folders are wiped by a background job and
+	remain visible until it completes, nothing can be created in
+	them meanwhile.
 */
 unsigned int ftpd_wipe(struct vfs_element *element) {
 
@@ -1359,8 +1914,20 @@ unsigned int ftpd_wipe(struct vfs_element *element) {
 		return 0;
 	}
 
+	if(element->type == VFS_FOLDER) {
+		return ftpd_wipe_folder(element, NULL);
+	}
+
+	return ftpd_wipe_now(element);
+}
+
+static unsigned int ftpd_wipe_now(struct vfs_element *element) {
+
 	obj_ref(&element->o);
 	
+	/* one delete query per slave for the whole wipe */
+	slave_delete_begin();
+	
 	//VFS_DBG("Wiping element(%08x) %s\\%s", (int)element, element->parent ? element->parent->name : "", element->name);
 	
 	if(element->type == VFS_FOLDER) {
@@ -1377,6 +1944,9 @@ unsigned int ftpd_wipe(struct vfs_element *element) {
 		/* queue the delete query for all slaves from wich it is unavailable */
 		collection_iterate(element->offline_from, (collection_f)ftpd_wipe_queue_delete_query, element);
 	}
+	
+	/* send the queries while the folder can still be located */
+	slave_delete_end((element->type == VFS_FOLDER) ? element : NULL);
 
 	/* delete the element */
 	vfs_recursive_delete(element);
@@ -1416,7 +1986,7 @@ static unsigned int ftpd_wipe_from_queue_delete_query(struct collection *c, stru
 
 static int ftpd_wipe_from_child(struct collection *c, struct vfs_element *child, struct slave_ctx *slave) {
 
-	ftpd_wipe_from(child, slave);
+	ftpd_wipe_from_now(child, slave);
 
 	return 1;
 }
@@ -1430,7 +2000,17 @@ unsigned int ftpd_wipe_from(struct vfs_element *element, struct slave_ctx *slave
 
 	if(!element) return 0;
 
+	if(element->type == VFS_FOLDER) {
+		return ftpd_wipe_folder(element, slave);
+	}
+
+	return ftpd_wipe_from_now(element, slave);
+}
+
+static unsigned int ftpd_wipe_from_now(struct vfs_element *element, struct slave_ctx *slave) {
+
 	obj_ref(&element->o);
+	slave_delete_begin();
 	
 	if(element->type == VFS_FOLDER) {
 
@@ -1459,6 +2039,7 @@ unsigned int ftpd_wipe_from(struct vfs_element *element, struct slave_ctx *slave
 		}
 	}
 
+	slave_delete_end(NULL);
 	obj_unref(&element->o);
 
 	return 1;
@@ -1529,7 +2110,7 @@ int ftpd_client_data_write(int fd, struct ftpd_client_ctx *client) {
 
 	collection_iterate(client->data_ctx.data, (collection_f)get_data_length, &length);
 	if(!length) {
-		ftpd_client_text_enqueue(client->messages, "226 Closing data connection.");
+		ftpd_client_reply_enqueue(client, "226 Closing data connection.");
 		ftpd_client_cleanup_data_connection(client);
 		return 0;
 	}
@@ -1556,7 +2137,7 @@ int ftpd_client_data_close(int fd, struct ftpd_client_ctx *client) {
 	
 	FTPD_DIALOG_DBG("Data connection closed gracefully.");
 
-	ftpd_client_text_enqueue(client->messages, "226 Closing data connection.");
+	ftpd_client_reply_enqueue(client, "226 Closing data connection.");
 	ftpd_client_cleanup_data_connection(client);
 
 	return 1;
@@ -1568,7 +2149,7 @@ int ftpd_client_data_error(int fd, struct ftpd_client_ctx *client) {
 	
 	FTPD_DBG("Data connection closed with error.");
 
-	ftpd_client_text_enqueue(client->messages, "425 Can't open data connection (socket error).");
+	ftpd_client_reply_enqueue(client, "425 Can't open data connection (socket error).");
 	ftpd_client_cleanup_data_connection(client);
 	
 	FTPD_DBG("Data connection was cleaned up.");
@@ -1580,7 +2161,7 @@ int ftpd_client_data_write_timeout(struct ftpd_client_ctx *client) {
 	
 	FTPD_DBG("Data write timed out");
 	
-	ftpd_client_text_enqueue(client->messages, "425 Can't open data connection (timed out).");
+	ftpd_client_reply_enqueue(client, "425 Can't open data connection (timed out).");
 	ftpd_client_cleanup_data_connection(client);
 	
 	return 0;
@@ -1590,7 +2171,7 @@ int ftpd_client_data_connect_timeout(struct ftpd_client_ctx *client) {
 	
 	FTPD_DBG("Data connection timed out");
 	
-	ftpd_client_text_enqueue(client->messages, "425 Can't open data connection (timed out).");
+	ftpd_client_reply_enqueue(client, "425 Can't open data connection (timed out).");
 	ftpd_client_cleanup_data_connection(client);
 	
 	return 0;
@@ -1682,7 +2263,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 	switch(*command) {
 	case CMD_USERNAME:
 	case CMD_PASSWORD:
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"503-You are already logged in.\n"
 			"503 Bad sequence of commands.\n"
 		);
@@ -1692,13 +2273,13 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 
 		FTPD_DIALOG_DBG("[%08x] CMD_SYSTEM", (int)client);
 
-		ftpd_client_text_enqueue(client->messages, "215 UNIX Type: L8.");
+		ftpd_client_reply_enqueue(client, "215 UNIX Type: L8.");
 		break;
 	case CMD_FEATURES:
 		
 		FTPD_DIALOG_DBG("[%08x] CMD_FEATURES", (int)client);
 
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"211-Extension supported:\n"
 			" CLNT\n"
 			" SIZE\n"
@@ -1718,7 +2299,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		FTPD_DIALOG_DBG("[%08x] CMD_CLIENT (%s)", (int)client, Pointer);
 
 		/* WE DON'T CARE, but thanks anyway */
-		ftpd_client_text_enqueue(client->messages, "200 Noted.");
+		ftpd_client_reply_enqueue(client, "200 Noted.");
 		break;
 	case CMD_SITE:
 /*
@@ -1730,12 +2311,12 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		FTPD_DIALOG_DBG("[%08x] CMD_SITE (%s)", (int)client, Pointer);
 
 		if(site_handle(client, Pointer)) {
-			ftpd_client_text_enqueue(client->messages, "200 Command OK.\n");
+			ftpd_client_reply_enqueue(client, "200 Command OK.\n");
 		} else {
-			ftpd_client_text_enqueue(client->messages, "500 One or more error occured.\n");
+			ftpd_client_reply_enqueue(client, "500 One or more error occured.\n");
 		}
 		/*
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"202-No SITE command supported yet.\n"
 			"202 Command not implemented, superfluous at this site.\n"
 		);
@@ -1756,7 +2337,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		/* do not accept AUTH ? */
 		if(ftpd_secure_control_type == FTPD_SECURE_NEVER) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"500-You cannot authenticate.\n"
 				"500 Syntax error, command unrecognized.\n"
 			);
@@ -1764,7 +2345,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		}
 		if(ftpd_secure_control_type == FTPD_SECURE_IMPLICIT) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You do not need to authenticate.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -1774,7 +2355,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		/* already sent AUTH ? */
 		if(client->auth != FTPD_AUTH_NONE) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You already sent AUTH.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -1785,7 +2366,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		client->auth = FTPD_AUTH_SSL_OR_TLS;
 		client->ssl_waiting = 1;
 		
-		ftpd_client_text_enqueue(client->messages, "234 Using secure connection.");
+		ftpd_client_reply_enqueue(client, "234 Using secure connection.");
 		
 		return 1;
 		
@@ -1801,7 +2382,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 			}
 		}
 		
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"200 SSCN:%s METHOD\n", client->secure_server ? "SERVER" : "CLIENT"
 		);
 		
@@ -1811,7 +2392,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		
 		/* client cannot use this command without AUTH */
 		if(client->auth != FTPD_AUTH_SSL_OR_TLS) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You cannot use PBSZ before AUTH.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -1819,12 +2400,12 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		}
 		
 		if(!strcasecmp(Pointer, "0")) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200 Protection Buffer Size set to 0\n"
 			);
 		}
 		else {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"501 This server only accept \"PBSZ 0\"\n"
 			);
 		}
@@ -1836,7 +2417,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		/*
 		PBSZ must be sent before PROT at any time, so it's wrong to check this here
 		if(client->last_command != CMD_PROTECTION_BUFFER_SIZE) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You must sent PBSZ before PROT.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -1845,7 +2426,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		
 		/* client cannot use this command without AUTH */
 		if(client->auth != FTPD_AUTH_SSL_OR_TLS) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You cannot use PROT before AUTH.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -1854,7 +2435,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		
 		/* set Private protection */
 		if(*Pointer == 'P') {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200 Protection set to Private.\n"
 			);
 			client->protection = FTPD_PROTECTION_PRIVATE;
@@ -1862,14 +2443,14 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		
 		/* set Clear protection */
 		else if(*Pointer == 'C') {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200 Protection set to Clear.\n"
 			);
 			client->protection = FTPD_PROTECTION_CLEAR;
 		}
 		
 		else {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"501 Unknown protection type.\n"
 			);
 		}
@@ -1879,7 +2460,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		FTPD_DIALOG_DBG("[%08x] CMD_CLEAR_COMMAND_CHANNEL", (int)client);
 		
 		if(client->auth != FTPD_AUTH_SSL_OR_TLS) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"533 Control connection is not protected.\n"
 			);
 			return 1;
@@ -1887,14 +2468,14 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		
 		/* auth-only connections cannot be unprotected */
 		if((ftpd_secure_control_type == FTPD_SECURE_ALWAYS) || (ftpd_secure_control_type == FTPD_SECURE_IMPLICIT) || ftpd_secure_no_drop) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"534 Control connection cannot be cleared.\n"
 			);
 			return 1;
 		}
 		
 		/*
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"200 Command Channel Cleared.\n"
 		);
 		
@@ -1902,7 +2483,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		client->ssl_waiting = 1;
 		*/
 		
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"534 Control connection cannot be cleared.\n"
 		);
 		
@@ -1918,7 +2499,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 *******************************************/
 	case CMD_ACCOUNT:
 		FTPD_DIALOG_DBG("[%08x] CMD_ACCOUNT (%s)", (int)client, Pointer);
-		ftpd_client_text_enqueue(client->messages, 
+		ftpd_client_reply_enqueue(client, 
 			"202-No account needed.\n"
 			"202 Command not implemented, superfluous at this site.\n"
 		);
@@ -1926,7 +2507,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		break;
 	case CMD_STRUCTURE_MOUNT:
 		FTPD_DIALOG_DBG("[%08x] CMD_STRUCTURE_MOUNT (%s)", (int)client, Pointer);
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"202-Intentionally left unsupported: coder too lazy.\n"
 			"202 Command not implemented, superfluous at this site.\n"
 		);
@@ -1934,7 +2515,7 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		break;
 	case CMD_REINITIALIZE:
 		FTPD_DIALOG_DBG("[%08x] CMD_REINITIALIZE", (int)client);
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"502-Intentionally left unsupported: coder too lazy.\n"
 			"502 Command not implemented.\n"
 		);
@@ -1942,27 +2523,27 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		break;
 	case CMD_STORE_UNIQUE:
 		FTPD_DIALOG_DBG("[%08x] CMD_STORE_UNIQUE", (int)client);
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"450-You must specify a filename.\n"
 			"450 Requested file action not taken.\n"
 		);
 		break;
 	case CMD_STATUS:
 		FTPD_DIALOG_DBG("[%08x] CMD_STATUS (%s)", (int)client, (Pointer ? Pointer : ""));
-		ftpd_client_text_enqueue(client->messages, "211 Server status is OK.");
+		ftpd_client_reply_enqueue(client, "211 Server status is OK.");
 		break;
 	case CMD_HELP:
 		FTPD_DIALOG_DBG("[%08x] CMD_HELP (%s)", (int)client, (Pointer ? Pointer : ""));
 		/* tell the user to read the famous manual */
-		ftpd_client_text_enqueue(client->messages, "214 RTFM");
+		ftpd_client_reply_enqueue(client, "214 RTFM");
 		break;
 	case CMD_NO_OPERATION:
 		FTPD_DIALOG_DBG("[%08x] CMD_NO_OPERATION", (int)client);
-		ftpd_client_text_enqueue(client->messages, "200 Command okay.");
+		ftpd_client_reply_enqueue(client, "200 Command okay.");
 		break;
 	case CMD_ALLOCATE:
 		FTPD_DIALOG_DBG("[%08x] CMD_ALLOCATE (%s)", (int)client, Pointer);
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"202-No allocation needed. You should begin transfer right away.\n"
 			"202 Command not implemented, superfluous at this site.\n"
 		);
@@ -2003,10 +2584,10 @@ static unsigned int ftpd_client_parse_logged_input(struct ftpd_client_ctx *clien
 		}
 
 //__type_error:
-		ftpd_client_text_enqueue(client->messages, "504 Command not implemented for that parameter.");
+		ftpd_client_reply_enqueue(client, "504 Command not implemented for that parameter.");
 		break;
 __type_success:
-		ftpd_client_text_enqueue(client->messages, "200 Command okay.");
+		ftpd_client_reply_enqueue(client, "200 Command okay.");
 		break;
 	case CMD_FILE_STRUCTURE:
 /*
@@ -2038,10 +2619,10 @@ __type_success:
 		}*/
 
 __structure_error:
-		ftpd_client_text_enqueue(client->messages, "504 Command not implemented for that parameter.");
+		ftpd_client_reply_enqueue(client, "504 Command not implemented for that parameter.");
 		break;
 __structure_success:
-		ftpd_client_text_enqueue(client->messages, "200 Command okay.");
+		ftpd_client_reply_enqueue(client, "200 Command okay.");
 		break;
 	case CMD_TRANSFER_MODE:
 /*
@@ -2073,10 +2654,10 @@ __structure_success:
 		}*/
 
 __mode_error:
-		ftpd_client_text_enqueue(client->messages, "504 Command not implemented for that parameter.");
+		ftpd_client_reply_enqueue(client, "504 Command not implemented for that parameter.");
 		break;
 __mode_success:
-		ftpd_client_text_enqueue(client->messages, "200 Command okay.");
+		ftpd_client_reply_enqueue(client, "200 Command okay.");
 		break;
 
 /*******************************************
@@ -2099,7 +2680,7 @@ __mode_success:
 
 			directory = vfs_get_relative_path(vfs_root, client->working_directory);
 			if(directory) {
-				ftpd_client_text_enqueue(client->messages, "257 \"%s\" is current directory\n", directory);
+				ftpd_client_reply_enqueue(client, "257 \"%s\" is current directory\n", directory);
 				free(directory);
 			} else {
 				return 0;
@@ -2125,12 +2706,12 @@ __mode_success:
 				*command = CMD_NO_OPERATION;
 
 				if(!event_onPreChangeDir(client, client->working_directory)) {
-					ftpd_client_text_enqueue(client->messages, "550-CWD rejected by external policy.\n"
+					ftpd_client_reply_enqueue(client, "550-CWD rejected by external policy.\n"
 												"550 Requested action not taken.");
 					break;
 				}
 
-				ftpd_client_text_enqueue(client->messages, "250 Requested file action okay, completed.");
+				ftpd_client_reply_enqueue(client, "250 Requested file action okay, completed.");
 				break;
 			}
 
@@ -2141,14 +2722,14 @@ __mode_success:
 
 			newdir = vfs_find_element(container, Pointer);
 			if(!newdir || (newdir->type != VFS_FOLDER)) {
-				ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+				ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 				break;
 			}
 
 			obj_ref(&newdir->o);
 
 			if(!event_onPreChangeDir(client, newdir)) {
-				ftpd_client_text_enqueue(client->messages, "550-CWD rejected by external policy.\n"
+				ftpd_client_reply_enqueue(client, "550-CWD rejected by external policy.\n"
 											"550 Requested action not taken.");
 
 				obj_unref(&newdir->o);
@@ -2173,7 +2754,7 @@ __mode_success:
 			}
 			client->working_directory = newdir;
 
-			ftpd_client_text_enqueue(client->messages, "250 Requested file action okay, completed.");
+			ftpd_client_reply_enqueue(client, "250 Requested file action okay, completed.");
 			event_onChangeDir(client, client->working_directory);
 			obj_unref(&newdir->o);
 		}
@@ -2189,7 +2770,7 @@ __mode_success:
 
 		if(client->working_directory->parent) {
 			if(!event_onPreChangeDir(client, client->working_directory->parent)) {
-				ftpd_client_text_enqueue(client->messages, "550-CWD rejected by external policy.\n"
+				ftpd_client_reply_enqueue(client, "550-CWD rejected by external policy.\n"
 											"550 Requested action not taken.");
 				break;
 			}
@@ -2205,7 +2786,7 @@ __mode_success:
 			client->working_directory = client->working_directory->parent;
 		}
 
-		ftpd_client_text_enqueue(client->messages, "250 Requested file action okay, completed.");
+		ftpd_client_reply_enqueue(client, "250 Requested file action okay, completed.");
 
 		event_onChangeDir(client, client->working_directory);
 
@@ -2228,27 +2809,27 @@ __mode_success:
 
 			element = vfs_find_element(container, Pointer);
 			if(!element) {
-				ftpd_client_text_enqueue(client->messages, "550-Could not find directory.");
-				ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+				ftpd_client_reply_enqueue(client, "550-Could not find directory.");
+				ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 				break;
 			}
 
 			if(element->type != VFS_FOLDER) {
-				ftpd_client_text_enqueue(client->messages, "550-This is not a directory.");
-				ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+				ftpd_client_reply_enqueue(client, "550-This is not a directory.");
+				ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 				break;
 			}
 
 			if(collection_size(element->childs)) {
-				ftpd_client_text_enqueue(client->messages, "550-This directory is not empty.");
-				ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+				ftpd_client_reply_enqueue(client, "550-This directory is not empty.");
+				ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 				break;
 			}
 
 			obj_ref(&element->o);
 
 			if(!event_onPreRemoveDir(client, element)) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"550-RMD rejected by external policy.\n"
 					"550 Requested action not taken."
 				);
@@ -2260,9 +2841,9 @@ __mode_success:
 			event_onRemoveDir(client, element);
 
 			if(!vfs_recursive_delete(element)) {
-				ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+				ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 			} else {
-				ftpd_client_text_enqueue(client->messages, "250 Requested file action okay, completed.");
+				ftpd_client_reply_enqueue(client, "250 Requested file action okay, completed.");
 			}
 			
 
@@ -2288,8 +2869,8 @@ __mode_success:
 
 			newdir = vfs_find_element(container, Pointer);
 			if(newdir) {
-				ftpd_client_text_enqueue(client->messages, "550-Directory already exist.");
-				ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+				ftpd_client_reply_enqueue(client, "550-Directory already exist.");
+				ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 				break;
 			}
 
@@ -2308,7 +2889,7 @@ __mode_success:
 
 				trimmedname = vfs_trim_name(Pointer);
 				if(!trimmedname) {
-					ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+					ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 					break;
 				}
 
@@ -2323,19 +2904,25 @@ __mode_success:
 					newdir = vfs_find_element(container, ptr);
 					if(!newdir) {
 
+						if(ftpd_wipe_pending(container)) {
+							ftpd_client_reply_enqueue(client,
+								"550-Target folder is being deleted.\n"
+								"550 Requested action not taken.\n"
+							);
+							break;
+						}
+
 						/* Directory does not exist, process with onPreMakeDir and onMakeDir */
 
 						newdir = vfs_create_folder(container, ptr, client->username);
 						if(!newdir) {
-							ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+							ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 							break;
 						} else {
 							obj_ref(&newdir->o);
 
-							nuke_check(newdir);
-
 							if(!event_onPreMakeDir(client, newdir)) {
-								ftpd_client_text_enqueue(client->messages,
+								ftpd_client_reply_enqueue(client,
 									"550-MKD rejected by external policy.\n"
 									"550 Requested action not taken.\n"
 								);
@@ -2344,7 +2931,7 @@ __mode_success:
 								break;
 							}
 							vfs_modify(newdir, time_now());
-							ftpd_client_text_enqueue(client->messages, "250 Requested file action okay, completed.");
+							ftpd_client_reply_enqueue(client, "250 Requested file action okay, completed.");
 							event_onMakeDir(client, newdir);
 
 							obj_unref(&newdir->o);
@@ -2370,8 +2957,8 @@ __mode_success:
 */
 		FTPD_DIALOG_DBG("[%08x] CMD_RENAME_FROM (%s)", (int)client, Pointer);
 
-		ftpd_client_text_enqueue(client->messages, "550-You should not move that.");
-		ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+		ftpd_client_reply_enqueue(client, "550-You should not move that.");
+		ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 		break;
 	case CMD_RENAME_TO:
 /*
@@ -2382,8 +2969,8 @@ __mode_success:
 */
 		FTPD_DIALOG_DBG("[%08x] CMD_RENAME_TO (%s)", (int)client, Pointer);
 
-		ftpd_client_text_enqueue(client->messages, "550-You should not move that.");
-		ftpd_client_text_enqueue(client->messages, "550 Requested action not taken.");
+		ftpd_client_reply_enqueue(client, "550-You should not move that.");
+		ftpd_client_reply_enqueue(client, "550 Requested action not taken.");
 
 		break;
 
@@ -2410,13 +2997,13 @@ __mode_success:
 
 			element = vfs_find_element(container, Pointer);
 			if(!element || element->type != VFS_FILE) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"550 No such file.\n"
 				);
 				break;
 			}
 
-			ftpd_client_text_enqueue(client->messages, "213 " LLU "\n", element->size);
+			ftpd_client_reply_enqueue(client, "213 " LLU "\n", element->size);
 		}
 
 		break;
@@ -2436,7 +3023,7 @@ __mode_success:
 
 			client->xfer.restart = i;
 
-			ftpd_client_text_enqueue(client->messages, "350 Requested file action pending further information.");
+			ftpd_client_reply_enqueue(client, "350 Requested file action pending further information.");
 		}
 
 		break;
@@ -2466,12 +3053,12 @@ __mode_success:
 			/* process the command, depending ... */
 			if(!strncasecmp(Pointer, "LIST", 4) || !strncasecmp(Pointer, "NLST", 4)) {
 				/* not needed but reply something gentle anyway */
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"200 OK, next transfer will be from master.\n"
 				);
 				break;
 			} else if(!strncasecmp(Pointer, "APPE", 4)) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"550 Requested action not taken. APPE is not acceptable.\n"
 				);
 				break;
@@ -2481,7 +3068,7 @@ __mode_success:
 				/* skip the first param */
 				Pointer = strchr(Pointer,' ');
 				if(!Pointer) {
-					ftpd_client_text_enqueue(client->messages,
+					ftpd_client_reply_enqueue(client,
 						"503-Bad sequence of commands. You should use PRET <RETR/STOR> <file>\n"
 					);
 					break;
@@ -2490,7 +3077,7 @@ __mode_success:
 
 				/* fill the struct xfer_client assigned to the client */
 				if(!setup_file_download(client, container, Pointer)) {
-					ftpd_client_text_enqueue(client->messages,
+					ftpd_client_reply_enqueue(client,
 						"550 Requested action not taken. File operation error occured.\n"
 					);
 					break;
@@ -2499,7 +3086,7 @@ __mode_success:
 				client->slave_xfer = 1;
 
 				/* give 200 to the client */
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"200 OK, next transfer will be from %s.\n", client->xfer.cnx->slave->name
 				);
 
@@ -2510,7 +3097,7 @@ __mode_success:
 				/* skip the first param */
 				Pointer = strchr(Pointer,' ');
 				if(!Pointer) {
-					ftpd_client_text_enqueue(client->messages,
+					ftpd_client_reply_enqueue(client,
 						"503 Bad sequence of commands. You should use PRET <RETR/STOR> <file>\n"
 					);
 					break;
@@ -2519,7 +3106,7 @@ __mode_success:
 
 				/* fill the struct xfer_client assigned to the client */
 				if(!setup_file_upload(client, container, Pointer)) {
-					ftpd_client_text_enqueue(client->messages,
+					ftpd_client_reply_enqueue(client,
 						"550 Requested action not taken. File operation error occured.\n"
 					);
 					break;
@@ -2528,12 +3115,12 @@ __mode_success:
 				client->slave_xfer = 1;
 
 				/* give 200 to the client */
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"200 OK, next transfer will be from %s.\n", client->xfer.cnx->slave->name
 				);
 			} else {
 				/* unknown PRET command */
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"503 Bad sequence of commands. Supported arguments for PRET are RETR/STOR.\n"
 				);
 				break;
@@ -2560,13 +3147,13 @@ __mode_success:
 		
 		if(client->data_ctx.fd != -1) {
 			//FTPD_DBG("Broken FTP client, tries to open multiple connections...");
-			//ftpd_client_text_enqueue(client->messages, "Broken FTP client.\n");
+			//ftpd_client_reply_enqueue(client, "Broken FTP client.\n");
 			ftpd_client_cleanup_data_connection(client);
 		}
 
 		/*if(client->last_command == CMD_PASSIVE) {
 			FTPD_DBG("Client sent CMD_PASSIVE twice!");
-			ftpd_client_text_enqueue(client->messages, "Your broken FTP client sent PASV twice in a row.\n");
+			ftpd_client_reply_enqueue(client, "Your broken FTP client sent PASV twice in a row.\n");
 		}*/
 
 		if(client->slave_xfer) {
@@ -2580,7 +3167,7 @@ __mode_success:
 			/* the callback will give its answer to the client */
 			/* the callback will set client->xfer.ready */
 			if(!make_slave_listen_query(client)) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"425-Internal memory error.\n"
 					"425 Can't open data connection.\n"
 				);
@@ -2602,8 +3189,8 @@ __mode_success:
 					I cannot figure a good goddamn reason why ...
 				*/
 				FTPD_DBG("ERROR: socket is not invalid!");
-				ftpd_client_text_enqueue(client->messages, "Your broken client fucking sent PASV twice in a row.\n");
-				ftpd_client_text_enqueue(client->messages, "425 Can't open data connection.");
+				ftpd_client_reply_enqueue(client, "Your broken client fucking sent PASV twice in a row.\n");
+				ftpd_client_reply_enqueue(client, "425 Can't open data connection.");
 				ftpd_client_cleanup_data_connection(client);
 				return 1;
 			}
@@ -2613,7 +3200,7 @@ __mode_success:
 			ip = socket_local_address(client->fd);
 			port = ftpd_get_next_data_port();
 
-			ftpd_client_text_enqueue(client->messages, "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u).\n",
+			ftpd_client_reply_enqueue(client, "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u).\n",
 				(ip) & 0xff,
 				(ip >> 8) & 0xff,
 				(ip >> 16) & 0xff,
@@ -2627,7 +3214,7 @@ __mode_success:
 
 			if(client->data_ctx.fd == -1) {
 				FTPD_DBG("Could not create listening socket for data connection");
-				ftpd_client_text_enqueue(client->messages, "425 Can't open data connection.");
+				ftpd_client_reply_enqueue(client, "425 Can't open data connection.");
 				ftpd_client_cleanup_data_connection(client);
 				break;
 			}
@@ -2667,7 +3254,7 @@ __mode_success:
 
 		if(client->data_ctx.fd != -1) {
 			//FTPD_DBG("Broken FTP client, tries to open multiple connections...");
-			//ftpd_client_text_enqueue(client->messages, "Broken FTP client.\n");
+			//ftpd_client_reply_enqueue(client, "Broken FTP client.\n");
 			ftpd_client_cleanup_data_connection(client);
 		}
 
@@ -2740,7 +3327,7 @@ __mode_success:
 			client->port  = (p2);
 			client->port |= (p1 << 8);
 
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"200-Will use data host %u.%u.%u.%u on port %u\n"
 				"200 Command okay.\n",
 				(client->ip) & 0xff,
@@ -2752,7 +3339,7 @@ __mode_success:
 			break;
 		}
 __port_error:
-		ftpd_client_text_enqueue(client->messages, "501 Syntax error in parameters or arguments.");
+		ftpd_client_reply_enqueue(client, "501 Syntax error in parameters or arguments.");
 		break;
 	case CMD_LIST:
 	{
@@ -2768,7 +3355,7 @@ __port_error:
 		FTPD_DIALOG_DBG("[%08x] CMD_LIST (%s)", (int)client, (Pointer ? Pointer : ""));
 
 		if((client->last_command != CMD_DATA_PORT) && (client->last_command != CMD_PASSIVE)) {
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"503-You should have done PORT/PASV before LIST.\n"
 				"503 Bad sequence of commands.\n"
 			);
@@ -2787,7 +3374,7 @@ __port_error:
 		if((client->protection == FTPD_PROTECTION_CLEAR) &&
 			(ftpd_secure_data_type == FTPD_SECURE_ALWAYS)) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"521-Data protection is Clear while it should be Private.\n"
 				"521-Server policy need SECURE data transfers.\n"
 				"521 Data connection cannot be opened with this PROT setting.\n"
@@ -2801,7 +3388,7 @@ __port_error:
 		if((client->protection == FTPD_PROTECTION_PRIVATE) &&
 			(ftpd_secure_data_type == FTPD_SECURE_NEVER)) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"521-Data protection is Clear while it should be Private.\n"
 				"521-Server policy DOES NOT accept SECURE data transfers.\n"
 				"521 Data connection cannot be opened with this PROT setting.\n"
@@ -2822,7 +3409,7 @@ __port_error:
 
 			element = vfs_find_element(container, Pointer);
 			if(!element || (element->type != VFS_FOLDER)) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"450-Target directory does not exist.\n"
 					"450 Requested file action not taken.\n"
 				);
@@ -2836,8 +3423,8 @@ __port_error:
 		if(!client->passive) {
 			if(client->data_ctx.fd != -1) {
 				//FTPD_DBG("ERROR: socket not -1");
-				//ftpd_client_text_enqueue(client->messages, "425 You have a broken FTP client.");
-				ftpd_client_text_enqueue(client->messages, "425 Can't open data connection.");
+				//ftpd_client_reply_enqueue(client, "425 You have a broken FTP client.");
+				ftpd_client_reply_enqueue(client, "425 Can't open data connection.");
 				ftpd_client_cleanup_data_connection(client);
 				break;
 			}
@@ -2846,7 +3433,7 @@ __port_error:
 			client->data_ctx.fd = connect_to_ip_non_blocking(client->ip, client->port);
 
 			if(client->data_ctx.fd == -1) {
-				ftpd_client_text_enqueue(client->messages, "425 Can't open data connection.");
+				ftpd_client_reply_enqueue(client, "425 Can't open data connection.");
 				ftpd_client_cleanup_data_connection(client);
 				break;
 			}
@@ -2865,10 +3452,10 @@ __port_error:
 					(signal_f)ftpd_client_data_close, client);
 			}
 			
-			ftpd_client_text_enqueue(client->messages, "150 File status okay; about to open data connection.");
+			ftpd_client_reply_enqueue(client, "150 File status okay; about to open data connection.");
 		}
 		else {
-			ftpd_client_text_enqueue(client->messages, "125 Data connection already open; transfer starting.");
+			ftpd_client_reply_enqueue(client, "125 Data connection already open; transfer starting.");
 		}
 
 		/* store the whole list to be transfered */
@@ -2895,7 +3482,7 @@ __port_error:
 */
 		FTPD_DIALOG_DBG("[%08x] CMD_NAME_LIST (%s)", (int)client, (Pointer ? Pointer : ""));
 
-		ftpd_client_text_enqueue(client->messages,
+		ftpd_client_reply_enqueue(client,
 			"425 NLST is not supported.\n"
 		);
 
@@ -2919,7 +3506,7 @@ __port_error:
 
 		if(client->passive && !client->slave_xfer) {
 			/* can't use RETR if PRET was not done */
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"425-You should have done PRET before STOR.\n"
 				"425-******************************************\n"
 				"425-**** If your client does not support\n"
@@ -2934,7 +3521,7 @@ __port_error:
 		if((client->protection == FTPD_PROTECTION_CLEAR) &&
 			(ftpd_secure_data_type == FTPD_SECURE_ALWAYS)) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"521-Data protection is Clear while it should be Private.\n"
 				"521-Server policy need SECURE data transfers.\n"
 				"521 Data connection cannot be opened with this PROT setting.\n"
@@ -2948,7 +3535,7 @@ __port_error:
 		if((client->protection == FTPD_PROTECTION_PRIVATE) &&
 			(ftpd_secure_data_type == FTPD_SECURE_NEVER)) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"521-Data protection is Clear while it should be Private.\n"
 				"521-Server policy DOES NOT accept SECURE data transfers.\n"
 				"521 Data connection cannot be opened with this PROT setting.\n"
@@ -2985,19 +3572,19 @@ __port_error:
 			/* tell the slave to start sending data */
 			if(!make_slave_transfer_query(client)) {
 				FTPD_DBG("Could not make the slave transfer query");
-				ftpd_client_text_enqueue(client->messages, "Could not make the transfer query to the slave\n", Pointer);
+				ftpd_client_reply_enqueue(client, "Could not make the transfer query to the slave\n", Pointer);
 				goto __retr_error;
 			}
 			
 			/*if(client->passive)
-				ftpd_client_text_enqueue(client->messages, "125 Data connection already open; transfer starting.");
+				ftpd_client_reply_enqueue(client, "125 Data connection already open; transfer starting.");
 			else*/
-				ftpd_client_text_enqueue(client->messages, "150 Opening ASCII mode data connection for %s from %s\r\n", Pointer, client->xfer.cnx->slave->name);
+				ftpd_client_reply_enqueue(client, "150 Opening ASCII mode data connection for %s from %s\r\n", Pointer, client->xfer.cnx->slave->name);
 		}
 
 		break;
 __retr_error:
-		ftpd_client_text_enqueue(client->messages, "425 Can't open data connection.");
+		ftpd_client_reply_enqueue(client, "425 Can't open data connection.");
 		ftpd_client_cleanup_data_connection(client);
 		break;
 	case CMD_STORE:
@@ -3017,7 +3604,7 @@ __retr_error:
 
 		if(client->passive && !client->slave_xfer) {
 			/* can't use STOR if PRET was not done */
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"425-You should have done PRET before STOR.\n"
 				"425-******************************************\n"
 				"425-**** If your client does not support  ****\n"
@@ -3033,7 +3620,7 @@ __retr_error:
 		if((client->protection == FTPD_PROTECTION_CLEAR) &&
 			(ftpd_secure_data_type == FTPD_SECURE_ALWAYS)) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"521-Data protection is Clear while it should be Private.\n"
 				"521-Server policy need SECURE data transfers.\n"
 				"521 Data connection cannot be opened with this PROT setting.\n"
@@ -3047,7 +3634,7 @@ __retr_error:
 		if((client->protection == FTPD_PROTECTION_PRIVATE) &&
 			(ftpd_secure_data_type == FTPD_SECURE_NEVER)) {
 			
-			ftpd_client_text_enqueue(client->messages,
+			ftpd_client_reply_enqueue(client,
 				"521-Data protection is Clear while it should be Private.\n"
 				"521-Server policy DOES NOT accept SECURE data transfers.\n"
 				"521 Data connection cannot be opened with this PROT setting.\n"
@@ -3071,31 +3658,31 @@ __retr_error:
 				/* is the slave is already listening ? */
 				if(!client->ready) {
 					/* TODO: send "hard abort" to the slave */
-					ftpd_client_text_enqueue(client->messages, "Already ready.");
+					ftpd_client_reply_enqueue(client, "Already ready.");
 					goto __stor_error;
 				}
 			} else if(!client->xfer.element) { /* rushftp do PRET STOR even on non-pasv transfers */
 				if(!setup_file_upload(client, container, Pointer)) {
-					ftpd_client_text_enqueue(client->messages, "Cannot setup file for upload.");
+					ftpd_client_reply_enqueue(client, "Cannot setup file for upload.");
 					goto __stor_error;
 				}
 			}
 
 			/* tell the slave to start receiving data */
 			if(!make_slave_transfer_query(client)) {
-				ftpd_client_text_enqueue(client->messages, "Cannot make slave transfer query.");
+				ftpd_client_reply_enqueue(client, "Cannot make slave transfer query.");
 				goto __stor_error;
 			}
 
 			/*if(client->passive)
-				ftpd_client_text_enqueue(client->messages, "125 Data connection already open; transfer starting.");
+				ftpd_client_reply_enqueue(client, "125 Data connection already open; transfer starting.");
 			else*/
-				ftpd_client_text_enqueue(client->messages, "150 Opening ASCII mode data connection for %s on %s\r\n", Pointer, client->xfer.cnx->slave->name);
+				ftpd_client_reply_enqueue(client, "150 Opening ASCII mode data connection for %s on %s\r\n", Pointer, client->xfer.cnx->slave->name);
 		}
 
 		break;
 __stor_error:
-		ftpd_client_text_enqueue(client->messages, "425 Can't open data connection.");
+		ftpd_client_reply_enqueue(client, "425 Can't open data connection.");
 		ftpd_client_cleanup_data_connection(client);
 		break;
 	case CMD_APPEND:
@@ -3104,7 +3691,7 @@ __stor_error:
 		ftpd_client_cleanup_data_connection(client);
 		/* intentionally left unsupported because files
 			may be served by more than one slave */
-		ftpd_client_text_enqueue(client->messages, "502 Command not implemented. You should not use APPE.");
+		ftpd_client_reply_enqueue(client, "502 Command not implemented. You should not use APPE.");
 		break;
 	case CMD_DELETE:
 /*
@@ -3126,7 +3713,7 @@ __stor_error:
 
 			element = vfs_find_element(container, Pointer);
 			if(!element || element->type != VFS_FILE) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"550 No such file.\n"
 				);
 				break;
@@ -3136,7 +3723,7 @@ __stor_error:
 
 			/* give a chance to cancel the download */
 			if(!event_onPreDelete(client, element)) {
-				ftpd_client_text_enqueue(client->messages,
+				ftpd_client_reply_enqueue(client,
 					"450-DELE rejected by external policy (file still exist).\n"
 					"450 Requested file action not taken.\n"
 				);
@@ -3160,7 +3747,7 @@ __stor_error:
 			/* call the ftpd deletion function to complete the operation */
 			ftpd_wipe(element);
 
-			ftpd_client_text_enqueue(client->messages, "250 Requested file action okay, completed.");
+			ftpd_client_reply_enqueue(client, "250 Requested file action okay, completed.");
 			
 			obj_unref(&element->o);
 		}
@@ -3180,7 +3767,7 @@ __stor_error:
 		
 		ftpd_client_cleanup_data_connection(client);
 
-		ftpd_client_text_enqueue(client->messages, "226*ABOR command successful.");
+		ftpd_client_reply_enqueue(client, "226*ABOR command successful.");
 
 		break;
 	case CMD_BROKEN_ABORT:
@@ -3196,8 +3783,8 @@ __stor_error:
 		
 		ftpd_client_cleanup_data_connection(client);
 
-		//ftpd_client_text_enqueue(client->messages, "425 Broken FTP client.");
-		ftpd_client_text_enqueue(client->messages, "226*ABOR command successful.");
+		//ftpd_client_reply_enqueue(client, "425 Broken FTP client.");
+		ftpd_client_reply_enqueue(client, "226*ABOR command successful.");
 
 		break;
 	case CMD_QUIT:
@@ -3207,7 +3794,7 @@ __stor_error:
           500
 */
 		FTPD_DIALOG_DBG("[%08x] CMD_QUIT", (int)client);
-		ftpd_client_text_enqueue(client->messages, "221 Service closing control connection.");
+		ftpd_client_reply_enqueue(client, "221 Service closing control connection.");
 
 		/* return an error so we get disconnected the proper way */
 		return 0;
@@ -3215,7 +3802,7 @@ __stor_error:
 		/* if the client is logged, send a "unknown command" message */
 		
 		FTPD_DBG("Unresolved: \"%s\"", ptr);
-		ftpd_client_text_enqueue(client->messages, "502 Command not implemented \"%s\"", ptr);
+		ftpd_client_reply_enqueue(client, "502 Command not implemented \"%s\"", ptr);
 		
 		/* Whatever. Cleanup this shitty client's data connection. */
 		ftpd_client_cleanup_data_connection(client);
@@ -3227,31 +3814,35 @@ __stor_error:
 }
 
 /* process input from client */
-/* ctx->iobuf must be filled with at least one line */
+/* every complete line of ctx->iobuf is processed, the rest is kept for the next read */
 static unsigned int ftpd_client_process_input(struct ftpd_client_ctx *client) {
 	ftpd_command command;
-	unsigned int ret = 1, i;
-	char *ptr, *next_ptr;
+	unsigned int ret = 1, len;
+	char *ptr, *next_ptr, *end, *cr;
 
 	ptr = client->iobuf;
+	end = &client->iobuf[client->filledsize];
 
 	/* process line by line */
-	while(strchr(ptr, '\n')) {
-		next_ptr = strchr(ptr, '\n');
+	while((ptr < end) && (next_ptr = memchr(ptr, '\n', end - ptr))) {
+		len = next_ptr - ptr;
 		*next_ptr = 0;
 		next_ptr++;
 
-		for(i=0;i<strlen(ptr);i++) {
-			if(ptr[i] == '\r') ptr[i] = 0;
+		/* the line stops at the first carriage return */
+		cr = memchr(ptr, '\r', len);
+		if(cr) {
+			*cr = 0;
+			len = cr - ptr;
 		}
 
-		if(!strlen(ptr)) {
+		if(!len) {
 			ptr = next_ptr;
 			continue;
 		}
 
 		/* translate the text command into a command number */
-		command = ftpd_client_text_to_command(ptr, strlen(ptr));
+		command = ftpd_client_text_to_command(ptr, len);
 
 		if(!client->logged) {
 			/* parse the input if the client is not logged */
@@ -3275,8 +3866,11 @@ static unsigned int ftpd_client_process_input(struct ftpd_client_ctx *client) {
 	}
 
 	/* move the rest of the buffer to the beginning */
-	memmove(client->iobuf, ptr, strlen(ptr));
-	client->filledsize = strlen(ptr);
+	len = end - ptr;
+	if(len && (ptr != client->iobuf)) {
+		memmove(client->iobuf, ptr, len);
+	}
+	client->filledsize = len;
 	client->iobuf[client->filledsize] = 0;
 
 	return ret;
@@ -3312,19 +3906,6 @@ static void ftpd_client_obj_destroy(struct ftpd_client_ctx *client) {
 		client->user = NULL;
 	//}
 
-	/* free the message collection,
-		this is freed after the data context because some callback
-		functions may still need to add messages */
-	if(client->messages) {
-		/*while(collection_size(client->messages)) {
-			void *first = collection_first(client->messages);
-			free(first);
-			collection_delete(client->messages, first);
-		}*/
-		collection_destroy(client->messages);
-		client->messages = NULL;
-	}
-
 	secure_destroy(&client->data_ctx.secure);
 	secure_destroy(&client->secure);
 
@@ -3357,6 +3938,12 @@ static void ftpd_client_obj_destroy(struct ftpd_client_ctx *client) {
 	free(client->iobuf);
 	client->iobuf = NULL;
 
+	/* free the reply buffers,
+		this is freed after the data context because some callback
+		functions may still need to add messages */
+	ftpd_reply_free(&client->output);
+	ftpd_reply_free(&client->sending);
+
 	/* delete the collection entry */
 	//collection_delete(clients, client);
 
@@ -3371,7 +3958,6 @@ void ftpd_client_destroy(struct ftpd_client_ctx *client) {
 	
 	collection_void(client->data_ctx.group);
 	collection_void(client->data_ctx.data);
-	collection_void(client->messages);
 	collection_void(client->group);
 
 	obj_destroy(&client->o);
@@ -3400,7 +3986,7 @@ int ftpd_client_error(int fd, struct ftpd_client_ctx *client) {
 			error but a damn client sending Out Of Band data. (ahem, FlashFXP.)
 		*/
 
-		//ftpd_client_text_enqueue(client->messages, "Your FTP client is SHIT.");
+		//ftpd_client_reply_enqueue(client, "Your FTP client is SHIT.");
 		
 		//FTPD_DBG("Client's FTP client is SHIT. Sending OOB data.");
 
@@ -3440,32 +4026,38 @@ int ftpd_client_read_timeout(struct ftpd_client_ctx *client) {
 }
 
 int ftpd_client_read(int fd, struct ftpd_client_ctx *client) {
-	int /*avail,*/ read;
-	unsigned int ret;
+	int read;
+	unsigned int ret = 1;
 	int tryagain;
 
-	/*avail = SSL_pending(client->secure.ssl);
+	obj_ref(&client->o);
 
-	if(avail > (client->buffersize - client->filledsize)-1)
-		avail = (client->buffersize - client->filledsize)-1;
+	/*
+		Read from the socket until it would block, in chunks of
+		FTPD_READ_SIZE bytes. All complete lines are processed once
+		the socket is drained (or when the buffer gets full) so all
+		the replies are sent together on the next write event.
 	*/
-	
-	//if(!avail) {
-		/* NO bytes available ?? */
-		/*FTPD_DBG("Nothing available, but read was called ...");
-		return 1;
-	}*/
-
-	/* try to read from socket until eof then try to process what's inside it. */
 	while(1) {
+		if((client->buffersize - client->filledsize - 1) < sizeof(client->readbuf)) {
+			/* make some room */
+			ret = ftpd_client_process_input(client);
+			if(!ret) break;
+
+			if((client->buffersize - client->filledsize - 1) < sizeof(client->readbuf)) {
+				FTPD_DBG("Line too long (%u bytes) from %s", client->filledsize, socket_ntoa(fd));
+				ret = 0;
+				break;
+			}
+		}
+
 		tryagain = 0;
-		read = secure_recv(&client->secure, &client->readchr, 1, &tryagain);
+		read = secure_recv(&client->secure, client->readbuf, sizeof(client->readbuf), &tryagain);
 		if((read == -1) && tryagain) {
 			//FTPD_DBG("Could NOT read a line (will try again!)");
 			
-			/* we cannot process what's in the buffer here because we NEED
-				to call secure_recv again with the EXACT SAME parameters,
-				so we just return; */
+			/* secure_recv will be called again with the exact same
+				parameters, the content of readbuf is not needed */
 			break;
 		}
 		if((read == -1) && 
@@ -3479,26 +4071,37 @@ int ftpd_client_read(int fd, struct ftpd_client_ctx *client) {
 			//FTPD_DBG("No more data available to be read from socket, %u filled.", client->filledsize);
 			break;
 		}
-		if(read != 1) {
-			FTPD_DBG("read error (%d, wanted %u)", read, 1);
+		if(read <= 0) {
+			FTPD_DBG("read error (%d, wanted %u)", read, (unsigned int)sizeof(client->readbuf));
 			ftpd_client_destroy(client);
+			obj_unref(&client->o);
 			return 0;
 		}
 		
-		client->iobuf[client->filledsize] = client->readchr;
+		memcpy(&client->iobuf[client->filledsize], client->readbuf, read);
 		client->filledsize += read;
+
+		if(!client->secure.use_secure && (read < sizeof(client->readbuf))) {
+			/*
+				The socket is drained, don't waste a syscall to learn it.
+				This can't be done with ssl because some data may still
+				be buffered by the ssl layer.
+			*/
+			break;
+		}
 	}
 
 	/* make sure it's zero-terminated */
 	client->iobuf[client->filledsize] = 0;
 
-	obj_ref(&client->o);
 	/*
 		This is a protected call. If the client is deleted
 		during the processing of this function, it'll not
 		crash the program
 	*/
-	ret = ftpd_client_process_input(client);
+	if(ret && obj_isvalid(&client->o)) {
+		ret = ftpd_client_process_input(client);
+	}
 
 	if(!ret) {
 		FTPD_DBG("Client disconnected because of what he sent at %s.", socket_ntoa(fd));
@@ -3520,231 +4123,75 @@ int ftpd_client_read(int fd, struct ftpd_client_ctx *client) {
 	return 1;
 }
 
-/* try to get the reply code from any message in the collection */
-static unsigned int get_replycode_callback(struct collection *c, struct ftpd_collectible_line *l, unsigned int *replycode) {
-	unsigned int n;
-	char s[4];
-
-	*replycode = 0;
-
-	if((l->line[3] != '-') && (l->line[3] != ' ')) {
-		return 1;
-	}
-
-	snprintf(s, 3, l->line);
-	s[3] = 0;
-
-	n = atoi(s);
-	if(!n) {
-		return 1;
-	}
-
-	*replycode = n;
-
-	return 0;
-}
-
-/* build the reply buffer */
-/* TODO: rewrite this mess */
-static unsigned int build_buffer_callback(struct collection *c, struct ftpd_collectible_line *l, void *param) {
-	char *ptr;
-	struct {
-		unsigned int count;
-		unsigned int current;
-		unsigned int replycode;
-		char *buffer;
-		char *last_line;
-	} *ctx = param;
-	char s[4];
-	char *line = l->line;
-	int skip_code = 0;
-	int new_code = 0;
-	char *last_buffer;
-
-	ctx->current++;
-
-	ptr = strchr(line, '\n');
-	if(ptr) {
-		*ptr = 0;
-		ptr++;
-		if(!strlen(ptr)) ptr = NULL;
-	}
-	
-	/* skip any reply code */
-	if((line[3] == '-') || (line[3] == ' ') || (line[3] == '*')) {
-		snprintf(s, 3, line);
-		skip_code = (line[3] == '*');
-		s[3] = 0;
-		new_code = atoi(s);
-		if(new_code) line += 4;
-	}
-
-	/* prepare the buffer */
-	if(ctx->buffer) {
-		last_buffer = ctx->buffer;
-		ctx->buffer = realloc(ctx->buffer, strlen(ctx->buffer) + 4 + strlen(line) + 3);
-		if(!ctx->buffer) {
-			FTPD_DBG("Memory error");
-			return 0;
-		}
-		if(ctx->last_line) {
-			ctx->last_line += (int)ctx->buffer - (int)last_buffer;
-		}
-	} else {
-		ctx->buffer = malloc(4 + strlen(line) + 3);
-		if(!ctx->buffer) {
-			FTPD_DBG("Memory error");
-			return 0;
-		}
-		*(ctx->buffer) = 0;
-	}
-	
-	if(skip_code) {
-		ctx->replycode = new_code;
-		if(ctx->last_line) {
-			ctx->last_line[3] = ' ';
-		}
-	}
-
-	/* append to the buffer */
-	if((ctx->current == ctx->count) && !ptr) {
-		ctx->last_line = &ctx->buffer[strlen(ctx->buffer)];
-		sprintf(&ctx->buffer[strlen(ctx->buffer)], "%u %s\r\n", ctx->replycode, line);
-	} else {
-		ctx->last_line = &ctx->buffer[strlen(ctx->buffer)];
-		sprintf(&ctx->buffer[strlen(ctx->buffer)], "%u-%s\r\n", ctx->replycode, line);
-	}
-	
-	skip_code = 0;
-
-	line = ptr;
-	/* loop the rest of the message */
-	while(line && strlen(line)) {
-		ptr = strchr(line, '\n');
-		if(ptr) {
-			*ptr = 0;
-			ptr++;
-			if(!strlen(ptr)) ptr = NULL;
-		}
-
-		skip_code = (line[3] == '*');
-		snprintf(s, 3, line);
-		s[3] = 0;
-		new_code = atoi(s);
-		
-		if(((line[3] == '-') || (line[3] == ' ') || (line[3] == '*')) && atoi(s)) {
-			line += 4;
-			
-			last_buffer = ctx->buffer;
-			ctx->buffer = realloc(ctx->buffer, strlen(ctx->buffer) + 4 + strlen(line) + 3);
-			if(!ctx->buffer) {
-				FTPD_DBG("Memory error");
-				return 0;
-			}
-			if(ctx->last_line) {
-				ctx->last_line += (int)ctx->buffer - (int)last_buffer;
-			}
-			
-			if(skip_code) {
-				ctx->replycode = new_code;
-				if(ctx->last_line) {
-					ctx->last_line[3] = ' ';
-				}
-			}
-			
-			/* append to the buffer */
-			if((ctx->current == ctx->count) && !ptr) {
-				ctx->last_line = &ctx->buffer[strlen(ctx->buffer)];
-				sprintf(&ctx->buffer[strlen(ctx->buffer)], "%u %s\r\n", ctx->replycode, line);
-			} else {
-				ctx->last_line = &ctx->buffer[strlen(ctx->buffer)];
-				sprintf(&ctx->buffer[strlen(ctx->buffer)], "%u-%s\r\n", ctx->replycode, line);
-			}
-			
-			skip_code = 0;
-		} else {
-			/* there was no reply code, don't add one */
-			last_buffer = ctx->buffer;
-			ctx->buffer = realloc(ctx->buffer, strlen(ctx->buffer) + strlen(line) + 3);
-			if(!ctx->buffer) {
-				FTPD_DBG("Memory error");
-				return 0;
-			}
-			if(ctx->last_line) {
-				ctx->last_line += (int)ctx->buffer - (int)last_buffer;
-			}
-
-			/* append to the buffer */
-			ctx->last_line = &ctx->buffer[strlen(ctx->buffer)];
-			sprintf(&ctx->buffer[strlen(ctx->buffer)], "%s\r\n", line);
-		}
-
-		line = ptr;
-	}
-
-	//free(item);
-	//collection_delete(c, item);
-	ftpd_line_destroy(l);
-
-	return 1;
-}
-
 static int ftpd_client_resume_send(int fd, struct ftpd_client_ctx *client) {
+	struct ftpd_reply_buffer *reply = &client->sending;
 	int size;
 	int tryagain;
 
+	if(reply->offset >= reply->length)
+		return 1;
+
 	tryagain = 0;
-	size = secure_send(&client->secure, client->resume_buffer, client->resume_length, &tryagain);
+	size = secure_send(&client->secure, &reply->data[reply->offset], reply->length - reply->offset, &tryagain);
 	if((size == -1) && tryagain) {
 		FTPD_DBG("SSL Re-Negotiation during Client-Server dialog!");
 		return 1;
 	}
-	if(size != client->resume_length) {
-		FTPD_DBG("WARNING: sent size mismatch line length");
+	if((size == -1) &&
+#ifdef WIN32
+  (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+  (errno == EWOULDBLOCK)
+#endif
+  ) {
+		/* the socket buffer is full, we'll send the rest on the next write event */
+		return 1;
+	}
+	if(size <= 0) {
+		FTPD_DBG("WARNING: could not send reply (%d, wanted %u)", size, reply->length - reply->offset);
+		ftpd_reply_reset(reply);
+		return 1;
 	}
 
-	free(client->resume_buffer);
-	client->resume_buffer = NULL;
-	client->resume_length = 0;
+	reply->offset += size;
+	if(reply->offset >= reply->length) {
+		ftpd_reply_reset(reply);
+	}
 	
 	return 1;
 }
 
 /*
-	because of the way we handle the messages to be sent, we
-	may have any kind of message in the messages collection
-	so we will normalize them, build a big buffer and send it
-*/
+	The replies are assembled in the 'output' buffer as they are
+	enqueued. Once the reply code is known, the buffer is swapped
+	with the 'sending' buffer and sent in one call. Both buffers
+	keep their memory from one reply to the next.
+*/
 static int ftpd_client_process_output(struct ftpd_client_ctx *client) {
-	struct {
-		unsigned int count;
-		unsigned int current;
-		unsigned int replycode;
-		char *buffer;
-		char *last_line;
-	} ctx = { 0, 0, 0, NULL, NULL };
+	struct ftpd_reply_buffer swap;
+	struct ftpd_reply_buffer *reply = &client->output;
 
-	ctx.count = collection_size(client->messages);
-	if(!ctx.count)
+	/* finish sending the previous replies first */
+	if(client->sending.length)
+		return ftpd_client_resume_send(client->fd, client);
+
+	if(!reply->length)
 		return 1;
 
-	/* try to get the reply code */
-	collection_iterate(client->messages, (collection_f)get_replycode_callback, &ctx.replycode);
-	if((ctx.replycode > 999) || (ctx.replycode < 100)) {
+	if(!reply->replycode) {
 		/* can't get replycode, but maybe we can ship this line with the next message */
-		//FTPD_DBG("Could not get valid reply code (%u is invalid)", ctx.replycode);
 		return 1;
 	}
 	
-	/* build a big buffer with all replies */
-	collection_iterate(client->messages, (collection_f)build_buffer_callback, &ctx);
-	if(!ctx.buffer) {
-		FTPD_DBG("Could not build a message buffer");
-		return 0;
+	/* the last line terminates the reply */
+	if((reply->last_line != -1) && (reply->last_line == reply->tail)) {
+		reply->data[reply->last_line+3] = ' ';
 	}
 	
-	client->resume_buffer = ctx.buffer;
-	client->resume_length = strlen(ctx.buffer);
+	swap = client->sending;
+	client->sending = client->output;
+	client->output = swap;
+	ftpd_reply_reset(&client->output);
 	
 	/* send the buffer */
 	return ftpd_client_resume_send(client->fd, client);
@@ -3779,8 +4226,8 @@ int ftpd_client_write(int fd, struct ftpd_client_ctx *client) {
 		ip = socket_peer_address(client->fd);
 		
 		/* say hello */
-		ftpd_client_text_enqueue(client->messages, "220-%s\n", ftpd_banner);
-		ftpd_client_text_enqueue(client->messages, "220-Connection accepted from %u.%u.%u.%u.\n",
+		ftpd_client_reply_enqueue(client, "220-%s\n", ftpd_banner);
+		ftpd_client_reply_enqueue(client, "220-Connection accepted from %u.%u.%u.%u.\n",
 			(ip) & 0xff, (ip >> 8) & 0xff,
 			(ip >> 16) & 0xff, (ip >> 24) & 0xff
 		);
@@ -3798,7 +4245,7 @@ int ftpd_client_write(int fd, struct ftpd_client_ctx *client) {
 			obj_unref(&client->o);
 			return 0;
 		}
-		ftpd_client_text_enqueue(client->messages, "220 Service ready for new user.");
+		ftpd_client_reply_enqueue(client, "220 Service ready for new user.");
 		
 		/* start ssl negotiation if the secure type is implicit */
 		/*if(ftpd_secure_control_type == FTPD_SECURE_IMPLICIT) {
@@ -3826,7 +4273,7 @@ int ftpd_client_write(int fd, struct ftpd_client_ctx *client) {
 			return 0;
 		}
 		
-		if(!collection_size(client->messages) && client->ssl_waiting) {
+		if(!client->output.length && !client->sending.length && client->ssl_waiting) {
 			if(client->auth == FTPD_AUTH_NONE) {
 				FTPD_DBG("Dropping SSL Session.");
 				secure_drop(&client->secure);
@@ -3851,7 +4298,7 @@ int ftpd_client_secure_connect(int fd, struct ftpd_client_ctx *client) {
 	FTPD_DBG("SSL Using Ciphers: %s", SSL_get_cipher_name(client->secure.ssl));
 	FTPD_DBG("SSL Connection Protocol: %s", SSL_get_cipher_version(client->secure.ssl));
 	
-	ftpd_client_text_enqueue(client->messages,
+	ftpd_client_reply_enqueue(client,
 		"Negotiated %s session using cipher(s) %s\n",
 		SSL_get_cipher_version(client->secure.ssl),
 		SSL_get_cipher_name(client->secure.ssl)
@@ -3879,6 +4326,8 @@ struct ftpd_client_ctx *ftpd_client_new(int fd) {
 	/* setup the i/o buffer */
 	obj_init(&client->o, client, (obj_f)ftpd_client_obj_destroy);
 	collectible_init(client);
+	wheel_timer_init(&client->xfer.timer, (wheel_f)ftpd_client_xfer_timeout, client);
+	stats_link_init(&client->xfer.progress, (stats_f)ftpd_client_xfer_progress);
 
 	client->buffersize = FTPD_BUFFER_SIZE;
 	client->iobuf = malloc(client->buffersize);
@@ -3898,8 +4347,9 @@ struct ftpd_client_ctx *ftpd_client_new(int fd) {
 		return NULL;
 	}
 
-	/* setup the message collection */
-	client->messages = collection_new(C_CASCADE);
+	/* setup the reply buffers */
+	ftpd_reply_init(&client->output);
+	ftpd_reply_init(&client->sending);
 	client->group = collection_new(C_CASCADE);
 
 	/* setup the default values for the data context */
@@ -3963,11 +4413,9 @@ struct ftpd_client_ctx *ftpd_client_new(int fd) {
 	client->xfer.element = NULL;
 	client->xfer.cnx = NULL;
 	client->xfer.xfered = 0;
+	client->xfer.speed = 0;
 	client->xfer.last_alive = time_now();
 	
-	client->resume_buffer = NULL;
-	client->resume_length = 0;
-
 	/* hook all signals on the socket */
 	socket_monitor_new(fd, 1, 1);
 	socket_monitor_signal_add(fd, client->group, "socket-close", (signal_f)ftpd_client_close, client);
@@ -4413,8 +4861,14 @@ int ftpd_init() {
 		return 0;
 	}
 
+	if(!ftpd_build_command_table()) {
+		FTPD_DBG("Could not build the command table");
+		return 0;
+	}
+
 	clients = collection_new(C_CASCADE);
 	ftpd_group = collection_new(C_CASCADE);
+	ftpd_wipes = collection_new(C_NONE);
 
 	/* create our main socket */
 	ftpd_fd = create_listening_socket(ftpd_client_port);
@@ -4468,6 +4922,12 @@ void ftpd_free() {
 		clients = NULL;
 	}
 
+	/* the wipe jobs were cancelled with the other jobs */
+	if(ftpd_wipes) {
+		collection_destroy(ftpd_wipes);
+		ftpd_wipes = NULL;
+	}
+
 	return;
 }
 
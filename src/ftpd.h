@@ -42,6 +42,8 @@
 #include "vfs.h"
 #include "users.h"
 #include "secure.h"
+#include "wheel.h"
+#include "stats.h"
 
 #include "debug.h"
 #if defined(DEBUG_FTPD)
@@ -178,15 +180,35 @@ struct slave_transfer_request {
 	char use_secure; /* use ssl for data connection ? */
 	char secure_server; /* is the slave the server end for ssl/tls negotiation ? */
 	
+	/* number of IO_SLAVE_TEE queries that will follow, on uploads.
+		it changed the layout of IO_SLAVE_TRANSFER: master and
+		slave must be updated together. */
+	unsigned char tees;
+	
 	char filename[1];
 } __attribute__((packed));
 
+/*
+	Sent to the slave receiving an upload for each replica
+	announced in slave_transfer_request.tees: the slave
+	connects to ip/port and sends a copy of everything it
+	receives, as a client would upload it.
+*/
+struct slave_tee_request {
+	unsigned long long int xfer_uid; /* of the upload */
+	
+	unsigned int ip;
+	unsigned short port; /* 0 if the replica could not be set up */
+} __attribute__((packed));
+
 typedef struct xfer_ctx client_xfer;
 struct xfer_ctx {
 	unsigned long long int uid; /* unique id for this transfer, shared with the slave */
 	unsigned long long int timestamp;
 
 	unsigned long long int last_alive; /* last time it was reported in the stats */
+	struct wheel_timer timer; /* armed while the transfer is linked to a slave */
+	struct stats_link progress; /* receives the reports while linked to a slave */
 
 	unsigned long long int restart; /* tells where to restart the RETR */
 
@@ -204,6 +226,7 @@ struct xfer_ctx {
 	/* currently assigned asynch command */
 	struct slave_asynch_command *cmd;
 	unsigned long long int xfered; /* current ammount of data transfered, updated by stats.c */
+	unsigned int speed; /* current speed in bytes per second, updated by stats.c */
 } __attribute__((packed));
 
 struct list_ctx {
@@ -218,6 +241,26 @@ struct list_ctx {
 	struct secure_ctx secure;
 } __attribute__((packed));
 
+/*
+	Control channel replies are assembled directly into this
+	buffer as they are enqueued. Each line that carries a reply
+	code has a 4 bytes "NNN-" slot in front of it, and the slots
+	are stamped as soon as the reply code is known, so building
+	the reply is linear in the size of the output. The buffer
+	is kept allocated for the whole life of the client.
+*/
+struct ftpd_reply_buffer {
+	char *data;					/* assembled lines, "\r\n" terminated */
+	unsigned int size;			/* allocated size of data */
+	unsigned int length;		/* used length of data */
+	unsigned int offset;		/* bytes of data already sent */
+	
+	unsigned int replycode;		/* code of the reply being assembled, 0 if not known yet */
+	int pending;				/* offset of the first line waiting for a reply code, -1 if none */
+	int last_line;				/* offset of the last line with a reply code slot, -1 if none */
+	int tail;					/* offset of the last line appended, -1 if none */
+} __attribute__((packed));
+
 typedef struct ftpd_client_ctx ftpd_client;
 struct ftpd_client_ctx {
 	struct obj o;
@@ -244,13 +287,13 @@ struct ftpd_client_ctx {
 	unsigned int buffersize;	/* max size */
 	unsigned int filledsize;	/* filled length of the buffer */
 	char *iobuf;				/* working buffer for the control socket */
-	char readchr;				/* OpenSSL needs read/write to be retried
+	char readbuf[FTPD_READ_SIZE];	/* OpenSSL needs read/write to be retried
 									with the exact same parameters each time,
-									so we use this char and move it to the
-									bigger buffer. please rewrite it, it's
-									all but efficient. */
+									so we read in this fixed buffer and move
+									the data to the bigger buffer. */
 
-	struct collection *messages; /* messages to be sent to the client */
+	struct ftpd_reply_buffer output;	/* replies being assembled for the client */
+	struct ftpd_reply_buffer sending;	/* replies currently being sent to the client */
 
 	/* data connection stuff */
 	ftpd_type type;				/* data representation type */
@@ -264,9 +307,6 @@ struct ftpd_client_ctx {
 	int ssl_waiting;			/* if this is set, the next time the message queue is 
 									empty a ssl negotiation will take place */
 
-	char *resume_buffer;
-	unsigned int resume_length;
-	
 	struct secure_ctx secure;
 	
 	char slave_xfer;			/* PRET has been issued for RETR/STOR */
@@ -286,6 +326,7 @@ struct xfer_ctx *ftpd_lua_client_to_xfer(struct ftpd_client_ctx *ctx);
 unsigned int ftpd_inject_listing(struct ftpd_client_ctx *ctx, char type, const char *name, const char *owner);
 unsigned int ftpd_inject_symlink(struct ftpd_client_ctx *ctx, const char *target, const char *name, const char *owner);
 
+/* big folders are wiped in background, see job.h */
 unsigned int ftpd_wipe(struct vfs_element *element);
 unsigned int ftpd_wipe_from(struct vfs_element *element, struct slave_ctx *slave);
 
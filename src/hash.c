@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#endif
+
+#include "hash.h"
+
+#define HASH_MIN_SIZE		16
+
+/* grow the table once there's more than two nodes per bucket */
+#define HASH_MAX_LOAD		2
+
+#define HASH_FOLD(_c) ((((_c) >= 'A') && ((_c) <= 'Z')) ? ((_c) + ('a' - 'A')) : (_c))
+
+/* FNV-1a */
+unsigned int hash_buffer(const char *key, unsigned int length, int nocase) {
+	unsigned int hash = 2166136261U;
+	unsigned int i;
+	
+	if(nocase) {
+		for(i=0;i<length;i++) {
+			hash ^= (unsigned char)HASH_FOLD(key[i]);
+			hash *= 16777619U;
+		}
+	} else {
+		for(i=0;i<length;i++) {
+			hash ^= (unsigned char)key[i];
+			hash *= 16777619U;
+		}
+	}
+	
+	return hash;
+}
+
+unsigned int hash_string(const char *key, int nocase) {
+	
+	return hash_buffer(key, strlen(key), nocase);
+}
+
+static struct collection_list *hash_alloc_buckets(unsigned int size) {
+	struct collection_list *buckets;
+	unsigned int i;
+	
+	buckets = malloc(sizeof(struct collection_list) * size);
+	if(!buckets) {
+		HASH_DBG("Memory error");
+		return NULL;
+	}
+	
+	for(i=0;i<size;i++) {
+		collection_list_init(&buckets[i]);
+	}
+	
+	return buckets;
+}
+
+struct hash_table *hash_new(unsigned int size, int nocase) {
+	struct hash_table *h;
+	unsigned int n;
+	
+	for(n=HASH_MIN_SIZE;n<size;n*=2);
+	
+	h = malloc(sizeof(struct hash_table));
+	if(!h) {
+		HASH_DBG("Memory error");
+		return NULL;
+	}
+	
+	h->buckets = hash_alloc_buckets(n);
+	if(!h->buckets) {
+		free(h);
+		return NULL;
+	}
+	
+	h->nocase = nocase ? 1 : 0;
+	h->count = 0;
+	h->mask = n - 1;
+	
+	return h;
+}
+
+/* the nodes are not freed, they belong to their host structure */
+void hash_destroy(struct hash_table *h) {
+	unsigned int i;
+	
+	if(!h) return;
+	
+	/* unlink all remaining nodes so hash_node_linked() stays accurate */
+	for(i=0;i<=h->mask;i++) {
+		while(h->buckets[i].next != &h->buckets[i]) {
+			struct collection_list *current = h->buckets[i].next;
+			collection_list_remove(current);
+		}
+	}
+	
+	free(h->buckets);
+	free(h);
+	
+	return;
+}
+
+void hash_node_init(struct hash_node *node) {
+	
+	collection_list_init(&node->list);
+	node->hash = 0;
+	node->key = NULL;
+	
+	return;
+}
+
+int hash_node_linked(struct hash_node *node) {
+	
+	return (node->list.next != &node->list);
+}
+
+/* double the number of buckets, the order of equal keys is kept */
+static void hash_grow(struct hash_table *h) {
+	struct collection_list *buckets;
+	unsigned int i, mask;
+	
+	mask = (h->mask * 2) + 1;
+	
+	buckets = hash_alloc_buckets(mask + 1);
+	if(!buckets) {
+		/* keep working with the current size */
+		return;
+	}
+	
+	for(i=0;i<=h->mask;i++) {
+		while(h->buckets[i].next != &h->buckets[i]) {
+			struct hash_node *node = CONTAINING_RECORD(h->buckets[i].next, struct hash_node, list);
+			
+			collection_list_remove(&node->list);
+			collection_list_addlast(&buckets[node->hash & mask], &node->list);
+		}
+	}
+	
+	free(h->buckets);
+	h->buckets = buckets;
+	h->mask = mask;
+	
+	return;
+}
+
+static int hash_key_equals(struct hash_table *h, struct hash_node *node, unsigned int hash, const char *key) {
+	
+	if(node->hash != hash) return 0;
+	
+	return h->nocase ? !strcasecmp(node->key, key) : !strcmp(node->key, key);
+}
+
+int hash_add(struct hash_table *h, struct hash_node *node, const char *key) {
+	struct collection_list *bucket, *current;
+	
+	if(!h || !node || !key) {
+		HASH_DBG("Params error");
+		return 0;
+	}
+	
+	if(hash_node_linked(node)) {
+		HASH_DBG("Node is already in a table");
+		return 0;
+	}
+	
+	if(h->count >= ((h->mask + 1) * HASH_MAX_LOAD)) {
+		hash_grow(h);
+	}
+	
+	node->key = key;
+	node->hash = hash_string(key, h->nocase);
+	
+	/* keep the nodes with the same key together, newest first */
+	bucket = &h->buckets[node->hash & h->mask];
+	for(current=bucket->next;current!=bucket;current=current->next) {
+		if(hash_key_equals(h, CONTAINING_RECORD(current, struct hash_node, list), node->hash, key)) {
+			break;
+		}
+	}
+	collection_list_addlast(current, &node->list);
+	
+	h->count++;
+	
+	return 1;
+}
+
+void hash_remove(struct hash_table *h, struct hash_node *node) {
+	
+	if(!h || !node) return;
+	
+	if(!hash_node_linked(node)) return;
+	
+	collection_list_remove(&node->list);
+	h->count--;
+	
+	return;
+}
+
+struct hash_node *hash_find(struct hash_table *h, const char *key) {
+	struct collection_list *bucket, *current;
+	unsigned int hash;
+	
+	if(!h || !key) return NULL;
+	
+	hash = hash_string(key, h->nocase);
+	
+	bucket = &h->buckets[hash & h->mask];
+	for(current=bucket->next;current!=bucket;current=current->next) {
+		struct hash_node *node = CONTAINING_RECORD(current, struct hash_node, list);
+		
+		if(hash_key_equals(h, node, hash, key)) {
+			return node;
+		}
+	}
+	
+	return NULL;
+}
+
+struct hash_node *hash_find_next(struct hash_table *h, struct hash_node *node) {
+	struct collection_list *bucket, *next;
+	
+	if(!h || !node || !hash_node_linked(node)) return NULL;
+	
+	bucket = &h->buckets[node->hash & h->mask];
+	next = node->list.next;
+	if(next == bucket) return NULL;
+	
+	if(!hash_key_equals(h, CONTAINING_RECORD(next, struct hash_node, list), node->hash, node->key)) {
+		return NULL;
+	}
+	
+	return CONTAINING_RECORD(next, struct hash_node, list);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __HASH_H
+#define __HASH_H
+
+#include "constants.h"
+
+#include "debug.h"
+#if defined(DEBUG_HASH)
+# define HASH_DBG(format, arg...) { _DEBUG_CONSOLE(format, ##arg) _DEBUG_FILE(format, ##arg) }
+#else
+# define HASH_DBG(format, arg...)
+#endif
+
+#include "collection.h"
+
+/*
+	String-keyed hash tables. The nodes are embedded in their host
+	structure, just like collection_list, and the host is retrieved
+	with hash_entry(). Nodes with the same key are kept together in
+	their bucket, most recently added first.
+
+	The key is not copied: it must point to a string owned by the
+	host structure and stay valid as long as the node is in a table.
+*/
+
+#define hash_entry(_node, _type, _field) CONTAINING_RECORD(_node, _type, _field)
+
+struct hash_node {
+	struct collection_list list; /* linked to the bucket's list */
+	unsigned int hash;
+	const char *key;
+} __attribute__((packed));
+
+struct hash_table {
+	char nocase; /* 1 if the keys are case insensitive */
+	
+	unsigned int count; /* number of nodes in the table */
+	unsigned int mask; /* number of buckets - 1 */
+	struct collection_list *buckets;
+} __attribute__((packed));
+
+/* return the hash of a string, case-folded if 'nocase' is set */
+unsigned int hash_string(const char *key, int nocase);
+unsigned int hash_buffer(const char *key, unsigned int length, int nocase);
+
+/* the size is rounded up to a power of two, the table grows as needed */
+struct hash_table *hash_new(unsigned int size, int nocase);
+void hash_destroy(struct hash_table *h);
+
+void hash_node_init(struct hash_node *node);
+int hash_node_linked(struct hash_node *node);
+
+int hash_add(struct hash_table *h, struct hash_node *node, const char *key);
+void hash_remove(struct hash_table *h, struct hash_node *node);
+
+/* return the first node matching the key, or NULL */
+struct hash_node *hash_find(struct hash_table *h, const char *key);
+
+/* return the next node with the same key as 'node', or NULL */
+struct hash_node *hash_find_next(struct hash_table *h, struct hash_node *node);
+
+#endif /* __HASH_H */
@@ -121,6 +121,18 @@ typedef enum {
 	IO_ERROR_UNUSED_5,
 	IO_ERROR_UNUSED_6,
 	
+	/* unsolicited progress report from the slave (see stats.h) */
+	IO_PROGRESS,
+	
+	/* many paths to delete at once, reply with FAILURE or DELETED */
+	IO_DELETE_BATCH,
+	
+	/* unsolicited checksums of the files read back by the slave (see fsd.h) */
+	IO_CHECKSUMS,
+	
+	/* stream an upload to a peer slave as well, reply with FAILURE or the same type */
+	IO_SLAVE_TEE,
+	
 } io_packet_type;
 
 #define IO_FLAGS_ENCRYPTED	0x1001
@@ -865,154 +865,252 @@ unsigned int irc_handle(struct irc_server *server, const char *line) {
 	return 1;
 }
 
-/* return 0 if no line could be read & correctly parsed */
-static unsigned int parse_line_from_master(struct irc_server *server) {
-//	unsigned int i;
-	int /*avail,*/ recvd, tryagain;
+/* return 1 if the last socket operation failed only because it would block */
+static unsigned int irc_would_block() {
+	
+#ifdef WIN32
+	return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+	return (errno == EWOULDBLOCK);
+#endif
+}
+
+/*
+	Call the handlers for every complete line in the receive
+	buffer and keep the trailing partial line for later. Return
+	0 if any line could not be handled.
+*/
+static unsigned int dispatch_lines_from_master(struct irc_server *server) {
+	char *line, *end, *src, *dst;
+	unsigned int consumed = 0;
+	
+	while(consumed < server->filled_length) {
+		line = &server->buffer[consumed];
+		end = memchr(line, '\n', server->filled_length - consumed);
+		if(!end) break;
+		
+		consumed += (end - line) + 1;
+		
+		/* drop the \r and \0 bytes the server may have sent along */
+		for(src=line,dst=line;src<end;src++) {
+			if((*src == '\r') || (*src == 0)) continue;
+			*dst++ = *src;
+		}
+		*dst = 0;
+		
+		if(dst == line) continue;
+		
+		/* parse the line and call the right handler */
+		if(!irc_handle(server, line)) {
+			IRCCORE_DBG("Could not handle command from server.");
+			return 0;
+		}
+		
+		/* a handler may have disconnected us */
+		if(server->s == -1) {
+			return 1;
+		}
+	}
 	
+	if(consumed) {
+		server->filled_length -= consumed;
+		memmove(&server->buffer[0], &server->buffer[consumed], server->filled_length);
+	}
+	
+	return 1;
+}
+
+/*
+	Read everything that is available from the server and handle
+	all the complete lines. Return 0 on any error.
+*/
+static unsigned int parse_line_from_master(struct irc_server *server) {
+	int recvd, tryagain;
 	
 	while(1) {
+		if(server->filled_length == sizeof(server->buffer)) {
+			IRCCORE_DBG("Server sent a line that is too big to be handled (over %u bytes).", sizeof(server->buffer));
+			return 0;
+		}
+		
 		tryagain = 0;
-		recvd = secure_recv(&server->secure, &server->buffer[server->filled_length], 1, &tryagain);
+		recvd = secure_recv(&server->secure, &server->buffer[server->filled_length],
+			sizeof(server->buffer) - server->filled_length, &tryagain);
 		if((recvd == -1) && tryagain) {
 			IRCCORE_DBG("Could NOT read a line (will try again!)");
 			break;
 		}
-		if((recvd == -1) &&
-#ifdef WIN32
-		  (WSAGetLastError() == WSAEWOULDBLOCK)
-#else
-      (errno == EWOULDBLOCK)
-#endif
-		) {
-			/* no more data available? */
-			IRCCORE_DBG("No more data available to be read from socket, %u filled.", server->filled_length);
+		if((recvd == -1) && irc_would_block()) {
+			/* no more data available */
 			break;
 		}
-		if(recvd != 1) {
+		if(recvd <= 0) {
 			IRCCORE_DBG("Could not receive from socket.");
 			return 0;
 		}
 		
-		if(server->buffer[server->filled_length] == 0) continue;
-		if(server->buffer[server->filled_length] == '\r') continue;
-		if(server->buffer[server->filled_length] == '\n') {
-			
-			/* parse the line and call the right handler */
-			server->buffer[server->filled_length] = 0;
-			
-			if(!irc_handle(server, server->buffer)) {
-				IRCCORE_DBG("Could not handle command from server.");
-				return 0;
-			}
-			
-			server->filled_length = 0;
-			break;
-		}
+		server->filled_length += recvd;
 		
-		server->filled_length++;
-		if(server->filled_length == sizeof(server->buffer)) {
-			IRCCORE_DBG("Server sent a line that is too big to be handled (over %u bytes).", sizeof(server->buffer));
+		if(!dispatch_lines_from_master(server)) {
 			return 0;
 		}
+		
+		if(server->s == -1) {
+			break;
+		}
 	}
 
-	/* we couldn't catch a \n. return so we
-		can read more data next time */
+	/* a partial line is kept in the buffer until the rest arrives */
 
 	return 1;
 }
 
-/* send a line to the server (and only one line) */
-static int send_from_queue_callback(struct collection *c, struct ftpd_collectible_line *l, void *param) {
-	struct {
-		unsigned int success;
-		struct irc_server *server;
-		struct collection *queue;
-	} *ctx = param;
-	unsigned int size = strlen(l->line);
-	int i, tryagain = 0;
-
-	i = secure_send(&ctx->server->secure, l->line, size, &tryagain);
-	if((i == -1) && tryagain) {
-		IRCCORE_DBG("Could NOT send the current line (will try again!)");
-		ctx->server->timestamp = time_now();
-		return 0;
+/* credit the tokens earned since the last refill */
+static void irc_refill_tokens(struct irc_server *server) {
+	unsigned long long int elapsed;
+	unsigned int earned;
+	
+	if(!server->delay) {
+		/* no flood control */
+		server->tokens = server->burst;
+		return;
 	}
 	
-	if(i != size) {
-		IRCCORE_DBG("ERROR: Line size mismatch sent size (expected: %u, sent: %d)", size, i);
-		ctx->success = 0;
+	elapsed = timer(server->refill);
+	earned = (unsigned int)(elapsed / server->delay);
+	if(!earned) return;
+	
+	server->tokens += earned;
+	server->refill += (unsigned long long int)earned * server->delay;
+	
+	if(server->tokens >= server->burst) {
+		/* a full bucket doesn't keep earning */
+		server->tokens = server->burst;
+		server->refill = time_now();
 	}
-
-	ftpd_line_destroy(l);
-
-	/* set new timestamp */
-	ctx->server->timestamp = time_now();
-
-	return 0;
+	
+	return;
 }
 
-/* return 1 if data was sent from the queue to the server */
-static unsigned int send_from_queue(struct irc_server *server, struct collection *queue) {
-	struct {
-		unsigned int success;
-		struct irc_server *server;
-		struct collection *queue;
-	} ctx = { 1, server, queue };
+/* copy a line into the send buffer, return 0 if it doesn't fit */
+static unsigned int irc_buffer_line(struct irc_server *server, struct ftpd_collectible_line *l) {
+	unsigned int size = strlen(l->line);
 	
-	collection_iterate(queue, (collection_f)send_from_queue_callback, &ctx);
-
-	return ctx.success;
+	if(server->send_length + size > sizeof(server->send_buffer)) {
+		if(server->send_length) {
+			return 0;
+		}
+		
+		/* the line is bigger than the whole buffer, the server would cut it anyway */
+		IRCCORE_DBG("Truncating a line of %u bytes.", size);
+		size = sizeof(server->send_buffer) - 1;
+		memcpy(&server->send_buffer[0], l->line, size);
+		server->send_buffer[size] = '\n';
+		server->send_length = size + 1;
+	} else {
+		memcpy(&server->send_buffer[server->send_length], l->line, size);
+		server->send_length += size;
+	}
+	
+	ftpd_line_destroy(l);
+	server->tokens--;
+	
+	return 1;
 }
 
-/* send data from the channel queue to the server */
-static int send_from_channel_queue_callback(struct collection *c, struct irc_channel *channel, void *param) {
-	struct {
-		unsigned int success;
-		struct irc_server *server;
-	} *ctx = param;
+/* pick a channel with messages waiting, send JOIN to those we're not on yet */
+static int next_channel_queue_callback(struct collection *c, struct irc_channel *channel, void *param) {
+	struct irc_server *server = param;
 
 	if(!channel->joined) {
 		if(timer(channel->timestamp) > 5000) {
 			/* hardcoded 5 secondes between JOIN queries */
-			irc_raw(ctx->server, "JOIN %s%s%s\n", channel->name,
+			irc_raw(server, "JOIN %s%s%s\n", channel->name,
 				channel->key ? " " : "",
 				channel->key ? channel->key : ""
 			);
 			IRCCORE_DBG("joining channel %s with key %s", channel->name, channel->key ? channel->key : ""); 
 			channel->timestamp = time_now();
 		}
-		/* return 1 so we'll still try to send a message if any exists */
-		return 1;
-	} else {
+		return 0;
+	}
 
-		if(collection_size(channel->queue)) {
-			if(!send_from_queue(ctx->server, channel->queue))
-				ctx->success = 0;
+	return (collection_size(channel->queue) != 0);
+}
 
-			/* move this channel to the end of the chain so the next
-				time its another channel that will receive a message */
-			collection_movelast(ctx->server->channels, channel);
-			return 0;
+/*
+	Fill the send buffer with as many queued lines as the tokens
+	allow. The server queue goes first, then the channels take
+	turns one line at a time.
+*/
+static void fill_from_queues(struct irc_server *server) {
+	struct ftpd_collectible_line *l;
+	struct irc_channel *channel;
+	
+	while(server->tokens) {
+		l = collection_first(server->queue);
+		if(!l) {
+			channel = collection_match(server->channels, (collection_f)next_channel_queue_callback, server);
+			
+			/* a JOIN may have just been queued */
+			l = collection_first(server->queue);
+			if(!l && channel) {
+				l = collection_first(channel->queue);
+				
+				/* move this channel to the end of the chain so the next
+					time its another channel that will receive a message */
+				collection_movelast(server->channels, channel);
+			}
+			
+			if(!l) break;
 		}
+		
+		if(!irc_buffer_line(server, l)) break;
 	}
-
-	return 1;
+	
+	return;
 }
 
-/* return 0 if any error occured while sending data to the server */
-/* return 1 if no data was ready to be sent */
-static unsigned int send_from_channels(struct irc_server *server) {
-	struct {
-		unsigned int success;
-		struct irc_server *server;
-	} ctx = { 1, server };
+/*
+	Write the send buffer to the server, refilling it from the
+	queues once it is empty. A pending buffer is never modified,
+	so an interrupted SSL write is retried with the same data.
+	Return 0 on error.
+*/
+static unsigned int send_to_server(struct irc_server *server) {
+	int i, tryagain;
+	
+	if(server->send_offset == server->send_length) {
+		server->send_offset = 0;
+		server->send_length = 0;
+		
+		irc_refill_tokens(server);
+		fill_from_queues(server);
+		
+		if(!server->send_length) {
+			return 1;
+		}
+	}
+	
+	tryagain = 0;
+	i = secure_send(&server->secure, &server->send_buffer[server->send_offset],
+		server->send_length - server->send_offset, &tryagain);
+	if((i == -1) && (tryagain || irc_would_block())) {
+		IRCCORE_DBG("Could NOT send the buffer (will try again!)");
+		return 1;
+	}
+	
+	if(i <= 0) {
+		IRCCORE_DBG("ERROR: Could not send to server (%u bytes pending)", server->send_length - server->send_offset);
+		return 0;
+	}
+	
+	server->send_offset += i;
 
-	/* try to send data from any channel queue */
-	collection_iterate(server->channels, (collection_f)send_from_channel_queue_callback, &ctx);
+	/* set new timestamp */
+	server->timestamp = time_now();
 
-	return ctx.success;
+	return 1;
 }
 
 int irccore_server_secure_write(int fd, struct irc_server *server) {
@@ -1039,24 +1137,18 @@ int irccore_server_secure_write(int fd, struct irc_server *server) {
 			server->realname
 		);
 		
+		/* start with a full bucket */
+		server->tokens = server->burst;
+		server->refill = time_now();
+		
 		server->connected = 1;
 		return 1;
 	}
 
-	if(collection_size(server->queue) && (timer(server->timestamp) > server->delay)) {
-		/* try to send data from the global queue */
-		if(!send_from_queue(server, server->queue)) {
-			IRCCORE_DBG("Could not send anything from server queue.");
-			irc_disconnect(server);
-			return 0;
-		}
-	} else {
-		/* try to send data from any channel queue */
-		if(!send_from_channels(server)) {
-			IRCCORE_DBG("Could not send anything to channel.");
-			irc_disconnect(server);
-			return 0;
-		}
+	if(!send_to_server(server)) {
+		IRCCORE_DBG("Could not send anything to server.");
+		irc_disconnect(server);
+		return 0;
 	}
 
 	return 1;
@@ -1141,6 +1233,12 @@ int irccore_load_config() {
 	}
 
 	irccore_server.delay = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.irc.delay", 600);
+	
+	irccore_server.burst = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.irc.burst", IRC_FLOOD_BURST);
+	if(!irccore_server.burst) {
+		IRCCORE_DBG("xftpd.irc.burst must be at least 1, defaulting to %u", IRC_FLOOD_BURST);
+		irccore_server.burst = IRC_FLOOD_BURST;
+	}
 
 	/* load all channels */
 	for(i=1;;i++) {
@@ -1327,6 +1425,11 @@ void irc_disconnect(struct irc_server *server) {
 
 	/* empty the server message queue */
 	collection_empty(server->queue);
+	
+	/* whatever was buffered belongs to the old connection */
+	server->filled_length = 0;
+	server->send_offset = 0;
+	server->send_length = 0;
 
 	signal_clear(server->group);
 	
@@ -1370,7 +1473,13 @@ int irccore_init() {
 	irccore_server.filled_length = 0;
 
 	irccore_server.delay = 0;
+	irccore_server.burst = IRC_FLOOD_BURST;
+	irccore_server.tokens = 0;
+	irccore_server.refill = 0;
 	irccore_server.timestamp = 0;
+	
+	irccore_server.send_offset = 0;
+	irccore_server.send_length = 0;
 
 	if(!irccore_load_config()) {
 		IRCCORE_DBG("THE IRC CONFIG COULD NOT BE LOADED, NO SITEBOT AVAILABLE.");
@@ -148,11 +148,24 @@ struct irc_server {
 	char *ident;
 
 	unsigned int filled_length;
-	char buffer[1024]; /* hardcoded 1024-bytes message size limit */
+	char buffer[IRC_READ_BUFFER_SIZE]; /* partial lines received from the server */
 
+	/*
+		Flood control is a token bucket: every line sent costs a
+		token, one token is credited every 'delay' milliseconds
+		and at most 'burst' tokens can be saved up.
+	*/
 	unsigned int delay; /* delay between messages, in milliseconds */
+	unsigned int burst; /* maximum number of tokens */
+	unsigned int tokens; /* lines that can be sent right now */
+	unsigned long long int refill; /* last time tokens were credited */
 	unsigned long long int timestamp; /* last send time */
 
+	/* lines taken from the queues, waiting to be written in one send */
+	unsigned int send_offset;
+	unsigned int send_length;
+	char send_buffer[IRC_SEND_BUFFER_SIZE];
+
 	struct collection *queue; /* message queue */
 
 } __attribute__((packed));
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "collection.h"
+#include "config.h"
+#include "time.h"
+#include "job.h"
+
+struct collection *jobs = NULL; /* collection of struct job_ctx */
+
+/* milliseconds spent in the jobs on each loop */
+static unsigned int job_budget = JOB_BUDGET;
+
+static void job_obj_destroy(struct job_ctx *job) {
+	
+	collectible_destroy(job);
+	
+	/* also reached when a script's jobs are destroyed */
+	if(job->cleanup) {
+		(*job->cleanup)(job);
+	}
+	
+	free(job->name);
+	free(job);
+	
+	return;
+}
+
+int job_init() {
+	
+	JOB_DBG("Loading ...");
+	
+	jobs = collection_new(C_CASCADE);
+	if(!jobs) {
+		JOB_DBG("Memory error");
+		return 0;
+	}
+	
+	job_budget = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.jobs.budget", JOB_BUDGET);
+	if(!job_budget) {
+		JOB_DBG("xftpd.jobs.budget must be at least 1, defaulting to %u", JOB_BUDGET);
+		job_budget = JOB_BUDGET;
+	}
+	
+	return 1;
+}
+
+/* log the metrics and destroy the job, once */
+static void job_finish(struct job_ctx *job, int cancelled) {
+	
+	if(job->done) {
+		return;
+	}
+	job->done = 1;
+	
+	JOB_DBG("%s %s after " LLU " step(s): " LLU " ms of work over " LLU " ms (queued for " LLU " ms)",
+		job->name, cancelled ? "cancelled" : "done", job->steps, job->runtime,
+		job->started ? timer(job->started) : 0, timer(job->created));
+	
+	obj_destroy(&job->o);
+	
+	return;
+}
+
+void job_free() {
+	
+	JOB_DBG("Unloading ...");
+	
+	/* the cleanups are called as the jobs are destroyed */
+	collection_destroy(jobs);
+	jobs = NULL;
+	
+	return;
+}
+
+struct job_ctx *job_new(const char *name, unsigned int priority, job_f step, job_cleanup_f cleanup, void *param) {
+	struct job_ctx *job;
+	
+	if(!name || !step) {
+		JOB_DBG("Params error");
+		return NULL;
+	}
+	
+	job = malloc(sizeof(struct job_ctx));
+	if(!job) {
+		JOB_DBG("Memory error");
+		return NULL;
+	}
+	
+	obj_init(&job->o, job, (obj_f)job_obj_destroy);
+	collectible_init(job);
+	
+	job->name = strdup(name);
+	if(!job->name) {
+		JOB_DBG("Memory error");
+		free(job);
+		return NULL;
+	}
+	
+	job->priority = priority;
+	job->step = step;
+	job->cleanup = cleanup;
+	job->param = param;
+	
+	job->script = NULL;
+	job->function_index = 0;
+	
+	job->done = 0;
+	
+	job->created = time_now();
+	job->started = 0;
+	job->runtime = 0;
+	job->steps = 0;
+	
+	if(!collection_add(jobs, job)) {
+		JOB_DBG("Collection error");
+		free(job->name);
+		free(job);
+		return NULL;
+	}
+	
+	return job;
+}
+
+void job_cancel(struct job_ctx *job) {
+	
+	if(!job) {
+		return;
+	}
+	
+	job_finish(job, 1);
+	
+	return;
+}
+
+static int job_clear_callback(struct collection *c, struct job_ctx *job, void *param) {
+	
+	if(job->script) {
+		job_finish(job, 1);
+	}
+	
+	return 1;
+}
+
+void job_clear() {
+	
+	collection_iterate(jobs, (collection_f)job_clear_callback, NULL);
+	
+	return;
+}
+
+/* the first job with the lowest priority value */
+static int job_next_callback(struct collection *c, struct job_ctx *job, struct job_ctx **next) {
+	
+	if(job->done) {
+		return 1;
+	}
+	
+	if(!*next || (job->priority < (*next)->priority)) {
+		*next = job;
+	}
+	
+	return 1;
+}
+
+unsigned int job_poll() {
+	struct job_ctx *job;
+	unsigned long long int start, now, step;
+	int more;
+	
+	if(!collection_size(jobs)) {
+		return 0;
+	}
+	
+	start = now = time_now();
+	while((now - start) < job_budget) {
+		job = NULL;
+		collection_iterate(jobs, (collection_f)job_next_callback, &job);
+		if(!job) {
+			break;
+		}
+		
+		if(!job->started) {
+			job->started = now;
+		}
+		
+		/* the step may cancel its own job */
+		obj_ref(&job->o);
+		
+		/* run this job until it is done or the budget is spent */
+		do {
+			step = now;
+			more = (*job->step)(job);
+			now = time_now();
+			
+			job->steps++;
+			job->runtime += (now - step);
+		} while(more && !job->done && ((now - start) < job_budget));
+		
+		if(!more) {
+			job_finish(job, 0);
+		} else if(!job->done) {
+			/* let the other jobs of the same priority go first next time */
+			collection_movelast(jobs, job);
+		}
+		
+		obj_unref(&job->o);
+	}
+	
+	return collection_size(jobs);
+}
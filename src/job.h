@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __JOB_H
+#define __JOB_H
+
+#include "constants.h"
+#include "collection.h"
+#include "scripts.h"
+
+#include "debug.h"
+#if defined(DEBUG_JOB)
+# define JOB_DBG(format, arg...) { _DEBUG_CONSOLE(format, ##arg) _DEBUG_FILE(format, ##arg) }
+#else
+# define JOB_DBG(format, arg...)
+#endif
+
+/*
+	Background jobs of the master.
+	
+	A job is a long operation cut in small steps. On each loop
+	job_poll() calls the steps of the queued jobs until its time
+	budget is spent, so the clients keep being served while a big
+	release is wiped or the nukes are matched.
+	
+	The job with the lowest priority value runs first, the jobs
+	of equal priority take turns. A step returns nonzero while
+	there is more to do. The cleanup is called exactly once, when
+	the job is done or cancelled.
+*/
+
+#define JOB_PRIORITY_HIGH	0
+#define JOB_PRIORITY_NORMAL	1
+#define JOB_PRIORITY_LOW	2
+
+typedef struct job_ctx job_ctx;
+struct job_ctx {
+	struct obj o;
+	struct collectible c;
+	
+	char *name;
+	unsigned int priority;
+	
+	int (*step)(struct job_ctx *job);
+	void (*cleanup)(struct job_ctx *job);
+	void *param;
+	
+	/* for the jobs started from lua, NULL otherwise */
+	struct script_ctx *script;
+	int function_index; /* function to call on each step */
+	
+	char done; /* nonzero once finished or cancelled */
+	
+	/* metrics */
+	unsigned long long int created; /* time at which it was queued */
+	unsigned long long int started; /* time of the first step, 0 until then */
+	unsigned long long int runtime; /* milliseconds spent in its steps */
+	unsigned long long int steps; /* number of steps run */
+} __attribute__((packed));
+
+typedef int (*job_f)(struct job_ctx *job);
+typedef void (*job_cleanup_f)(struct job_ctx *job);
+
+extern struct collection *jobs;
+
+int job_init();
+void job_free();
+
+/* queue a new job, its first step runs on the next loop */
+struct job_ctx *job_new(const char *name, unsigned int priority, job_f step, job_cleanup_f cleanup, void *param);
+
+/* stop a job before its next step */
+void job_cancel(struct job_ctx *job);
+
+/* cancel all the jobs started from the scripts */
+void job_clear();
+
+/* run the jobs for at most the configured budget, return nonzero if any is left */
+unsigned int job_poll();
+
+#endif /* __JOB_H */
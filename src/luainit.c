@@ -47,6 +47,7 @@
 #include "events.h"
 #include "slaveselection.h"
 #include "timer.h"
+#include "job.h"
 #include "site.h"
 #include "irccore.h"
 #include "dir.h"
@@ -63,6 +64,7 @@
 //#include "luaslaves.h" // nothing yet
 //#include "luatime.h" // nothing yet
 #include "luatimer.h"
+#include "luajob.h"
 //#include "luaupdate.h" // nothing yet
 //#include "luausers.h" // nothing yet
 #include "luavfs.h"
@@ -399,6 +401,7 @@ lua_State *luainit_newstate() {
 	//luaopen_xftpd_slaves(L); // nothing yet
 	//luaopen_xftpd_time(L); // nothing yet
 	luaopen_xftpd_timer(L);
+	luaopen_xftpd_job(L);
 	//luaopen_xftpd_update(L); // nothing yet
 	//luaopen_xftpd_users(L); // nothing yet
 	luaopen_xftpd_vfs(L);
@@ -425,6 +428,8 @@ lua_State *luainit_newstate() {
 		EQ("irc_quit");
 		EQ("mirror_side");
 		EQ("mirror_ctx");
+		EQ("mirror_batch");
+		EQ("mirror_hot");
 		EQ("nuke_nukee");
 		EQ("nuke_ctx");
 		EQ("sfv_entry");
@@ -433,6 +438,7 @@ lua_State *luainit_newstate() {
 		EQ("hello_data");
 		EQ("slave_ctx");
 		EQ("timer_ctx");
+		EQ("job_ctx");
 		EQ("user_ctx");
 		EQ("vfs_section");
 		EQ("vfs_element");
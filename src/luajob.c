@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <tolua++.h>
+
+#include "constants.h"
+
+#include "luainit.h"
+#include "job.h"
+
+/* call the lua function, the job goes on while it returns true */
+static int luajob_step(struct job_ctx *job) {
+	lua_State *L = job->script->L;
+	int more = 0;
+	
+	lua_pushcfunction(L, luainit_traceback);
+	
+	tolua_pushusertype(L,(void*)job,"job_ctx");
+	
+	luainit_tget(L, JOB_REFTABLE, job->function_index);
+	if(lua_isfunction(L, -1)) {
+		int err;
+		
+		/* call the function with one param and one return */
+		err = lua_pcall(L, 1, 1, -2);
+		if(err) {
+			/* a failing job is not called again */
+			luainit_error(L, "(calling job step)", err);
+		} else {
+			more = lua_toboolean(L, -1);
+		}
+		
+		/* pops the error message or the return value */
+		lua_pop(L, 1);
+	} else {
+		/* pops the thing we just pushed that is not a function */
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1); /* pops the errfunc */
+	
+	return more;
+}
+
+static void luajob_cleanup(struct job_ctx *job) {
+	lua_State *L = job->script->L;
+	
+	luainit_tremove(L, JOB_REFTABLE, job->function_index);
+	
+	return;
+}
+
+/* add a job:
+job_ctx *add(name, (*step)(job_ctx *), priority = JOB_PRIORITY_NORMAL) */
+static int luajob_add(lua_State *L) {
+#ifndef TOLUA_RELEASE
+	tolua_Error tolua_err;
+	if (
+		!tolua_isstring(L,1,0,&tolua_err) ||
+		!tolua_isfunction(L,2,0,&tolua_err) ||
+		!tolua_isnumber(L,3,1,&tolua_err) ||
+		!tolua_isnoobj(L,4,&tolua_err)
+	) {
+		goto tolua_lerror;
+	} else
+#endif
+	{
+		struct job_ctx *job;
+		const char *name = lua_tostring(L, 1);
+		unsigned int priority = (lua_isnumber(L, 3) ? (unsigned int)lua_tonumber(L, 3) : JOB_PRIORITY_NORMAL);
+		
+		job = job_new(name, priority, luajob_step, NULL, NULL);
+		if(!job) {
+			JOB_DBG("Memory error");
+			return 0;
+		}
+		
+		job->script = script_resolve(L);
+		job->function_index = luainit_tinsert(L, JOB_REFTABLE, 2);
+		job->cleanup = luajob_cleanup;
+		
+		collection_add(job->script->jobs, job);
+		
+		tolua_pushusertype(L,(void*)job,"job_ctx");
+	}
+	return 1;
+#ifndef TOLUA_RELEASE
+tolua_lerror:
+	tolua_error(L,"#ferror in function luajob_add.",&tolua_err);
+	return 0;
+#endif
+}
+
+TOLUA_API int luaopen_xftpd_job(lua_State* L)
+{
+	luainit_tcreate(L, JOB_REFTABLE);
+	
+	tolua_module(L,NULL,0);
+	tolua_beginmodule(L,NULL);
+		tolua_module(L,"job",1);
+		tolua_beginmodule(L,"job");
+			tolua_function(L,"add", luajob_add);
+		tolua_endmodule(L);
+	tolua_endmodule(L);
+	
+	return 1;
+}
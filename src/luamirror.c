@@ -157,6 +157,108 @@ tolua_lerror:
 #endif
 }
 
+static int luamirror_batch_callback(struct mirror_batch *batch, void *param) {
+	struct mirror_lua_ctx *lua_ctx = param;
+	lua_State *L = lua_ctx->script->L;
+  
+	lua_pushcfunction(L, luainit_traceback);
+	
+	luainit_tget(L, MIRRORS_REFTABLE, lua_ctx->function_index);
+	if(lua_isfunction(L, -1)) {
+		int err;
+		
+		/* batch */
+		tolua_pushusertype(L, batch, "mirror_batch");
+		
+		/* param */
+		luainit_tget(L, MIRRORS_REFTABLE, lua_ctx->param_index);
+		
+		/* call the function with two params and one return */
+		err = lua_pcall(L, 2, 1, -4);
+		if(err) {
+			luainit_error(L, "(calling mirror batch callback)", err);
+		}
+		
+		/* pops the error message or the return value */
+		lua_pop(L, 1);
+	} else {
+		/* pops the thing we just pushed that is not a function */
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1); /* pops the errfunc */
+	
+	luainit_tremove(L, MIRRORS_REFTABLE, lua_ctx->function_index);
+	luainit_tremove(L, MIRRORS_REFTABLE, lua_ctx->param_index);
+	free(lua_ctx);
+	
+	return 1;
+}
+
+/* mirrors.queue(folder, slave, priority, function[, param]) */
+int luamirror_queue(lua_State *L) {
+#ifndef TOLUA_RELEASE
+	tolua_Error tolua_err;
+	if (
+		!tolua_isusertype(L,1,"vfs_element",0,&tolua_err) ||
+		!tolua_isusertype(L,2,"slave_ctx",0,&tolua_err) ||
+		!tolua_isnumber(L,3,0,&tolua_err) ||
+		!tolua_isfunction(L,4,0,&tolua_err) ||
+		/* 5th param is not mandatory */
+		!tolua_isnoobj(L,6,&tolua_err)
+	) {
+		goto tolua_lerror;
+	} else
+#endif
+	{
+		struct vfs_element *folder = ((struct vfs_element*)tolua_tousertype(L,1,0));
+		struct slave_ctx *target = ((struct slave_ctx*)tolua_tousertype(L,2,0));
+		unsigned int priority = ((unsigned int)tolua_tonumber(L,3,0));
+		
+		struct mirror_batch *batch;
+		struct mirror_lua_ctx *lua_ctx;
+		
+		lua_ctx = malloc(sizeof(struct mirror_lua_ctx));
+		if(!lua_ctx) {
+			MIRROR_DBG("Memory error");
+			return 0;
+		}
+		
+		lua_ctx->script = script_resolve(L);
+		
+		lua_ctx->function_index = luainit_tinsert(L, MIRRORS_REFTABLE, 4);
+		
+		if(!lua_isnil(L, 5) && !lua_isnone(L, 5)) {
+			lua_ctx->param_index = luainit_tinsert(L, MIRRORS_REFTABLE, 5);
+		} else {
+			lua_ctx->param_index = 0;
+		}
+		
+		batch = mirror_batch_new(folder, target, priority, luamirror_batch_callback, lua_ctx);
+		if(!batch) {
+			MIRROR_DBG("Memory error");
+			luainit_tremove(L, MIRRORS_REFTABLE, lua_ctx->function_index);
+			luainit_tremove(L, MIRRORS_REFTABLE, lua_ctx->param_index);
+			free(lua_ctx);
+			return 0;
+		}
+		
+		/* the callback releases the lua_ctx */
+		if(!collection_add(lua_ctx->script->mirrors, batch)) {
+			MIRROR_DBG("Collection error");
+			mirror_batch_cancel(batch);
+			return 0;
+		}
+		
+		tolua_pushusertype(L, batch, "mirror_batch");
+	}
+	return 1;
+#ifndef TOLUA_RELEASE
+tolua_lerror:
+	tolua_error(L,"#ferror in function luamirror_queue.",&tolua_err);
+	return 0;
+#endif
+}
+
 TOLUA_API int luaopen_xftpd_mirror(lua_State* L)
 {
 	luainit_tcreate(L, MIRRORS_REFTABLE);
@@ -166,6 +268,7 @@ TOLUA_API int luaopen_xftpd_mirror(lua_State* L)
 		tolua_module(L,"mirrors",1);
 		tolua_beginmodule(L,"mirrors");
 			tolua_function(L,"new", luamirror_new);
+			tolua_function(L,"queue", luamirror_queue);
 		tolua_endmodule(L);
 	tolua_endmodule(L);
 	
@@ -32,12 +32,13 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-
+
 #ifdef WIN32
 #include <windows.h>
 #endif
 
 #include <tolua++.h>
+#include <lauxlib.h>
 
 #include "constants.h"
 
@@ -72,6 +73,73 @@ static int luaskins_getline(lua_State* tolua_S)
 #endif
 }
 
+struct luaskins_render_ctx {
+	lua_State *L;
+	int values; /* stack index of the values table, 0 if none */
+	luaL_Buffer b;
+};
+
+static void luaskins_render_append(struct luaskins_render_ctx *ctx, const char *text, unsigned int length)
+{
+	luaL_addlstring(&ctx->b, text, length);
+}
+
+static int luaskins_render_slot(struct luaskins_render_ctx *ctx, const char *slot)
+{
+	int type;
+	
+	if(!ctx->values)
+		return 0;
+	
+	lua_getfield(ctx->L, ctx->values, slot);
+	type = lua_type(ctx->L, -1);
+	if((type != LUA_TSTRING) && (type != LUA_TNUMBER)) {
+		lua_pop(ctx->L, 1);
+		return 0;
+	}
+	
+	/* the value goes straight from the stack into the buffer */
+	luaL_addvalue(&ctx->b);
+	
+	return 1;
+}
+
+/* skins.render(line, values): fill the line's slots with the values table */
+static int luaskins_render(lua_State* tolua_S)
+{
+#ifndef TOLUA_RELEASE
+	tolua_Error tolua_err;
+	if (
+		!tolua_isstring(tolua_S,1,0,&tolua_err) ||
+		!tolua_istable(tolua_S,2,1,&tolua_err) ||
+		!tolua_isnoobj(tolua_S,3,&tolua_err)
+	)
+	goto tolua_lerror;
+	else
+#endif
+	{
+		struct luaskins_render_ctx ctx;
+		const char* line = ((const char*)  tolua_tostring(tolua_S,1,0));
+		
+		ctx.L = tolua_S;
+		ctx.values = lua_istable(tolua_S,2) ? 2 : 0;
+		
+		if(!skins_get_template(line))
+			return 0;
+		
+		luaL_buffinit(tolua_S, &ctx.b);
+		skins_render(line, (skins_append_f)luaskins_render_append, (skins_slot_f)luaskins_render_slot, &ctx);
+		luaL_pushresult(&ctx.b);
+		
+		return 1;
+	}
+#ifndef TOLUA_RELEASE
+	tolua_lerror:
+	tolua_error(tolua_S,"#ferror in function 'render'.",&tolua_err);
+	return 0;
+#endif
+}
+
 TOLUA_API int luaopen_xftpd_skins(lua_State* L)
 {
 	tolua_module(L,NULL,1);
@@ -79,6 +147,7 @@ TOLUA_API int luaopen_xftpd_skins(lua_State* L)
 		tolua_module(L,"skins",1);
 		tolua_beginmodule(L,"skins");
 			tolua_function(L,"getline", luaskins_getline);
+			tolua_function(L,"render", luaskins_render);
 		tolua_endmodule(L);
 	tolua_endmodule(L);
 	
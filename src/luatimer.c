@@ -51,6 +51,7 @@ static void timer_obj_destroy(struct timer_ctx *to) {
 	
 	collectible_destroy(to);
 	
+	wheel_cancel(&to->timer);
 	luainit_tremove(L, TIMER_REFTABLE, to->function_index);
 	free(to);
 	
@@ -95,6 +96,8 @@ static int luatimer_add(lua_State *L) {
 		collection_add(timers, to);
 		collection_add(to->script->timers, to);
 		
+		timer_start(to);
+		
 		tolua_pushusertype(L,(void*)to,"timer_ctx");
 	}
 	return 1;
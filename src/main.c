@@ -57,6 +57,8 @@
 #include "irccore.h"
 #include "users.h"
 #include "timer.h"
+#include "job.h"
+#include "wheel.h"
 #include "mirror.h"
 #include "site.h"
 #include "time.h"
@@ -159,6 +161,10 @@ int main(int argc, char* argv[]) {
 		MAIN_DBG("Could not initialize \"ftpd\" module");
 		return 1;
 	}
+	if(!job_init()) {
+		MAIN_DBG("Could not initialize \"job\" module");
+		return 1;
+	}
 	if(!nuke_init()) {
 		MAIN_DBG("Could not initialize \"nuke\" module");
 		return 1;
@@ -217,17 +223,20 @@ int main(int argc, char* argv[]) {
 		
 		probe_stats();
 		
-		timer_poll();
+		/* signal timeouts, asynch commands, xfers, mirrors and lua timers */
+		wheel_poll();
 		
 		socket_poll();
 		
-		secure_poll();
+		/* wipes, nuke matching and lua jobs, within their budget */
+		job_poll();
 		
 		slaves_dump_fileslog();
 		
 		config_poll();
 		
-		sleep(MASTER_SLEEP_TIME);
+		/* do not sleep while some jobs are pending */
+		sleep(collection_size(jobs) ? 0 : wheel_sleep_time(MASTER_SLEEP_TIME));
 		
 		if(obj_balance) {
 			MAIN_DBG("WARNING!!! Object dereferencing is not balanced!");
@@ -258,6 +267,9 @@ int main(int argc, char* argv[]) {
 			/* clean all timers */
 			timer_clear();
 			
+			/* cancel the jobs of the scripts */
+			job_clear();
+			
 			/* clean all events */
 			events_clear();
 			
@@ -292,6 +304,7 @@ int main(int argc, char* argv[]) {
 	irccore_free();
 	//luainit_free();
 	
+	job_free();
 	nuke_free();
 	site_free();
 	mirror_free();
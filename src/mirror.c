@@ -54,15 +54,48 @@
 #include "asynch.h"
 #include "obj.h"
 #include "config.h"
+#include "slaveselection.h"
+#include "vfs.h"
 
 
 struct collection *mirrors = NULL;
+struct collection *mirror_batches = NULL;
+struct collection *mirror_hots = NULL;
+
+static unsigned int mirror_max_running = MIRROR_MAX_RUNNING;
+static unsigned int mirror_max_per_slave = MIRROR_MAX_PER_SLAVE;
+static struct wheel_timer mirror_schedule_timer;
+
+static unsigned int mirror_hot_threshold = MIRROR_HOT_THRESHOLD; /* 0 to disable */
+static unsigned int mirror_hot_copies = MIRROR_HOT_COPIES;
+static unsigned int mirror_hot_expire = MIRROR_HOT_EXPIRE;
+static struct wheel_timer mirror_hot_timer;
+
+static unsigned int mirror_hot_total_hits = 0;
+static unsigned int mirror_hot_total_copy_hits = 0;
+static unsigned long long int mirror_hot_total_served = 0;
+
+static void mirror_schedule(void *param);
+static void mirror_hot_pass(void *param);
 
 int mirror_init() {
 	
 	MIRROR_DBG("Loading ...");
 
 	mirrors = collection_new(C_CASCADE);
+	mirror_batches = collection_new(C_CASCADE);
+	mirror_hots = collection_new(C_CASCADE);
+	
+	mirror_max_running = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.mirror.max-running", MIRROR_MAX_RUNNING);
+	mirror_max_per_slave = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.mirror.max-per-slave", MIRROR_MAX_PER_SLAVE);
+	
+	wheel_timer_init(&mirror_schedule_timer, (wheel_f)mirror_schedule, NULL);
+	
+	mirror_hot_threshold = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.mirror.hot-threshold", MIRROR_HOT_THRESHOLD);
+	mirror_hot_copies = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.mirror.hot-copies", MIRROR_HOT_COPIES);
+	mirror_hot_expire = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.mirror.hot-expire", MIRROR_HOT_EXPIRE);
+	
+	wheel_timer_init(&mirror_hot_timer, (wheel_f)mirror_hot_pass, NULL);
 	
 	return 1;
 }
@@ -73,6 +106,20 @@ void mirror_free() {
 
 	/* TODO! */
 
+	wheel_cancel(&mirror_schedule_timer);
+	wheel_cancel(&mirror_hot_timer);
+
+	/* the copies in progress are canceled with their batch */
+	if(mirror_hots) {
+		collection_destroy(mirror_hots);
+		mirror_hots = NULL;
+	}
+
+	if(mirror_batches) {
+		collection_destroy(mirror_batches);
+		mirror_batches = NULL;
+	}
+
 	if(mirrors) {
 		collection_destroy(mirrors);
 	}
@@ -80,6 +127,27 @@ void mirror_free() {
 	return;
 }
 
+/* both the upload and its copy are complete: keep the copy if it is the same */
+static void mirror_tee_verify(struct mirror_ctx *mirror) {
+
+	if(!mirror->source.finished || !mirror->target.finished) {
+		return;
+	}
+
+	if(mirror->source.checksum != mirror->target.checksum) {
+		MIRROR_DBG("" LLU ": Replica of %s has checksum %08x instead of %08x", mirror->uid,
+			mirror->target.file->name, mirror->target.checksum, mirror->source.checksum);
+	} else {
+		/* link this file to the slave's available_from collection */
+		slave_mark_online_from(mirror->target.cnx, mirror->target.file);
+		mirror->success = 1;
+	}
+
+	mirror_cancel(mirror);
+
+	return;
+}
+
 /* p is NULL on timeout and on read error */
 static unsigned int mirror_slave_transfer_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
 	struct mirror_ctx *mirror = (struct mirror_ctx *)cmd->param;
@@ -120,6 +188,16 @@ static unsigned int mirror_slave_transfer_query_callback(struct slave_connection
 			return 0;
 		}
 
+		if(mirror->tee) {
+			/* the copy is made available once the upload is complete too */
+			side->xfered = reply->xfersize;
+			side->checksum = reply->checksum;
+			side->finished = 1;
+
+			mirror_tee_verify(mirror);
+			return 1;
+		}
+
 		/* update new size in vfs only if it's not already done */
 		if(!source && !collection_size(side->file->available_from) && !collection_size(side->file->offline_from)) {
 			
@@ -164,11 +242,36 @@ static unsigned int mirror_slave_transfer_query_callback(struct slave_connection
 	return 0;
 }
 
+/* p is NULL on timeout and on read error */
+static unsigned int mirror_slave_tee_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
+	struct mirror_ctx *mirror = (struct mirror_ctx *)cmd->param;
+
+	MIRROR_DBG("" LLU ": Mirror tee response received", cmd->uid);
+
+	mirror->source.cmd = NULL;
+
+	if(!p || (p->type != IO_SLAVE_TEE)) {
+		MIRROR_DBG("" LLU ": The upload could not be streamed to the replica", cmd->uid);
+		mirror_cancel(mirror);
+		return 1;
+	}
+
+	/* the source is finished when the upload is (see mirror_tee_complete) */
+	return 1;
+}
+
+/* the slave stops waiting for a replica that will never come */
+static unsigned int mirror_slave_tee_release_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
+
+	return 1;
+}
+
 /* p is NULL on timeout and on read error */
 static unsigned int mirror_slave_listen_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
 	struct slave_listen_reply *reply;
 	struct mirror_ctx *mirror = (struct mirror_ctx *)cmd->param;
 	struct slave_transfer_request *data;
+	struct slave_tee_request tee;
 	unsigned int length;
 	struct mirror_side *side;
 	unsigned int source; /* 1 if this callback is from the source */
@@ -207,28 +310,44 @@ static unsigned int mirror_slave_listen_query_callback(struct slave_connection *
 			return 0;
 		}
 
-		/* send the transfer query for both slaves */
-		data = ftpd_transfer(mirror->uid, mirror->source.cnx->slave->vroot, mirror->source.file,
-					reply->ip, reply->port, mirror->source.pasv, 0 /* we're downloading from the source */, 0, &length);
-		if(!data) {
-			MIRROR_DBG("Could not build the (source) transfer data.");
-			mirror_cancel(mirror);
-			return 1;
-		}
-		mirror->source.cmd = asynch_new(
-			mirror->source.cnx,
-			IO_SLAVE_TRANSFER,
-			-1,			/* transfer queries does not timeout because they come back only when the transfer succeed or fail */
-			(void*)data,
-			length,
-			mirror_slave_transfer_query_callback,
-			mirror
-		);
-		free(data);
-		if(!mirror->source.cmd) {
-			MIRROR_DBG("Could not make the (source) transfer query.");
-			mirror_cancel(mirror);
-			return 1;
+		if(mirror->tee) {
+			/* the source streams the upload it receives to the target */
+			tee.xfer_uid = mirror->tee_uid;
+			tee.ip = reply->ip;
+			tee.port = reply->port;
+
+			mirror->tee_queried = 1;
+			mirror->source.cmd = asynch_new(mirror->source.cnx, IO_SLAVE_TEE, MASTER_ASYNCH_TIMEOUT,
+				(void*)&tee, sizeof(tee), mirror_slave_tee_query_callback, mirror);
+			if(!mirror->source.cmd) {
+				MIRROR_DBG("Could not make the (source) tee query.");
+				mirror_cancel(mirror);
+				return 1;
+			}
+		} else {
+			/* send the transfer query for both slaves */
+			data = ftpd_transfer(mirror->uid, mirror->source.cnx->slave->vroot, mirror->source.file,
+						reply->ip, reply->port, mirror->source.pasv, 0 /* we're downloading from the source */, 0, &length);
+			if(!data) {
+				MIRROR_DBG("Could not build the (source) transfer data.");
+				mirror_cancel(mirror);
+				return 1;
+			}
+			mirror->source.cmd = asynch_new(
+				mirror->source.cnx,
+				IO_SLAVE_TRANSFER,
+				-1,			/* transfer queries does not timeout because they come back only when the transfer succeed or fail */
+				(void*)data,
+				length,
+				mirror_slave_transfer_query_callback,
+				mirror
+			);
+			free(data);
+			if(!mirror->source.cmd) {
+				MIRROR_DBG("Could not make the (source) transfer query.");
+				mirror_cancel(mirror);
+				return 1;
+			}
 		}
 
 		data = ftpd_transfer(mirror->uid, mirror->target.cnx->slave->vroot, mirror->target.file,
@@ -296,9 +415,64 @@ static unsigned int find_destination_slave(struct collection *c, void *item, voi
 	return 1;
 }
 
+/* called by the wheel when a side may have timed out */
+static void mirror_check_timeout(struct mirror_ctx *mirror) {
+	unsigned long long int last_alive;
+	
+	if(!obj_isvalid(&mirror->o))
+		return;
+	
+	last_alive = mirror->source.last_alive;
+	if(mirror->target.last_alive < last_alive)
+		last_alive = mirror->target.last_alive;
+	
+	if(timer(last_alive) > FTPD_XFER_TIMEOUT) {
+		MIRROR_DBG("" LLU ": Mirror xfer timeout reached!", mirror->uid);
+		
+		mirror_cancel(mirror);
+		
+		return;
+	}
+	
+	wheel_schedule(&mirror->timer, last_alive + FTPD_XFER_TIMEOUT + 1);
+	
+	return;
+}
+
+/* called by stats.c when the source slave reported its progress */
+static void mirror_source_progress(struct stats_link *link) {
+	struct mirror_ctx *mirror = CONTAINING_RECORD(link, struct mirror_ctx, source.progress);
+	
+	mirror->source.xfered = link->xfered;
+	mirror->source.speed = link->speed;
+	mirror->source.last_alive = time_now();
+	
+	return;
+}
+
+/* called by stats.c when the target slave reported its progress */
+static void mirror_target_progress(struct stats_link *link) {
+	struct mirror_ctx *mirror = CONTAINING_RECORD(link, struct mirror_ctx, target.progress);
+	
+	mirror->target.xfered = link->xfered;
+	mirror->target.speed = link->speed;
+	mirror->target.last_alive = time_now();
+	
+#ifdef GROW_FILE_SIZES_ON_TRANSFER
+	/* Update the filesize here if needed */
+	vfs_set_size(mirror->target.file, mirror->target.xfered);
+#endif
+	
+	return;
+}
+
 static void mirror_obj_destroy(struct mirror_ctx *mirror) {
 	
 	collectible_destroy(mirror);
+	
+	wheel_cancel(&mirror->timer);
+	stats_link_remove(&mirror->source.progress);
+	stats_link_remove(&mirror->target.progress);
 
 	MIRROR_DBG("Destroying");
 
@@ -326,11 +500,31 @@ static void mirror_obj_destroy(struct mirror_ctx *mirror) {
 
 	/* TODO: send a cancel to both slaves for the xfer */
 	
+	if(mirror->tee) {
+		if(!mirror->tee_queried && mirror->source.cnx) {
+			/* the source still waits for this replica before reading the upload */
+			struct slave_tee_request tee;
+			
+			tee.xfer_uid = mirror->tee_uid;
+			tee.ip = 0;
+			tee.port = 0;
+			
+			asynch_new(mirror->source.cnx, IO_SLAVE_TEE, MASTER_ASYNCH_TIMEOUT,
+				(void*)&tee, sizeof(tee), mirror_slave_tee_release_callback, NULL);
+		}
+		
+		if(!mirror->success && mirror->target.finished && mirror->target.cnx && mirror->target.file) {
+			/* the copy is complete but it is not the uploaded file */
+			slave_delete_file(mirror->target.cnx, mirror->target.file);
+		}
+		
+		/* the file itself belongs to the upload */
+	}
 	/*
 		if the file is no longer available from anywhere,
 		then delete it from the vfs.
 	*/
-	if(mirror->target.file) {
+	else if(mirror->target.file) {
 		if (!collection_size(mirror->target.file->mirror_to) &&
 			!collection_size(mirror->target.file->available_from) &&
 			!collection_size(mirror->target.file->offline_from)) {
@@ -345,6 +539,14 @@ static void mirror_obj_destroy(struct mirror_ctx *mirror) {
 	mirror->source.file = NULL;
 	mirror->target.file = NULL;
 
+	/* the mirror left both slave's mirror collection, it no longer counts in their load */
+	if(mirror->source.cnx && obj_isvalid(&mirror->source.cnx->o)) {
+		slaveselection_update(mirror->source.cnx);
+	}
+	if(mirror->target.cnx && obj_isvalid(&mirror->target.cnx->o)) {
+		slaveselection_update(mirror->target.cnx);
+	}
+
 	/* unlink from both slave's mirror collection */
 	mirror->source.cnx = NULL;
 	mirror->target.cnx = NULL;
@@ -355,72 +557,18 @@ static void mirror_obj_destroy(struct mirror_ctx *mirror) {
 	return;
 }
 
-/*
-	Mirror the content of one file from one
-	slave to the same file or another file
-	on another slave. Both files must already
-	exist.
-*/
-struct mirror_ctx *mirror_new(
+/* start a mirror whose parameters were checked by the caller */
+static struct mirror_ctx *mirror_alloc(
 	struct slave_connection *src_cnx,
 	struct vfs_element *src_file,
 	struct slave_connection *dest_cnx,
 	struct vfs_element *dest_file,
+	char tee,
+	unsigned long long int tee_uid,
 	int (*callback)(struct mirror_ctx *mirror, int success, void *param),
 	void *param
 ) {
 	struct mirror_ctx *mirror;
-	struct {
-		struct slave_connection *cnx;
-		struct vfs_element *file;
-		unsigned int found;
-	} ctx = { dest_cnx, dest_file, 0 };
-
-	if(!src_cnx || !src_file || !dest_cnx || !dest_file) {
-		MIRROR_DBG("Parameter error");
-		return NULL;
-	}
-
-	if(src_file->type != VFS_FILE) {
-		MIRROR_DBG("Source file is not VFS_FILE-type");
-		return NULL;
-	}
-
-	if(dest_file->type != VFS_FILE) {
-		MIRROR_DBG("Destination file is not VFS_FILE-type");
-		return NULL;
-	}
-
-	/* don't transfer a file if the dest file is bigger than the source file */
-	//if(dest_file->size >= src_file->size) return NULL;
-
-	/* don't transfer if the source file is not available on the source slave */
-	if(!collection_find(src_file->available_from, src_cnx)) {
-		MIRROR_DBG("Source file is not available from the source slave");
-		return NULL;
-	}
-
-	/* don't transfer if the destination file is already on the destination slave */
-	if(collection_find(dest_file->available_from, dest_cnx)) {
-		MIRROR_DBG("Destination file is already on the destination slave");
-		return NULL;
-	}
-
-	/* don't transfer if the source slave is the destination slave */
-	if(src_cnx == dest_cnx) {
-		MIRROR_DBG("Source slave IS the destination slave");
-		return NULL;
-	}
-
-	/* don't transfer if the destination slave is already used as a target
-		for the same destination file in any mirror operation */
-	collection_iterate(mirrors, (collection_f)find_destination_slave, &ctx);
-	if(ctx.found) {
-		MIRROR_DBG("This file is already being mirrored to that slave.");
-		return NULL;
-	}
-
-	/* Everything should be good for the transfer to begin. */
 
 	mirror = malloc(sizeof(struct mirror_ctx));
 	if(!mirror) {
@@ -430,11 +578,18 @@ struct mirror_ctx *mirror_new(
 
 	obj_init(&mirror->o, mirror, (obj_f)mirror_obj_destroy);
 	collectible_init(mirror);
+	wheel_timer_init(&mirror->timer, (wheel_f)mirror_check_timeout, mirror);
+	stats_link_init(&mirror->source.progress, (stats_f)mirror_source_progress);
+	stats_link_init(&mirror->target.progress, (stats_f)mirror_target_progress);
 
 	mirror->callback = callback;
 	mirror->callback_param = param;
 
 	mirror->success = 0;
+	
+	mirror->tee = tee;
+	mirror->tee_queried = 0;
+	mirror->tee_uid = tee_uid;
 
 	//mirror->canceled = 0;
 	mirror->uid = ftpd_next_xfer();
@@ -449,13 +604,18 @@ struct mirror_ctx *mirror_new(
 	mirror->source.xfered = 0;
 	mirror->target.xfered = 0;
 	
+	mirror->source.speed = 0;
+	mirror->target.speed = 0;
+	
 	mirror->source.last_alive = time_now();
 	mirror->target.last_alive = time_now();
 
 	/* by default the source is doing pasv unless
-		there's a rule that says it's not possible */
-	mirror->source.pasv = 1;
-	mirror->target.pasv = 0;
+		there's a rule that says it's not possible. the
+		source of a tee connects to the target like a client
+		uploading to it would */
+	mirror->source.pasv = tee ? 0 : 1;
+	mirror->target.pasv = tee ? 1 : 0;
 
 	mirror->source.cnx = src_cnx;
 	mirror->source.file = src_file;
@@ -532,10 +692,83 @@ struct mirror_ctx *mirror_new(
 		free(mirror);
 		return NULL;
 	}
+	
+	wheel_schedule(&mirror->timer, time_now() + FTPD_XFER_TIMEOUT + 1);
+	stats_link_add(&mirror->source.progress, src_cnx, tee ? tee_uid : mirror->uid);
+	stats_link_add(&mirror->target.progress, dest_cnx, mirror->uid);
+	slaveselection_update(src_cnx);
+	slaveselection_update(dest_cnx);
 
 	return mirror;
 }
 
+/*
+	Mirror the content of one file from one
+	slave to the same file or another file
+	on another slave. Both files must already
+	exist.
+*/
+struct mirror_ctx *mirror_new(
+	struct slave_connection *src_cnx,
+	struct vfs_element *src_file,
+	struct slave_connection *dest_cnx,
+	struct vfs_element *dest_file,
+	int (*callback)(struct mirror_ctx *mirror, int success, void *param),
+	void *param
+) {
+	struct {
+		struct slave_connection *cnx;
+		struct vfs_element *file;
+		unsigned int found;
+	} ctx = { dest_cnx, dest_file, 0 };
+
+	if(!src_cnx || !src_file || !dest_cnx || !dest_file) {
+		MIRROR_DBG("Parameter error");
+		return NULL;
+	}
+
+	if(src_file->type != VFS_FILE) {
+		MIRROR_DBG("Source file is not VFS_FILE-type");
+		return NULL;
+	}
+
+	if(dest_file->type != VFS_FILE) {
+		MIRROR_DBG("Destination file is not VFS_FILE-type");
+		return NULL;
+	}
+
+	/* don't transfer a file if the dest file is bigger than the source file */
+	//if(dest_file->size >= src_file->size) return NULL;
+
+	/* don't transfer if the source file is not available on the source slave */
+	if(!collection_find(src_file->available_from, src_cnx)) {
+		MIRROR_DBG("Source file is not available from the source slave");
+		return NULL;
+	}
+
+	/* don't transfer if the destination file is already on the destination slave */
+	if(collection_find(dest_file->available_from, dest_cnx)) {
+		MIRROR_DBG("Destination file is already on the destination slave");
+		return NULL;
+	}
+
+	/* don't transfer if the source slave is the destination slave */
+	if(src_cnx == dest_cnx) {
+		MIRROR_DBG("Source slave IS the destination slave");
+		return NULL;
+	}
+
+	/* don't transfer if the destination slave is already used as a target
+		for the same destination file in any mirror operation */
+	collection_iterate(mirrors, (collection_f)find_destination_slave, &ctx);
+	if(ctx.found) {
+		MIRROR_DBG("This file is already being mirrored to that slave.");
+		return NULL;
+	}
+
+	return mirror_alloc(src_cnx, src_file, dest_cnx, dest_file, 0, -1, callback, param);
+}
+
 unsigned int mirror_cancel(struct mirror_ctx *mirror) {
 
 	if(!mirror) {
@@ -547,3 +780,915 @@ unsigned int mirror_cancel(struct mirror_ctx *mirror) {
 	return 1;
 }
 
+/* nonzero if the slave can't take one more mirror */
+static int mirror_slave_busy(struct slave_connection *cnx) {
+
+	return ((collection_size(cnx->mirror_from) + collection_size(cnx->mirror_to)) >= mirror_max_per_slave);
+}
+
+struct mirror_tee_ctx {
+	struct slave_connection *source; /* receives the upload */
+	struct vfs_element *file;
+	
+	struct slave_connection *chosen[MIRROR_TEE_MAX];
+	unsigned int count;
+	
+	struct slave_connection *cnx; /* best candidate so far */
+	unsigned int score;
+};
+
+/* pick the least loaded slave of the section that can take one more replica */
+static int mirror_tee_candidate(struct collection *c, struct slave_ctx *slave, struct mirror_tee_ctx *ctx) {
+	struct slave_connection *cnx = slave->cnx;
+	unsigned int i;
+	
+	if(!cnx || !cnx->ready || (cnx == ctx->source)) {
+		return 1;
+	}
+	
+	if(!vfs_is_child(slave->vroot, ctx->file) || mirror_slave_busy(cnx)) {
+		return 1;
+	}
+	
+	for(i=0;i<ctx->count;i++) {
+		if(ctx->chosen[i] == cnx) {
+			return 1;
+		}
+	}
+	
+	if(!ctx->cnx || (cnx->load.up < ctx->score)) {
+		ctx->cnx = cnx;
+		ctx->score = cnx->load.up;
+	}
+	
+	return 1;
+}
+
+unsigned int mirror_tee_start(struct slave_connection *cnx, struct vfs_element *file, unsigned long long int uid) {
+	struct mirror_tee_ctx ctx;
+	struct vfs_section *section;
+	unsigned int replicas;
+	unsigned int started = 0;
+	
+	if(!cnx || !file || (file->type != VFS_FILE)) {
+		MIRROR_DBG("Parameter error");
+		return 0;
+	}
+	
+	section = vfs_get_section(file);
+	if(!section || !section->config) {
+		return 0;
+	}
+	
+	/* number of copies besides the one on the uploading slave */
+	replicas = config_read_int(section->config, "replicas", 0);
+	if(replicas > MIRROR_TEE_MAX) {
+		replicas = MIRROR_TEE_MAX;
+	}
+	
+	ctx.source = cnx;
+	ctx.file = file;
+	ctx.count = 0;
+	
+	while(ctx.count < replicas) {
+		ctx.cnx = NULL;
+		ctx.score = 0;
+		collection_iterate(section->slaves, (collection_f)mirror_tee_candidate, &ctx);
+		if(!ctx.cnx) {
+			break;
+		}
+		
+		ctx.chosen[ctx.count++] = ctx.cnx;
+		
+		if(!mirror_alloc(cnx, file, ctx.cnx, file, 1, uid, NULL, NULL)) {
+			MIRROR_DBG("" LLU ": Could not start a replica of %s", uid, file->name);
+			continue;
+		}
+		
+		started++;
+	}
+	
+	if(started) {
+		MIRROR_DBG("" LLU ": Upload of %s streamed to %u replica(s)", uid, file->name, started);
+	}
+	
+	return started;
+}
+
+static int mirror_tee_complete_callback(struct collection *c, struct mirror_ctx *mirror, void *param) {
+	struct {
+		int success;
+		unsigned int checksum;
+	} *ctx = param;
+	
+	if(!mirror->tee || mirror->source.finished) {
+		return 1;
+	}
+	
+	if(!ctx->success) {
+		/*
+			the replica is reset by the source when the upload fails.
+			when the upload was rejected after it completed, the copy
+			is already on its way and it will show up in the target's
+			next file list.
+		*/
+		mirror_cancel(mirror);
+		return 1;
+	}
+	
+	mirror->source.finished = 1;
+	mirror->source.checksum = ctx->checksum;
+	
+	mirror_tee_verify(mirror);
+	
+	return 1;
+}
+
+void mirror_tee_complete(struct vfs_element *file, int success, unsigned int checksum) {
+	struct {
+		int success;
+		unsigned int checksum;
+	} ctx = { success, checksum };
+	
+	if(!file || !file->mirror_to) {
+		return;
+	}
+	
+	collection_iterate(file->mirror_to, (collection_f)mirror_tee_complete_callback, &ctx);
+	
+	return;
+}
+
+/* run the scheduler on the next loop */
+static void mirror_schedule_soon() {
+
+	wheel_schedule(&mirror_schedule_timer, time_now());
+
+	return;
+}
+
+/* called when one of the batch's mirrors is destroyed */
+static int mirror_batch_callback(struct mirror_ctx *mirror, int success, void *param) {
+	struct mirror_batch *batch = param;
+
+	if(success) {
+		batch->done++;
+		batch->xfered += mirror->target.xfered;
+	} else {
+		batch->failed++;
+	}
+
+	/* the slot is free: the next file can start */
+	mirror_schedule_soon();
+
+	return 1;
+}
+
+static void mirror_batch_obj_destroy(struct mirror_batch *batch) {
+
+	collectible_destroy(batch);
+
+	MIRROR_DBG("Batch %s: %u/%u files mirrored, %u failed, " LLU " bytes in " LLU " ms",
+		batch->path, batch->done, batch->files, batch->failed, batch->xfered, timer(batch->timestamp));
+
+	if(batch->callback) {
+		(*batch->callback)(batch, batch->callback_param);
+		batch->callback = NULL;
+		batch->callback_param = NULL;
+	}
+
+	/* the remaining mirrors are canceled without calling us back */
+	while(collection_size(batch->running)) {
+		struct mirror_ctx *mirror = collection_first(batch->running);
+		collection_delete(batch->running, mirror);
+		mirror->callback = NULL;
+		mirror->callback_param = NULL;
+		mirror_cancel(mirror);
+	}
+	collection_destroy(batch->running);
+	collection_destroy(batch->queued);
+
+	obj_unref(&batch->target->o);
+	batch->target = NULL;
+
+	free(batch->path);
+	free(batch);
+
+	return;
+}
+
+/* used by mirror_batch_new */
+static unsigned int mirror_batch_add_files(struct collection *c, struct vfs_element *element, struct mirror_batch *batch) {
+
+	if(element->type == VFS_FOLDER) {
+		collection_iterate(element->childs, (collection_f)mirror_batch_add_files, batch);
+		return 1;
+	}
+
+	if(element->type != VFS_FILE) {
+		return 1;
+	}
+
+	if(!collection_add(batch->queued, element)) {
+		MIRROR_DBG("Collection error");
+		return 0;
+	}
+	batch->files++;
+
+	return 1;
+}
+
+/*
+	Queue all files of a folder to be mirrored to the
+	target slave. The slave does not need to be connected,
+	the files wait until it is.
+*/
+struct mirror_batch *mirror_batch_new(
+	struct vfs_element *folder,
+	struct slave_ctx *target,
+	unsigned int priority,
+	int (*callback)(struct mirror_batch *batch, void *param),
+	void *param
+) {
+	struct mirror_batch *batch;
+
+	if(!folder || !target) {
+		MIRROR_DBG("Parameter error");
+		return NULL;
+	}
+
+	if(priority > MIRROR_PRIORITY_LOW) {
+		priority = MIRROR_PRIORITY_LOW;
+	}
+
+	batch = malloc(sizeof(struct mirror_batch));
+	if(!batch) {
+		MIRROR_DBG("Memory error");
+		return NULL;
+	}
+
+	batch->path = vfs_get_relative_path(vfs_root, folder);
+	if(!batch->path) {
+		MIRROR_DBG("Memory error");
+		free(batch);
+		return NULL;
+	}
+
+	batch->queued = collection_new(C_NONE);
+	batch->running = collection_new(C_NONE);
+	if(!batch->queued || !batch->running) {
+		MIRROR_DBG("Memory error");
+		if(batch->queued) collection_destroy(batch->queued);
+		if(batch->running) collection_destroy(batch->running);
+		free(batch->path);
+		free(batch);
+		return NULL;
+	}
+
+	obj_init(&batch->o, batch, (obj_f)mirror_batch_obj_destroy);
+	collectible_init(batch);
+
+	batch->priority = priority;
+	batch->target = target;
+	batch->last_source = NULL;
+	batch->files = 0;
+	batch->done = 0;
+	batch->failed = 0;
+	batch->xfered = 0;
+	batch->timestamp = time_now();
+	batch->callback = NULL;
+	batch->callback_param = NULL;
+
+	/* a single file is queued as is */
+	mirror_batch_add_files(NULL, folder, batch);
+
+	if(!collection_add(mirror_batches, batch)) {
+		MIRROR_DBG("Collection error");
+		collection_destroy(batch->running);
+		collection_destroy(batch->queued);
+		free(batch->path);
+		free(batch);
+		return NULL;
+	}
+
+	/* keep the slave around until the batch is done */
+	obj_ref(&target->o);
+
+	batch->callback = callback;
+	batch->callback_param = param;
+
+	MIRROR_DBG("Batch %s: %u files queued for %s (priority %u)", batch->path, batch->files, target->name, priority);
+
+	mirror_schedule_soon();
+
+	return batch;
+}
+
+unsigned int mirror_batch_cancel(struct mirror_batch *batch) {
+
+	if(!batch) {
+		return 0;
+	}
+
+	obj_destroy(&batch->o);
+
+	return 1;
+}
+
+/* used by mirror_batch_speed */
+static unsigned int mirror_batch_speed_callback(struct collection *c, struct mirror_ctx *mirror, unsigned int *speed) {
+
+	*speed += mirror->target.speed;
+
+	return 1;
+}
+
+unsigned int mirror_batch_speed(struct mirror_batch *batch) {
+	unsigned int speed = 0;
+
+	if(!batch) {
+		return 0;
+	}
+
+	collection_iterate(batch->running, (collection_f)mirror_batch_speed_callback, &speed);
+
+	return speed;
+}
+
+/* used by mirror_queue_depth */
+static unsigned int mirror_queue_depth_callback(struct collection *c, struct mirror_batch *batch, unsigned int *depth) {
+
+	*depth += collection_size(batch->queued);
+
+	return 1;
+}
+
+unsigned int mirror_queue_depth() {
+	unsigned int depth = 0;
+
+	collection_iterate(mirror_batches, (collection_f)mirror_queue_depth_callback, &depth);
+
+	return depth;
+}
+
+/* used by mirror_queue_speed */
+static unsigned int mirror_queue_speed_callback(struct collection *c, struct mirror_batch *batch, unsigned int *speed) {
+
+	*speed += mirror_batch_speed(batch);
+
+	return 1;
+}
+
+unsigned int mirror_queue_speed() {
+	unsigned int speed = 0;
+
+	collection_iterate(mirror_batches, (collection_f)mirror_queue_speed_callback, &speed);
+
+	return speed;
+}
+
+struct mirror_schedule_ctx {
+	struct mirror_batch *batch;
+	struct slave_connection *target;
+	struct vfs_element *file;
+	struct slave_connection *source;
+	unsigned int scanned;
+	unsigned int priority;
+};
+
+/* used by mirror_schedule_file: is the file already coming to the target ? */
+static unsigned int mirror_schedule_incoming(struct collection *c, struct mirror_ctx *mirror, struct mirror_schedule_ctx *ctx) {
+
+	return (mirror->target.cnx == ctx->target);
+}
+
+/* used by mirror_schedule_file: pick the least loaded source, the previous one if possible */
+static unsigned int mirror_schedule_source(struct collection *c, struct slave_connection *cnx, struct mirror_schedule_ctx *ctx) {
+
+	if((cnx == ctx->target) || !cnx->ready || mirror_slave_busy(cnx)) {
+		return 1;
+	}
+
+	if(cnx == ctx->batch->last_source) {
+		ctx->source = cnx;
+		return 0;
+	}
+
+	if(!ctx->source || (collection_size(cnx->mirror_from) < collection_size(ctx->source->mirror_from))) {
+		ctx->source = cnx;
+	}
+
+	return 1;
+}
+
+/* used by mirror_schedule_batch */
+static unsigned int mirror_schedule_file(struct collection *c, struct vfs_element *file, struct mirror_schedule_ctx *ctx) {
+	struct mirror_batch *batch = ctx->batch;
+	struct mirror_ctx *mirror;
+
+	if((collection_size(mirrors) >= mirror_max_running) || mirror_slave_busy(ctx->target)) {
+		return 0;
+	}
+
+	if(++ctx->scanned > MIRROR_SCHEDULE_SCAN) {
+		return 0;
+	}
+
+	if(collection_find(file->available_from, ctx->target)) {
+		/* nothing to do */
+		collection_delete(c, file);
+		batch->done++;
+		return 1;
+	}
+
+	if(collection_match(file->mirror_to, (collection_f)mirror_schedule_incoming, ctx)) {
+		/* someone else is mirroring it there, it will be done on the next pass */
+		return 1;
+	}
+
+	ctx->source = NULL;
+	collection_iterate(file->available_from, (collection_f)mirror_schedule_source, ctx);
+	if(!ctx->source) {
+		/* no free source for now */
+		return 1;
+	}
+
+	collection_delete(c, file);
+
+	mirror = mirror_new(ctx->source, file, ctx->target, file, mirror_batch_callback, batch);
+	if(!mirror) {
+		MIRROR_DBG("Batch %s: could not mirror %s", batch->path, file->name);
+		batch->failed++;
+		return 1;
+	}
+
+	if(!collection_add(batch->running, mirror)) {
+		MIRROR_DBG("Collection error");
+		mirror->callback = NULL;
+		mirror->callback_param = NULL;
+		mirror_cancel(mirror);
+		batch->failed++;
+		return 1;
+	}
+
+	batch->last_source = ctx->source;
+
+	return 1;
+}
+
+/* used by mirror_schedule: start the queued files of the batches of that priority */
+static unsigned int mirror_schedule_batch(struct collection *c, struct mirror_batch *batch, struct mirror_schedule_ctx *ctx) {
+
+	if(batch->priority != ctx->priority) {
+		return 1;
+	}
+
+	if(collection_size(mirrors) >= mirror_max_running) {
+		return 0;
+	}
+
+	if(!obj_isvalid(&batch->target->o)) {
+		MIRROR_DBG("Batch %s: target slave was deleted", batch->path);
+		mirror_batch_cancel(batch);
+		return 1;
+	}
+
+	ctx->target = batch->target->cnx;
+	if(!ctx->target || !ctx->target->ready) {
+		/* wait until the slave is connected */
+		return 1;
+	}
+
+	ctx->batch = batch;
+	ctx->scanned = 0;
+	collection_iterate(batch->queued, (collection_f)mirror_schedule_file, ctx);
+
+	return 1;
+}
+
+/* used by mirror_schedule */
+static unsigned int mirror_schedule_finished(struct collection *c, struct mirror_batch *batch, void *param) {
+
+	if(!collection_size(batch->queued) && !collection_size(batch->running)) {
+		mirror_batch_cancel(batch);
+	}
+
+	return 1;
+}
+
+/* start as many queued files as the limits allow, highest priority first */
+static void mirror_schedule(void *param) {
+	struct mirror_schedule_ctx ctx;
+
+	for(ctx.priority=MIRROR_PRIORITY_HIGH;ctx.priority<=MIRROR_PRIORITY_LOW;ctx.priority++) {
+		collection_iterate(mirror_batches, (collection_f)mirror_schedule_batch, &ctx);
+	}
+
+	collection_iterate(mirror_batches, (collection_f)mirror_schedule_finished, NULL);
+
+	if(collection_size(mirror_batches)) {
+		/* the limits may be used by other mirrors, or a slave may be offline */
+		wheel_schedule(&mirror_schedule_timer, time_now() + MIRROR_SCHEDULE_INTERVAL);
+	}
+
+	return;
+}
+
+/* the release folder of a file, NULL if the file is not in one */
+static struct vfs_element *mirror_hot_folder(struct vfs_element *file) {
+	struct vfs_element *folder = file->parent;
+	
+	if(!folder || (folder == vfs_root) || folder->section || folder->vrooted) {
+		/* copying the folder would copy a whole section */
+		return NULL;
+	}
+	
+	return folder;
+}
+
+static unsigned int mirror_hot_unref_copy(struct collection *c, struct slave_ctx *slave, void *param) {
+	
+	collection_delete(c, slave);
+	obj_unref(&slave->o);
+	
+	return 1;
+}
+
+static void mirror_hot_obj_destroy(struct mirror_hot *hot) {
+	
+	collectible_destroy(hot);
+	
+	if(hot->element) {
+		hot->element->hot = NULL;
+		hot->element = NULL;
+	}
+	
+	if(hot->batch) {
+		hot->batch->callback = NULL;
+		hot->batch->callback_param = NULL;
+		mirror_batch_cancel(hot->batch);
+		hot->batch = NULL;
+	}
+	
+	collection_iterate(hot->copies, (collection_f)mirror_hot_unref_copy, NULL);
+	collection_destroy(hot->copies);
+	
+	free(hot);
+	
+	return;
+}
+
+static struct mirror_hot *mirror_hot_get(struct vfs_element *element) {
+	struct mirror_hot *hot;
+	
+	if(element->hot) {
+		return element->hot;
+	}
+	
+	hot = malloc(sizeof(struct mirror_hot));
+	if(!hot) {
+		MIRROR_DBG("Memory error");
+		return NULL;
+	}
+	
+	hot->copies = collection_new(C_NONE);
+	if(!hot->copies) {
+		MIRROR_DBG("Memory error");
+		free(hot);
+		return NULL;
+	}
+	
+	obj_init(&hot->o, hot, (obj_f)mirror_hot_obj_destroy);
+	collectible_init(hot);
+	
+	hot->element = NULL;
+	hot->demand = 0;
+	hot->leechers = 0;
+	hot->speed = 0;
+	hot->last_hot = 0;
+	hot->batch = NULL;
+	hot->hits = 0;
+	hot->copy_hits = 0;
+	hot->served = 0;
+	hot->timestamp = time_now();
+	
+	if(!collection_add(mirror_hots, hot)) {
+		MIRROR_DBG("Collection error");
+		collection_destroy(hot->copies);
+		free(hot);
+		return NULL;
+	}
+	
+	hot->element = element;
+	element->hot = hot;
+	
+	if(collection_size(mirror_hots) == 1) {
+		/* the passes stop when there is nothing left to track */
+		wheel_schedule(&mirror_hot_timer, time_now() + MIRROR_HOT_INTERVAL);
+	}
+	
+	return hot;
+}
+
+/* nonzero if the download is served by one of the temporary copies */
+static int mirror_hot_from_copy(struct vfs_element *file, struct slave_connection *cnx) {
+	struct vfs_element *folder;
+	
+	if(!cnx || !cnx->slave) {
+		return 0;
+	}
+	
+	if(file->hot && collection_find(file->hot->copies, cnx->slave)) {
+		return 1;
+	}
+	
+	folder = mirror_hot_folder(file);
+	if(folder && folder->hot && collection_find(folder->hot->copies, cnx->slave)) {
+		return 1;
+	}
+	
+	return 0;
+}
+
+void mirror_hot_hit(struct vfs_element *file, struct slave_connection *cnx) {
+	struct vfs_element *folder;
+	struct mirror_hot *hot;
+	int copy;
+	
+	if(!mirror_hot_threshold || !file || (file->type != VFS_FILE)) {
+		return;
+	}
+	
+	copy = mirror_hot_from_copy(file, cnx);
+	
+	mirror_hot_total_hits++;
+	if(copy) {
+		mirror_hot_total_copy_hits++;
+	}
+	
+	hot = mirror_hot_get(file);
+	if(hot) {
+		hot->demand += 16;
+		hot->hits++;
+		if(copy) hot->copy_hits++;
+	}
+	
+	folder = mirror_hot_folder(file);
+	if(folder) {
+		hot = mirror_hot_get(folder);
+		if(hot) {
+			hot->demand += 16;
+			hot->hits++;
+			if(copy) hot->copy_hits++;
+		}
+	}
+	
+	return;
+}
+
+void mirror_hot_served(struct vfs_element *file, struct slave_connection *cnx, unsigned long long int size) {
+	struct vfs_element *folder;
+	
+	if(!file || !mirror_hot_from_copy(file, cnx)) {
+		return;
+	}
+	
+	mirror_hot_total_served += size;
+	
+	if(file->hot) {
+		file->hot->served += size;
+	}
+	
+	folder = mirror_hot_folder(file);
+	if(folder && folder->hot) {
+		folder->hot->served += size;
+	}
+	
+	return;
+}
+
+unsigned int mirror_hot_hits() {
+	
+	return mirror_hot_total_hits;
+}
+
+unsigned int mirror_hot_copy_hits() {
+	
+	return mirror_hot_total_copy_hits;
+}
+
+unsigned long long int mirror_hot_bytes_served() {
+	
+	return mirror_hot_total_served;
+}
+
+static unsigned int mirror_hot_leechers(struct collection *c, struct ftpd_client_ctx *client, struct mirror_hot *hot) {
+	
+	hot->leechers++;
+	hot->speed += client->xfer.speed;
+	
+	return 1;
+}
+
+struct mirror_hot_folder_ctx {
+	struct mirror_hot *hot;
+	unsigned int servers; /* of the most available file */
+};
+
+static unsigned int mirror_hot_folder_leechers(struct collection *c, struct vfs_element *child, struct mirror_hot_folder_ctx *ctx) {
+	
+	if(child->type != VFS_FILE) {
+		return 1;
+	}
+	
+	collection_iterate(child->leechers, (collection_f)mirror_hot_leechers, ctx->hot);
+	
+	if(collection_size(child->available_from) > ctx->servers) {
+		ctx->servers = collection_size(child->available_from);
+	}
+	
+	return 1;
+}
+
+/* nonzero if some of the files are on the slave already */
+static unsigned int mirror_hot_holds(struct collection *c, struct vfs_element *element, struct slave_ctx *slave) {
+	
+	if(element->type == VFS_FOLDER) {
+		return (collection_match(element->childs, (collection_f)mirror_hot_holds, slave) != NULL);
+	}
+	
+	if(element->type != VFS_FILE) {
+		return 0;
+	}
+	
+	if(collection_find(element->offline_from, slave)) {
+		return 1;
+	}
+	
+	return (slave->cnx && collection_find(element->available_from, slave->cnx));
+}
+
+struct mirror_hot_target_ctx {
+	struct mirror_hot *hot;
+	struct slave_ctx *slave;
+	unsigned int score;
+};
+
+/* pick the slave of the section with the least downloads that does not have the files */
+static unsigned int mirror_hot_target(struct collection *c, struct slave_ctx *slave, struct mirror_hot_target_ctx *ctx) {
+	struct slave_connection *cnx = slave->cnx;
+	
+	if(!cnx || !cnx->ready || mirror_slave_busy(cnx)) {
+		return 1;
+	}
+	
+	if(collection_find(ctx->hot->copies, slave) || !vfs_is_child(slave->vroot, ctx->hot->element)) {
+		return 1;
+	}
+	
+	if(mirror_hot_holds(NULL, ctx->hot->element, slave)) {
+		return 1;
+	}
+	
+	if(!ctx->slave || (cnx->load.down < ctx->score)) {
+		ctx->slave = slave;
+		ctx->score = cnx->load.down;
+	}
+	
+	return 1;
+}
+
+static int mirror_hot_batch_callback(struct mirror_batch *batch, void *param) {
+	struct mirror_hot *hot = param;
+	
+	MIRROR_DBG("Hot %s: copy to %s done", batch->path, batch->target->name);
+	
+	hot->batch = NULL;
+	
+	return 1;
+}
+
+/* start one more temporary copy */
+static void mirror_hot_copy(struct mirror_hot *hot) {
+	struct mirror_hot_target_ctx ctx = { hot, NULL, 0 };
+	struct vfs_section *section;
+	
+	section = vfs_get_section(hot->element);
+	if(!section) {
+		return;
+	}
+	
+	collection_iterate(section->slaves, (collection_f)mirror_hot_target, &ctx);
+	if(!ctx.slave) {
+		/* all slaves are busy or have it */
+		return;
+	}
+	
+	if(!collection_add(hot->copies, ctx.slave)) {
+		MIRROR_DBG("Collection error");
+		return;
+	}
+	obj_ref(&ctx.slave->o);
+	
+	hot->batch = mirror_batch_new(hot->element, ctx.slave, MIRROR_PRIORITY_HIGH, mirror_hot_batch_callback, hot);
+	if(!hot->batch) {
+		MIRROR_DBG("Could not copy %s to %s", hot->element->name, ctx.slave->name);
+		collection_delete(hot->copies, ctx.slave);
+		obj_unref(&ctx.slave->o);
+		return;
+	}
+	
+	MIRROR_DBG("Hot %s: %u downloads running, copying to %s", hot->element->name, hot->leechers, ctx.slave->name);
+	
+	return;
+}
+
+/* remove the slave's copy of the files that are still online elsewhere */
+static unsigned int mirror_hot_wipe(struct collection *c, struct vfs_element *element, struct slave_ctx *slave) {
+	
+	if(element->type == VFS_FOLDER) {
+		collection_iterate(element->childs, (collection_f)mirror_hot_wipe, slave);
+		return 1;
+	}
+	
+	if((element->type != VFS_FILE) || !slave->cnx) {
+		/* files of an offline slave may be missing elsewhere by now */
+		return 1;
+	}
+	
+	if(collection_find(element->available_from, slave->cnx) && (collection_size(element->available_from) > 1)) {
+		ftpd_wipe_from(element, slave);
+	}
+	
+	return 1;
+}
+
+static unsigned int mirror_hot_expire_copy(struct collection *c, struct slave_ctx *slave, struct mirror_hot *hot) {
+	
+	if(obj_isvalid(&slave->o)) {
+		MIRROR_DBG("Hot %s: removing the copy from %s", hot->element->name, slave->name);
+		mirror_hot_wipe(NULL, hot->element, slave);
+	}
+	
+	collection_delete(c, slave);
+	obj_unref(&slave->o);
+	
+	return 1;
+}
+
+static unsigned int mirror_hot_pass_callback(struct collection *c, struct mirror_hot *hot, void *param) {
+	struct mirror_hot_folder_ctx ctx = { hot, 0 };
+	unsigned int pressure;
+	
+	if(!hot->element) {
+		/* deleted from the vfs */
+		obj_destroy(&hot->o);
+		return 1;
+	}
+	
+	hot->demand -= (hot->demand + MIRROR_HOT_DECAY - 1) / MIRROR_HOT_DECAY;
+	hot->leechers = 0;
+	hot->speed = 0;
+	
+	if(hot->element->type == VFS_FILE) {
+		collection_iterate(hot->element->leechers, (collection_f)mirror_hot_leechers, hot);
+		ctx.servers = collection_size(hot->element->available_from);
+	} else {
+		collection_iterate(hot->element->childs, (collection_f)mirror_hot_folder_leechers, &ctx);
+	}
+	
+	/* running downloads plus the recent ones */
+	pressure = hot->leechers + (hot->demand / 16);
+	
+	if((hot->element->type == VFS_FILE) && mirror_hot_folder(hot->element)) {
+		/* the copies are made for the whole release */
+	} else if(pressure >= (mirror_hot_threshold * (ctx.servers ? ctx.servers : 1))) {
+		hot->last_hot = time_now();
+		
+		if(!hot->batch && (collection_size(hot->copies) < mirror_hot_copies)) {
+			mirror_hot_copy(hot);
+		}
+		return 1;
+	} else if(collection_size(hot->copies) && !hot->batch && !hot->leechers &&
+			(timer(hot->last_hot) > mirror_hot_expire)) {
+		collection_iterate(hot->copies, (collection_f)mirror_hot_expire_copy, hot);
+	}
+	
+	if(!hot->demand && !hot->leechers && !hot->batch && !collection_size(hot->copies)) {
+		/* nothing left to track */
+		obj_destroy(&hot->o);
+	}
+	
+	return 1;
+}
+
+static void mirror_hot_pass(void *param) {
+	
+	collection_iterate(mirror_hots, (collection_f)mirror_hot_pass_callback, NULL);
+	
+	if(collection_size(mirror_hots)) {
+		wheel_schedule(&mirror_hot_timer, time_now() + MIRROR_HOT_INTERVAL);
+	}
+	
+	return;
+}
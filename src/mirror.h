@@ -41,6 +41,8 @@
 #include "luainit.h"
 #include "collection.h"
 #include "scripts.h"
+#include "wheel.h"
+#include "stats.h"
 
 #include "debug.h"
 #if defined(DEBUG_MIRROR)
@@ -50,6 +52,8 @@
 #endif
 
 extern struct collection *mirrors; /* collection of struct mirror_ctx */
+extern struct collection *mirror_batches; /* collection of struct mirror_batch */
+extern struct collection *mirror_hots; /* collection of struct mirror_hot */
 
 typedef void* mirror_param;
 
@@ -69,6 +73,8 @@ struct mirror_side {
 	unsigned int checksum;
 	unsigned long long int xfered; /* current size that was transfered, updated by the stats */
 	unsigned long long int last_alive; /* last time it was reported by the stats */
+	unsigned int speed; /* current speed in bytes per second, updated by the stats */
+	struct stats_link progress; /* receives the reports */
 
 	struct slave_connection *cnx; /* slave connection */
 	struct vfs_element *file; /* transfered file */
@@ -94,14 +100,143 @@ struct mirror_ctx {
 
 	/* success of the mirror operation  */
 	char success;
+	
+	/*
+		A tee copies an upload to a replica while it is received:
+		the source is the slave receiving the upload and it streams
+		the data to the target (see IO_SLAVE_TEE). The copy is made
+		available once its checksum matches the upload's.
+	*/
+	char tee;
+	char tee_queried; /* IO_SLAVE_TEE was sent to the source */
+	unsigned long long int tee_uid; /* of the upload */
 
 	struct mirror_side source;
 	struct mirror_side target;
+	
+	/* fires when a side was not reported by the stats for too long */
+	struct wheel_timer timer;
+} __attribute__((packed));
+
+#define MIRROR_PRIORITY_HIGH		0 /* new releases */
+#define MIRROR_PRIORITY_NORMAL		1
+#define MIRROR_PRIORITY_LOW		2
+
+/*
+	A folder (or a single file) to copy to a slave. Its files
+	are queued and mirrored a few at a time from any slave that
+	has them, within the limits of xftpd.mirror.max-running and
+	xftpd.mirror.max-per-slave. The batches with the lowest
+	priority value are served first, then the oldest.
+	
+	The batch is destroyed once all of its files are done,
+	the callback is called from its destructor.
+*/
+typedef struct mirror_batch mirror_batch;
+struct mirror_batch {
+	struct obj o;
+	struct collectible c;
+	
+	unsigned int priority; /* MIRROR_PRIORITY_* */
+	char *path; /* of the mirrored folder */
+	struct slave_ctx *target; /* slave that receives the files */
+	
+	struct collection *queued; /* vfs_element structs not started yet */
+	struct collection *running; /* mirror_ctx structs */
+	
+	/*
+		the files are taken from the same source as the
+		previous one whenever possible, so consecutive
+		mirrors reuse the same pair of slaves.
+	*/
+	struct slave_connection *last_source; /* only compared, never dereferenced */
+	
+	unsigned int files; /* number of files queued */
+	unsigned int done; /* mirrored, or already on the target */
+	unsigned int failed;
+	unsigned long long int xfered; /* bytes mirrored by the finished mirrors */
+	unsigned long long int timestamp; /* creation */
+	
+	int (*callback)(struct mirror_batch *batch, void *param);
+	void *callback_param;
+} __attribute__((packed));
+
+/*
+	Download demand of a file, or of the release folder holding
+	it. The entries are created by the downloads and dropped once
+	there is no demand nor temporary copy left.
+	
+	When the demand per slave serving the release reaches
+	xftpd.mirror.hot-threshold, the release is copied to the least
+	loaded slave of its section with a high priority batch, up to
+	xftpd.mirror.hot-copies times. The copies are deleted after
+	xftpd.mirror.hot-expire below the threshold, once nobody is
+	downloading from the release anymore.
+	
+	Files that are not in a release folder are copied on their own.
+*/
+typedef struct mirror_hot mirror_hot;
+struct mirror_hot {
+	struct obj o;
+	struct collectible c;
+	
+	struct vfs_element *element; /* NULL once deleted from the vfs */
+	
+	unsigned int demand; /* recent downloads in 1/16th, decays on each pass */
+	unsigned int leechers; /* running downloads, as of the last pass */
+	unsigned int speed; /* bytes per second of those downloads */
+	unsigned long long int last_hot; /* last time the demand was above the threshold */
+	
+	struct collection *copies; /* slave_ctx structs given a temporary copy */
+	struct mirror_batch *batch; /* copy in progress */
+	
+	unsigned int hits; /* downloads started */
+	unsigned int copy_hits; /* of those, from a temporary copy */
+	unsigned long long int served; /* bytes sent by the temporary copies */
+	unsigned long long int timestamp; /* creation */
 } __attribute__((packed));
 
 int mirror_init();
 void mirror_free();
 
+/* called by ftpd when a download starts, and when it is complete */
+void mirror_hot_hit(struct vfs_element *file, struct slave_connection *cnx);
+void mirror_hot_served(struct vfs_element *file, struct slave_connection *cnx, unsigned long long int size);
+
+/* totals since startup */
+unsigned int mirror_hot_hits();
+unsigned int mirror_hot_copy_hits();
+unsigned long long int mirror_hot_bytes_served();
+
+struct mirror_batch *mirror_batch_new(
+	struct vfs_element *folder,
+	struct slave_ctx *target,
+	unsigned int priority,
+	int (*callback)(struct mirror_batch *batch, void *param),
+	void *param
+);
+unsigned int mirror_batch_cancel(struct mirror_batch *batch);
+
+/* bytes per second of the batch's running mirrors */
+unsigned int mirror_batch_speed(struct mirror_batch *batch);
+
+/* files not yet started, for all batches */
+unsigned int mirror_queue_depth();
+
+/* bytes per second of the running mirrors of all batches */
+unsigned int mirror_queue_speed();
+
+/*
+	Start the replicas of an upload about to be sent to cnx, as
+	many as the "replicas" setting of the file's section asks
+	for. Return the number of IO_SLAVE_TEE queries the slave
+	must wait for before reading from the client.
+*/
+unsigned int mirror_tee_start(struct slave_connection *cnx, struct vfs_element *file, unsigned long long int uid);
+
+/* the upload feeding the file's replicas is over */
+void mirror_tee_complete(struct vfs_element *file, int success, unsigned int checksum);
+
 unsigned int mirror_cancel(struct mirror_ctx *mirror);
 struct mirror_ctx *mirror_new(
 	struct slave_connection *src_cnx,
@@ -45,9 +45,20 @@
 #include "time.h"
 #include "logging.h"
 #include "main.h"
+#include "job.h"
 
 struct collection *nukes = NULL; /* nuke_ctx */
 
+/* matches the nukes with the vfs in background, NULL when idle */
+static struct job_ctx *nuke_check_job = NULL;
+
+/* nuke_ctx indexed by path and by last path component */
+static struct hash_table *nukes_by_path = NULL;
+static struct hash_table *nukes_by_name = NULL;
+
+/* nukelog records made obsolete since it was last rewritten */
+static unsigned int nuke_journal_dead = 0;
+
 static void nukee_obj_destroy(struct nuke_nukee *nukee) {
 	
 	collectible_destroy(nukee);
@@ -73,6 +84,15 @@ static void nuke_destroy_nukee(struct nuke_nukee *nukee) {
 
 static void nuke_obj_destroy(struct nuke_ctx *nuke) {
 
+	collectible_destroy(nuke);
+
+	if(hash_node_linked(&nuke->path_node)) {
+		hash_remove(nukes_by_path, &nuke->path_node);
+	}
+	if(hash_node_linked(&nuke->name_node)) {
+		hash_remove(nukes_by_name, &nuke->name_node);
+	}
+
 	if(nuke->nukees) {
 		collection_destroy(nuke->nukees);
 		nuke->nukees = NULL;
@@ -127,6 +147,9 @@ static struct nuke_ctx *nuke_new(unsigned int multiplier, char *nuker, char *rea
 	nuke->element = NULL;
 	nuke->path = NULL;
 
+	hash_node_init(&nuke->path_node);
+	hash_node_init(&nuke->name_node);
+
 	nuke->nuker = strdup(nuker);
 	if(!nuke->nuker) {
 		NUKE_DBG("Memory error");
@@ -152,6 +175,46 @@ static struct nuke_ctx *nuke_new(unsigned int multiplier, char *nuker, char *rea
 	return nuke;
 }
 
+/*
+	Normalize a path in place the way vfs_get_relative_path()
+	builds them: '/' separators, a leading '/' and no trailing one.
+*/
+static void nuke_normalize_path(char *path) {
+	char *src, *dst;
+
+	for(src=dst=path;*src;src++) {
+		if(*src == '\\') {
+			*src = '/';
+		}
+		if((*src == '/') && (dst > path) && (*(dst-1) == '/')) {
+			continue;
+		}
+		*dst++ = *src;
+	}
+	if((dst > (path+1)) && (*(dst-1) == '/')) {
+		dst--;
+	}
+	*dst = 0;
+
+	return;
+}
+
+/* add the nuke to both indexes once its path is set */
+static int nuke_index(struct nuke_ctx *nuke) {
+	char *name;
+
+	name = strrchr(nuke->path, '/');
+	name = name ? name+1 : nuke->path;
+
+	if(!hash_add(nukes_by_path, &nuke->path_node, nuke->path) ||
+			!hash_add(nukes_by_name, &nuke->name_node, name)) {
+		NUKE_DBG("Could not index %s", nuke->path);
+		return 0;
+	}
+
+	return 1;
+}
+
 static struct nuke_ctx *nuke_new_from_element(struct vfs_element *element, unsigned int multiplier, char *nuker, char *reason, unsigned long long int timestamp) {
 	struct nuke_ctx *nuke;
 
@@ -176,6 +239,11 @@ static struct nuke_ctx *nuke_new_from_element(struct vfs_element *element, unsig
 		return NULL;
 	}
 
+	if(!nuke_index(nuke)) {
+		nuke_destroy(nuke);
+		return NULL;
+	}
+
 	return nuke;
 }
 
@@ -194,6 +262,12 @@ static struct nuke_ctx *nuke_new_from_path(char *path, unsigned int multiplier,
 		nuke_destroy(nuke);
 		return NULL;
 	}
+	nuke_normalize_path(nuke->path);
+
+	if(!nuke_index(nuke)) {
+		nuke_destroy(nuke);
+		return NULL;
+	}
 
 	return nuke;
 }
@@ -219,7 +293,7 @@ struct nuke_ctx *nuke_add(struct vfs_element *element, unsigned int multiplier,
 	}
 
 	//nuke_dump_all();
-	logging_write(NUKELOG_FILE, "nuke;%s;%u;%s;%s;%I64u\r\n", nuke->path, nuke->multiplier, nuke->nuker, nuke->reason, nuke->timestamp);
+	logging_write(NUKELOG_FILE, "nuke;%s;%u;%s;%s;" LLU "\r\n", nuke->path, nuke->multiplier, nuke->nuker, nuke->reason, nuke->timestamp);
 
 	return nuke;
 }
@@ -269,11 +343,22 @@ struct nuke_nukee *nukee_add(struct nuke_ctx *nuke, char *name, unsigned long lo
 	}
 
 	//nuke_dump_all();
-	logging_write(NUKELOG_FILE, "nukee;%s;%s;%I64u\r\n", nukee->nuke->path, nukee->name, nukee->ammount);
+	logging_write(NUKELOG_FILE, "nukee;%s;%s;" LLU "\r\n", nukee->nuke->path, nukee->name, nukee->ammount);
 
 	return nukee;
 }
 
+/* rewrite the nukelog once enough of it is obsolete */
+static void nuke_journal_compact() {
+
+	if(nuke_journal_dead >= NUKE_JOURNAL_COMPACT) {
+		NUKE_DBG("Compacting " NUKELOG_FILE " (%u obsolete records)", nuke_journal_dead);
+		nuke_dump_all();
+	}
+
+	return;
+}
+
 void nukee_del(struct nuke_nukee *nukee) {
 
 	if(!nukee) {
@@ -281,8 +366,11 @@ void nukee_del(struct nuke_nukee *nukee) {
 		return;
 	}
 
+	logging_write(NUKELOG_FILE, "unnukee;%s;%s\r\n", nukee->nuke->path, nukee->name);
+	nuke_journal_dead += 2;
+
 	nuke_destroy_nukee(nukee);
-	nuke_dump_all();
+	nuke_journal_compact();
 
 	return;
 }
@@ -294,92 +382,167 @@ void nuke_del(struct nuke_ctx *nuke) {
 		return;
 	}
 
-	nuke_destroy(nuke);
+	logging_write(NUKELOG_FILE, "unnuke;%s;" LLU "\r\n", nuke->path, nuke->timestamp);
+	nuke_journal_dead += 2 + collection_size(nuke->nukees);
 
-	/* dump to file */
-	nuke_dump_all();
+	nuke_destroy(nuke);
+	nuke_journal_compact();
 
 	return;
 }
 
-static int nuke_get_matcher(struct collection *c, struct nuke_ctx *nuke, char *path) {
-
-	return !strcasecmp(nuke->path, path);
-}
-
-/* lookup a nuke from its (normalized) path */
+/* lookup a nuke from its path */
 struct nuke_ctx *nuke_get(char *path) {
+	struct hash_node *node;
+	char *normalized;
 
 	if(!path) {
 		NUKE_DBG("Param error");
 		return NULL;
 	}
 
-	return collection_match(nukes, (collection_f)nuke_get_matcher, path);
+	normalized = strdup(path);
+	if(!normalized) {
+		NUKE_DBG("Memory error");
+		return NULL;
+	}
+	nuke_normalize_path(normalized);
+
+	node = hash_find(nukes_by_path, normalized);
+	free(normalized);
+
+	return node ? hash_entry(node, struct nuke_ctx, path_node) : NULL;
 }
 
-static int nuke_check_matcher(struct collection *c, struct nuke_ctx *nuke, char *path) {
+/* compare the element's path with the nuke's, from the end */
+static int nuke_path_match(const char *path, struct vfs_element *element) {
+	const char *end = path + strlen(path);
+	unsigned int length;
 
-	if(nuke->element)
-		return 0;
+	for(;element && (element != vfs_root);element = element->parent) {
+		length = strlen(element->name);
+		if((end - path) < (length + 1)) {
+			return 0;
+		}
 
-	if(!strcasecmp(nuke->path, path)) {
-		return 1;
+		end -= length;
+		if(strncasecmp(end, element->name, length)) {
+			return 0;
+		}
+
+		end--;
+		if(*end != '/') {
+			return 0;
+		}
 	}
 
-	return 0;
+	return (element == vfs_root) && (end == path);
 }
 
 /* we have an element and we want to match it with any nuke possible. */
 struct nuke_ctx *nuke_check(struct vfs_element *element) {
+	struct hash_node *node;
 	struct nuke_ctx *nuke;
-	char *path;
 
 	if(element->nuke) {
 		NUKE_DBG("nuke_check on already nuked element!?");
 		return element->nuke;
 	}
 
-	path = vfs_get_relative_path(vfs_root, element);
-	if(!path) {
-		NUKE_DBG("Memory error");
+	if(!nukes_by_name) {
+		/* the nukes are not loaded yet, nuke_check_all() will do */
 		return NULL;
 	}
 
-	nuke = collection_match(nukes, (collection_f)nuke_check_matcher, path);
-	free(path);
+	/* the path is only compared when the name is known */
+	for(node = hash_find(nukes_by_name, element->name);node;node = hash_find_next(nukes_by_name, node)) {
+		nuke = hash_entry(node, struct nuke_ctx, name_node);
+		if(!nuke->element && nuke_path_match(nuke->path, element)) {
+			nuke->element = element;
+			element->nuke = nuke;
+			return nuke;
+		}
+	}
+
+	return NULL;
+}
 
-	if(nuke) {
-		nuke->element = element;
-		element->nuke = nuke;
+static int nuke_check_all_callback(struct collection *c, struct nuke_ctx *nuke, struct collection *pending) {
+
+	if(!nuke->element) {
+		collection_add(pending, nuke);
 	}
 
-	return nuke;
+	return 1;
 }
 
-static int nuke_check_all_callback(struct collection *c, struct nuke_ctx *nuke, void *param) {
+/* match the next few pending nukes */
+static int nuke_check_all_step(struct job_ctx *job) {
+	struct collection *pending = job->param;
 	struct vfs_element *element;
+	struct nuke_ctx *nuke;
+	unsigned int i;
 
-	if(nuke->element) {
-		return 1;
-	}
+	for(i=0;i<NUKE_CHECK_STEP;i++) {
+		nuke = collection_first(pending);
+		if(!nuke) {
+			break;
+		}
+		collection_delete(pending, nuke);
 
-	element = vfs_find_element(vfs_root, nuke->path);
-	if(!element) {
-		/* element is not found */
-		return 1;
+		if(nuke->element) {
+			continue;
+		}
+
+		element = vfs_find_element(vfs_root, nuke->path);
+		if(!element) {
+			/* element is not found */
+			continue;
+		}
+
+		element->nuke = nuke;
+		nuke->element = element;
 	}
 
-	element->nuke = nuke;
-	nuke->element = element;
+	return collection_size(pending);
+}
 
-	return 1;
+static void nuke_check_all_cleanup(struct job_ctx *job) {
+	struct collection *pending = job->param;
+
+	collection_destroy(pending);
+	nuke_check_job = NULL;
+
+	return;
 }
 
-/* check all nukes and try to match them with files/folders on the vfs */
+/*
+	check all nukes and try to match them with files/folders on the vfs,
+	the matching is done by a background job.
+*/
 int nuke_check_all() {
+	struct collection *pending;
+
+	if(nuke_check_job) {
+		/* already running, start over with the current nukes */
+		pending = nuke_check_job->param;
+		collection_empty(pending);
+	} else {
+		pending = collection_new(C_NONE);
+		if(!pending) {
+			NUKE_DBG("Memory error");
+			return 0;
+		}
 
-	collection_iterate(nukes, (collection_f)nuke_check_all_callback, NULL);
+		nuke_check_job = job_new("nuke check", JOB_PRIORITY_LOW, nuke_check_all_step, nuke_check_all_cleanup, pending);
+		if(!nuke_check_job) {
+			NUKE_DBG("Could not start the nuke check job");
+			collection_destroy(pending);
+			return 0;
+		}
+	}
+
+	collection_iterate(nukes, (collection_f)nuke_check_all_callback, pending);
 
 	return 1;
 }
@@ -402,14 +565,14 @@ struct nuke_nukee *nukee_get(struct nuke_ctx *nuke, char *name) {
 
 int nuke_dump_all_nukees_callback(struct collection *c, struct nuke_nukee *nukee, FILE *f) {
 
-	logging_write_file(f, "nukee;%s;%s;%I64u\r\n", nukee->nuke->path, nukee->name, nukee->ammount);
+	logging_write_file(f, "nukee;%s;%s;" LLU "\r\n", nukee->nuke->path, nukee->name, nukee->ammount);
 
 	return 1;
 }
 
 int nuke_dump_all_callback(struct collection *c, struct nuke_ctx *nuke, FILE *f) {
 
-	logging_write_file(f, "nuke;%s;%u;%s;%s;%I64u\r\n", nuke->path, nuke->multiplier, nuke->nuker, nuke->reason, nuke->timestamp);
+	logging_write_file(f, "nuke;%s;%u;%s;%s;" LLU "\r\n", nuke->path, nuke->multiplier, nuke->nuker, nuke->reason, nuke->timestamp);
 
 	collection_iterate(nuke->nukees, (collection_f)nuke_dump_all_nukees_callback, f);
 
@@ -430,6 +593,8 @@ int nuke_dump_all() {
 
 	fclose(f);
 
+	nuke_journal_dead = 0;
+
 	return 1;
 }
 
@@ -444,6 +609,8 @@ int nuke_load_all() {
 	char *_name, *_ammount;
 
 	struct nuke_ctx *nuke;
+	struct nuke_nukee *nukee;
+	struct hash_node *node;
 
 	buffer = config_load_file(NUKELOG_FILE, &length);
 	if(!buffer) {
@@ -528,6 +695,42 @@ int nuke_load_all() {
 				NUKE_DBG("Add nukee failed for (%s/%s) on %s", _name, _ammount, _path);
 				continue;
 			}
+		} else if(!strcasecmp(what, "unnuke")) {
+			
+			_timestamp = ptr;
+			
+			/* many nukes may share the path, find the right one */
+			nuke = NULL;
+			nuke_normalize_path(_path);
+			for(node = hash_find(nukes_by_path, _path);node;node = hash_find_next(nukes_by_path, node)) {
+				nuke = hash_entry(node, struct nuke_ctx, path_node);
+				if(nuke->timestamp == _atoi64(_timestamp)) {
+					break;
+				}
+				nuke = NULL;
+			}
+			if(!nuke) {
+				NUKE_DBG("Failed to get nuke for path %s, cannot delete it", _path);
+				continue;
+			}
+			
+			nuke_journal_dead += 2 + collection_size(nuke->nukees);
+			nuke_destroy(nuke);
+			
+		} else if(!strcasecmp(what, "unnukee")) {
+			
+			_name = ptr;
+			
+			nuke = nuke_get(_path);
+			nukee = nuke ? nukee_get(nuke, _name) : NULL;
+			if(!nukee) {
+				NUKE_DBG("Failed to get nukee %s on %s, cannot delete it", _name, _path);
+				continue;
+			}
+			
+			nuke_journal_dead += 2;
+			nuke_destroy_nukee(nukee);
+			
 		} else {
 			NUKE_DBG("Nukelog corrupt? invalid \"what\": %s", what);
 			continue;
@@ -545,12 +748,22 @@ int nuke_init() {
 
 	nukes = collection_new(C_CASCADE);
 
+	nukes_by_path = hash_new(0, 1);
+	nukes_by_name = hash_new(0, 1);
+	if(!nukes || !nukes_by_path || !nukes_by_name) {
+		NUKE_DBG("Memory error");
+		return 0;
+	}
+
 	/* Load all nukes from file */
 	if(!nuke_load_all()) {
 		NUKE_DBG("Could not load nukes from file.");
 		return 0;
 	}
 
+	/* the journal may have grown a lot since the last run */
+	nuke_journal_compact();
+
 	/* nuke_check_all() */
 	nuke_check_all();
 
@@ -577,11 +790,24 @@ void nuke_free() {
 	/* Save all nukes to file */
 	nuke_dump_all();
 
+	if(nuke_check_job) {
+		job_cancel(nuke_check_job);
+	}
+
 	/* destroy all nukes */
 	if(nukes) {
 		collection_destroy(nukes);
 		nukes = NULL;
 	}
 
+	if(nukes_by_path) {
+		hash_destroy(nukes_by_path);
+		nukes_by_path = NULL;
+	}
+	if(nukes_by_name) {
+		hash_destroy(nukes_by_name);
+		nukes_by_name = NULL;
+	}
+
 	return;
 }
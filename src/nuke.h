@@ -39,6 +39,7 @@
 #include "constants.h"
 #include "obj.h"
 #include "collection.h"
+#include "hash.h"
 
 #include "debug.h"
 #if defined(DEBUG_NUKE)
@@ -92,6 +93,9 @@ struct nuke_ctx {
 	/* struct nuke_nukee */
 	struct collection *nukees;
 
+	struct hash_node path_node; /* in the index by path */
+	struct hash_node name_node; /* in the index by last path component */
+
 } __attribute__((packed));
 
 int nuke_init();
@@ -104,7 +108,7 @@ struct nuke_ctx *nuke_add(struct vfs_element *element, unsigned int multiplier,
 /* Add a nukee and save to file */
 struct nuke_nukee *nukee_add(struct nuke_ctx *nuke, char *name, unsigned long long int ammount);
 
-/* Fast lookup from path to nuke */
+/* Fast lookup from path to nuke, the most recent one if many */
 struct nuke_ctx *nuke_get(char *path);
 
 /* Fast lookup from name to nukee */
@@ -118,19 +122,22 @@ void nuke_del(struct nuke_ctx *nuke);
 
 /*
 	Lookup in the nukes and link the element if it is nuked
-	Called	on new dir
-			on new file
+	Called	by the vfs on each new dir and new file
 */
 struct nuke_ctx *nuke_check(struct vfs_element *element);
 
 /*
 	Check all nukes and link them to thier elements.
 	Called	on ititilalitation,
-			after a files list is received from a slave
+			on reload
+	The matching is done in background by a job.
 */
 int nuke_check_all();
 
-/* Dump all nukes to file. */
+/*
+	Rewrite the nukelog with only the current nukes. In between,
+	the changes are appended to it as a journal.
+*/
 int nuke_dump_all();
 
 #endif /* __NUKE_H */
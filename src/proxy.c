@@ -33,14 +33,24 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* splice() */
+#endif
+
 #ifdef WIN32
 #include <windows.h>
 #else
 #include <stdlib.h>
+#include <unistd.h>
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/prctl.h>
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -54,6 +64,11 @@
 #include "signal.h"
 #include "packet.h"
 #include "time.h"
+#include "wheel.h"
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+#define PROXY_USE_SPLICE
+#endif
 
 /* 1 if the traffic is chained to another proxy */
 static int chained = 0;
@@ -69,8 +84,135 @@ static unsigned int proxy_external_ip = 0;
 /* traffic buffer size */
 static unsigned int proxy_buffer_size = 0;
 
+/* 1 if the traffic should be relayed with splice() when possible */
+static unsigned int proxy_use_splice = 1;
+
+/*
+	Each worker is a process with its own event loop and its
+	own share of the connections, the kernel spreads incoming
+	connections between the workers' listening sockets.
+*/
+static unsigned int proxy_workers = 1;
+
+/* counters of this worker, reported every PROXY_STATS_INTERVAL */
+static struct {
+	unsigned int index; /* worker number, 0 is the parent process */
+	
+	unsigned int connections; /* currently open */
+	unsigned long long int accepted; /* since startup */
+	unsigned long long int relayed; /* bytes, since startup */
+	
+	unsigned long long int timestamp; /* time of the last report */
+	unsigned long long int reported; /* 'relayed' at the last report */
+	
+	struct wheel_timer timer;
+} proxy_worker;
+
 static struct collection *proxies;
 
+/*
+	Setup one side of the relay. The pipe is optional: if it
+	can't be created the traffic goes thru the ring buffer.
+*/
+static unsigned int proxy_data_init(struct proxy_data *data, int fd) {
+	
+	data->connected = 0;
+	data->ready = 0;
+	data->fd = fd;
+	data->shutdown = 0;
+	
+	data->head = 0;
+	data->filledsize = 0;
+	
+	data->pipe[0] = -1;
+	data->pipe[1] = -1;
+	data->piped = 0;
+	data->pipesize = 0;
+	
+	data->relayed = 0;
+	
+#ifdef PROXY_USE_SPLICE
+	if(proxy_use_splice) {
+		/* the struct is packed, the pipe is created on the stack */
+		int fds[2];
+		
+		if(!pipe(fds)) {
+			data->pipe[0] = fds[0];
+			data->pipe[1] = fds[1];
+		}
+	}
+	
+	if(data->pipe[0] != -1) {
+		int size = -1;
+		
+#ifdef F_SETPIPE_SZ
+		/* may fail above /proc/sys/fs/pipe-max-size, the default size is kept then */
+		fcntl(data->pipe[1], F_SETPIPE_SZ, proxy_buffer_size);
+		size = fcntl(data->pipe[1], F_GETPIPE_SZ);
+#endif
+		
+		data->pipesize = (size > 0) ? size : (64 * 1024);
+	} else {
+		data->pipe[0] = -1;
+		data->pipe[1] = -1;
+	}
+#endif
+	
+	data->maxsize = (data->pipe[0] != -1) ? PROXY_CONTROL_BUFFER_SIZE : proxy_buffer_size;
+	data->buffer = malloc(data->maxsize);
+	if(!data->buffer) {
+		PROXY_DBG("Memory error");
+		return 0;
+	}
+	
+	return 1;
+}
+
+static void proxy_data_free(struct proxy_data *data) {
+	
+#ifdef PROXY_USE_SPLICE
+	if(data->pipe[0] != -1) {
+		close(data->pipe[0]);
+		close(data->pipe[1]);
+		data->pipe[0] = -1;
+		data->pipe[1] = -1;
+	}
+#endif
+	
+	if(data->buffer) {
+		free(data->buffer);
+		data->buffer = NULL;
+	}
+	
+	return;
+}
+
+/* number of bytes still waiting to be sent on this side */
+static unsigned int proxy_data_pending(struct proxy_data *data) {
+	
+	return data->filledsize + data->piped;
+}
+
+/* queue one of our own packets at the end of the ring buffer */
+static unsigned int proxy_data_enqueue(struct proxy_data *data, struct packet *p) {
+	unsigned int tail, first;
+	
+	if(p->size > (data->maxsize - data->filledsize)) {
+		PROXY_DBG("No room left for a %u bytes packet.", p->size);
+		return 0;
+	}
+	
+	tail = (data->head + data->filledsize) % data->maxsize;
+	first = data->maxsize - tail;
+	if(first > p->size) first = p->size;
+	
+	memcpy(&data->buffer[tail], p, first);
+	memcpy(&data->buffer[0], ((char *)p) + first, p->size - first);
+	data->filledsize += p->size;
+	
+	return 1;
+}
+
 static void proxy_obj_destroy(struct proxy_connection *proxy) {
 	
 	collectible_destroy(proxy);
@@ -98,8 +240,14 @@ static void proxy_obj_destroy(struct proxy_connection *proxy) {
 		proxy->group = NULL;
 	}
 
-	free(proxy->in.buffer);
-	free(proxy->out.buffer);
+	PROXY_DBG("Relayed " LLU " bytes in and " LLU " bytes out in " LLU " ms%s.",
+		proxy->out.relayed, proxy->in.relayed, timer(proxy->timestamp),
+		(proxy->in.pipe[0] != -1) ? " (splice)" : "");
+
+	proxy_worker.connections--;
+
+	proxy_data_free(&proxy->in);
+	proxy_data_free(&proxy->out);
 	
 	free(proxy);
 
@@ -108,6 +256,7 @@ static void proxy_obj_destroy(struct proxy_connection *proxy) {
 
 struct proxy_connection *proxy_new(int fd) {
 	struct proxy_connection *proxy;
+	unsigned int ok;
 
 	proxy = malloc(sizeof(struct proxy_connection));
 	if(!proxy) {
@@ -124,24 +273,25 @@ struct proxy_connection *proxy_new(int fd) {
 	proxy->p = NULL;
 	proxy->filledsize = 0;
 
+	proxy->timestamp = time_now();
+
+	/* balanced in proxy_obj_destroy */
+	proxy_worker.connections++;
+
+	ok = proxy_data_init(&proxy->in, fd);
+	if(!proxy_data_init(&proxy->out, -1)) ok = 0;
+	if(!ok) {
+		/* the caller still owns the socket */
+		proxy->in.fd = -1;
+		obj_destroy(&proxy->o);
+		return NULL;
+	}
 	proxy->in.connected = 1;
-	proxy->in.fd = fd;
-	proxy->in.ready = 0;
-	proxy->in.filledsize = 0;
-	proxy->in.maxsize = proxy_buffer_size;
-	proxy->in.buffer = malloc(proxy_buffer_size);
-	proxy->in.shutdown = 0;
-
-	proxy->out.connected = 0;
-	proxy->out.fd = -1;
-	proxy->out.ready = 0;
-	proxy->out.filledsize = 0;
-	proxy->out.maxsize = proxy_buffer_size;
-	proxy->out.buffer = malloc(proxy_buffer_size);
-	proxy->out.shutdown = 0;
 	
 	collection_add(proxies, proxy);
 
+	proxy_worker.accepted++;
+
 	return proxy;
 }
 
@@ -167,7 +317,7 @@ int proxy_cleanup_side(struct proxy_connection *proxy, int fd) {
 		
 		proxy->out.shutdown = 1;
 
-		if(!proxy->out.filledsize) {
+		if(!proxy_data_pending(&proxy->out)) {
 			/* No more data to be sent AND we must shutdown */
 
 			PROXY_DBG("No more data to send, shutting down now");
@@ -175,7 +325,7 @@ int proxy_cleanup_side(struct proxy_connection *proxy, int fd) {
 			make_socket_blocking(proxy->out.fd, 1);
 			shutdown(proxy->out.fd, SD_SEND);
 		} else {
-			PROXY_DBG("Still %u bytes to send to the output side.", proxy->out.filledsize);
+			PROXY_DBG("Still %u bytes to send to the output side.", proxy_data_pending(&proxy->out));
 		}
 	}
 	else if(proxy->out.fd == fd) {
@@ -184,7 +334,7 @@ int proxy_cleanup_side(struct proxy_connection *proxy, int fd) {
 		
 		proxy->in.shutdown = 1;
 		
-		if(!proxy->in.filledsize) {
+		if(!proxy_data_pending(&proxy->in)) {
 			/* No more data to be sent AND we must shutdown */
 
 			PROXY_DBG("No more data to send, shutting down now");
@@ -192,7 +342,7 @@ int proxy_cleanup_side(struct proxy_connection *proxy, int fd) {
 			make_socket_blocking(proxy->in.fd, 1);
 			shutdown(proxy->in.fd, SD_SEND);
 		} else {
-			PROXY_DBG("Still %u bytes to send to the input side.", proxy->in.filledsize);
+			PROXY_DBG("Still %u bytes to send to the input side.", proxy_data_pending(&proxy->in));
 		}
 	}
 	else {
@@ -228,28 +378,60 @@ int proxy_connection_close(int fd, struct proxy_connection *cnx) {
 }
 
 int proxy_connection_read(int fd, struct proxy_data *dst) {
-	int avail, recvd;
+	unsigned int tail, avail;
+	int recvd;
+
+	/*
+		The socket monitor only raises the read signal when data is
+		available, so there is no need to ask for the amount first.
+	*/
+
+#ifdef PROXY_USE_SPLICE
+	if(dst->pipe[1] != -1) {
+		/* move data from 'fd' to the pipe, it never leaves the kernel */
+		avail = dst->pipesize - dst->piped;
+		if(!avail) {
+			/* pipe is FULL */
+			return 1;
+		}
 
-	/* read data from 'fd' and put it in 'dst->buffer' */
+		recvd = splice(fd, NULL, dst->pipe[1], NULL, avail, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if((recvd == -1) && (errno == EAGAIN)) {
+			return 1;
+		}
+		if(recvd <= 0) {
+			/* error while receiving */
+			PROXY_DBG("Error while splicing: shutting down socket");
+			make_socket_blocking(fd, 1);
+			shutdown(fd, SD_SEND);
+			return 0;
+		}
+		dst->piped += recvd;
 
-	avail = socket_avail(fd);
-	if(avail <= 0) {
-		/* invalid available number of bytes */
-		PROXY_DBG("No valid available size: shutting down socket");
-		make_socket_blocking(fd, 1);
-		shutdown(fd, SD_SEND);
-		return 0;
+		return 1;
 	}
+#endif
 
-	if(avail > (dst->maxsize - dst->filledsize))
-		avail = (dst->maxsize - dst->filledsize);
+	/* read data from 'fd' and put it in the free space after the tail of 'dst->buffer' */
 
-	if(!avail) {
-		/* buffer is FULL: maybe we should increase it here ? */
+	if(dst->filledsize == dst->maxsize) {
+		/* buffer is FULL */
 		return 1;
 	}
 
-	recvd = recv(fd, &dst->buffer[dst->filledsize], avail, 0);
+	if(!dst->filledsize) {
+		/* keep the reads as large as possible */
+		dst->head = 0;
+	}
+
+	tail = (dst->head + dst->filledsize) % dst->maxsize;
+	if(tail < dst->head) {
+		avail = dst->head - tail;
+	} else {
+		avail = dst->maxsize - tail;
+	}
+
+	recvd = recv(fd, &dst->buffer[tail], avail, 0);
 	if(recvd <= 0) {
 		/* error while receiving */
 		PROXY_DBG("Error while receiving: shutting down socket");
@@ -263,29 +445,61 @@ int proxy_connection_read(int fd, struct proxy_data *dst) {
 }
 
 int proxy_connection_write(int fd, struct proxy_data *src) {
+	unsigned int size;
 	int sent;
 
-	/* we take data from src->buffer and send it to 'fd' */
+	if(src->filledsize) {
+		/*
+			we take data from the head of src->buffer and send it to 'fd'.
+			our own packets are always queued before any relayed data, so
+			they have to be sent before anything waiting in the pipe.
+		*/
+		size = src->maxsize - src->head;
+		if(size > src->filledsize) size = src->filledsize;
 
-	if(!src->filledsize)
-		return 1;
+		sent = send(fd, &src->buffer[src->head], size, 0);
+		if(sent <= 0) {
+			/* no data sent ... */
+			PROXY_DBG("DATA COULD NOT BE SENT: Connection error");
 
-	sent = send(fd, src->buffer, src->filledsize, 0);
-	if(sent <= 0) {
-		/* no data sent ... */
-		PROXY_DBG("DATA COULD NOT BE SENT: Connection error");
+			make_socket_blocking(fd, 1);
+			shutdown(fd, SD_SEND);
+			
+			src->filledsize = 0;
+			return 0;
+		}
 
-		make_socket_blocking(fd, 1);
-		shutdown(fd, SD_SEND);
-		
-		src->filledsize = 0;
-		return 0;
+		src->head = (src->head + sent) % src->maxsize;
+		src->filledsize -= sent;
 	}
+#ifdef PROXY_USE_SPLICE
+	else if(src->piped) {
+		sent = splice(src->pipe[0], NULL, fd, NULL, src->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if((sent == -1) && (errno == EAGAIN)) {
+			return 1;
+		}
+		if(sent <= 0) {
+			/* no data sent ... */
+			PROXY_DBG("DATA COULD NOT BE SPLICED: Connection error");
 
-	memmove(src->buffer, &src->buffer[sent], src->filledsize-sent);
-	src->filledsize -= sent;
+			make_socket_blocking(fd, 1);
+			shutdown(fd, SD_SEND);
+			
+			src->piped = 0;
+			return 0;
+		}
 
-	if(!src->filledsize && src->shutdown) {
+		src->piped -= sent;
+	}
+#endif
+	else {
+		return 1;
+	}
+
+	src->relayed += sent;
+	proxy_worker.relayed += sent;
+
+	if(!proxy_data_pending(src) && src->shutdown) {
 		/* No more data to be sent AND we must shutdown */
 
 		PROXY_DBG("No more data to send, and we must shutdown");
@@ -367,8 +581,12 @@ int proxy_connection_out_connect(int fd, struct proxy_connection *cnx) {
 			return 0;
 		}
 
-		memcpy(&cnx->in.buffer[cnx->in.filledsize], p, p->size);
-		cnx->in.filledsize += p->size;
+		if(!proxy_data_enqueue(&cnx->in, p)) {
+			free(p);
+			proxy_destroy(cnx);
+			return 0;
+		}
+		free(p);
 	}
 
 	if(cnx->p) {
@@ -439,8 +657,12 @@ int proxy_connection_read_packet(int fd, struct proxy_connection *cnx) {
 				return 0;
 			}
 
-			memcpy(&cnx->in.buffer[cnx->in.filledsize], p, p->size);
-			cnx->in.filledsize += p->size;
+			if(!proxy_data_enqueue(&cnx->in, p)) {
+				free(p);
+				proxy_destroy(cnx);
+				return 0;
+			}
+			free(p);
 
 			/* register the write[in to in] callback because of the enqueued "listening" packet */
 			socket_monitor_signal_add(cnx->in.fd, cnx->group, "socket-write", (signal_f)proxy_connection_write, &cnx->in);
@@ -572,6 +794,52 @@ void set_current_path() {
 }
 #endif
 
+static void proxy_worker_report(void *param) {
+	unsigned long long int elapsed;
+
+	elapsed = timer(proxy_worker.timestamp);
+	if(!elapsed) elapsed = 1;
+
+	PROXY_DBG("Worker %u: %u connection(s) open, " LLU " accepted, " LLU " bytes relayed (" LLU " kb/s).",
+		proxy_worker.index, proxy_worker.connections, proxy_worker.accepted, proxy_worker.relayed,
+		(proxy_worker.relayed - proxy_worker.reported) / elapsed);
+
+	proxy_worker.timestamp = time_now();
+	proxy_worker.reported = proxy_worker.relayed;
+
+	wheel_schedule(&proxy_worker.timer, proxy_worker.timestamp + PROXY_STATS_INTERVAL);
+
+	return;
+}
+
+/*
+	Fork the additional workers. Return the index of the
+	worker the calling process became, 0 for the parent.
+*/
+static unsigned int proxy_spawn_workers(unsigned int count) {
+#ifndef WIN32
+	unsigned int i;
+	pid_t pid;
+
+	for(i=1;i<count;i++) {
+		pid = fork();
+		if(pid == -1) {
+			PROXY_DBG("Could not fork worker %u, running with %u worker(s).", i, i);
+			break;
+		}
+		if(!pid) {
+#ifdef __linux__
+			/* don't outlive the parent process */
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+			return i;
+		}
+	}
+#endif
+
+	return 0;
+}
+
 #ifdef PROXY_WIN32_SERVICE
 int win32_service_main() {
 #else
@@ -601,6 +869,8 @@ int main(int argc, char* argv[]) {
 		proxy_buffer_size = 1 * 1024 * 1024;
 	}
 
+	proxy_use_splice = config_raw_read_int(PROXY_CONFIG_FILE, "proxy.splice", 1);
+
 	proxy_port = (unsigned short)config_raw_read_int(PROXY_CONFIG_FILE, "proxy.port", 0);
 	if(!proxy_port) {
 		PROXY_DBG("Cannot get local listening port (proxy.port)");
@@ -640,15 +910,42 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	proxy_workers = config_raw_read_int(PROXY_CONFIG_FILE, "proxy.workers", 1);
+	if(!proxy_workers) {
+		proxy_workers = 1;
+	}
+#if defined(WIN32) || !defined(SO_REUSEPORT)
+	if(proxy_workers > 1) {
+		PROXY_DBG("Multiple workers are not supported on this system (proxy.workers)");
+		proxy_workers = 1;
+	}
+#endif
+
+	proxy_worker.index = proxy_spawn_workers(proxy_workers);
+	proxy_worker.connections = 0;
+	proxy_worker.accepted = 0;
+	proxy_worker.relayed = 0;
+	proxy_worker.timestamp = time_now();
+	proxy_worker.reported = 0;
+
 	listen_signals = collection_new(C_CASCADE);
 	proxies = collection_new(C_CASCADE);
 
-	listen_fd = create_listening_socket(proxy_port);
+	if(proxy_workers > 1) {
+		listen_fd = create_shared_listening_socket(proxy_port);
+	} else {
+		listen_fd = create_listening_socket(proxy_port);
+	}
 	if(listen_fd == -1) {
 		PROXY_DBG("Could not listen on port %u", proxy_port);
 		return 1;
 	}
 
+	PROXY_DBG("Worker %u of %u listening on port %u", proxy_worker.index, proxy_workers, proxy_port);
+
+	wheel_timer_init(&proxy_worker.timer, proxy_worker_report, NULL);
+	wheel_schedule(&proxy_worker.timer, proxy_worker.timestamp + PROXY_STATS_INTERVAL);
+
 	socket_monitor_new(listen_fd, 0, 1);
 	socket_monitor_signal_add(listen_fd, listen_signals, "socket-connect", (signal_f)proxy_listening_connect, &listening);
 	socket_monitor_signal_add(listen_fd, listen_signals, "socket-error", (signal_f)proxy_listening_error, &listening);
@@ -656,17 +953,21 @@ int main(int argc, char* argv[]) {
 
 	while(listening) {
 		
-		//signal_poll();
+		wheel_poll();
 		
 		socket_poll();
 		
 //		collection_cleanup_iterators();
 		
-		sleep(PROXY_SLEEP_TIME);
+		sleep(wheel_sleep_time(PROXY_SLEEP_TIME));
 	}
 
 	PROXY_DBG("Proxy's main loop exited");
 
+	wheel_cancel(&proxy_worker.timer);
+	proxy_worker_report(NULL);
+	wheel_cancel(&proxy_worker.timer);
+
 	signal_clear(listen_signals);
 	collection_destroy(listen_signals);
 	listen_signals = 0;
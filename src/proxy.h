@@ -76,9 +76,26 @@ struct proxy_data {
 
 	int shutdown;
 
+	/*
+		Ring buffer: 'filledsize' bytes are waiting to be sent,
+		starting at 'head' and wrapping around at 'maxsize'.
+	*/
 	char *buffer;
+	unsigned int head;
 	unsigned int filledsize;
 	unsigned int maxsize;
+
+	/*
+		When splice() is available, the relayed traffic goes thru
+		this pipe from one socket to the other without ever being
+		copied to userspace. The ring buffer is then only used for
+		the proxy's own packets, which are always sent first.
+	*/
+	int pipe[2];
+	unsigned int piped; /* bytes waiting in the pipe */
+	unsigned int pipesize; /* capacity of the pipe */
+
+	unsigned long long int relayed; /* bytes sent to 'fd' so far */
 } __attribute__((packed));
 
 struct proxy_connection {
@@ -92,6 +109,8 @@ struct proxy_connection {
 
 	struct collection *group;
 
+	unsigned long long int timestamp; /* creation time */
+
 	struct proxy_data in;
 	struct proxy_data out;
 } __attribute__((packed));
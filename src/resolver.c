@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "resolver.h"
+#include "time.h"
+
+/* queries waiting for the worker, and answers waiting for resolver_poll() */
+collection_static_list(resolver_queued);
+collection_static_list(resolver_completed);
+
+/* cache of the answers, only touched by the main thread */
+static struct hash_table *resolver_cache = NULL;
+
+static char resolver_started = 0;
+
+#ifdef WIN32
+static CRITICAL_SECTION resolver_lock;
+static HANDLE resolver_event;
+
+#define RESOLVER_LOCK()		EnterCriticalSection(&resolver_lock)
+#define RESOLVER_UNLOCK()	LeaveCriticalSection(&resolver_lock)
+#define RESOLVER_WAIT()		{ RESOLVER_UNLOCK(); WaitForSingleObject(resolver_event, INFINITE); RESOLVER_LOCK(); }
+#define RESOLVER_WAKE()		SetEvent(resolver_event)
+#else
+static pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+
+#define RESOLVER_LOCK()		pthread_mutex_lock(&resolver_lock)
+#define RESOLVER_UNLOCK()	pthread_mutex_unlock(&resolver_lock)
+#define RESOLVER_WAIT()		pthread_cond_wait(&resolver_cond, &resolver_lock)
+#define RESOLVER_WAKE()		pthread_cond_signal(&resolver_cond)
+#endif
+
+/* return the first ipv4 address of the host, or -1 */
+static unsigned int resolver_getaddrinfo(const char *hostname) {
+	struct addrinfo hints;
+	struct addrinfo *res;
+	unsigned int ip;
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	if(getaddrinfo(hostname, NULL, &hints, &res) || !res) {
+		return -1;
+	}
+	
+	ip = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+	freeaddrinfo(res);
+	
+	return ip;
+}
+
+#ifdef WIN32
+static DWORD WINAPI resolver_worker(void *param) {
+#else
+static void *resolver_worker(void *param) {
+#endif
+	struct resolver_query *query;
+	unsigned int ip;
+	
+	RESOLVER_LOCK();
+	while(1) {
+		if(resolver_queued.next == &resolver_queued) {
+			RESOLVER_WAIT();
+			continue;
+		}
+		
+		query = CONTAINING_RECORD(resolver_queued.next, struct resolver_query, list);
+		collection_list_remove(&query->list);
+		
+		/* the query can only be cancelled while we work, not freed */
+		RESOLVER_UNLOCK();
+		ip = resolver_getaddrinfo(query->hostname);
+		RESOLVER_LOCK();
+		
+		query->ip = ip;
+		collection_list_addlast(&resolver_completed, &query->list);
+	}
+	RESOLVER_UNLOCK();
+	
+	return 0;
+}
+
+static int resolver_start() {
+	
+	if(resolver_started) {
+		return 1;
+	}
+	
+#ifdef WIN32
+	InitializeCriticalSection(&resolver_lock);
+	resolver_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(!resolver_event) {
+		RESOLVER_DBG("Could not create the worker's event");
+		return 0;
+	}
+	
+	{
+		HANDLE thread;
+		
+		thread = CreateThread(NULL, 0, resolver_worker, NULL, 0, NULL);
+		if(!thread) {
+			RESOLVER_DBG("Could not start the worker thread");
+			return 0;
+		}
+		CloseHandle(thread);
+	}
+#else
+	{
+		pthread_t thread;
+		
+		if(pthread_create(&thread, NULL, resolver_worker, NULL)) {
+			RESOLVER_DBG("Could not start the worker thread");
+			return 0;
+		}
+		pthread_detach(thread);
+	}
+#endif
+	
+	resolver_started = 1;
+	
+	return 1;
+}
+
+/* return the cached entry for the host, dropping it if it expired */
+static struct resolver_entry *resolver_cache_get(const char *hostname) {
+	struct resolver_entry *entry;
+	struct hash_node *node;
+	
+	if(!resolver_cache) {
+		return NULL;
+	}
+	
+	node = hash_find(resolver_cache, hostname);
+	if(!node) {
+		return NULL;
+	}
+	
+	entry = hash_entry(node, struct resolver_entry, node);
+	if(entry->expires <= time_now()) {
+		hash_remove(resolver_cache, &entry->node);
+		free(entry);
+		return NULL;
+	}
+	
+	return entry;
+}
+
+static void resolver_cache_set(const char *hostname, unsigned int ip) {
+	struct resolver_entry *entry;
+	
+	if(!resolver_cache) {
+		resolver_cache = hash_new(RESOLVER_CACHE_SIZE, 1);
+		if(!resolver_cache) {
+			RESOLVER_DBG("Memory error");
+			return;
+		}
+	}
+	
+	entry = resolver_cache_get(hostname);
+	if(!entry) {
+		entry = malloc(sizeof(struct resolver_entry) + strlen(hostname));
+		if(!entry) {
+			RESOLVER_DBG("Memory error");
+			return;
+		}
+		strcpy(entry->hostname, hostname);
+		
+		hash_node_init(&entry->node);
+		if(!hash_add(resolver_cache, &entry->node, entry->hostname)) {
+			RESOLVER_DBG("Memory error");
+			free(entry);
+			return;
+		}
+	}
+	
+	entry->ip = ip;
+	entry->expires = time_now() + ((ip == -1) ? RESOLVER_NEGATIVE_TTL : RESOLVER_POSITIVE_TTL);
+	
+	return;
+}
+
+/* return 1 if the answer is already known */
+static int resolver_known(const char *hostname, unsigned int *ip) {
+	struct resolver_entry *entry;
+	unsigned int addr;
+	
+	addr = inet_addr(hostname);
+	if(addr != INADDR_NONE) {
+		*ip = addr;
+		return 1;
+	}
+	
+	entry = resolver_cache_get(hostname);
+	if(entry) {
+		*ip = entry->ip;
+		return 1;
+	}
+	
+	return 0;
+}
+
+struct resolver_query *resolver_lookup(const char *hostname, resolver_f callback, void *param, unsigned int *ip) {
+	struct resolver_query *query;
+	
+	*ip = -1;
+	
+	if(resolver_known(hostname, ip)) {
+		return NULL;
+	}
+	
+	if(!resolver_start()) {
+		/* no worker: resolve it right now */
+		*ip = resolver_resolve(hostname);
+		return NULL;
+	}
+	
+	query = malloc(sizeof(struct resolver_query) + strlen(hostname));
+	if(!query) {
+		RESOLVER_DBG("Memory error");
+		return NULL;
+	}
+	
+	query->cancelled = 0;
+	query->ip = -1;
+	query->callback = callback;
+	query->param = param;
+	strcpy(query->hostname, hostname);
+	
+	RESOLVER_DBG("Resolving %s", hostname);
+	
+	RESOLVER_LOCK();
+	collection_list_addlast(&resolver_queued, &query->list);
+	RESOLVER_WAKE();
+	RESOLVER_UNLOCK();
+	
+	return query;
+}
+
+void resolver_cancel(struct resolver_query *query) {
+	
+	/*
+		The query is left to complete: resolver_poll() will still
+		cache its answer and free it, without calling the callback.
+	*/
+	query->cancelled = 1;
+	
+	return;
+}
+
+unsigned int resolver_resolve(const char *hostname) {
+	unsigned int ip;
+	
+	if(resolver_known(hostname, &ip)) {
+		return ip;
+	}
+	
+	ip = resolver_getaddrinfo(hostname);
+	resolver_cache_set(hostname, ip);
+	
+	return ip;
+}
+
+int resolver_poll() {
+	struct collection_list completed;
+	struct resolver_query *query;
+	int count = 0;
+	
+	if(!resolver_started) {
+		return 0;
+	}
+	
+	/* take all the answers at once so the worker is not held back */
+	RESOLVER_LOCK();
+	if(resolver_completed.next == &resolver_completed) {
+		RESOLVER_UNLOCK();
+		return 0;
+	}
+	completed.next = resolver_completed.next;
+	completed.prev = resolver_completed.prev;
+	completed.next->prev = &completed;
+	completed.prev->next = &completed;
+	collection_list_init(&resolver_completed);
+	RESOLVER_UNLOCK();
+	
+	while(completed.next != &completed) {
+		query = CONTAINING_RECORD(completed.next, struct resolver_query, list);
+		collection_list_remove(&query->list);
+		
+		RESOLVER_DBG("%s resolved to %08x", query->hostname, query->ip);
+		resolver_cache_set(query->hostname, query->ip);
+		
+		if(!query->cancelled) {
+			query->callback(query->ip, query->param);
+		}
+		free(query);
+		count++;
+	}
+	
+	return count;
+}
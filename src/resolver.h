@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RESOLVER_H
+#define __RESOLVER_H
+
+#include "constants.h"
+
+#include "debug.h"
+#if defined(DEBUG_RESOLVER)
+# define RESOLVER_DBG(format, arg...) { _DEBUG_CONSOLE(format, ##arg) _DEBUG_FILE(format, ##arg) }
+#else
+# define RESOLVER_DBG(format, arg...)
+#endif
+
+#include "collection.h"
+#include "hash.h"
+
+/*
+	Host name resolution.
+	
+	Lookups are done by getaddrinfo() in a worker thread so the main
+	loop never waits on a slow name server. The answers, positive or
+	negative, are kept in a cache for a fixed time, since getaddrinfo()
+	does not report the records' ttl.
+	
+	The callbacks are only ever called from resolver_poll(), on the
+	main thread.
+*/
+
+/* 'ip' is -1 if the host could not be resolved */
+typedef void (*resolver_f)(unsigned int ip, void *param);
+
+struct resolver_query {
+	struct collection_list list; /* linked to the queued or completed list */
+	
+	char cancelled;
+	unsigned int ip;
+	
+	resolver_f callback;
+	void *param;
+	
+	char hostname[1];
+} __attribute__((packed));
+
+struct resolver_entry {
+	struct hash_node node;
+	
+	unsigned int ip; /* -1 for a negative entry */
+	unsigned long long int expires;
+	
+	char hostname[1];
+} __attribute__((packed));
+
+/*
+	Start resolving 'hostname'. If the answer is known right away
+	(numeric address or cached entry) it is stored in 'ip' and NULL
+	is returned; otherwise the returned query will complete later.
+*/
+struct resolver_query *resolver_lookup(const char *hostname, resolver_f callback, void *param, unsigned int *ip);
+
+/* the callback of a pending query will never be called */
+void resolver_cancel(struct resolver_query *query);
+
+/* blocking resolution, still going through the cache */
+unsigned int resolver_resolve(const char *hostname);
+
+/* call the callbacks of the completed queries, return how many there was */
+int resolver_poll();
+
+#endif /* __RESOLVER_H */
@@ -107,6 +107,14 @@ static void script_obj_destroy(struct script_ctx *script)
   collection_destroy(script->events);
   script->events = NULL;
 
+  /* the lua jobs must release their function while the state exists */
+  collection_destroy(script->jobs);
+  script->jobs = NULL;
+
+  /* same for the mirrors and mirror batches */
+  collection_destroy(script->mirrors);
+  script->mirrors = NULL;
+
   free(script->filename);
 
   luainit_freestate(script->L);
@@ -188,6 +196,19 @@ int scripts_load_file(const char *filename) {
 		return 0;
 	}
 	
+	script->jobs = collection_new(C_CASCADE);
+	if(!script->jobs) {
+		SCRIPTS_DBG("Memory error");
+		collection_destroy(script->events);
+		collection_destroy(script->irchandlers);
+		collection_destroy(script->mirrors);
+		collection_destroy(script->sitehandlers);
+		collection_destroy(script->timers);
+		free(script->filename);
+		free(script);
+		return 0;
+	}
+	
 	script->L = luainit_newstate();
 	if(!script->L) {
 		SCRIPTS_DBG("Could not create lua state for %s", script->filename);
@@ -196,6 +217,7 @@ int scripts_load_file(const char *filename) {
 		collection_destroy(script->mirrors);
 		collection_destroy(script->sitehandlers);
 		collection_destroy(script->timers);
+		collection_destroy(script->jobs);
 		free(script->filename);
 		free(script);
 		return 0;
@@ -209,6 +231,7 @@ int scripts_load_file(const char *filename) {
 		collection_destroy(script->mirrors);
 		collection_destroy(script->sitehandlers);
 		collection_destroy(script->timers);
+		collection_destroy(script->jobs);
 		free(script->filename);
 		free(script);
 		return 0;
@@ -221,6 +244,7 @@ int scripts_load_file(const char *filename) {
 		collection_destroy(script->mirrors);
 		collection_destroy(script->sitehandlers);
 		collection_destroy(script->timers);
+		collection_destroy(script->jobs);
 		free(script->filename);
 		free(script);
 		return 0;
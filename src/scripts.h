@@ -65,9 +65,10 @@ struct script_ctx {
     script (callbacks, handlers, timers, etc). */
   struct collection *events; /* struct event_callback */
   struct collection *irchandlers; /* struct irc_handler */
-  struct collection *mirrors; /* struct mirror_ctx */
+  struct collection *mirrors; /* struct mirror_ctx and mirror_batch */
   struct collection *sitehandlers; /* struct site_handler */
   struct collection *timers; /* struct timer_ctx */
+  struct collection *jobs; /* struct job_ctx */
 } __attribute__((packed));
 
 int scripts_init();
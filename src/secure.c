@@ -67,13 +67,6 @@ void secure_free() {
 	return;
 }
 
-int secure_poll() {
-	
-	signal_poll(secure_signals);
-
-	return 1;
-}
-
 int secure_setup(struct secure_ctx *secure, int type) {
 	
 	if(!secure) {
@@ -110,7 +110,6 @@ struct secure_ctx {
 /*  */
 int secure_init();
 void secure_free();
-int secure_poll();
 
 /*
 	Setup a secure_ctx structure to its default values. The
@@ -60,6 +60,12 @@ static void sfv_obj_destroy(struct sfv_ctx *sfv) {
 	
 	collectible_destroy(sfv);
 
+	/* the entries only go away with their sfv */
+	if(sfv->index) {
+		hash_destroy(sfv->index);
+		sfv->index = NULL;
+	}
+
 	if(sfv->entries) {
 		collection_destroy(sfv->entries);
 		sfv->entries = NULL;
@@ -88,6 +94,14 @@ struct sfv_ctx *sfv_new(struct vfs_element *folder) {
 	collectible_init(sfv);
 	
 	sfv->entries = collection_new(C_CASCADE);
+	sfv->index = hash_new(0, 1);
+	if(!sfv->entries || !sfv->index) {
+		SFV_DBG("Memory error");
+		if(sfv->entries) collection_destroy(sfv->entries);
+		if(sfv->index) hash_destroy(sfv->index);
+		free(sfv);
+		return NULL;
+	}
 	sfv->element = folder;
 	folder->sfv = sfv;
 	
@@ -214,7 +228,7 @@ static unsigned int sfv_query_callback(struct slave_connection *cnx, struct slav
 	unsigned int length, i, current_length;
 	struct vfs_element *file;
 	struct vfs_element *parent;
-	struct sfv_entry *entry;
+	struct sfvlog_entry *entry;
 
 	if(!p) {
 		SFV_DBG("" LLU ": query failed", cmd->uid);
@@ -245,9 +259,9 @@ static unsigned int sfv_query_callback(struct slave_connection *cnx, struct slav
 	}
 
 	for(i=0;i<length;) {
-		if((length - i) < sizeof(struct sfv_entry)) break;
-		entry = (struct sfv_entry *)&p->data[i];
-		current_length = (sizeof(struct sfv_entry) + strlen(entry->filename) + 1);
+		if((length - i) < sizeof(struct sfvlog_entry)) break;
+		entry = (struct sfvlog_entry *)&p->data[i];
+		current_length = (sizeof(struct sfvlog_entry) + strlen(entry->filename) + 1);
 		i += current_length;
 
 		if(!sfv_add_entry(parent->sfv, entry->filename, entry->crc)) {
@@ -287,11 +301,13 @@ struct sfv_entry *sfv_add_entry(struct sfv_ctx *sfv, char *filename, unsigned in
 		
 		obj_init(&entry->o, entry, (obj_f)sfv_entry_obj_destroy);
 		collectible_init(entry);
+		hash_node_init(&entry->node);
 
 		entry->crc = crc;
 		sprintf(entry->filename, filename);
 
 		collection_add(sfv->entries, entry);
+		hash_add(sfv->index, &entry->node, entry->filename);
 	} else {
 		if(entry->crc != crc) return NULL;
 	}
@@ -299,34 +315,71 @@ struct sfv_entry *sfv_add_entry(struct sfv_ctx *sfv, char *filename, unsigned in
 	return entry;
 }
 
-static int get_entry_callback(struct collection *c, void *item, void *param) {
-	struct {
-		struct sfv_entry *entry;
-		char *filename;
-	} *ctx = param;
-	struct sfv_entry *entry = item;
+/* return the entry for the given filename, case insensitive */
+struct sfv_entry *sfv_get_entry(struct sfv_ctx *sfv, char *filename) {
+	struct hash_node *node;
 
-	if(!strcasecmp(entry->filename, ctx->filename)) {
-		ctx->entry = entry;
-		return 0;
+	if(!sfv || !filename) return 0;
+
+	node = hash_find(sfv->index, filename);
+
+	return node ? hash_entry(node, struct sfv_entry, node) : NULL;
+}
+
+static int sfv_get_status_callback(struct collection *c, struct vfs_element *file, struct sfv_status *status) {
+	struct sfv_entry *entry;
+
+	if((file->type != VFS_FILE) || file->uploader) {
+		/* still uploading, counted as missing */
+		return 1;
+	}
+
+	entry = sfv_get_entry(file->parent->sfv, file->name);
+	if(!entry) {
+		/* not part of the release */
+		return 1;
+	}
+
+	if(file->checksum && (file->checksum != entry->crc)) {
+		status->bad++;
+	} else {
+		status->complete++;
+		status->size += file->size;
 	}
 
 	return 1;
 }
 
-/* this function does not check for duplicates, it returns the
-	first entry matching the given filename */
-struct sfv_entry *sfv_get_entry(struct sfv_ctx *sfv, char *filename) {
-	struct {
-		struct sfv_entry *entry;
-		char *filename;
-	} ctx = { NULL, filename };
+/*
+	Fill 'status' with the number of files of the folder that are
+	complete, missing or bad according to its sfv. Walks the folder
+	once and looks each file up in the sfv's index.
+*/
+int sfv_get_status(struct vfs_element *folder, struct sfv_status *status) {
 
-	if(!sfv || !filename) return 0;
+	if(!status) return 0;
+
+	memset(status, 0, sizeof(struct sfv_status));
+
+	if(!folder || (folder->type != VFS_FOLDER) || !folder->sfv) return 0;
+
+	collection_iterate(folder->childs, (collection_f)sfv_get_status_callback, status);
+
+	status->total = collection_size(folder->sfv->entries);
+	if(status->total > (status->complete + status->bad)) {
+		status->missing = status->total - (status->complete + status->bad);
+	}
+
+	return 1;
+}
+
+/* same as sfv_get_status() for the scripts, the counts are all zero without sfv */
+struct sfv_status sfv_lua_status(struct vfs_element *folder) {
+	struct sfv_status status;
 
-	collection_iterate(sfv->entries, (collection_f)get_entry_callback, &ctx);
+	sfv_get_status(folder, &status);
 
-	return ctx.entry;
+	return status;
 }
 
 /* delete the sfv structure and all its entries */
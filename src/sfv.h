@@ -46,12 +46,15 @@
 #endif
 
 #include "vfs.h"
+#include "hash.h"
 
 typedef struct sfv_entry sfv_entry;
 struct sfv_entry {
 	struct obj o;
 	struct collectible c;
 	
+	struct hash_node node; /* in the sfv's index */
+	
 	unsigned int crc;
 	char filename[];
 } __attribute__((packed));
@@ -62,14 +65,26 @@ struct sfv_ctx {
 	struct collectible c;
 	
 	struct collection *entries; /* collection of sfv_entry structures */
+	struct hash_table *index; /* sfv_entry by filename */
 	struct vfs_element *element;
 } __attribute__((packed));
 
+/* race status of a folder, see sfv_get_status() */
+typedef struct sfv_status sfv_status;
+struct sfv_status {
+	unsigned int total; /* files listed in the sfv */
+	unsigned int complete; /* uploaded with the right crc, or an unknown one */
+	unsigned int missing; /* not uploaded yet, or still uploading */
+	unsigned int bad; /* uploaded with another crc */
+	unsigned long long int size; /* of the complete files */
+} __attribute__((packed));
+
 struct sfvlog_file {
 	unsigned short next; /* offset to the next file in the buffer, zero for the last */
 	char filename[]; /* name of this sfv file */
 } __attribute__((packed));
 
+/* also the format of the IO_SFV reply, one after the other */
 struct sfvlog_entry {
 	unsigned int crc;
 	char filename[];
@@ -80,6 +95,10 @@ struct sfv_entry *sfv_add_entry(struct sfv_ctx *sfv, char *filename, unsigned in
 struct sfv_entry *sfv_get_entry(struct sfv_ctx *sfv, char *filename);
 void sfv_delete(struct sfv_ctx *sfv);
 
+/* count the files of the folder against its sfv, in one pass */
+int sfv_get_status(struct vfs_element *folder, struct sfv_status *status);
+struct sfv_status sfv_lua_status(struct vfs_element *folder);
+
 int make_sfvlog_query(struct slave_connection *cnx, struct collection *sfvfiles);
 
 #endif /* __SFV_H */
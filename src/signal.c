@@ -116,6 +116,8 @@ struct signal_ctx *signal_get(struct collection *signals, const char *name, int
 static void signal_callback_obj_destroy(struct signal_callback *s) {
 
 	collectible_destroy(s);
+	
+	wheel_cancel(&s->timer);
 
 	SIGNAL_DBG("callback %08x deleted.", (int)s);
 	
@@ -125,6 +127,46 @@ static void signal_callback_obj_destroy(struct signal_callback *s) {
 	return;
 }
 
+/*
+	Called by the wheel when the timeout may have been reached. The
+	timer is not moved each time the callback is called, so we first
+	check if the deadline has been pushed back since it was armed.
+*/
+static void signal_timeout_expired(struct signal_callback *s) {
+
+	if(!obj_isvalid(&s->o) || !s->timeout_callback)
+		return;
+
+	/* the signals of closed sockets are not watched anymore */
+	if(s->ctx && s->ctx->signals && collection_is_void(s->ctx->signals))
+		return;
+
+	if(timer(s->timestamp) <= s->timeout) {
+		wheel_schedule(&s->timer, s->timestamp + s->timeout + 1);
+		return;
+	}
+
+	obj_ref(&s->o);
+
+	/*
+		call the timeout callback, then set the
+		timestamp to 'now' so we don't call again
+		before another full timeout.
+	*/
+	SIGNAL_DBG("timeout of %u(s) reached on callback %08x of signal \"%s\".", s->timeout, (int)s, s->ctx->name);
+
+	(*s->timeout_callback)(s->timeout_param);
+	s->timestamp = time_now();
+
+	if(obj_isvalid(&s->o)) {
+		wheel_schedule(&s->timer, s->timestamp + s->timeout + 1);
+	}
+
+	obj_unref(&s->o);
+
+	return;
+}
+
 struct signal_callback *signal_add(struct collection *signals, struct collection *owner, const char *name, int (*callback)(void *obj, void *param), void *param) {
 	struct signal_callback *s;
 	struct signal_ctx *ctx;
@@ -154,6 +196,7 @@ struct signal_callback *signal_add(struct collection *signals, struct collection
 	s->callback = callback;
 	s->param = param;
 	s->timeout_callback = NULL;
+	wheel_timer_init(&s->timer, (wheel_f)signal_timeout_expired, s);
 
 	if(!collection_add(owner, s)) {
 		SIGNAL_DBG("Collection error");
@@ -193,8 +236,10 @@ int signal_timeout(struct signal_callback *s, unsigned int timeout, int (*callba
 	s->timeout_callback = callback;
 	s->timeout_param = param;
 	
-	s->timestamp = 0;
+	s->timestamp = time_now();
 	s->timeout = timeout;
+	
+	wheel_schedule(&s->timer, s->timestamp + timeout + 1);
 
 	return 1;
 }
@@ -351,48 +396,3 @@ int signal_raise(struct signal_ctx *signal, void *obj) {
 
 	return 1;
 }
-
-static unsigned int signal_timeout_callbacks_iterator(struct collection *c, struct signal_callback *s, void *param) {
-
-	obj_ref(&s->o);
-
-	if(s->timeout_callback) {
-		if(!s->timestamp)
-			/* first pass, we just set the timestamp to 'now'. */
-			s->timestamp = time_now();
-		else {
-			if(timer(s->timestamp) > s->timeout) {
-				/*
-					call the timeout callback, then set the
-					timestamp to 'now' so we don't call again
-					on the next pass.
-				*/
-				SIGNAL_DBG("timeout of %u(s) reached on callback %08x of signal \"%s\".", s->timeout, (int)s, s->ctx->name);
-
-				(*s->timeout_callback)(s->timeout_param);
-				s->timestamp = time_now();
-			}
-		}
-	}
-				
-	obj_unref(&s->o);
-
-	return 1;
-}
-
-static unsigned int signal_timeout_signals_iterator(struct collection *c, struct signal_ctx *s, void *param) {
-
-	collection_iterate(s->callbacks, (collection_f)signal_timeout_callbacks_iterator, NULL);
-
-	return 1;
-}
-
-int signal_poll(struct collection *signals) {
-
-	if(!signals)
-		return 0;
-
-	collection_iterate(signals, (collection_f)signal_timeout_signals_iterator, NULL);
-
-	return 1;
-}
@@ -39,6 +39,7 @@
 #include "constants.h"
 #include "obj.h"
 #include "collection.h"
+#include "wheel.h"
 
 #include "debug.h"
 #if defined(DEBUG_SIGNAL)
@@ -76,16 +77,14 @@ struct signal_callback {
 
 	int (*timeout_callback)(void *param);
 	void *timeout_param;
-	unsigned long long int timestamp;
+	unsigned long long int timestamp; /* last time the callback was called */
 	unsigned int timeout;
+	struct wheel_timer timer; /* armed while there is a timeout */
 
 	int filter;
 	void *obj;
 } __attribute__((packed));
 
-/* Must be called periodally, call the timeouts when needed. */
-int signal_poll(struct collection *signals);
-
 /* Get a signal from its name */
 struct signal_ctx *signal_get(struct collection *signals, const char *name, int create);
 
@@ -104,7 +103,10 @@ struct signal_callback *signal_add(struct collection *signals, struct collection
 /* Add a filter to a signal callback */
 int signal_filter(struct signal_callback *s, void *obj);
 
-/* Add a timeout on a signal callback. If the callback is not triggered in time, the timeout callback will be. */
+/*
+	Add a timeout on a signal callback. If the callback is not triggered in time, the timeout callback will be.
+	The timeouts are called from wheel_poll().
+*/
 int signal_timeout(struct signal_callback *s, unsigned int timeout, int (*callback)(void *param), void *param);
 
 /* Delete a callback that is registered in the specified group */
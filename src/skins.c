@@ -32,7 +32,7 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-
+
 #ifdef WIN32
 #include <windows.h>
 #else
@@ -48,9 +48,15 @@
 #include "skins.h"
 #include "asprintf.h"
 #include "dir.h"
+#include "hash.h"
 
 struct collection *skins = NULL; /* collection of struct config_file */
 
+/* compiled templates of all lines, rebuilt when 'skins_dirty' is set */
+static struct hash_table *skins_templates = NULL;
+collection_static_list(skins_all);
+static int skins_dirty = 1;
+
 int skins_loadall() {
 	char *skins;
 	
@@ -74,6 +80,12 @@ int skins_init() {
 	
 	skins = collection_new(C_CASCADE);
 	
+	skins_templates = hash_new(0, 1);
+	if(!skins_templates) {
+		SKINS_DBG("Memory error");
+		return 0;
+	}
+	
 	skins_loadall();
 	
 	return 1;
@@ -84,6 +96,7 @@ int skins_reload() {
 	SKINS_DBG("Reloading ...");
 	
 	skins_loadall();
+	skins_dirty = 1;
 	
 	return 1;
 }
@@ -110,6 +123,8 @@ int skins_load_file(const char *filename) {
 		return 0;
 	}
 	
+	skins_dirty = 1;
+	
 	return 1;
 }
 
@@ -125,6 +140,7 @@ int skins_unload(const char *filename) {
 	if(config) {
 		collection_delete(skins, config);
 		config_close(config);
+		skins_dirty = 1;
 		return 1;
 	}
 	
@@ -141,35 +157,233 @@ int skins_isloaded(const char *filename) {
 	return (collection_match(skins, (collection_f)skins_isloaded_matcher, (void *)filename) != NULL);
 }
 
-int skins_getline_iterator(struct collection *c, struct config_file *config, void *param) {
-	struct {
-		const char *line;
-		char *value;
-	} *ctx = param;
+#define IS_SLOT_FIRST(_c) ((((_c) >= 'a') && ((_c) <= 'z')) || (((_c) >= 'A') && ((_c) <= 'Z')) || ((_c) == '_'))
+#define IS_SLOT_CHAR(_c) (IS_SLOT_FIRST(_c) || (((_c) >= '0') && ((_c) <= '9')))
+
+struct skins_token {
+	const char *text;
+	unsigned int length;
+	const char *slot;
+	unsigned int slot_length;
+	unsigned int consumed; /* number of characters of the line used */
+};
+
+/* read the segment starting at 'p' */
+static void skins_scan(const char *p, struct skins_token *token) {
+	const char *q;
+	
+	token->text = p;
+	token->slot = NULL;
+	token->slot_length = 0;
+	
+	if(*p == '$') {
+		if(p[1] == '$') {
+			/* escaped dollar sign */
+			token->length = 1;
+			token->consumed = 2;
+			return;
+		}
+		
+		if((p[1] == '{') && IS_SLOT_FIRST(p[2])) {
+			for(q=&p[3];IS_SLOT_CHAR(*q);q++);
+			if(*q == '}') {
+				token->slot = &p[2];
+				token->slot_length = (q - &p[2]);
+				token->length = token->consumed = ((q + 1) - p);
+				return;
+			}
+		} else if(IS_SLOT_FIRST(p[1])) {
+			for(q=&p[2];IS_SLOT_CHAR(*q);q++);
+			token->slot = &p[1];
+			token->slot_length = (q - &p[1]);
+			token->length = token->consumed = (q - p);
+			return;
+		}
+		
+		/* a lone dollar sign is part of the text */
+		q = strchr(&p[1], '$');
+	} else {
+		q = strchr(p, '$');
+	}
+	
+	if(!q) q = &p[strlen(p)];
+	token->length = token->consumed = (q - p);
+	
+	return;
+}
+
+#undef IS_SLOT_CHAR
+#undef IS_SLOT_FIRST
+
+/*
+	The template is allocated in one block: the structure, its segments,
+	then a copy of the name, of the line and of all slot names.
+*/
+static struct skins_template *skins_compile_line(const char *name, const char *line) {
+	struct skins_template *template;
+	struct skins_token token;
+	unsigned int count = 0, slots = 0, i;
+	char *strings;
+	const char *p;
+	
+	for(p=line;*p;p+=token.consumed) {
+		skins_scan(p, &token);
+		if(token.slot) slots += token.slot_length + 1;
+		count++;
+	}
+	
+	template = malloc(sizeof(struct skins_template) + (count * sizeof(struct skins_segment)) +
+					strlen(name) + 1 + strlen(line) + 1 + slots);
+	if(!template) {
+		SKINS_DBG("Memory error");
+		return NULL;
+	}
+	
+	collection_list_init(&template->all);
+	hash_node_init(&template->node);
+	
+	template->count = count;
+	template->segments = (struct skins_segment *)&template[1];
+	
+	strings = (char *)&template->segments[count];
+	template->name = strings;
+	strcpy(template->name, name);
+	strings += strlen(name) + 1;
+	
+	template->line = strings;
+	strcpy(template->line, line);
+	strings += strlen(line) + 1;
+	
+	/* parse the copy, so the segments point inside the template */
+	for(i=0,p=template->line;*p;i++,p+=token.consumed) {
+		skins_scan(p, &token);
+		
+		template->segments[i].text = token.text;
+		template->segments[i].length = token.length;
+		template->segments[i].slot = NULL;
+		
+		if(token.slot) {
+			memcpy(strings, token.slot, token.slot_length);
+			strings[token.slot_length] = 0;
+			template->segments[i].slot = strings;
+			strings += token.slot_length + 1;
+		}
+	}
+	
+	return template;
+}
+
+static int skins_compile_field(struct collection *c, struct config_field *field, void *param) {
+	struct skins_template *template;
+	
+	/* the first skin defining a line wins */
+	if(hash_find(skins_templates, field->name))
+		return 1;
+	
+	template = skins_compile_line(field->name, field->value);
+	if(!template)
+		return 1;
+	
+	if(!hash_add(skins_templates, &template->node, template->name)) {
+		SKINS_DBG("Hash error");
+		free(template);
+		return 1;
+	}
+	collection_list_addlast(&skins_all, &template->all);
+	
+	return 1;
+}
+
+static int skins_compile_file(struct collection *c, struct config_file *config, void *param) {
 	
-	ctx->value = config_read(config, ctx->line, NULL);
+	collection_iterate(config->fields, (collection_f)skins_compile_field, NULL);
 	
-	return (ctx->value == NULL);
+	return 1;
+}
+
+static void skins_clear() {
+	struct skins_template *template;
+	
+	while(skins_all.next != &skins_all) {
+		template = CONTAINING_RECORD(skins_all.next, struct skins_template, all);
+		collection_list_remove(&template->all);
+		hash_remove(skins_templates, &template->node);
+		free(template);
+	}
+	
+	return;
+}
+
+/* build the templates of all lines from all loaded skins */
+static void skins_compile() {
+	
+	skins_clear();
+	collection_iterate(skins, (collection_f)skins_compile_file, NULL);
+	skins_dirty = 0;
+	
+	SKINS_DBG("Compiled %u lines", skins_templates->count);
+	
+	return;
+}
+
+struct skins_template *skins_get_template(const char *line) {
+	struct hash_node *node;
+	
+	if(!line || !skins_templates) {
+		SKINS_DBG("Params error");
+		return NULL;
+	}
+	
+	if(skins_dirty)
+		skins_compile();
+	
+	node = hash_find(skins_templates, line);
+	if(!node)
+		return NULL;
+	
+	return hash_entry(node, struct skins_template, node);
+}
+
+int skins_render(const char *line, skins_append_f append, skins_slot_f slot, void *param) {
+	struct skins_template *template;
+	struct skins_segment *segment;
+	unsigned int i;
+	
+	if(!append) {
+		SKINS_DBG("Params error");
+		return 0;
+	}
+	
+	template = skins_get_template(line);
+	if(!template)
+		return 0;
+	
+	for(i=0;i<template->count;i++) {
+		segment = &template->segments[i];
+		
+		if(segment->slot && slot && slot(param, segment->slot))
+			continue;
+		
+		append(param, segment->text, segment->length);
+	}
+	
+	return 1;
 }
 
 char *skins_getline(const char *line, const char *default_value)
 {
-	struct {
-		const char *line;
-		char *value;
-	} ctx = { line, NULL };
+	struct skins_template *template;
 	
-	collection_iterate(skins, (collection_f)skins_getline_iterator, (void *)&ctx);
-	
-	if(ctx.value)
-		return strdup(ctx.value);
+	template = skins_get_template(line);
+	if(template)
+		return strdup(template->line);
 	
 	if(default_value)
 		return strdup(default_value);
 	
 	return NULL;
 }
-
+
 #define ENDSWITH(a, b) \
   ((strlen(a) > strlen(b)) && !strcasecmp(&a[strlen(a)-strlen(b)], b))
   
@@ -220,12 +434,18 @@ int skins_load_directory(const char *directory)
 
 	return 1;
 }
-
+
 #undef ENDSWITH
 
 void skins_free() {
 
 	SKINS_DBG("Unloading ...");
 
+	if(skins_templates) {
+		skins_clear();
+		hash_destroy(skins_templates);
+		skins_templates = NULL;
+	}
+
 	return;
 }
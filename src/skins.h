@@ -45,8 +45,40 @@
 # define SKINS_DBG(format, arg...)
 #endif
 
+#include "hash.h"
+
 extern struct collection *skins;
 
+/*
+	Skin lines are compiled into templates when they are first needed
+	after a skin is loaded or unloaded. A template is a list of literal
+	segments and slots. A slot is written $name or ${name} in the skin,
+	a name starts with a letter or an underscore and may contain letters,
+	digits and underscores. $$ stands for a single dollar sign.
+*/
+struct skins_segment {
+	const char *text; /* raw text of the segment, including the $ for slots */
+	unsigned int length;
+	const char *slot; /* zero-terminated slot name, NULL for literals */
+} __attribute__((packed));
+
+struct skins_template {
+	struct collection_list all; /* linked to the list of all templates */
+	struct hash_node node; /* linked to the templates index, keyed by name */
+	
+	char *name;
+	char *line; /* the line, as found in the skin */
+	
+	unsigned int count;
+	struct skins_segment *segments;
+} __attribute__((packed));
+
+/* append some text to the rendered line */
+typedef void (*skins_append_f)(void *param, const char *text, unsigned int length);
+
+/* append the value of a slot, or return zero to keep the slot's raw text */
+typedef int (*skins_slot_f)(void *param, const char *slot);
+
 int skins_init();
 int skins_reload();
 void skins_free();
@@ -64,4 +96,14 @@ int skins_unload(const char *filename);
 */
 char *skins_getline(const char *line, const char *default_value);
 
+/* Return the compiled template for a line, or NULL if no skin has it. */
+struct skins_template *skins_get_template(const char *line);
+
+/*
+	Render a line by walking its template: the literal segments are given
+	to 'append' and the slots to 'slot'. Return zero if the line cannot
+	be found in the skin files.
+*/
+int skins_render(const char *line, skins_append_f append, skins_slot_f slot, void *param);
+
 #endif /* __SKINS_H */
@@ -62,6 +62,7 @@
 #include "signal.h"
 #include "nuke.h"
 #include "asynch.h"
+#include "stats.h"
 #include "dir.h"
 #include "wild.h"
 
@@ -78,6 +79,14 @@ static unsigned int slaves_use_encryption = 0;
 
 static unsigned int slaves_use_compression = 0;
 static unsigned int slaves_compression_threshold = 500;
+
+/* ms per loop spent merging the file list of a connecting slave */
+static unsigned int slaves_file_list_slice = SLAVES_FILE_LIST_SLICE;
+
+/* see slave_delete_begin() */
+static unsigned int slaves_delete_depth = 0;
+static struct collection *slaves_delete_pending = NULL; /* slave_connection with paths to send */
+static struct collection *slaves_deletelog_pending = NULL; /* slave_ctx with paths to log */
 
 #define ENDSWITH(a, b) \
   ((strlen(a) > strlen(b)) && !strcasecmp(&a[strlen(a)-strlen(b)], b))
@@ -124,6 +133,8 @@ int slaves_load_config() {
 	/* prepare the slave socket */
 	slaves_port = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.slaves.port", SLAVES_PORT);
 
+	slaves_file_list_slice = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.slaves.file-list-slice", SLAVES_FILE_LIST_SLICE);
+
 	return 1;
 }
 
@@ -388,6 +399,51 @@ unsigned int slave_mark_offline_from(struct slave_ctx *slave, struct vfs_element
 	return 1;
 }
 
+/* append one path, followed by 'separator' */
+static int slave_delete_batch_append(struct slave_delete_batch *batch, const char *path, char separator) {
+	unsigned int length, size;
+	char *buffer;
+	
+	length = strlen(path) + 1;
+	
+	/* keep room for the final zero */
+	if((batch->length + length + 1) > batch->size) {
+		size = batch->size ? batch->size : 1024;
+		while(size < (batch->length + length + 1)) {
+			size *= 2;
+		}
+		
+		buffer = realloc(batch->buffer, size);
+		if(!buffer) {
+			SLAVES_DBG("Memory error");
+			return 0;
+		}
+		batch->buffer = buffer;
+		batch->size = size;
+	}
+	
+	memcpy(&batch->buffer[batch->length], path, length - 1);
+	batch->buffer[batch->length + length - 1] = separator;
+	batch->length += length;
+	batch->buffer[batch->length] = 0;
+	batch->count++;
+	
+	return 1;
+}
+
+static void slave_delete_batch_free(struct slave_delete_batch *batch) {
+	
+	if(batch->buffer) {
+		free(batch->buffer);
+		batch->buffer = NULL;
+	}
+	batch->count = 0;
+	batch->length = 0;
+	batch->size = 0;
+	
+	return;
+}
+
 /* enqueue a file for deletion in the deletelog */
 unsigned int slave_offline_delete(struct slave_ctx *slave, struct vfs_element *file, int log) {
 	char *path;
@@ -407,7 +463,13 @@ unsigned int slave_offline_delete(struct slave_ctx *slave, struct vfs_element *f
 		path = vfs_get_relative_path(slave->vroot, file);
 		if(!path) return 0;
 
-		logging_write(slave->deletelog, "%s\n", path);
+		if(slaves_delete_depth && slave_delete_batch_append(&slave->deletes, path, '\n')) {
+			if(!collection_find(slaves_deletelog_pending, slave)) {
+				collection_add(slaves_deletelog_pending, slave);
+			}
+		} else {
+			logging_write(slave->deletelog, "%s\n", path);
+		}
 
 		free(path);
 	}
@@ -517,6 +579,7 @@ static void slave_obj_destroy(struct slave_ctx *slave) {
 		free(slave->deletelog);
 		slave->deletelog = NULL;
 	}
+	slave_delete_batch_free(&slave->deletes);
 
 	if(slave->name) {
 		free(slave->name);
@@ -610,6 +673,7 @@ struct slave_ctx *slave_load(const char *filename) {
 
 	slave->fileslog = fileslog;
 	slave->deletelog = deletelog;
+	memset(&slave->deletes, 0, sizeof(slave->deletes));
 
 	{
 		char *foldername;
@@ -773,6 +837,7 @@ struct slave_ctx *slave_new(const char *name) {
 
 	slave->deletelog = deletelog;
 	slave->fileslog = fileslog;
+	memset(&slave->deletes, 0, sizeof(slave->deletes));
 
 	slave->lastonline = 0;
 	config_write_int(slave->config, "last-online", 0);
@@ -891,6 +956,128 @@ static unsigned int delete_query_callback(struct slave_connection *cnx, struct s
 	return 1;
 }
 
+/* the reply holds one bit per path, set if it was deleted */
+static unsigned int delete_batch_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
+	unsigned char *bitmap;
+	unsigned int count, deleted, length, i;
+
+	if(!p) {
+		SLAVES_DBG("" LLU ": No good packet received.", cmd->uid);
+		return 1;
+	}
+
+	if(p->type != IO_DELETED) {
+		SLAVES_DBG("" LLU ": Batch could NOT be deleted from the remote slave.", p->uid);
+		return 1;
+	}
+
+	count = 0;
+	for(i=0;i<cmd->data_length;i++) {
+		if(!cmd->data[i]) count++;
+	}
+
+	bitmap = (unsigned char *)&p->data[0];
+	length = packet_data_length(p);
+
+	deleted = 0;
+	for(i=0;(i<count) && ((i / 8) < length);i++) {
+		if(bitmap[i / 8] & (1 << (i % 8))) deleted++;
+	}
+
+	if(deleted < count) {
+		SLAVES_DBG("" LLU ": %u of %u path(s) could NOT be deleted from the remote slave.", p->uid, count - deleted, count);
+	} else {
+		SLAVES_DIALOG_DBG("" LLU ": Remote slave deleted %u path(s) with no problem", p->uid, count);
+	}
+
+	return 1;
+}
+
+static unsigned int slave_delete_batch_send(struct slave_connection *cnx) {
+	struct slave_asynch_command *cmd;
+
+	if(!cnx->deletes.count) {
+		return 1;
+	}
+
+	cmd = asynch_new(cnx, IO_DELETE_BATCH, MASTER_ASYNCH_TIMEOUT, (unsigned char *)cnx->deletes.buffer, cnx->deletes.length, delete_batch_query_callback, NULL);
+	if(cmd) {
+		SLAVES_DIALOG_DBG("" LLU ": Delete query built for %u path(s)", cmd->uid, cnx->deletes.count);
+	}
+
+	slave_delete_batch_free(&cnx->deletes);
+
+	return cmd ? 1 : 0;
+}
+
+/* replace the files by their folder, which the slave deletes at once */
+static void slave_delete_batch_collapse(struct slave_connection *cnx, struct vfs_element *folder) {
+	char *path, *entry;
+
+	/* never the whole virtual root */
+	if(!cnx->slave || (folder == cnx->slave->vroot) || !vfs_is_child(cnx->slave->vroot, folder)) {
+		return;
+	}
+
+	path = vfs_get_relative_path(cnx->slave->vroot, folder);
+	if(!path) {
+		return;
+	}
+
+	entry = malloc(strlen(path) + 2);
+	if(entry) {
+		sprintf(entry, "%s/", path);
+		slave_delete_batch_free(&cnx->deletes);
+		slave_delete_batch_append(&cnx->deletes, entry, 0);
+		free(entry);
+	}
+	free(path);
+
+	return;
+}
+
+void slave_delete_begin() {
+
+	slaves_delete_depth++;
+
+	return;
+}
+
+void slave_delete_end(struct vfs_element *folder) {
+	struct slave_connection *cnx;
+	struct slave_ctx *slave;
+
+	if(!slaves_delete_depth) {
+		SLAVES_DBG("Unbalanced slave_delete_end()");
+		return;
+	}
+
+	slaves_delete_depth--;
+	if(slaves_delete_depth) {
+		return;
+	}
+
+	while((cnx = collection_first(slaves_delete_pending))) {
+		collection_delete(slaves_delete_pending, cnx);
+
+		if(folder && (cnx->deletes.count > 1)) {
+			slave_delete_batch_collapse(cnx, folder);
+		}
+		slave_delete_batch_send(cnx);
+	}
+
+	while((slave = collection_first(slaves_deletelog_pending))) {
+		collection_delete(slaves_deletelog_pending, slave);
+
+		if(slave->deletes.count) {
+			logging_write(slave->deletelog, "%s", slave->deletes.buffer);
+		}
+		slave_delete_batch_free(&slave->deletes);
+	}
+
+	return;
+}
+
 unsigned int slave_delete_file(struct slave_connection *cnx, struct vfs_element *element) {
 	struct slave_asynch_command *cmd;
 	char *filepath;
@@ -906,6 +1093,20 @@ unsigned int slave_delete_file(struct slave_connection *cnx, struct vfs_element
 		return 0;
 	}
 
+	if(slaves_delete_depth) {
+		/* sent by slave_delete_end() */
+		if((cnx->deletes.length + strlen(filepath) + 1) > SLAVE_DELETE_BATCH_SIZE) {
+			slave_delete_batch_send(cnx);
+		}
+		if(slave_delete_batch_append(&cnx->deletes, filepath, 0)) {
+			if(!collection_find(slaves_delete_pending, cnx)) {
+				collection_add(slaves_delete_pending, cnx);
+			}
+			free(filepath);
+			return 1;
+		}
+	}
+
 	cmd = asynch_new(cnx, IO_DELETE, MASTER_ASYNCH_TIMEOUT, (unsigned char *)filepath, strlen(filepath)+1, delete_query_callback, NULL);
 	if(!cmd) {
 		free(filepath);
@@ -1088,75 +1289,70 @@ unsigned int file_list_query_cleanup_offline_files(struct collection *c, struct
 	return 1;
 }
 
-/*
-	after this last callback, if everything went well, the slave
-	is fully merged and is ready to serve ftp clients
-*/
-/* p is NULL on timeout and on read error */
-static unsigned int file_list_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
-	unsigned int length = 0;
-	struct file_list_entry *entry;
-	unsigned int total_files = 0;
-	unsigned long long int total_size = 0;
-	struct vfs_element *element;
-	//char *ptr;
-	struct collection *sfv_files;
+static void file_list_destroy(struct slave_connection *cnx) {
+	struct slave_file_list *list = cnx->file_list;
 
-	unsigned long long int t;
+	if(!list) return;
+	cnx->file_list = NULL;
 
-	if(!p) {
-		SLAVES_DBG("" LLU ": No good packet received.", cmd->uid);
-		return 0;
-	}
-	
-	if(p->type != IO_FILE_LIST) {
-		SLAVES_DBG("" LLU ": Non-IO_FILE_LIST type received.", p->uid);
-		return 0;
-	}
+	wheel_cancel(&list->timer);
+	collection_destroy(list->sfv_files);
+	free(list->p);
+	free(list);
 
-	SLAVES_DIALOG_DBG("" LLU ": File list response received", p->uid);
+	return;
+}
 
-	length = (p->size - sizeof(struct packet));
+/* nonzero once all entries are merged */
+static int file_list_done(struct slave_file_list *list) {
 
-	t = time_now();
+	return ((packet_data_length(list->p) - list->offset) <= sizeof(struct file_list_entry));
+}
+
+/*
+	merge the next entries of the file list, for at most
+	slaves_file_list_slice ms. return 0 on protocol error.
+*/
+static unsigned int file_list_merge(struct slave_connection *cnx) {
+	struct slave_file_list *list = cnx->file_list;
+	struct packet *p = list->p;
+	struct file_list_entry *entry;
+	struct vfs_element *element;
+	unsigned int length, count, namelen;
+	unsigned long long int start;
 
-	sfv_files = collection_new(C_NONE);
+	length = packet_data_length(p);
+	start = time_now();
 
-	entry = (struct file_list_entry *)p->data;
-	while(length > sizeof(struct file_list_entry)) {
-		unsigned int namelen;
+	for(count=1;!file_list_done(list);count++) {
+		entry = (struct file_list_entry *)&p->data[list->offset];
 		if(!entry->entry_size) {
 			SLAVES_DBG("" LLU ": ZERO entry size!", p->uid);
-			collection_destroy(sfv_files);
 			return 0;
 		}
-		if(entry->entry_size > length) {
+		if(entry->entry_size > (length - list->offset)) {
 			SLAVES_DBG("" LLU ": Not enough room for another entry.", p->uid);
-			collection_destroy(sfv_files);
 			return 0;
 		}
-		length -= entry->entry_size;
+		list->offset += entry->entry_size;
 
-		total_files++;
-		total_size += entry->size;
+		list->files++;
+		list->size += entry->size;
 
-		//element = vfs_find_element(cnx->slave->vroot, entry->name);
-		//if(!element) {
-			/* add the file to the vfs */
-			element = vfs_create_file(cnx->slave->vroot, entry->name, "xFTPd");
-			if(!element) {
-				SLAVES_DBG("" LLU ": Could not create the file in vfs: %s", p->uid, element->name);
-				continue;
-			}
+		/* add the file to the vfs */
+		element = vfs_create_file(cnx->slave->vroot, entry->name, "xFTPd");
+		if(!element) {
+			SLAVES_DBG("" LLU ": Could not create the file in vfs: %s", p->uid, entry->name);
+			continue;
+		}
 
-			/* set the size of the element */
-			vfs_set_size(element, entry->size);
+		/* set the size of the element */
+		vfs_set_size(element, entry->size);
 
-			/* set the modification date of the element */
-			if(element->timestamp != 0) {
-				vfs_modify(element, (entry->timestamp - cnx->timediff));
-			}
-		//}
+		/* set the modification date of the element */
+		if(element->timestamp != 0) {
+			vfs_modify(element, (entry->timestamp - cnx->timediff));
+		}
 
 		slave_mark_online_from(cnx, element);
 
@@ -1165,52 +1361,150 @@ static unsigned int file_list_query_callback(struct slave_connection *cnx, struc
 			/* if the file was .sfv then request its infos */
 			namelen = strlen(element->name);
 			if((namelen > 4) && !strcasecmp(&element->name[namelen-4], ".sfv")) {
-				collection_add(sfv_files, element);
+				collection_add(list->sfv_files, element);
 			}
 		}
 
-		entry = (struct file_list_entry *)((char*)entry + entry->entry_size);
+		if(!(count % SLAVES_FILE_LIST_CHECK) && (timer(start) >= slaves_file_list_slice)) {
+			break;
+		}
 	}
 
+	list->progress = (unsigned int)(((unsigned long long int)list->offset * 1000) / (length ? length : 1));
+
+	return 1;
+}
+
+/*
+	after this last step, if everything went well, the slave
+	is fully merged and is ready to serve ftp clients
+*/
+static unsigned int file_list_merged(struct slave_connection *cnx) {
+	struct slave_file_list *list = cnx->file_list;
+
+	list->progress = 1000;
+
 	/* cleanup the slave's offline_files list */
 	collection_iterate(cnx->slave->offline_files, (collection_f)file_list_query_cleanup_offline_files, cnx->slave);
 
 	/* dump the files to the fileslog. */
 	//slave_dump_fileslog(cnx->slave);
-	SLAVES_DBG("" LLU ": Slave sent %u files (" LLU " bytes), we queried for %u sfv in " LLU " ms.", p->uid,
-		total_files, total_size, collection_size(sfv_files), timer(t));
+	SLAVES_DBG("" LLU ": Slave sent %u files (" LLU " bytes), we queried for %u sfv in " LLU " ms.", list->p->uid,
+		list->files, list->size, collection_size(list->sfv_files), timer(list->timestamp));
 	
 	/* add th slave to the ready connections */
 	collection_delete(connecting_slaves, cnx);
 	if(!collection_add(connected_slaves, cnx)) {
 		SLAVES_DBG("Collection error");
-		collection_destroy(sfv_files);
 		return 0;
 	}
 
-	/* try to match any nukes with the files we've just got */
-	nuke_check_all();
-
-	if(!collection_size(sfv_files)) {
+	if(!collection_size(list->sfv_files)) {
 		/* this was the last stage of the connection process.
 			now we will call the slave connection callback */
 		if(!event_onSlaveIdentSuccess(cnx)) {
-			SLAVES_DBG("" LLU ": Slave connection rejected by onSlaveIdentSuccess", p->uid);
-			collection_destroy(sfv_files);
+			SLAVES_DBG("" LLU ": Slave connection rejected by onSlaveIdentSuccess", list->p->uid);
 			return 0;
 		}
 
 		/* from now on, this slave can send and receive files */
 		cnx->ready = 1;
 	} else {
-		if(!make_sfvlog_query(cnx, sfv_files)) {
+		if(!make_sfvlog_query(cnx, list->sfv_files)) {
 			SLAVES_DBG("Could NOT make SFV log query !");
-			collection_destroy(sfv_files);
 			return 0;
 		}
 	}
 
-	collection_destroy(sfv_files);
+	file_list_destroy(cnx);
+
+	return 1;
+}
+
+/* merge one more slice, on each loop until the list is done */
+static void file_list_slice(struct slave_connection *cnx) {
+	unsigned int success;
+
+	obj_ref(&cnx->o);
+
+	success = file_list_merge(cnx);
+	if(success && obj_isvalid(&cnx->o)) {
+		event_onSlaveIdentProgress(cnx);
+
+		if(obj_isvalid(&cnx->o) && cnx->file_list) {
+			if(!file_list_done(cnx->file_list)) {
+				/* not before the next loop */
+				wheel_schedule(&cnx->file_list->timer, time_now() + 1);
+			} else {
+				success = file_list_merged(cnx);
+			}
+		}
+	}
+
+	if(!success && obj_isvalid(&cnx->o)) {
+		SLAVES_DBG("Slave will be disconnected because of its file list.");
+		slave_connection_destroy(cnx);
+	}
+
+	obj_unref(&cnx->o);
+
+	return;
+}
+
+/*
+	the file list is only checked here, it is merged
+	in the vfs by file_list_slice() over the next loops
+*/
+/* p is NULL on timeout and on read error */
+static unsigned int file_list_query_callback(struct slave_connection *cnx, struct slave_asynch_command *cmd, struct packet *p) {
+	struct slave_file_list *list;
+
+	if(!p) {
+		SLAVES_DBG("" LLU ": No good packet received.", cmd->uid);
+		return 0;
+	}
+	
+	if(p->type != IO_FILE_LIST) {
+		SLAVES_DBG("" LLU ": Non-IO_FILE_LIST type received.", p->uid);
+		return 0;
+	}
+
+	SLAVES_DIALOG_DBG("" LLU ": File list response received", p->uid);
+
+	if(cnx->file_list) {
+		SLAVES_DBG("" LLU ": File list received twice.", p->uid);
+		return 0;
+	}
+
+	list = malloc(sizeof(struct slave_file_list));
+	if(!list) {
+		SLAVES_DBG("Memory error");
+		return 0;
+	}
+
+	/* the packet is freed when we return */
+	list->p = malloc(p->size);
+	list->sfv_files = collection_new(C_NONE);
+	if(!list->p || !list->sfv_files) {
+		SLAVES_DBG("Memory error");
+		if(list->p) free(list->p);
+		if(list->sfv_files) collection_destroy(list->sfv_files);
+		free(list);
+		return 0;
+	}
+	memcpy(list->p, p, p->size);
+
+	list->offset = 0;
+	list->files = 0;
+	list->size = 0;
+	list->progress = 0;
+	list->timestamp = time_now();
+	wheel_timer_init(&list->timer, (wheel_f)file_list_slice, cnx);
+
+	cnx->file_list = list;
+
+	/* the first slice is merged on the next loop */
+	wheel_schedule(&list->timer, time_now());
 
 	return 1;
 }
@@ -1735,8 +2029,8 @@ static unsigned int send_asynch_query_callback(struct collection *c, void *item,
 		return 0;
 	}
 
-	/* update the send time */
-	cmd->send_time = time_now();
+	/* update the send time and start the timeout */
+	asynch_sent(cmd);
 	ctx->cnx->asynchtime = time_now();
 
 	ctx->success = 1;
@@ -1756,6 +2050,49 @@ static int send_asynch_query(struct slave_connection *cnx) {
 	return ctx.success;
 }
 
+/*
+	checksums the slave found while reading back its files.
+	a checksum we already know is kept: the vfs element
+	may describe a good copy held by another slave.
+*/
+static unsigned int slave_checksums(struct slave_connection *cnx, struct packet *p) {
+	struct slave_checksum_entry *entry;
+	struct vfs_element *element;
+	unsigned int length, offset, count = 0;
+
+	length = packet_data_length(p);
+
+	for(offset=0;(length - offset) > sizeof(struct slave_checksum_entry);) {
+		entry = (struct slave_checksum_entry *)&p->data[offset];
+		if(!entry->entry_size || (entry->entry_size > (length - offset))) {
+			SLAVES_DBG("" LLU ": Bad checksum entry size from %s", p->uid, cnx->slave->name);
+			return 0;
+		}
+		offset += entry->entry_size;
+		((char *)entry)[entry->entry_size - 1] = 0;
+
+		element = vfs_find_element(cnx->slave->vroot, entry->name);
+		if(!element || (element->type != VFS_FILE)) {
+			/* deleted meanwhile */
+			continue;
+		}
+
+		if(!element->checksum) {
+			vfs_set_checksum(element, entry->checksum);
+			count++;
+		} else if(element->checksum != entry->checksum) {
+			SLAVES_DBG("Checksum mismatch on %s for %s: %08x on disk, %08x expected",
+				cnx->slave->name, entry->name, entry->checksum, element->checksum);
+		}
+	}
+
+	if(count) {
+		SLAVES_DBG("%s: learned the checksum of %u files", cnx->slave->name, count);
+	}
+
+	return 1;
+}
+
 static unsigned int read_asynch_response(struct slave_connection *cnx) {
 	struct packet *p = NULL;
 	unsigned int success;
@@ -1770,7 +2107,15 @@ static unsigned int read_asynch_response(struct slave_connection *cnx) {
 		return 1;
 	}
 
-	success = asynch_match(cnx, p);
+	if(p->type == IO_PROGRESS) {
+		/* pushed by the slave, not an answer to any query */
+		success = cnx->ready ? stats_progress(cnx, p) : 1;
+	} else if(p->type == IO_CHECKSUMS) {
+		/* pushed by the slave once our file list is merged */
+		success = cnx->slave ? slave_checksums(cnx, p) : 1;
+	} else {
+		success = asynch_match(cnx, p);
+	}
 	if(!success) {
 		SLAVES_DBG("Slave will be disconnected because of the data received.");
 	}
@@ -1829,80 +2174,6 @@ void slaves_dump_fileslog() {
 	return;
 }
 
-int slaves_check_asynch_timeouts(struct collection *c, struct slave_asynch_command *cmd, struct slave_connection *cnx) {
-
-	if(cmd->timeout == -1) {
-		return 1;
-	}
-
-	if(timer(cmd->send_time) > cmd->timeout) {
-		SLAVES_DBG("" LLU ": Asynch timeout reached! (%u ms) packet type: %u", cmd->uid, cmd->timeout, cmd->command);
-		
-		asynch_destroy(cmd, NULL);
-		
-		return 1;
-	}
-
-	return 1;
-}
-
-int slaves_check_xfer_timeouts(struct collection *c, struct ftpd_client_ctx *client, struct slave_connection *cnx) {
-
-	/*if(!collection_find(clients, client)) {
-		SLAVES_DBG("ERROR: client at %08x IS INVALID!!!", (int)client);
-
-		collection_delete(c, client);
-		return 1;
-	}*/
-
-	if(timer(client->xfer.last_alive) > FTPD_XFER_TIMEOUT) {
-		SLAVES_DBG("" LLU ": Client xfer timeout reached!", client->xfer.uid);
-
-		/*if(client->xfer.uid == -1) {
-			SLAVES_DBG("WARNING!!!! Client's xfer uid is -1!!!!");
-		}*/
-
-		ftpd_client_cleanup_data_connection(client);
-
-		//collection_delete(c, client);
-		return 1;
-	}
-
-	return 1;
-}
-
-int slaves_check_mirror_timeouts(struct collection *c, struct mirror_ctx *mirror, struct slave_connection *cnx) {
-	struct mirror_side *side;
-
-	side = (mirror->source.cnx == cnx) ? &mirror->source : &mirror->target;
-
-	if(timer(side->last_alive) > FTPD_XFER_TIMEOUT) {
-		SLAVES_DBG("" LLU ": Mirror xfer timeout reached!", mirror->uid);
-
-		mirror_cancel(mirror);
-
-		return 1;
-	}
-
-	return 1;
-}
-
-/* Check and enforces all timeouts for the slave */
-static int slave_check_timeouts(struct slave_connection *cnx) {
-
-	/* 1. Check timeouts on awaited asynch responses */
-	collection_iterate(cnx->asynch_response, (collection_f)slaves_check_asynch_timeouts, cnx);
-
-	/* 2. Check timeouts on xfers */
-	collection_iterate(cnx->xfers, (collection_f)slaves_check_xfer_timeouts, cnx);
-
-	/* 3. Check timeouts on mirrors */
-	collection_iterate(cnx->mirror_to, (collection_f)slaves_check_mirror_timeouts, cnx);
-	collection_iterate(cnx->mirror_from, (collection_f)slaves_check_mirror_timeouts, cnx);
-
-	return 1;
-}
-
 int slave_connection_read(int fd, struct slave_connection *cnx) {
 
 	/* start by dumping the fileslog to disk */
@@ -1927,8 +2198,6 @@ int slave_connection_read(int fd, struct slave_connection *cnx) {
 		return 0;
 	}
 
-	slave_check_timeouts(cnx);
-	
 	obj_unref(&cnx->o);
 
 	return 1;
@@ -2109,6 +2378,9 @@ void slave_connection_obj_destroy(struct slave_connection *cnx) {
 	collection_destroy(cnx->asynch_response);
 	cnx->asynch_response = NULL;
 
+	slave_delete_batch_free(&cnx->deletes);
+	file_list_destroy(cnx);
+
 	collection_destroy(cnx->xfers);
 	cnx->xfers = NULL;
 
@@ -2187,12 +2459,20 @@ struct slave_connection *slave_connection_new(int fd) {
 
 	cnx->timestamp = time_now();
 	cnx->statstime = 0;
+	cnx->reporttime = 0;
 	cnx->asynchtime = 0;
 
 	cnx->diskfree = 0;
 	cnx->disktotal = 0;
 
 	cnx->lagtime = 0;
+	
+	/* nothing known about it yet: last choice until it reports */
+	memset(&cnx->load, 0, sizeof(cnx->load));
+	cnx->load.up = (unsigned int)-1;
+	cnx->load.down = (unsigned int)-1;
+	memset(&cnx->deletes, 0, sizeof(cnx->deletes));
+	cnx->file_list = NULL;
 
 	cnx->asynch_queries = collection_new(C_CASCADE);
 	cnx->asynch_response = collection_new(C_CASCADE);
@@ -2330,6 +2610,9 @@ int slaves_init() {
 	connecting_slaves = collection_new(C_CASCADE);
 	connected_slaves = collection_new(C_CASCADE);
 
+	slaves_delete_pending = collection_new(C_NONE);
+	slaves_deletelog_pending = collection_new(C_NONE);
+
 	slaves_port = 0;
 	slaves_group = collection_new(C_CASCADE);
 	slaves_fd = -1;
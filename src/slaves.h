@@ -64,6 +64,55 @@ struct vfs_element;
 
 /* structure used to keep track of connected peers */
 typedef struct slave_connection slave_connection;
+/*
+	File list of a connecting slave, merged in the vfs a slice at
+	a time. The slave stays in connecting_slaves until it is done.
+*/
+typedef struct slave_file_list slave_file_list;
+struct slave_file_list {
+	struct packet *p; /* copy of the IO_FILE_LIST reply */
+	unsigned int offset; /* of the next entry in p->data */
+	
+	unsigned int files; /* merged so far */
+	unsigned long long int size;
+	unsigned int progress; /* per thousand of the list */
+	
+	struct collection *sfv_files; /* .sfv files with no infos yet */
+	unsigned long long int timestamp; /* when the list was received */
+	
+	struct wheel_timer timer; /* next slice */
+} __attribute__((packed));
+
+/*
+	Paths waiting for the end of a wipe, see slave_delete_begin().
+	On a connection they are sent as one IO_DELETE_BATCH, separated
+	by zeros. On an offline slave they are appended to the deletelog
+	in one write, one per line.
+*/
+typedef struct slave_delete_batch slave_delete_batch;
+struct slave_delete_batch {
+	unsigned int count; /* number of paths */
+	unsigned int length; /* bytes used, not counting the final zero */
+	unsigned int size; /* bytes allocated */
+	char *buffer;
+} __attribute__((packed));
+
+/*
+	Load of a slave connection, refreshed by slaveselection_update()
+	when its transfers are reported or change. The scores are what
+	the default slave selection compares: lower is better.
+*/
+typedef struct slave_score slave_score;
+struct slave_score {
+	unsigned int in; /* bytes per second received by the slave (uploads, mirror targets) */
+	unsigned int out; /* bytes per second sent by the slave (downloads, mirror sources) */
+	unsigned int capacity; /* link capacity in bytes per second, configured or highest seen */
+	unsigned int queue; /* number of transfers and mirrors */
+	
+	unsigned int up; /* upload score */
+	unsigned int down; /* download score */
+} __attribute__((packed));
+
 struct slave_connection {
 	struct obj o;
 	struct collectible c;
@@ -84,6 +133,7 @@ struct slave_connection {
 
 	unsigned long long int timestamp;	/* connect time */
 	unsigned long long int statstime;	/*  */
+	unsigned long long int reporttime;	/* last stats answer, 0 until the first one */
 
 	/* utility information */
 	unsigned long long int diskfree;
@@ -105,6 +155,12 @@ struct slave_connection {
 	/* tracking for mirror operations */
 	struct collection *mirror_from; /* outgoing */
 	struct collection *mirror_to; /* incoming */
+	
+	struct slave_score load;
+	
+	struct slave_delete_batch deletes;
+	
+	struct slave_file_list *file_list; /* NULL unless the file list is being merged */
 } __attribute__((packed));
 
 typedef struct slave_ctx slave_ctx;
@@ -126,6 +182,7 @@ struct slave_ctx {
 
 	struct collection *offline_files; /* files that are currently offline from that slave */
 	char *deletelog; /* on-disk deletelog filename */
+	struct slave_delete_batch deletes; /* not yet written to the deletelog */
 
 	struct slave_connection *cnx; /* NULL if the slave is not connected */
 
@@ -159,6 +216,16 @@ unsigned int slave_mark_offline_from(struct slave_ctx *slave, struct vfs_element
 
 unsigned int slave_delete_file(struct slave_connection *cnx, struct vfs_element *element);
 
+/*
+	Group all the slave_delete_file() and slave_offline_delete()
+	calls made until the matching slave_delete_end() into a single
+	query per slave. The calls may be nested, only the outermost
+	end sends the queries. If 'folder' is given, it is being wiped
+	as a whole and the slaves are asked to delete it in one go.
+*/
+void slave_delete_begin();
+void slave_delete_end(struct vfs_element *folder);
+
 unsigned long long int slave_usage_from(struct slave_connection *cnx, struct vfs_element *element);
 
 int slaves_init();
@@ -37,11 +37,17 @@
 #include <windows.h>
 #endif
 
+#include <stdio.h>
 
 #include "constants.h"
+#include "time.h"
 #include "vfs.h"
 #include "collection.h"
 #include "slaves.h"
+#include "ftpd.h"
+#include "mirror.h"
+#include "config.h"
+#include "topology.h"
 #include "events.h"
 #include "luainit.h"
 #include "logging.h"
@@ -50,8 +56,18 @@
 static struct signal_ctx *slaveselection_signal_up = NULL;
 static struct signal_ctx *slaveselection_signal_down = NULL;
 
+/* handed to the scripts, only filled when some are hooked */
+static struct collection *slaveselection_list = NULL;
+
 int slaveselection_init() {
 	
+	slaveselection_list = collection_new(C_NONE);
+	
+	if(!topology_init()) {
+		SLAVESELECTION_DBG("Could not load the topology");
+		return 0;
+	}
+	
 	slaveselection_signal_up = event_signal_get("slaveselection_up", 1);
 	signal_ref(slaveselection_signal_up);
 	
@@ -68,7 +84,111 @@ void slaveselection_free() {
 
 	signal_unref(slaveselection_signal_down);
 	slaveselection_signal_down = NULL;
+	
+	if(slaveselection_list) {
+		collection_destroy(slaveselection_list);
+		slaveselection_list = NULL;
+	}
+	
+	topology_free();
+
+	return;
+}
 
+static int slaveselection_update_xfer(struct collection *c, struct ftpd_client_ctx *client, struct slave_score *load) {
+	
+	if(client->xfer.upload) {
+		load->in += client->xfer.speed;
+	} else {
+		load->out += client->xfer.speed;
+	}
+	load->queue++;
+	
+	return 1;
+}
+
+static int slaveselection_update_mirror_from(struct collection *c, struct mirror_ctx *mirror, struct slave_score *load) {
+	
+	load->out += mirror->source.speed;
+	load->queue++;
+	
+	return 1;
+}
+
+static int slaveselection_update_mirror_to(struct collection *c, struct mirror_ctx *mirror, struct slave_score *load) {
+	
+	load->in += mirror->target.speed;
+	load->queue++;
+	
+	return 1;
+}
+
+/* scale the usage of one direction of the link to 0-1000 */
+static unsigned int slaveselection_link_score(unsigned int speed, unsigned int capacity) {
+	unsigned long long int score;
+	
+	score = ((unsigned long long int)speed * 1000) / capacity;
+	
+	return (score > 1000) ? 1000 : (unsigned int)score;
+}
+
+/*
+	Recompute the load of a slave connection from
+	its transfers and its last reported stats. This
+	is done every time they change so the selection
+	itself only has to compare the scores.
+*/
+void slaveselection_update(struct slave_connection *cnx) {
+	struct slave_score load;
+	unsigned int lag, disk;
+	
+	if(!cnx) {
+		return;
+	}
+	
+	memset(&load, 0, sizeof(load));
+	
+	collection_iterate(cnx->xfers, (collection_f)slaveselection_update_xfer, &load);
+	collection_iterate(cnx->mirror_from, (collection_f)slaveselection_update_mirror_from, &load);
+	collection_iterate(cnx->mirror_to, (collection_f)slaveselection_update_mirror_to, &load);
+	
+	/* the link capacity is either configured in kb/s
+		or the most this slave was ever seen to do */
+	load.capacity = 0;
+	if(cnx->slave && cnx->slave->config) {
+		load.capacity = (unsigned int)config_read_int(cnx->slave->config, "capacity", 0) * 1024;
+	}
+	if(!load.capacity) {
+		load.capacity = cnx->load.capacity;
+		if(load.capacity < (load.in + load.out)) {
+			load.capacity = (load.in + load.out);
+		}
+		if(load.capacity < SLAVESELECTION_MIN_CAPACITY) {
+			load.capacity = SLAVESELECTION_MIN_CAPACITY;
+		}
+	}
+	
+	lag = (cnx->lagtime > SLAVESELECTION_MAX_LAG) ? SLAVESELECTION_MAX_LAG : (unsigned int)cnx->lagtime;
+	lag = (lag * 1000) / SLAVESELECTION_MAX_LAG;
+	
+	/* a slave that never answered a stats probe has
+		speeds of 0 for transfers that may well be busy */
+	if(!cnx->reporttime) {
+		lag += SLAVESELECTION_UNREPORTED_COST;
+	}
+	
+	load.down = slaveselection_link_score(load.out, load.capacity) + lag + (load.queue * SLAVESELECTION_QUEUE_COST);
+	
+	if(!cnx->diskfree || !cnx->disktotal) {
+		/* nothing reported yet, or full: last choice */
+		load.up = (unsigned int)-1;
+	} else {
+		disk = (unsigned int)(((cnx->disktotal - cnx->diskfree) * 1000) / cnx->disktotal);
+		load.up = slaveselection_link_score(load.in, load.capacity) + disk + lag + (load.queue * SLAVESELECTION_QUEUE_COST);
+	}
+	
+	cnx->load = load;
+	
 	return;
 }
 
@@ -126,10 +246,19 @@ struct slave_connection *call_selectionup(struct collection *selection, struct v
 	return object.ret.ptr;
 }
 
+/* only give the scripts a list when some are listening */
+static int slaveselection_hooked(struct signal_ctx *signal) {
+	
+	return signal && collection_size(signal->callbacks);
+}
+
 static int build_selectiondown_list(struct collection *c, void *item, void *param) {
 	struct slave_connection *cnx = item;
 	struct collection *selection = param;
 
+	/* still merging its file list, it can not transfer yet */
+	if(!cnx->ready) return 1;
+
 	collection_add(selection, cnx);
 	collection_movelast(selection, cnx);
 
@@ -140,7 +269,7 @@ static int build_selectionup_list(struct collection *c, void *item, void *param)
 	struct slave_ctx *slave = item;
 	struct collection *selection = param;
 
-	if(!slave->cnx) return 1;
+	if(!slave->cnx || !slave->cnx->ready) return 1;
 
 	collection_add(selection, slave->cnx);
 	collection_movelast(selection, slave->cnx);
@@ -148,27 +277,89 @@ static int build_selectionup_list(struct collection *c, void *item, void *param)
 	return 1;
 }
 
-static int get_less_busy_connection(struct collection *c, void *item, void *param) {
+struct slaveselection_down_ctx {
+	unsigned int score; /* load and cost of the selected slave */
+	struct slave_connection *cnx;
+	
+	/* where the client is, NULL if nowhere known */
+	struct topology_prefix *prefix;
+	
+	/* every candidate's score, only kept when logging */
+	char candidates[512];
+	unsigned int length;
+};
+
+/* on a tie the first one wins, so the movelast keeps rotating them */
+static int get_less_loaded_download(struct collection *c, void *item, void *param) {
+	struct slave_connection *cnx = item;
+	struct slaveselection_down_ctx *ctx = param;
+	unsigned int cost, score;
+	int n;
+
+	/* its files are online while it merges its file list, but it can not transfer yet */
+	if(!cnx->ready) return 1;
+
+	cost = topology_get_cost(ctx->prefix, cnx);
+	score = cnx->load.down + cost;
+	
+	if(topology_log && (ctx->length < sizeof(ctx->candidates))) {
+		n = snprintf(&ctx->candidates[ctx->length], sizeof(ctx->candidates) - ctx->length, "%s%s=%u+%u",
+			ctx->length ? "," : "", cnx->slave ? cnx->slave->name : "?", cnx->load.down, cost);
+		ctx->length = (n > 0) ? (ctx->length + n) : sizeof(ctx->candidates);
+	}
+
+	if(!ctx->cnx || (ctx->score > score)) {
+		ctx->score = score;
+		ctx->cnx = cnx;
+	}
+
+	return 1;
+}
+
+/* one line per decision: time;client;prefix;file;slave;score;candidates */
+static void slaveselection_log_download(struct slaveselection_down_ctx *ctx, struct vfs_element *file, ipaddress ip) {
+	
+	if(!topology_log || !ctx->cnx) {
+		return;
+	}
+	
+	logging_write(TOPOLOGY_LOG_FILE, "download;" LLU ";%u.%u.%u.%u;%s;%s;%s;%u;%s\n",
+		time_now(), ip.c4, ip.c3, ip.c2, ip.c1, ctx->prefix ? ctx->prefix->name : "*",
+		file->name, ctx->cnx->slave ? ctx->cnx->slave->name : "?", ctx->score, ctx->candidates);
+	
+	return;
+}
+
+static int get_less_loaded_upload(struct collection *c, void *item, void *param) {
 	struct slave_connection *cnx = item;
 	struct {
-		unsigned int connections;
+		unsigned int score;
 		struct slave_connection *cnx;
 	} *ctx = param;
 
-	if(!ctx->cnx || (ctx->connections > collection_size(cnx->xfers))) {
-		ctx->connections = collection_size(cnx->xfers);
+	if(!cnx->ready) return 1;
+
+	if(!ctx->cnx || (ctx->score > cnx->load.up)) {
+		ctx->score = cnx->load.up;
 		ctx->cnx = cnx;
 	}
 
 	return 1;
 }
 
-struct slave_connection *slaveselection_download(struct vfs_element *file) {
-	struct collection *selection;
-	struct {
-		unsigned int connections; /* connection count for the selected slave- needed for tracking in the callback */
-		struct slave_connection *cnx;
-	} ctx = { 0, NULL };
+/* same as above, straight from the section's slaves */
+static int get_less_loaded_slave(struct collection *c, void *item, void *param) {
+	struct slave_ctx *slave = item;
+
+	if(!slave->cnx) return 1;
+
+	return get_less_loaded_upload(NULL, slave->cnx, param);
+}
+
+struct slave_connection *slaveselection_download(struct vfs_element *file, struct ftpd_client_ctx *client) {
+	struct collection *selection = slaveselection_list;
+	struct slaveselection_down_ctx ctx;
+	ipaddress ip;
 
 	if(file->type != VFS_FILE) {
 		/* can't download folders */
@@ -181,8 +372,28 @@ struct slave_connection *slaveselection_download(struct vfs_element *file) {
 		//SLAVESELECTION_DBG("Unavailable");
 		return NULL;
 	}
+	
+	ctx.score = 0;
+	ctx.cnx = NULL;
+	ctx.prefix = NULL;
+	ctx.candidates[0] = 0;
+	ctx.length = 0;
+	
+	ip = mkipaddress(0, 0, 0, 0);
+	if(client) {
+		ip = client_ipaddress(client);
+		ctx.prefix = topology_match(ip);
+	}
 
-	selection = collection_new(C_NONE);
+	if(!slaveselection_hooked(slaveselection_signal_down)) {
+		/* no script to filter the list, pick directly */
+		collection_iterate(file->available_from, get_less_loaded_download, &ctx);
+		if(ctx.cnx) {
+			slaveselection_log_download(&ctx, file, ip);
+			collection_movelast(file->available_from, ctx.cnx);
+		}
+		return ctx.cnx;
+	}
 
 	/* transfer all available slaves into the collection */
 	collection_iterate(file->available_from, build_selectiondown_list, selection);
@@ -190,7 +401,7 @@ struct slave_connection *slaveselection_download(struct vfs_element *file) {
 	/* give a chance to select a slave from the scripts */
 	ctx.cnx = call_selectiondown(selection, file);
 	if(ctx.cnx) {
-		collection_destroy(selection);
+		collection_empty(selection);
 		collection_movelast(file->available_from, ctx.cnx);
 		return ctx.cnx;
 	}
@@ -203,11 +414,12 @@ struct slave_connection *slaveselection_download(struct vfs_element *file) {
 		collection_iterate(file->available_from, build_selectiondown_list, selection);
 	}
 	
-	/* try select the less busy slave */
-	collection_iterate(selection, get_less_busy_connection, &ctx);
-	collection_destroy(selection);
+	/* try select the less loaded slave */
+	collection_iterate(selection, get_less_loaded_download, &ctx);
+	collection_empty(selection);
 
 	if(ctx.cnx) {
+		slaveselection_log_download(&ctx, file, ip);
 		collection_movelast(file->available_from, ctx.cnx);
 	}
 
@@ -215,9 +427,9 @@ struct slave_connection *slaveselection_download(struct vfs_element *file) {
 }
 
 struct slave_connection *slaveselection_upload(struct vfs_element *folder) {
-	struct collection *selection;
+	struct collection *selection = slaveselection_list;
 	struct {	
-		unsigned int connections; /* connection count for the selected slave- needed for tracking in the callback */
+		unsigned int score; /* load of the selected slave- needed for tracking in the callback */
 		struct slave_connection *cnx;
 	} ctx = { 0, NULL };
 	struct vfs_section *section;
@@ -243,7 +455,14 @@ struct slave_connection *slaveselection_upload(struct vfs_element *folder) {
 		return NULL;
 	}
 
-	selection = collection_new(C_NONE);
+	if(!slaveselection_hooked(slaveselection_signal_up)) {
+		/* no script to filter the list, pick directly */
+		collection_iterate(section->slaves, get_less_loaded_slave, &ctx);
+		if(ctx.cnx) {
+			collection_movelast(section->slaves, ctx.cnx->slave);
+		}
+		return ctx.cnx;
+	}
 
 	/* transfer all available slave connections into the collection */
 	collection_iterate(section->slaves, build_selectionup_list, selection);
@@ -251,7 +470,7 @@ struct slave_connection *slaveselection_upload(struct vfs_element *folder) {
 	/* give a chance to select a slave from the scripts */
 	ctx.cnx = call_selectionup(selection, folder);
 	if(ctx.cnx) {
-		collection_destroy(selection);
+		collection_empty(selection);
 		collection_movelast(section->slaves, ctx.cnx->slave);
 		return ctx.cnx;
 	}
@@ -264,9 +483,9 @@ struct slave_connection *slaveselection_upload(struct vfs_element *folder) {
 		collection_iterate(section->slaves, build_selectionup_list, selection);
 	}
 
-	/* try select the less busy slave */
-	collection_iterate(selection, get_less_busy_connection, &ctx);
-	collection_destroy(selection);
+	/* try select the less loaded slave */
+	collection_iterate(selection, get_less_loaded_upload, &ctx);
+	collection_empty(selection);
 
 	if(ctx.cnx) {
 		collection_movelast(section->slaves, ctx.cnx->slave);
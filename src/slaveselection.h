@@ -45,11 +45,17 @@
 # define SLAVESELECTION_DBG(format, arg...)
 #endif
 
+struct slave_connection;
+struct vfs_element;
+struct ftpd_client_ctx;
 
 int slaveselection_init();
 void slaveselection_free();
 
-struct slave_connection *slaveselection_download(struct vfs_element *file);
+void slaveselection_update(struct slave_connection *cnx);
+
+/* client may be NULL, the slave is then picked on its load alone */
+struct slave_connection *slaveselection_download(struct vfs_element *file, struct ftpd_client_ctx *client);
 struct slave_connection *slaveselection_upload(struct vfs_element *folder);
 
 #endif /* __SLAVESELECTION_H */
@@ -45,9 +45,27 @@
 #include "time.h"
 #include "signal.h"
 #include "obj.h"
+#include "resolver.h"
 
 //unsigned long long int socket_current = 0;
 
+/*
+	Sockets returned by connect_to_host_non_blocking() while their
+	host name is being resolved. Their monitor is not polled until
+	the connect() is issued.
+*/
+struct socket_resolving {
+	struct collection_list list;
+	
+	int fd;
+	short port;
+	struct resolver_query *query;
+} __attribute__((packed));
+
+collection_static_list(socket_resolving_list);
+
+static struct socket_monitor *socket_monitor_get_fd(int fd);
+
 int socket_init() {
 	//SOCKET_DBG("Socket set size is %u", FD_SETSIZE);
 
@@ -178,12 +196,8 @@ int make_socket_blocking(int s, int blocking) {
 }
 
 unsigned int socket_addr(const char *hostname) {
-  struct hostent *host_entry;
 
-  host_entry = gethostbyname(hostname); /* FIXME: use getaddrinfo */
-  if(host_entry == NULL) return INVALID_SOCKET;
-  
-  return *((unsigned int*)*host_entry->h_addr_list);
+	return resolver_resolve(hostname);
 }
 
 int socket_linger(int fd, unsigned short timeout) {
@@ -195,8 +209,22 @@ int socket_linger(int fd, unsigned short timeout) {
 	return setsockopt(fd, IPPROTO_TCP, SO_LINGER, (void*)&l, sizeof(l));
 }
 
-int connect_to_ip_non_blocking(unsigned int ip, short port) {
+static int socket_connect_non_blocking(int s, unsigned int ip, short port) {
 	struct sockaddr_in saServer;
+
+	saServer.sin_family = AF_INET;
+	*(unsigned int *)&saServer.sin_addr = ip;
+	saServer.sin_port = htons(port);
+	if((connect(s, (struct sockaddr *)&saServer, sizeof(struct sockaddr)) == SOCKET_ERROR) &&
+			(GetLastError() != EWOULDBLOCK)) {
+		SOCKET_DBG("non-blocking connect() failed.");
+		return 0;
+	}
+
+	return 1;
+}
+
+int connect_to_ip_non_blocking(unsigned int ip, short port) {
 	int s;
 
 	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -205,12 +233,7 @@ int connect_to_ip_non_blocking(unsigned int ip, short port) {
 		return INVALID_SOCKET;
 	}
 	make_socket_blocking(s, 0);
-	saServer.sin_family = AF_INET;
-	*(unsigned int *)&saServer.sin_addr = ip;
-	saServer.sin_port = htons(port);
-	if((connect(s, (struct sockaddr *)&saServer, sizeof(struct sockaddr)) == SOCKET_ERROR) &&
-			(GetLastError() != EWOULDBLOCK)) {
-		SOCKET_DBG("non-blocking connect() failed.");
+	if(!socket_connect_non_blocking(s, ip, port)) {
 		closesocket(s);
 		return INVALID_SOCKET;
 	}
@@ -263,24 +286,105 @@ int connect_to_ip(unsigned int ip, short port) {
 }
 
 int connect_to_host(const char *hostname, short port) {
-  struct hostent *host_entry;
+	unsigned int ip;
 
-  host_entry = gethostbyname(hostname); /* FIXME: use getaddrinfo */
-  if(host_entry == NULL) return INVALID_SOCKET;
-  
-  return connect_to_ip(*((unsigned int*)*host_entry->h_addr_list), port);
+	ip = resolver_resolve(hostname);
+	if(ip == INVALID_SOCKET) return INVALID_SOCKET;
+
+	return connect_to_ip(ip, port);
+}
+
+static struct socket_resolving *socket_resolving_get(int fd) {
+	struct collection_list *l;
+	struct socket_resolving *resolving;
+
+	for(l = socket_resolving_list.next; l != &socket_resolving_list; l = l->next) {
+		resolving = CONTAINING_RECORD(l, struct socket_resolving, list);
+		if(resolving->fd == fd) {
+			return resolving;
+		}
+	}
+
+	return NULL;
+}
+
+/* the host of a pending socket is resolved, issue the connect() now */
+static void socket_resolved(unsigned int ip, struct socket_resolving *resolving) {
+	struct socket_monitor *monitor;
+	int fd = resolving->fd;
+	int success;
+
+	collection_list_remove(&resolving->list);
+
+	if(ip == INVALID_SOCKET) {
+		SOCKET_DBG("fds[%08x] host could not be resolved", fd);
+		success = 0;
+	} else {
+		success = socket_connect_non_blocking(fd, ip, resolving->port);
+	}
+
+	free(resolving);
+
+	monitor = socket_monitor_get_fd(fd);
+	if(!monitor) {
+		return;
+	}
+
+	monitor->resolving = 0;
+
+	if(!success) {
+		/* report it just like a connection failure */
+		obj_ref(&monitor->o);
+		monitor->dead = 1;
+		signal_raise(monitor->error_signal, (void *)fd);
+		obj_destroy(&monitor->o);
+		obj_unref(&monitor->o);
+	}
+
+	return;
 }
 
 int connect_to_host_non_blocking(const char *hostname, short port) {
-  struct hostent *host_entry;
+	struct socket_resolving *resolving;
+	unsigned int ip;
+	int s;
 
-  host_entry = gethostbyname(hostname); /* FIXME: use getaddrinfo */
-  if(host_entry == NULL) return INVALID_SOCKET;
-  
-  return connect_to_ip_non_blocking(*((unsigned int*)*host_entry->h_addr_list), port);
+	resolving = malloc(sizeof(struct socket_resolving));
+	if(!resolving) {
+		SOCKET_DBG("Memory error");
+		return INVALID_SOCKET;
+	}
+
+	resolving->query = resolver_lookup(hostname, (resolver_f)socket_resolved, resolving, &ip);
+	if(!resolving->query) {
+		/* the answer was known right away */
+		free(resolving);
+		if(ip == INVALID_SOCKET) return INVALID_SOCKET;
+
+		return connect_to_ip_non_blocking(ip, port);
+	}
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(s == INVALID_SOCKET) {
+		SOCKET_DBG("socket() failed.");
+		/* the answer will still be cached */
+		resolver_cancel(resolving->query);
+		free(resolving);
+		return INVALID_SOCKET;
+	}
+	make_socket_blocking(s, 0);
+
+	/* enable SO_LINGER */
+	socket_linger(s, 0);
+
+	resolving->fd = s;
+	resolving->port = port;
+	collection_list_addlast(&socket_resolving_list, &resolving->list);
+
+	return s;
 }
 
-int create_listening_socket(short int port)
+static int create_listening_socket_ex(short int port, unsigned int shared)
 {
 	int s;
 	struct sockaddr_in addr;
@@ -299,6 +403,17 @@ int create_listening_socket(short int port)
 	i = 1;
 	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*)&i, sizeof(i));
 
+#ifdef SO_REUSEPORT
+	if(shared) {
+		/* let other processes bind the same port, the kernel spreads the connections */
+		if(setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (char*)&i, sizeof(i)) != 0) {
+			SOCKET_DBG("setsockopt(SO_REUSEPORT) failed.");
+			closesocket(s);
+			return INVALID_SOCKET;
+		}
+	}
+#endif
+
 	/* enable TCP_NODELAY */
 	/*{
 		BOOL optval = 1;
@@ -318,10 +433,36 @@ int create_listening_socket(short int port)
 	return s;
 }
 
+int create_listening_socket(short int port)
+{
+
+	return create_listening_socket_ex(port, 0);
+}
+
+int create_shared_listening_socket(short int port)
+{
+
+#ifdef SO_REUSEPORT
+	return create_listening_socket_ex(port, 1);
+#else
+	SOCKET_DBG("SO_REUSEPORT is not supported on this system.");
+	return INVALID_SOCKET;
+#endif
+}
+
 void close_socket(int fd)
 {
+	struct socket_resolving *resolving;
 
 	if(fd != -1) {
+		/* never connect() a socket that was closed during the resolution */
+		resolving = socket_resolving_get(fd);
+		if(resolving) {
+			resolver_cancel(resolving->query);
+			collection_list_remove(&resolving->list);
+			free(resolving);
+		}
+
 		make_socket_blocking(fd, 1);
 		shutdown(fd, SD_SEND);
 
@@ -454,6 +595,9 @@ static void socket_monitor_obj_destroy(struct socket_monitor *monitor) {
 	
 	collectible_destroy(monitor);
 
+	/* stop the timeouts of any callback still registered */
+	collection_void(monitor->signals);
+
 	signal_unref(monitor->connect_signal);
 	monitor->connect_signal = NULL;
 
@@ -512,6 +656,7 @@ int socket_monitor_new(int fd, int connected, int listening) {
 	monitor->dead = 0;
 	monitor->connected = connected;
 	monitor->listening = listening;
+	monitor->resolving = (socket_resolving_get(fd) != NULL);
 	monitor->fd = fd;
 	monitor->signals = collection_new(C_NONE);
 
@@ -710,11 +855,6 @@ static int socket_handle_fdset(struct pollfd fdset[], struct socket_monitor *fds
 			}
 		}
 
-		/* check for any timeout here */
-		if(obj_isvalid(&fdset_monitors[i]->o)) {
-			signal_poll(fdset_monitors[i]->signals);
-		}
-
 		HANDLE_CLEANUP(i);
 	}
 
@@ -733,7 +873,7 @@ unsigned int socket_poll_monitors(struct collection *c, struct socket_monitor *m
 	struct socket_poll_ctx *ctx = param;
 	int r;
 
-	if(monitor->dead) {
+	if(monitor->dead || monitor->resolving) {
 		return 1;
 	}
 
@@ -786,6 +926,9 @@ int socket_poll() {
 	ctx.count = 0;
 	ctx.nfds = 0;
 
+	/* connect the sockets whose host was resolved */
+	resolver_poll();
+
 	collection_iterate(socket_monitors, (collection_f)socket_poll_monitors, &ctx);
 
 	if(ctx.nfds) {
@@ -144,6 +144,12 @@ struct socket_monitor {
 	*/
 	int dead;
 
+	/*
+		Set while the host of a socket created by connect_to_host_non_blocking()
+		is being resolved. The socket is not polled until connect() is called.
+	*/
+	int resolving;
+
 	struct collection *signals;
 
 	/* cached pointers to avoid looking them up every time. */
@@ -176,6 +182,8 @@ int connect_to_ip_non_blocking(unsigned int ip, short port);
 int connect_to_host(const char *hostname, short port);
 int connect_to_host_non_blocking(const char *hostname, short port);
 int create_listening_socket(short int port);
+/* same, but many processes may listen on the same port (SO_REUSEPORT) */
+int create_shared_listening_socket(short int port);
 void close_socket(int s);
 
 /* Utilities */
@@ -52,63 +52,165 @@
 #include "mirror.h"
 #include "main.h"
 #include "asynch.h"
+#include "slaveselection.h"
 
-static int probe_stats_update_xfer(struct collection *c, struct ftpd_client_ctx *client, void *param) {
-	struct {
-		struct slave_connection *cnx;
-		struct stats_xfer *stats;
-	} *ctx = param;
+/*
+	The uids are handed out in sequence, so their low
+	bits spread the transfers evenly over the buckets.
+*/
+#define STATS_BUCKETS		256
+#define STATS_BUCKETS_MASK	(STATS_BUCKETS - 1)
 
-	if((client->xfer.uid != -1) && (client->xfer.uid == ctx->stats->uid)) {
+static struct collection_list stats_buckets[STATS_BUCKETS];
+static char stats_initialized = 0;
 
-		/*
-			update the timestamp because the client is xfering
-			and we don't want him to get disconnected
-		*/
-		client->last_timestamp = time_now();
+static void stats_init() {
+	unsigned int i;
+	
+	for(i=0;i<STATS_BUCKETS;i++) {
+		collection_list_init(&stats_buckets[i]);
+	}
+	
+	stats_initialized = 1;
+	
+	return;
+}
 
-		/* update the xfered size */
-		client->xfer.xfered = ctx->stats->xfered;
-		client->xfer.last_alive = time_now();
+void stats_link_init(struct stats_link *link, stats_f callback) {
+	
+	collection_list_init(&link->list);
+	
+	link->uid = -1;
+	link->cnx = NULL;
+	link->timestamp = 0;
+	link->xfered = 0;
+	link->speed = 0;
+	link->callback = callback;
+	
+	return;
+}
 
-#ifdef GROW_FILE_SIZES_ON_TRANSFER
-		if(client->xfer.upload && client->xfer.element) {
-			/* set the current file size if the user is uploading it */
-			vfs_set_size(client->xfer.element, client->xfer.xfered);
+void stats_link_add(struct stats_link *link, struct slave_connection *cnx, unsigned long long int uid) {
+	
+	if(!stats_initialized) {
+		stats_init();
+	}
+	
+	collection_list_remove(&link->list);
+	
+	link->uid = uid;
+	link->cnx = cnx;
+	link->timestamp = time_now();
+	link->xfered = 0;
+	link->speed = 0;
+	
+	collection_list_addlast(&stats_buckets[uid & STATS_BUCKETS_MASK], &link->list);
+	
+	return;
+}
+
+void stats_link_remove(struct stats_link *link) {
+	
+	collection_list_remove(&link->list);
+	link->speed = 0;
+	
+	return;
+}
+
+/* apply one transfer's progress, to both sides if the slave mirrors to itself */
+static void stats_report(struct slave_connection *cnx, struct stats_xfer *stats) {
+	struct collection_list *bucket, *l, *next;
+	struct stats_link *link;
+	unsigned long long int now, elapsed;
+	unsigned int speed;
+	
+	if(!stats_initialized) {
+		return;
+	}
+	
+	now = time_now();
+	
+	bucket = &stats_buckets[stats->uid & STATS_BUCKETS_MASK];
+	for(l = bucket->next; l != bucket; l = next) {
+		next = l->next;
+		link = CONTAINING_RECORD(l, struct stats_link, list);
+		
+		if((link->uid != stats->uid) || (link->cnx != cnx)) {
+			continue;
 		}
-#endif
+		
+		elapsed = now - link->timestamp;
+		if(elapsed && (stats->xfered >= link->xfered)) {
+			speed = (unsigned int)(((stats->xfered - link->xfered) * 1000) / elapsed);
+			link->speed = link->speed ? ((link->speed + speed) / 2) : speed;
+			link->timestamp = now;
+		}
+		link->xfered = stats->xfered;
+		
+		(*link->callback)(link);
+	}
+	
+	return;
+}
 
+unsigned int stats_progress(struct slave_connection *cnx, struct packet *p) {
+	struct stats_xfer *xstats;
+	unsigned int length;
+	unsigned int xfers_count, i;
+	
+	length = (p->size - sizeof(struct packet));
+	
+	/* protocol error */
+	if((length % sizeof(struct stats_xfer)) != 0) {
+		STATS_DBG("Protocol error");
 		return 0;
 	}
-
+	
+	xfers_count = (length / sizeof(struct stats_xfer));
+	xstats = (struct stats_xfer *)&p->data[0];
+	
+	for(i=0;i<xfers_count;i++) {
+		stats_report(cnx, &xstats[i]);
+	}
+	
+	slaveselection_update(cnx);
+	
 	return 1;
 }
 
-static int probe_stats_update_mirror(struct collection *c, struct mirror_ctx *mirror, void *param) {
-	struct {
-		struct slave_connection *cnx;
-		struct stats_xfer *stats;
-	} *ctx = param;
+static int stats_slave_speed_xfer(struct collection *c, struct ftpd_client_ctx *client, unsigned int *speed) {
+	
+	*speed += client->xfer.speed;
+	
+	return 1;
+}
 
-	if(mirror->uid == ctx->stats->uid) {
-		if(mirror->source.cnx == ctx->cnx) {
-			mirror->source.xfered = ctx->stats->xfered;
-			mirror->source.last_alive = time_now();
-		}
-		if(mirror->target.cnx == ctx->cnx) {
-			mirror->target.xfered = ctx->stats->xfered;
-			mirror->target.last_alive = time_now();
+static int stats_slave_speed_mirror_from(struct collection *c, struct mirror_ctx *mirror, unsigned int *speed) {
+	
+	*speed += mirror->source.speed;
+	
+	return 1;
+}
 
-#ifdef GROW_FILE_SIZES_ON_TRANSFER
-			/* Update the filesize here if needed */
-			vfs_set_size(mirror->target.file, mirror->target.xfered);
-#endif
+static int stats_slave_speed_mirror_to(struct collection *c, struct mirror_ctx *mirror, unsigned int *speed) {
+	
+	*speed += mirror->target.speed;
+	
+	return 1;
+}
 
-		}
+unsigned int stats_slave_speed(struct slave_connection *cnx) {
+	unsigned int speed = 0;
+	
+	if(!cnx) {
 		return 0;
 	}
-
-	return 1;
+	
+	collection_iterate(cnx->xfers, (collection_f)stats_slave_speed_xfer, &speed);
+	collection_iterate(cnx->mirror_from, (collection_f)stats_slave_speed_mirror_from, &speed);
+	collection_iterate(cnx->mirror_to, (collection_f)stats_slave_speed_mirror_to, &speed);
+	
+	return speed;
 }
 
 /* receive the stats response from the slaves */
@@ -118,10 +220,6 @@ static unsigned int probe_stats_callback(struct slave_connection *cnx, struct sl
 	struct stats_xfer *xstats;
 	unsigned int length;
 	unsigned int xfers_count, i;
-	struct {
-		struct slave_connection *cnx;
-		struct stats_xfer *stats;
-	} ctx = { cnx, NULL };
 
 	/* if timeout or protocol error then exit */
 	if(!p || (p->type != IO_STATS)) {
@@ -142,6 +240,7 @@ static unsigned int probe_stats_callback(struct slave_connection *cnx, struct sl
 
 	cnx->diskfree = gstats->diskfree;
 	cnx->disktotal = gstats->disktotal;
+	cnx->reporttime = time_now();
 	
 	/* protocol error */
 	if(((length - sizeof(struct stats_global)) % sizeof(struct stats_xfer)) != 0) {
@@ -156,12 +255,11 @@ static unsigned int probe_stats_callback(struct slave_connection *cnx, struct sl
 	xstats = (struct stats_xfer *)&p->data[sizeof(struct stats_global)];
 
 	for(i=0;i<xfers_count;i++) {
-		ctx.stats = &xstats[i];
-		/* the stat may be about a xfer or a mirror, no way to know */
-		collection_iterate(cnx->xfers, (collection_f)probe_stats_update_xfer, &ctx);
-		collection_iterate(cnx->mirror_from, (collection_f)probe_stats_update_mirror, &ctx);
-		collection_iterate(cnx->mirror_to, (collection_f)probe_stats_update_mirror, &ctx);
+		/* the stat may be about a xfer or a mirror, the link knows */
+		stats_report(cnx, &xstats[i]);
 	}
+	
+	slaveselection_update(cnx);
 
 	return 1;
 }
@@ -37,6 +37,8 @@
 #define __STATS_H
 
 #include "constants.h"
+#include "collection.h"
+#include "packet.h"
 
 #include "debug.h"
 #if defined(DEBUG_STATS)
@@ -55,6 +57,46 @@ struct stats_xfer {
 	unsigned long long int xfered; /* current number of bytes transfered */
 } __attribute__((packed));
 
+/*
+	The slaves push an IO_PROGRESS packet made of stats_xfer
+	structures for the transfers that moved since the last one.
+	The IO_STATS query is still answered with every transfer.
+*/
+
+struct slave_connection;
+struct stats_link;
+
+/*
+	Progress of one transfer, as reported by one slave. The link is
+	embedded in the client's xfer or in each side of a mirror and is
+	kept in a table keyed by the transfer uid while it is running, so
+	each report is applied without looking through the transfers.
+*/
+typedef void (*stats_f)(struct stats_link *link);
+
+struct stats_link {
+	struct collection_list list; /* linked to its bucket */
+	
+	unsigned long long int uid;
+	struct slave_connection *cnx; /* only compared, never used */
+	
+	unsigned long long int timestamp; /* time of the last report */
+	unsigned long long int xfered;
+	unsigned int speed; /* bytes per second, smoothed over the reports */
+	
+	stats_f callback; /* called after each report */
+} __attribute__((packed));
+
+void stats_link_init(struct stats_link *link, stats_f callback);
+void stats_link_add(struct stats_link *link, struct slave_connection *cnx, unsigned long long int uid);
+void stats_link_remove(struct stats_link *link);
+
+/* handle an IO_PROGRESS packet, return 0 to disconnect the slave */
+unsigned int stats_progress(struct slave_connection *cnx, struct packet *p);
+
+/* sum of the speed of all the transfers of the slave, in bytes per second */
+unsigned int stats_slave_speed(struct slave_connection *cnx);
+
 unsigned int probe_stats();
 
 #endif /* __STATS_H */
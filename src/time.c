@@ -53,6 +53,22 @@ unsigned long long int time_now() {
 	return (timeptr.time * 1000) + timeptr.millitm;
 }
 
+/* return a time in milliseconds that is never set back, only
+	meaningful when compared with another value of this clock */
+unsigned long long int time_monotonic() {
+#ifdef WIN32
+	return GetTickCount64();
+#else
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		return time_now();
+	}
+
+	return ((unsigned long long int)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif
+}
+
 /* return the number of milliseconds elapsed since 'start' */
 unsigned long long int timer(unsigned long long int start) {
 	return (time_now() - start);
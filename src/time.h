@@ -43,6 +43,7 @@
 #include <time.h>
 
 unsigned long long int time_now();
+unsigned long long int time_monotonic();
 unsigned long long int timer(unsigned long long int start);
 
 void time_stamp_to_formated(unsigned long long int time, unsigned short *day,
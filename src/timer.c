@@ -74,47 +74,54 @@ void timer_clear() {
 	return;
 }
 
-static unsigned int timer_call_callback(struct collection *c, struct timer_ctx *to, void *param) {
+/* called by the wheel when the timer is due */
+static void timer_call_callback(struct timer_ctx *to) {
 	lua_State *L = to->script->L;
 	
-	if((time_now() >= to->timestamp) && (timer(to->timestamp) >= to->timeout)) {
-		
-		to->timestamp = time_now();
-		
-		lua_pushcfunction(L, luainit_traceback);
-		
-		tolua_pushusertype(L,(void*)to,"timer_ctx");
+	if(!obj_isvalid(&to->o))
+		return;
+	
+	obj_ref(&to->o);
+	
+	to->timestamp = time_now();
+	wheel_schedule(&to->timer, to->timestamp + to->timeout);
+	
+	lua_pushcfunction(L, luainit_traceback);
+	
+	tolua_pushusertype(L,(void*)to,"timer_ctx");
+	
+	luainit_tget(L, TIMER_REFTABLE, to->function_index);
+	if(lua_isfunction(L, -1)) {
+		int err;
 		
-		luainit_tget(L, TIMER_REFTABLE, to->function_index);
-		if(lua_isfunction(L, -1)) {
-			int err;
-			
-			/* call the function with two params and one return */
-			err = lua_pcall(L, 1, 1, -2);
-			if(err) {
-				/* do something with the error ... ? */
-				luainit_error(L, "(calling timer callback)", err);
-			} else {
-				/* do nothing */
-			}
-			
-			/* pops the error message or the return value */
-			lua_pop(L, 1);
+		/* call the function with two params and one return */
+		err = lua_pcall(L, 1, 1, -2);
+		if(err) {
+			/* do something with the error ... ? */
+			luainit_error(L, "(calling timer callback)", err);
 		} else {
-			/* pops the thing we just pushed that is not a function */
-			lua_pop(L, 1);
+			/* do nothing */
 		}
-		lua_pop(L, 1); /* pops the errfunc */
+		
+		/* pops the error message or the return value */
+		lua_pop(L, 1);
+	} else {
+		/* pops the thing we just pushed that is not a function */
+		lua_pop(L, 1);
 	}
+	lua_pop(L, 1); /* pops the errfunc */
+	
+	obj_unref(&to->o);
 
-	return 1;
+	return;
 }
 
-/* call any timeout that need so */
-unsigned int timer_poll() {
+/* arm a new timer for its first call */
+void timer_start(struct timer_ctx *to) {
 	
-	collection_iterate(timers, (collection_f)timer_call_callback, NULL);
+	wheel_timer_init(&to->timer, (wheel_f)timer_call_callback, to);
+	wheel_schedule(&to->timer, to->timestamp + to->timeout);
 	
-	return 1;
+	return;
 }
 
@@ -39,6 +39,7 @@
 #include "constants.h"
 #include "collection.h"
 #include "scripts.h"
+#include "wheel.h"
 
 #include "debug.h"
 #if defined(DEBUG_TIMER)
@@ -60,6 +61,8 @@ struct timer_ctx {
 	unsigned long long int timestamp; /* time of the last call */
 	unsigned long long int timeout; /* timeout in milliseconds */
 	int function_index; /* function to call */
+	
+	struct wheel_timer timer; /* armed for the next call */
 } __attribute__((packed));
 
 extern struct collection *timers;
@@ -71,7 +74,8 @@ void timer_free();
 //int timer_add(lua_State *L);
 //unsigned int timer_del(char *function);
 
-unsigned int timer_poll();
+/* arm a new timer, it will be called at timestamp + timeout, then every timeout */
+void timer_start(struct timer_ctx *to);
 
 void timer_clear();
 
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "config.h"
+#include "logging.h"
+#include "socket.h"
+#include "slaves.h"
+#include "topology.h"
+
+int topology_log = 0;
+
+static struct topology_node *topology_root = NULL;
+static unsigned int topology_count = 0;
+
+/* ipaddress holds the bytes of sin_addr as they are: c4 is the first octet */
+static unsigned int topology_ip(ipaddress ip) {
+	
+	return ((unsigned int)ip.c4 << 24) | ((unsigned int)ip.c3 << 16) | ((unsigned int)ip.c2 << 8) | ip.c1;
+}
+
+static void topology_prefix_destroy(struct topology_prefix *prefix) {
+	unsigned int i;
+	
+	for(i=0;i<prefix->count;i++) {
+		free(prefix->costs[i].slave);
+	}
+	if(prefix->costs) {
+		free(prefix->costs);
+	}
+	free(prefix->name);
+	free(prefix);
+	
+	return;
+}
+
+static void topology_node_destroy(struct topology_node *node) {
+	
+	if(!node) {
+		return;
+	}
+	
+	topology_node_destroy(node->child[0]);
+	topology_node_destroy(node->child[1]);
+	
+	if(node->prefix) {
+		topology_prefix_destroy(node->prefix);
+	}
+	free(node);
+	
+	return;
+}
+
+static struct topology_node *topology_node_new() {
+	struct topology_node *node;
+	
+	node = malloc(sizeof(struct topology_node));
+	if(!node) {
+		TOPOLOGY_DBG("Memory error");
+		return NULL;
+	}
+	
+	node->child[0] = NULL;
+	node->child[1] = NULL;
+	node->prefix = NULL;
+	
+	return node;
+}
+
+/* parse "a.b.c.d/n", a missing length is a single host */
+static int topology_parse_prefix(const char *str, unsigned int *ip, unsigned int *bits) {
+	unsigned int c1, c2, c3, c4;
+	int n;
+	
+	*bits = 32;
+	n = sscanf(str, "%u.%u.%u.%u/%u", &c1, &c2, &c3, &c4, bits);
+	if(n < 4) {
+		return 0;
+	}
+	
+	if((c1 > 255) || (c2 > 255) || (c3 > 255) || (c4 > 255) || (*bits > 32)) {
+		return 0;
+	}
+	
+	*ip = (c1 << 24) | (c2 << 16) | (c3 << 8) | c4;
+	if(*bits < 32) {
+		/* drop the host part */
+		*ip &= ~(0xffffffff >> *bits);
+	}
+	
+	return 1;
+}
+
+/* make sure an address as the sockets give it falls in the prefix parsed from the same text */
+static int topology_self_check() {
+	struct in_addr addr;
+	ipaddress ip;
+	unsigned int prefix, bits;
+	
+	addr.s_addr = inet_addr("10.1.2.3");
+	memcpy(&ip, &addr, sizeof(ip));
+	
+	if(!topology_parse_prefix("10.1.0.0/16", &prefix, &bits)) {
+		return 0;
+	}
+	
+	return ((topology_ip(ip) & ~(0xffffffff >> bits)) == prefix);
+}
+
+/* parse "slave=cost;slave=cost;*=cost" */
+static int topology_parse_costs(struct topology_prefix *prefix, char *str) {
+	char *entry, *next, *value;
+	unsigned int count;
+	
+	count = 1;
+	for(entry = str;(entry = strchr(entry, ';'));entry++) {
+		count++;
+	}
+	
+	prefix->costs = malloc(sizeof(struct topology_cost) * count);
+	if(!prefix->costs) {
+		TOPOLOGY_DBG("Memory error");
+		return 0;
+	}
+	
+	for(entry = str;entry;entry = next) {
+		next = strchr(entry, ';');
+		if(next) {
+			*next = 0;
+			next++;
+		}
+		
+		value = strchr(entry, '=');
+		if(!value || (value == entry)) {
+			if(*entry) {
+				TOPOLOGY_DBG("Invalid cost entry \"%s\" for %s", entry, prefix->name);
+			}
+			continue;
+		}
+		*value = 0;
+		value++;
+		
+		if(!strcmp(entry, "*")) {
+			prefix->default_cost = strtoul(value, NULL, 10);
+			continue;
+		}
+		
+		prefix->costs[prefix->count].slave = strdup(entry);
+		if(!prefix->costs[prefix->count].slave) {
+			TOPOLOGY_DBG("Memory error");
+			return 0;
+		}
+		prefix->costs[prefix->count].cost = strtoul(value, NULL, 10);
+		prefix->count++;
+	}
+	
+	return 1;
+}
+
+static int topology_insert(struct topology_prefix *prefix) {
+	struct topology_node *node;
+	unsigned int i, bit;
+	
+	if(!topology_root) {
+		topology_root = topology_node_new();
+		if(!topology_root) {
+			return 0;
+		}
+	}
+	
+	node = topology_root;
+	for(i=0;i<prefix->bits;i++) {
+		bit = (prefix->ip >> (31 - i)) & 1;
+		if(!node->child[bit]) {
+			node->child[bit] = topology_node_new();
+			if(!node->child[bit]) {
+				return 0;
+			}
+		}
+		node = node->child[bit];
+	}
+	
+	if(node->prefix) {
+		TOPOLOGY_DBG("%s is configured twice, keeping the last one", prefix->name);
+		topology_prefix_destroy(node->prefix);
+		topology_count--;
+	}
+	node->prefix = prefix;
+	topology_count++;
+	
+	return 1;
+}
+
+int topology_init() {
+	char buffer[128];
+	struct topology_prefix *prefix;
+	char *name, *costs;
+	unsigned int i, ip, bits;
+	
+	if(!topology_self_check()) {
+		TOPOLOGY_DBG("Address byte order does not match the prefixes");
+		return 0;
+	}
+	
+	topology_log = config_raw_read_int(MASTER_CONFIG_FILE, "xftpd.topology.log", 0);
+	
+	for(i=1;;i++) {
+		sprintf(buffer, "xftpd.topology(%u).prefix", i);
+		name = config_raw_read(MASTER_CONFIG_FILE, buffer, NULL);
+		if(!name) break;
+		
+		if(!topology_parse_prefix(name, &ip, &bits)) {
+			TOPOLOGY_DBG("Invalid prefix \"%s\"", name);
+			free(name);
+			continue;
+		}
+		
+		prefix = malloc(sizeof(struct topology_prefix));
+		if(!prefix) {
+			TOPOLOGY_DBG("Memory error");
+			free(name);
+			return 0;
+		}
+		prefix->ip = ip;
+		prefix->bits = bits;
+		prefix->name = name;
+		prefix->default_cost = 0;
+		prefix->count = 0;
+		prefix->costs = NULL;
+		
+		sprintf(buffer, "xftpd.topology(%u).costs", i);
+		costs = config_raw_read(MASTER_CONFIG_FILE, buffer, NULL);
+		if(costs) {
+			if(!topology_parse_costs(prefix, costs)) {
+				free(costs);
+				topology_prefix_destroy(prefix);
+				return 0;
+			}
+			free(costs);
+		}
+		
+		if(!topology_insert(prefix)) {
+			topology_prefix_destroy(prefix);
+			return 0;
+		}
+	}
+	
+	TOPOLOGY_DBG("Loaded %u prefix(es).", topology_count);
+	
+	return 1;
+}
+
+void topology_free() {
+	
+	topology_node_destroy(topology_root);
+	topology_root = NULL;
+	topology_count = 0;
+	
+	return;
+}
+
+struct topology_prefix *topology_match(ipaddress ip) {
+	struct topology_node *node;
+	struct topology_prefix *best = NULL;
+	unsigned int addr, i;
+	
+	addr = topology_ip(ip);
+	
+	node = topology_root;
+	for(i=0;node;i++) {
+		if(node->prefix) {
+			best = node->prefix;
+		}
+		if(i == 32) {
+			break;
+		}
+		node = node->child[(addr >> (31 - i)) & 1];
+	}
+	
+	return best;
+}
+
+unsigned int topology_get_cost(struct topology_prefix *prefix, struct slave_connection *cnx) {
+	unsigned int i;
+	
+	if(!prefix) {
+		return 0;
+	}
+	
+	if(cnx->slave) {
+		for(i=0;i<prefix->count;i++) {
+			if(!strcasecmp(prefix->costs[i].slave, cnx->slave->name)) {
+				return prefix->costs[i].cost;
+			}
+		}
+	}
+	
+	return prefix->default_cost;
+}
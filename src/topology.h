@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __TOPOLOGY_H
+#define __TOPOLOGY_H
+
+#include "constants.h"
+
+#include "debug.h"
+#if defined(DEBUG_TOPOLOGY)
+# define TOPOLOGY_DBG(format, arg...) { _DEBUG_CONSOLE(format, ##arg) _DEBUG_FILE(format, ##arg) }
+#else
+# define TOPOLOGY_DBG(format, arg...)
+#endif
+
+#include "socket.h"
+
+/*
+	Network topology of the clients, as seen by the slave selection.
+	
+	Each configured prefix maps a range of client addresses to a cost
+	for every slave, so a download is served by the closest slave that
+	holds the file. The prefixes are kept in a binary trie and the
+	longest one matching the client wins:
+	
+		xftpd.topology(1).prefix = 10.1.0.0/16
+		xftpd.topology(1).costs = eu1=0;eu2=0;*=500
+	
+	Slaves that are not listed cost what '*' does, or nothing.
+*/
+
+struct slave_connection;
+
+typedef struct topology_cost topology_cost;
+struct topology_cost {
+	char *slave; /* slave name */
+	unsigned int cost;
+} __attribute__((packed));
+
+typedef struct topology_prefix topology_prefix;
+struct topology_prefix {
+	unsigned int ip;
+	unsigned int bits;
+	
+	char *name; /* the prefix as written in the config, for the logs */
+	
+	unsigned int default_cost; /* for the slaves not listed */
+	unsigned int count;
+	struct topology_cost *costs;
+} __attribute__((packed));
+
+typedef struct topology_node topology_node;
+struct topology_node {
+	struct topology_node *child[2];
+	struct topology_prefix *prefix; /* NULL if no prefix ends here */
+} __attribute__((packed));
+
+/* nonzero if the selection decisions should be written to TOPOLOGY_LOG_FILE */
+extern int topology_log;
+
+int topology_init();
+void topology_free();
+
+/* longest prefix containing the address, or NULL */
+struct topology_prefix *topology_match(ipaddress ip);
+
+/* cost of serving the prefix from that slave, 0 if prefix is NULL */
+unsigned int topology_get_cost(struct topology_prefix *prefix, struct slave_connection *cnx);
+
+#endif /* __TOPOLOGY_H */
@@ -32,7 +32,7 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-
+
 #ifdef WIN32
 #include <windows.h>
 #endif
@@ -51,7 +51,12 @@
 #include "asprintf.h"
 
 struct collection *users = NULL;
-
+
+/* case-insensitive index of the users by username */
+static struct hash_table *users_index = NULL;
+
+unsigned int users_generation = 0;
+
 #define ENDSWITH(a, b) \
   ((strlen(a) > strlen(b)) && !strcasecmp(&a[strlen(a)-strlen(b)], b))
 #define BEGINSWITH(a, b) \
@@ -66,6 +71,11 @@ int users_init() {
 
 	/* load all users from file here */
 	users = collection_new(C_CASCADE);
+	users_index = hash_new(0, 1);
+	if(!users_index) {
+		USERS_DBG("Memory error");
+		return 0;
+	}
 
 	path = dir_fullpath(USERS_FOLDER);
 	if(!path) {
@@ -95,7 +105,7 @@ int users_init() {
 
 	return 1;
 }
-
+
 #undef BEGINSWITH
 #undef ENDSWITH
 
@@ -124,6 +134,11 @@ static void user_obj_destroy(struct user_ctx *user) {
 	
 	collectible_destroy(user);
 	
+	if(hash_node_linked(&user->node)) {
+		hash_remove(users_index, &user->node);
+		users_generation++;
+	}
+	
 	event_onDeleteUser(user);
 	
 	/* kick all the user's clients out */
@@ -261,6 +276,7 @@ struct user_ctx *user_load(char *filename) {
 	memcpy(user->password_hash, password_hash, sizeof(password_hash));
 
 	user->clients = collection_new(C_CASCADE);
+	hash_node_init(&user->node);
 
 	if(!collection_add(users, user)) {
 		USERS_DBG("Collection error");
@@ -272,6 +288,9 @@ struct user_ctx *user_load(char *filename) {
 		return NULL;
 	}
 
+	hash_add(users_index, &user->node, user->username);
+	users_generation++;
+
 	return user;
 }
 
@@ -312,6 +331,7 @@ struct user_ctx *user_new(char *username, char *usergroup, char *password) {
 	
 	obj_init(&user->o, user, (obj_f)user_obj_destroy);
 	collectible_init(user);
+	hash_node_init(&user->node);
 
 	user->config = config_open(fullpath);
 	free(fullpath);
@@ -357,6 +377,8 @@ struct user_ctx *user_new(char *username, char *usergroup, char *password) {
 	config_write(user->config, "password", password_hash);
 
 	collection_add(users, user);
+	hash_add(users_index, &user->node, user->username);
+	users_generation++;
 
 	/* write user infos to file */
 	config_save(user->config);
@@ -368,17 +390,21 @@ struct user_ctx *user_new(char *username, char *usergroup, char *password) {
 	return user;
 }
 
-static int user_get_matcher(struct collection *c, struct user_ctx *user, char *username) {
-
-	return !strcasecmp(user->username, username);
-}
-
 /* return a user from its username */
 struct user_ctx *user_get(char *username) {
+	struct hash_node *node;
+	struct user_ctx *user;
 
-	if(!username) return NULL;
+	if(!username || !users_index) return NULL;
 
-	return collection_match(users, (collection_f)user_get_matcher, username);
+	for(node=hash_find(users_index, username);node;node=hash_find_next(users_index, node)) {
+		user = hash_entry(node, struct user_ctx, node);
+		if(obj_isvalid(&user->o)) {
+			return user;
+		}
+	}
+
+	return NULL;
 }
 
 /*
@@ -465,6 +491,12 @@ unsigned int user_disable(struct user_ctx *user, char disabled) {
 
 void user_destroy(struct user_ctx *user) {
 	
+	/* the user can't be found anymore, even if it is still referenced */
+	if(hash_node_linked(&user->node)) {
+		hash_remove(users_index, &user->node);
+		users_generation++;
+	}
+	
 	collection_void(user->clients);
 	obj_destroy(&user->o);
 	
@@ -48,6 +48,7 @@
 #include <openssl/md5.h>
 
 #include "collection.h"
+#include "hash.h"
 
 int users_init();
 void users_free();
@@ -70,10 +71,18 @@ struct user_ctx {
 	char disabled; /* 1 if the user is disabled */
 
 	struct collection *clients;
+
+	struct hash_node node; /* linked in the users index by username */
 } __attribute__((packed));
 
 extern struct collection *users;
 
+/*
+	Increased every time a user is added or removed so the
+	lookups cached elsewhere know when they are stale.
+*/
+extern unsigned int users_generation;
+
 struct user_ctx *user_new(char *username, char *usergroup, char *password);
 struct user_ctx *user_get(char *username);
 struct user_ctx *user_load(char *filename);
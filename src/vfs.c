@@ -34,7 +34,7 @@
  */
 
 /* virtual file system */
-
+
 #ifdef WIN32
 #include <windows.h>
 #endif
@@ -57,10 +57,97 @@
 #include "dir.h"
 #include "asprintf.h"
 #include "wild.h"
+#include "users.h"
+#include "hash.h"
 
 struct collection *sections = NULL;
 
-struct vfs_element *vfs_root = NULL;
+struct vfs_element *vfs_root = NULL;
+
+/*
+	Element owners are interned: all the elements owned by the same
+	user point to the same string, and the string remembers which
+	user it resolves to. The directory listing resolves the owner
+	of each entry through this pointer instead of a user lookup.
+*/
+struct vfs_owner {
+	struct hash_node node;
+	unsigned int refs;
+	
+	unsigned int generation; /* users_generation when 'user' was resolved */
+	struct user_ctx *user;
+	
+	char name[1];
+} __attribute__((packed));
+
+static struct hash_table *vfs_owners = NULL;
+
+#define vfs_owner_from_name(_name) CONTAINING_RECORD(_name, struct vfs_owner, name)
+
+/* return the interned copy of 'name' */
+static char *vfs_owner_get(const char *name) {
+	struct hash_node *node;
+	struct vfs_owner *owner;
+	unsigned int len;
+	
+	if(!vfs_owners) {
+		vfs_owners = hash_new(0, 0);
+		if(!vfs_owners) {
+			VFS_DBG("Memory error");
+			return NULL;
+		}
+	}
+	
+	node = hash_find(vfs_owners, name);
+	if(node) {
+		owner = hash_entry(node, struct vfs_owner, node);
+		owner->refs++;
+		return owner->name;
+	}
+	
+	len = strlen(name);
+	owner = malloc(sizeof(struct vfs_owner) + len);
+	if(!owner) {
+		VFS_DBG("Memory error");
+		return NULL;
+	}
+	
+	memcpy(owner->name, name, len+1);
+	owner->refs = 1;
+	owner->generation = users_generation - 1;
+	owner->user = NULL;
+	
+	hash_node_init(&owner->node);
+	hash_add(vfs_owners, &owner->node, owner->name);
+	
+	return owner->name;
+}
+
+static void vfs_owner_put(char *name) {
+	struct vfs_owner *owner;
+	
+	owner = vfs_owner_from_name(name);
+	if(--owner->refs) return;
+	
+	hash_remove(vfs_owners, &owner->node);
+	free(owner);
+	
+	return;
+}
+
+struct user_ctx *vfs_get_owner(struct vfs_element *element) {
+	struct vfs_owner *owner;
+	
+	if(!element || !element->owner) return NULL;
+	
+	owner = vfs_owner_from_name(element->owner);
+	if(owner->generation != users_generation) {
+		owner->user = user_get(owner->name);
+		owner->generation = users_generation;
+	}
+	
+	return owner->user;
+}
 
 static void vfs_obj_destroy(struct vfs_element *element) {
 	
@@ -89,6 +176,11 @@ static void vfs_obj_destroy(struct vfs_element *element) {
 		element->nuke = NULL;
 	}
 
+	if(element->hot) {
+		element->hot->element = NULL;
+		element->hot = NULL;
+	}
+
 	if(element->section) {
 		section_unlink_root(element->section, element);
 		element->section = NULL;
@@ -163,7 +255,7 @@ static void vfs_obj_destroy(struct vfs_element *element) {
 
 	/* free some memory */
 	if(element->owner) {
-		free(element->owner);
+		vfs_owner_put(element->owner);
 		element->owner = NULL;
 	}
 	if(element->name) {
@@ -230,6 +322,7 @@ struct vfs_element *vfs_create_root() {
 
 	root->vrooted = NULL;
 	root->nuke = NULL;
+	root->hot = NULL;
 
 	root->xfertime = 0;
 
@@ -239,7 +332,7 @@ struct vfs_element *vfs_create_root() {
 
 	return root;
 }
-
+
 #define ENDSWITH(a, b) \
   ((strlen(a) > strlen(b)) && !strcasecmp(&a[strlen(a)-strlen(b)], b))
 #define BEGINSWITH(a, b) \
@@ -291,7 +384,7 @@ int vfs_init() {
 	
 	return 1;
 }
-
+
 #undef BEGINSWITH
 #undef ENDSWITH
 
@@ -1323,7 +1416,7 @@ struct vfs_element *vfs_create_file(struct vfs_element *container, const char *n
 	element->parent = container;
 	element->type = VFS_FILE;
 	element->section = NULL;
-	element->owner = (owner && *owner) ? strdup(owner) : NULL;
+	element->owner = (owner && *owner) ? vfs_owner_get(owner) : NULL;
 	element->size = 0;
 	element->timestamp = 0;
 	element->sfv = NULL;
@@ -1332,9 +1425,13 @@ struct vfs_element *vfs_create_file(struct vfs_element *container, const char *n
 	element->browsers = NULL;
 	element->vrooted = NULL;
 	element->nuke = NULL;
+	element->hot = NULL;
 	element->xfertime = 0;
 	//element->destroyed = 0;
 
+	/* link it to its nuke, if any */
+	nuke_check(element);
+
 	return element;
 }
 
@@ -1408,7 +1505,7 @@ struct vfs_element *vfs_secure_create_symlink(struct vfs_element *container, str
 		return NULL;
 	}
 	
-	element->owner = strdup(owner);
+	element->owner = vfs_owner_get(owner);
 	if(!element->owner) {
 		VFS_DBG("Memory error");
 		free(element->name);
@@ -1435,6 +1532,7 @@ struct vfs_element *vfs_secure_create_symlink(struct vfs_element *container, str
 	element->browsers = NULL;
 	element->vrooted = NULL;
 	element->nuke = NULL;
+	element->hot = NULL;
 	element->xfertime = 0;
 	//element->destroyed = 0;
 
@@ -1548,7 +1646,7 @@ struct vfs_element *vfs_secure_create_folder(struct vfs_element *container, cons
 		element->parent = container;
 		element->type = VFS_FOLDER;
 		element->section = NULL;
-		element->owner = (owner && *owner) ? strdup(owner) : strdup("xFTPd");
+		element->owner = vfs_owner_get((owner && *owner) ? owner : "xFTPd");
 		element->size = 0;
 		element->timestamp = 0;
 		element->sfv = NULL;
@@ -1559,8 +1657,12 @@ struct vfs_element *vfs_secure_create_folder(struct vfs_element *container, cons
 		element->link_to = NULL;
 		element->vrooted = NULL;
 		element->nuke = NULL;
+		element->hot = NULL;
 		element->xfertime = 0;
 		//element->destroyed = 0;
+
+		/* link it to its nuke, if any */
+		nuke_check(element);
 	}
 
 	if(!ptr) {
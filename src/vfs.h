@@ -145,6 +145,8 @@ struct vfs_element {
 
 	struct nuke_ctx *nuke; /* nuke information on the file/folder */
 
+	struct mirror_hot *hot; /* download demand, NULL while there is none */
+
 	//int destroyed; /* avoid double-frees */
 } __attribute__((packed));
 
@@ -178,6 +180,9 @@ unsigned int vfs_get_checksum(struct vfs_element *element);
 
 struct vfs_element *vfs_create_root();
 
+/* return the user owning the element, resolved through the interned owner */
+struct user_ctx *vfs_get_owner(struct vfs_element *element);
+
 const char *vfs_lua_get_relative_path(struct vfs_element *container, struct vfs_element *element);
 
 /* apis for sections management */
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include "wheel.h"
+#include "time.h"
+
+/*
+	The first level has one slot per millisecond for the next 256 ms,
+	each of the following levels has 64 slots covering 64 times the
+	span of the previous level. A timer is kept in the lowest level that
+	covers its deadline and is moved down (cascaded) when its slot in the
+	upper level is reached. Five levels cover 2^32 ms (about 49 days),
+	timers further than that are cascaded again until they are close enough.
+*/
+#define WHEEL_ROOT_BITS		8
+#define WHEEL_LEVEL_BITS	6
+#define WHEEL_LEVELS		4 /* number of levels above the root */
+
+#define WHEEL_ROOT_SIZE		(1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE	(1 << WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK		(WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK	(WHEEL_LEVEL_SIZE - 1)
+
+/* shift of the deadline to get the slot index in level 'n' (1 to WHEEL_LEVELS) */
+#define WHEEL_SHIFT(_n)		(WHEEL_ROOT_BITS + (((_n) - 1) * WHEEL_LEVEL_BITS))
+
+static struct collection_list wheel_root[WHEEL_ROOT_SIZE];
+static struct collection_list wheel_levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+
+/* next millisecond that will be processed by wheel_poll() */
+static unsigned long long int wheel_current = 0;
+static char wheel_initialized = 0;
+
+/* number of armed timers */
+static unsigned int wheel_count = 0;
+
+static void wheel_init() {
+	unsigned int i, j;
+	
+	for(i=0;i<WHEEL_ROOT_SIZE;i++) {
+		collection_list_init(&wheel_root[i]);
+	}
+	
+	for(i=0;i<WHEEL_LEVELS;i++) {
+		for(j=0;j<WHEEL_LEVEL_SIZE;j++) {
+			collection_list_init(&wheel_levels[i][j]);
+		}
+	}
+	
+	wheel_current = time_monotonic();
+	wheel_initialized = 1;
+	
+	return;
+}
+
+/* link the timer in the slot matching its deadline */
+static void wheel_insert(struct wheel_timer *t) {
+	unsigned long long int deadline = t->deadline;
+	unsigned long long int delta;
+	struct collection_list *slot;
+	unsigned int n;
+	
+	if(deadline < wheel_current) {
+		/* already expired, it will be called on the next poll */
+		deadline = wheel_current;
+	}
+	
+	delta = deadline - wheel_current;
+	
+	if(delta < WHEEL_ROOT_SIZE) {
+		slot = &wheel_root[deadline & WHEEL_ROOT_MASK];
+	} else {
+		for(n=1;n<WHEEL_LEVELS;n++) {
+			if(delta < (1ULL << WHEEL_SHIFT(n + 1)))
+				break;
+		}
+		
+		if(n == WHEEL_LEVELS) {
+			/* too far away, park it in the last slot we can reach */
+			if(delta >= (1ULL << WHEEL_SHIFT(n + 1))) {
+				deadline = wheel_current + (1ULL << WHEEL_SHIFT(n + 1)) - 1;
+			}
+		}
+		
+		slot = &wheel_levels[n - 1][(deadline >> WHEEL_SHIFT(n)) & WHEEL_LEVEL_MASK];
+	}
+	
+	collection_list_addlast(slot, &t->list);
+	
+	return;
+}
+
+void wheel_timer_init(struct wheel_timer *t, void (*callback)(void *param), void *param) {
+	
+	collection_list_init(&t->list);
+	t->deadline = 0;
+	t->callback = callback;
+	t->param = param;
+	
+	return;
+}
+
+int wheel_schedule(struct wheel_timer *t, unsigned long long int deadline) {
+	unsigned long long int now;
+	
+	if(!t || !t->callback) {
+		WHEEL_DBG("Params error");
+		return 0;
+	}
+	
+	if(!wheel_initialized) {
+		wheel_init();
+	}
+	
+	if(wheel_pending(t)) {
+		collection_list_remove(&t->list);
+	} else {
+		wheel_count++;
+	}
+	
+	/* from the wall clock to the wheel's clock */
+	now = time_now();
+	t->deadline = time_monotonic() + ((deadline > now) ? (deadline - now) : 0);
+	wheel_insert(t);
+	
+	return 1;
+}
+
+void wheel_cancel(struct wheel_timer *t) {
+	
+	if(!t) return;
+	
+	if(wheel_pending(t)) {
+		collection_list_remove(&t->list);
+		wheel_count--;
+	}
+	
+	return;
+}
+
+int wheel_pending(struct wheel_timer *t) {
+	
+	return (t->list.next != &t->list);
+}
+
+/* move all timers of an upper level slot to the lower levels */
+static void wheel_cascade(struct collection_list *slot) {
+	struct collection_list list;
+	struct wheel_timer *t;
+	
+	if(slot->next == slot) return;
+	
+	/* detach the whole slot first, the timers may land in it again */
+	list.next = slot->next;
+	list.prev = slot->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	collection_list_init(slot);
+	
+	while(list.next != &list) {
+		t = CONTAINING_RECORD(list.next, struct wheel_timer, list);
+		collection_list_remove(&t->list);
+		wheel_insert(t);
+	}
+	
+	return;
+}
+
+unsigned int wheel_poll() {
+	struct collection_list expired;
+	struct wheel_timer *t;
+	unsigned long long int now;
+	unsigned int index, n, count = 0;
+	
+	if(!wheel_initialized) {
+		wheel_init();
+		return 0;
+	}
+	
+	now = time_monotonic();
+	
+	if(!wheel_count) {
+		/* nothing to walk through */
+		if(wheel_current <= now) {
+			wheel_current = now + 1;
+		}
+		return 0;
+	}
+	
+	while(wheel_current <= now) {
+		index = (wheel_current & WHEEL_ROOT_MASK);
+		
+		if(!index) {
+			/* the root wrapped, bring down the next slot of each level */
+			for(n=1;n<=WHEEL_LEVELS;n++) {
+				unsigned int slot = ((wheel_current >> WHEEL_SHIFT(n)) & WHEEL_LEVEL_MASK);
+				
+				wheel_cascade(&wheel_levels[n - 1][slot]);
+				if(slot) break;
+			}
+		}
+		
+		wheel_current++;
+		
+		if(wheel_root[index].next == &wheel_root[index])
+			continue;
+		
+		/*
+			Detach the slot before calling anything: the callbacks
+			may arm or cancel any timer, including expired ones.
+		*/
+		expired.next = wheel_root[index].next;
+		expired.prev = wheel_root[index].prev;
+		expired.next->prev = &expired;
+		expired.prev->next = &expired;
+		collection_list_init(&wheel_root[index]);
+		
+		while(expired.next != &expired) {
+			t = CONTAINING_RECORD(expired.next, struct wheel_timer, list);
+			collection_list_remove(&t->list);
+			wheel_count--;
+			
+			(*t->callback)(t->param);
+			count++;
+		}
+	}
+	
+	return count;
+}
+
+unsigned int wheel_sleep_time(unsigned int max) {
+	unsigned long long int now, next;
+	unsigned int i;
+	
+	if(!wheel_initialized || !wheel_count)
+		return max;
+	
+	now = time_monotonic();
+	if(wheel_current <= now) {
+		/* some slots are not processed yet */
+		return 0;
+	}
+	
+	/* the first non-empty root slot gives the exact deadline */
+	next = (wheel_current | WHEEL_ROOT_MASK) + 1;
+	for(i=0;i<WHEEL_ROOT_SIZE;i++) {
+		if(wheel_root[(wheel_current + i) & WHEEL_ROOT_MASK].next != &wheel_root[(wheel_current + i) & WHEEL_ROOT_MASK]) {
+			next = wheel_current + i;
+			break;
+		}
+		
+		/* the upper levels must be cascaded when the root wraps */
+		if(!((wheel_current + i + 1) & WHEEL_ROOT_MASK)) {
+			next = wheel_current + i + 1;
+			break;
+		}
+	}
+	
+	if((next - now) < max)
+		return (unsigned int)(next - now);
+	
+	return max;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2007, The xFTPd Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of the xFTPd Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ *     * Redistributions of this project or parts of this project in any form
+ *       must retain the following aknowledgment:
+ *       "This product includes software developed by the xFTPd Project.
+ *        http://www.xftpd.com/ - http://www.xftpd.org/"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE xFTPd PROJECT ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE xFTPd PROJECT BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __WHEEL_H
+#define __WHEEL_H
+
+#include "constants.h"
+
+#include "debug.h"
+#if defined(DEBUG_WHEEL)
+# define WHEEL_DBG(format, arg...) { _DEBUG_CONSOLE(format, ##arg) _DEBUG_FILE(format, ##arg) }
+#else
+# define WHEEL_DBG(format, arg...)
+#endif
+
+#include "collection.h"
+
+/*
+	Hierarchical timing wheel, with a resolution of one millisecond.
+	
+	The timers are embedded in their host structure and are armed
+	with an absolute deadline, as returned by time_now(). The wheel
+	itself runs on time_monotonic(), the deadline is turned into a
+	delay when the timer is armed so setting the clock back does not
+	hold the timers. Each call
+	to wheel_poll() only touches the slots that became due since the
+	previous call, so the cost does not depend on the number of
+	pending timers.
+	
+	The callback is called once when the deadline is reached, the
+	timer may be armed again from inside the callback.
+*/
+
+typedef void (*wheel_f)(void *param);
+
+struct wheel_timer {
+	struct collection_list list; /* linked to a slot of the wheel */
+	
+	unsigned long long int deadline; /* on the time_monotonic() clock */
+	
+	void (*callback)(void *param);
+	void *param;
+} __attribute__((packed));
+
+void wheel_timer_init(struct wheel_timer *t, void (*callback)(void *param), void *param);
+
+/* (re)arm the timer, replacing any previous deadline */
+int wheel_schedule(struct wheel_timer *t, unsigned long long int deadline);
+
+/* disarm the timer, does nothing if it is not armed */
+void wheel_cancel(struct wheel_timer *t);
+
+/* return nonzero if the timer is armed */
+int wheel_pending(struct wheel_timer *t);
+
+/* call the callback of all expired timers, return how many were called */
+unsigned int wheel_poll();
+
+/*
+	Return the time in milliseconds until the next deadline,
+	but never more than 'max'. Meant to be used as the sleep time
+	of the main loops.
+*/
+unsigned int wheel_sleep_time(unsigned int max);
+
+#endif /* __WHEEL_H */